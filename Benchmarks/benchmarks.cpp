@@ -0,0 +1,291 @@
+// Console runner for the benchmarks in NeuralNetwork/benchmarks:
+//   benchmarks <name> [arguments]
+// Without a name it lists the benchmarks and their arguments. Build with optimizations; the
+// numbers of a debug build say nothing about the kernels.
+
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <optional>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <initializer_list>
+
+#include "../NeuralNetwork/benchmarks/augment_benchmark.h"
+#include "../NeuralNetwork/benchmarks/distributed_benchmark.h"
+#include "../NeuralNetwork/benchmarks/preprocess_benchmark.h"
+#include "../NeuralNetwork/benchmarks/profile_benchmark.h"
+#include "../NeuralNetwork/benchmarks/sweep_benchmark.h"
+#include "../NeuralNetwork/benchmarks/transpose_benchmark.h"
+
+namespace
+{
+    using arguments = std::vector<std::string>;
+
+    enum class outcome
+    {
+        ok,
+        failed,
+        // the arguments do not match the command's usage
+        usage
+    };
+
+    struct command
+    {
+        const char* name;
+        const char* usage;
+        outcome (*run)(const arguments& args);
+    };
+
+    bool parse_size(const std::string& text, size_t& value)
+    {
+        char* end = nullptr;
+        const unsigned long long parsed = std::strtoull(text.c_str(), &end, 10);
+
+        if (text.empty() || *end != '\0' || parsed == 0)
+            return false;
+
+        value = static_cast<size_t>(parsed);
+        return true;
+    }
+
+    // Fills the optional positional sizes in order; false on a malformed or extra argument
+    bool parse_sizes(const arguments& args, std::initializer_list<size_t*> values)
+    {
+        if (args.size() > values.size())
+            return false;
+
+        auto value = values.begin();
+
+        for (const auto& arg : args)
+        {
+            if (!parse_size(arg, **value++))
+                return false;
+        }
+
+        return true;
+    }
+
+    // [count] [samples] [mnist images file] [mnist labels file] of the training benchmarks
+    bool parse_training_args(const arguments& args, size_t& count, size_t& samples, std::string& images, std::string& labels)
+    {
+        if (args.size() == 3 || args.size() > 4)
+            return false;
+
+        if (args.size() == 4)
+        {
+            images = args[2];
+            labels = args[3];
+        }
+
+        return parse_sizes(arguments(args.begin(), args.begin() + std::min<size_t>(args.size(), 2)), { &count, &samples });
+    }
+
+    // 28 x 28 stand-ins for MNIST digits, for the training benchmarks when no MNIST files are given:
+    // a bar whose row encodes the label over faint noise, so that the models have something to learn
+    ml::mnist::training_set synthetic_digits(size_t count)
+    {
+        constexpr size_t side = 28;
+        std::mt19937 gen{ 42 };
+        std::uniform_int_distribution<int> noise{ 0, 63 };
+
+        ml::mnist::training_set set(count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& sample = set[i];
+            const size_t label = i % ml::mnist::classes;
+
+            sample.first = static_cast<ml::mnist::byte>(label);
+            sample.second.resize(side * side);
+
+            for (auto& pixel : sample.second)
+                pixel = static_cast<ml::mnist::byte>(noise(gen));
+
+            for (size_t x = 4; x < side - 4; ++x)
+                sample.second[(4 + 2 * label) * side + x] = static_cast<ml::mnist::byte>(255);
+        }
+
+        return set;
+    }
+
+    // The first samples of the MNIST files when both are given, synthetic_digits otherwise; empty if
+    // the files could not be read
+    std::optional<ml::mnist::training_set> training_data(size_t samples, const std::string& images, const std::string& labels)
+    {
+        if (images.empty())
+            return synthetic_digits(samples);
+
+        auto set = ml::mnist::load_mnist_db(images, labels);
+
+        if (set && set->size() > samples)
+            set->resize(samples);
+
+        return set;
+    }
+
+    outcome run_augment(const arguments& args)
+    {
+        size_t images = 10000;
+        size_t batch_size = 100;
+        size_t repeats = 5;
+
+        if (!parse_sizes(args, { &images, &batch_size, &repeats }))
+            return outcome::usage;
+
+        ml::bench::run_augment_benchmarks(images, batch_size, repeats);
+        return outcome::ok;
+    }
+
+    // Forks 1, 2, 4, ... up to processes local workers and compares them with the threaded trainer;
+    // must run before anything starts the shared thread pool
+    outcome run_distributed(const arguments& args)
+    {
+        size_t processes = std::max<size_t>(std::thread::hardware_concurrency(), 2);
+        size_t samples = 20000;
+
+        std::string images;
+        std::string labels;
+
+        if (!parse_training_args(args, processes, samples, images, labels))
+            return outcome::usage;
+
+        const auto set = training_data(samples, images, labels);
+
+        if (!set)
+            return outcome::failed;
+
+        std::vector<size_t> world_sizes;
+
+        for (size_t world = 1; world < processes; world *= 2)
+            world_sizes.push_back(world);
+
+        world_sizes.push_back(processes);
+
+        ml::trainer_config config;
+        config.batch_size = 32;
+        config.max_epochs = 1;
+        config.eval_every = std::numeric_limits<size_t>::max();
+
+        return ml::bench::run_scaling_benchmark(*set, world_sizes, config) ? outcome::ok : outcome::failed;
+    }
+
+    outcome run_preprocess(const arguments& args)
+    {
+        size_t images = 2000;
+        size_t repeats = 5;
+
+        if (!parse_sizes(args, { &images, &repeats }))
+            return outcome::usage;
+
+        ml::bench::run_preprocess_benchmarks(images, repeats);
+        return outcome::ok;
+    }
+
+    // a { 784, hidden, 10 } perceptron
+    outcome run_profile(const arguments& args)
+    {
+        size_t hidden = 150;
+        size_t batch = 256;
+        size_t iterations = 20;
+
+        if (!parse_sizes(args, { &hidden, &batch, &iterations }))
+            return outcome::usage;
+
+        ml::bench::run_profile_benchmark({ 784, hidden, 10 }, batch, iterations);
+        return outcome::ok;
+    }
+
+    // models { 784, 100, 10 } networks that differ in learning rate and initial weights
+    outcome run_sweep(const arguments& args)
+    {
+        size_t models = 8;
+        size_t samples = 20000;
+
+        std::string images;
+        std::string labels;
+
+        if (!parse_training_args(args, models, samples, images, labels))
+            return outcome::usage;
+
+        const auto set = training_data(samples, images, labels);
+
+        if (!set)
+            return outcome::failed;
+
+        std::vector<ml::sweep_run> runs(models);
+
+        for (size_t i = 0; i < models; ++i)
+        {
+            runs[i].sizes = { 784, 100, 10 };
+            runs[i].optimizer.learning_rate = 0.05f * (1 + i % 4);
+            runs[i].seed = i + 1;
+        }
+
+        ml::sweep_config config;
+        config.batch_size = 32;
+
+        ml::bench::run_sweep_benchmark(*set, runs, config);
+        return outcome::ok;
+    }
+
+    outcome run_transpose(const arguments& args)
+    {
+        size_t repeats = 200;
+
+        if (!parse_sizes(args, { &repeats }))
+            return outcome::usage;
+
+        ml::bench::run_transpose_benchmarks(repeats);
+        return outcome::ok;
+    }
+
+    const command commands[] =
+    {
+        { "augment", "[images] [batch size] [repeats]", run_augment },
+        { "distributed", "[processes] [samples] [mnist images file] [mnist labels file]", run_distributed },
+        { "preprocess", "[images] [repeats]", run_preprocess },
+        { "profile", "[hidden units] [batch] [iterations]", run_profile },
+        { "sweep", "[models] [samples] [mnist images file] [mnist labels file]", run_sweep },
+        { "transpose", "[repeats]", run_transpose },
+    };
+
+    void print_usage(const char* program)
+    {
+        std::cerr << "usage: " << program << " <benchmark> [arguments]\n";
+
+        for (const auto& c : commands)
+            std::cerr << "    " << c.name << ' ' << c.usage << '\n';
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    const std::string name = argv[1];
+    const arguments args(argv + 2, argv + argc);
+
+    for (const auto& c : commands)
+    {
+        if (name != c.name)
+            continue;
+
+        const outcome result = c.run(args);
+
+        if (result != outcome::usage)
+            return result == outcome::ok ? 0 : 1;
+
+        std::cerr << "usage: " << argv[0] << ' ' << c.name << ' ' << c.usage << '\n';
+        return 2;
+    }
+
+    print_usage(argv[0]);
+    return 2;
+}
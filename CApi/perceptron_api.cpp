@@ -0,0 +1,286 @@
+#include "perceptron_api.h"
+
+#include <new>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <type_traits>
+
+#include "../NeuralNetwork/ml/perceptron.h"
+#include "../NeuralNetwork/ml/inference_cache.h"
+#include "../NeuralNetwork/ml/tuning_cache.h"
+#include "../NeuralNetwork/utils/mnist/mnist.h"
+
+struct perceptron_model
+{
+    ml::perceptron network;
+    size_t inputs = 0;
+    size_t outputs = 0;
+    std::unique_ptr<ml::inference_cache> cache;
+};
+
+namespace
+{
+    thread_local std::string last_error;
+
+    perceptron_status fail(perceptron_status status, const std::string& message)
+    {
+        last_error = message;
+        return status;
+    }
+
+    // no exception may cross the C boundary
+    template<typename Fn>
+    perceptron_status guarded(Fn&& fn)
+    {
+        try
+        {
+            last_error.clear();
+            return fn();
+        }
+        catch (const std::bad_alloc&)
+        {
+            return fail(PERCEPTRON_ERROR_OUT_OF_MEMORY, "out of memory");
+        }
+        catch (const std::exception& e)
+        {
+            return fail(PERCEPTRON_ERROR_INTERNAL, e.what());
+        }
+        catch (...)
+        {
+            return fail(PERCEPTRON_ERROR_INTERNAL, "unknown error");
+        }
+    }
+
+    // the handle's model never changes, so every result is cached under version 1
+    perceptron_status forward_cached(const perceptron_model* model, const uint8_t* samples, size_t count, size_t stride,
+        float* out_probs, int32_t* out_labels)
+    {
+        const size_t outputs = model->outputs;
+        std::vector<float> probs(count * outputs);
+
+        model->cache->forward_u8(model->network, 1, samples, count, stride, model->inputs, probs.data());
+
+        for (size_t s = 0; s < count; ++s)
+        {
+            const float* row = probs.data() + s * outputs;
+
+            if (out_probs)
+                std::copy(row, row + outputs, out_probs + s * outputs);
+
+            if (out_labels)
+                out_labels[s] = static_cast<int32_t>(std::max_element(row, row + outputs) - row);
+        }
+
+        return PERCEPTRON_OK;
+    }
+
+    template<typename Input, typename Convert>
+    perceptron_status forward(const perceptron_model* model, const Input* samples, size_t count, size_t stride,
+        float* out_probs, int32_t* out_labels, Convert convert)
+    {
+        if (!model || (!samples && count != 0))
+            return fail(PERCEPTRON_ERROR_INVALID_ARGUMENT, "model and samples must not be null");
+
+        if (stride < model->inputs)
+            return fail(PERCEPTRON_ERROR_SHAPE, "stride " + std::to_string(stride) + " is smaller than the input width " + std::to_string(model->inputs));
+
+        if (count == 0)
+            return PERCEPTRON_OK;
+
+        return guarded([&]
+        {
+            if constexpr (std::is_same_v<Input, uint8_t>)
+            {
+                if (model->cache)
+                    return forward_cached(model, samples, count, stride, out_probs, out_labels);
+            }
+
+            const auto result = model->network.forward_rows(samples, count, stride, convert);
+            const float* values = result.data_ptr();
+            const size_t outputs = model->outputs;
+
+            for (size_t s = 0; s < count; ++s)
+            {
+                size_t best = 0;
+
+                for (size_t i = 0; i < outputs; ++i)
+                {
+                    const float value = values[i * count + s];
+
+                    if (out_probs)
+                        out_probs[s * outputs + i] = value;
+
+                    if (value > values[best * count + s])
+                        best = i;
+                }
+
+                if (out_labels)
+                    out_labels[s] = static_cast<int32_t>(best);
+            }
+
+            return PERCEPTRON_OK;
+        });
+    }
+}
+
+extern "C"
+{
+    uint32_t perceptron_abi_version(void)
+    {
+        return PERCEPTRON_ABI_VERSION;
+    }
+
+    const char* perceptron_status_string(perceptron_status status)
+    {
+        switch (status)
+        {
+        case PERCEPTRON_OK: return "ok";
+        case PERCEPTRON_ERROR_INVALID_ARGUMENT: return "invalid argument";
+        case PERCEPTRON_ERROR_IO: return "i/o error";
+        case PERCEPTRON_ERROR_SHAPE: return "shape mismatch";
+        case PERCEPTRON_ERROR_OUT_OF_MEMORY: return "out of memory";
+        case PERCEPTRON_ERROR_INTERNAL: return "internal error";
+        }
+
+        return "unknown status";
+    }
+
+    const char* perceptron_last_error(void)
+    {
+        return last_error.c_str();
+    }
+
+    perceptron_status perceptron_load(const char* path, perceptron_model** model)
+    {
+        if (!path || !model)
+            return fail(PERCEPTRON_ERROR_INVALID_ARGUMENT, "path and model must not be null");
+
+        *model = nullptr;
+
+        return guarded([&]
+        {
+            auto loaded = std::make_unique<perceptron_model>();
+
+            if (!loaded->network.load(path))
+                return fail(PERCEPTRON_ERROR_IO, std::string("could not load model: ") + path);
+
+            if (loaded->network.layer_count() == 0)
+                return fail(PERCEPTRON_ERROR_SHAPE, std::string("model has no layers: ") + path);
+
+            loaded->inputs = loaded->network.layer(0).size_n();
+            loaded->outputs = loaded->network.layer(loaded->network.layer_count() - 1).size_m();
+
+            *model = loaded.release();
+            return PERCEPTRON_OK;
+        });
+    }
+
+    void perceptron_free(perceptron_model* model)
+    {
+        delete model;
+    }
+
+    perceptron_status perceptron_shape(const perceptron_model* model, size_t* inputs, size_t* outputs, size_t* layers)
+    {
+        if (!model)
+            return fail(PERCEPTRON_ERROR_INVALID_ARGUMENT, "model must not be null");
+
+        if (inputs)
+            *inputs = model->inputs;
+
+        if (outputs)
+            *outputs = model->outputs;
+
+        if (layers)
+            *layers = model->network.layer_count();
+
+        return PERCEPTRON_OK;
+    }
+
+    perceptron_status perceptron_forward_batch_f32(const perceptron_model* model, const float* samples, size_t count, size_t stride,
+        float* out_probs, int32_t* out_labels)
+    {
+        return forward(model, samples, count, stride, out_probs, out_labels, [](float value) { return value; });
+    }
+
+    perceptron_status perceptron_forward_batch_u8(const perceptron_model* model, const uint8_t* samples, size_t count, size_t stride,
+        float* out_probs, int32_t* out_labels)
+    {
+        return forward(model, samples, count, stride, out_probs, out_labels,
+            [](uint8_t pixel) { return ml::mnist::normalize_pixel(static_cast<ml::mnist::byte>(pixel)); });
+    }
+
+    perceptron_status perceptron_set_sparse_input(perceptron_model* model, int enabled)
+    {
+        if (!model)
+            return fail(PERCEPTRON_ERROR_INVALID_ARGUMENT, "model must not be null");
+
+        return guarded([&]
+        {
+            model->network.set_sparse_input(enabled != 0);
+            return PERCEPTRON_OK;
+        });
+    }
+
+    perceptron_status perceptron_load_tuning(perceptron_model* model, const char* path, int* applied)
+    {
+        if (!model)
+            return fail(PERCEPTRON_ERROR_INVALID_ARGUMENT, "model must not be null");
+
+        return guarded([&]
+        {
+            ml::tuning_cache cache;
+            const bool found = cache.load(path ? std::string(path) : ml::tuning_cache::default_path()) && cache.apply(model->network);
+
+            if (applied)
+                *applied = found ? 1 : 0;
+
+            return PERCEPTRON_OK;
+        });
+    }
+
+    perceptron_status perceptron_cache_configure(perceptron_model* model, size_t entries)
+    {
+        if (!model)
+            return fail(PERCEPTRON_ERROR_INVALID_ARGUMENT, "model must not be null");
+
+        return guarded([&]
+        {
+            model->cache.reset();
+
+            if (entries != 0)
+            {
+                ml::inference_cache_config config;
+                config.capacity = entries;
+                config.outputs = model->outputs;
+
+                model->cache = std::make_unique<ml::inference_cache>(config);
+            }
+
+            return PERCEPTRON_OK;
+        });
+    }
+
+    perceptron_status perceptron_cache_get_stats(const perceptron_model* model, perceptron_cache_stats* stats)
+    {
+        if (!model || !stats)
+            return fail(PERCEPTRON_ERROR_INVALID_ARGUMENT, "model and stats must not be null");
+
+        *stats = perceptron_cache_stats{};
+
+        if (model->cache)
+        {
+            const auto current = model->cache->stats();
+            stats->hits = current.hits;
+            stats->misses = current.misses;
+            stats->evictions = current.evictions;
+            stats->entries = current.entries;
+            stats->memory_bytes = current.memory_bytes;
+        }
+
+        return PERCEPTRON_OK;
+    }
+}
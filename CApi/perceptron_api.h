@@ -0,0 +1,114 @@
+#pragma once
+
+/*
+ * Plain C interface to ml::perceptron, built as perceptron.dll (CApi.vcxproj) or, on Linux, as
+ * libperceptron.so by the CMake build at the repository root:
+ *     cmake -S . -B build && cmake --build build --target perceptron
+ *
+ * Every function returns a perceptron_status; PERCEPTRON_OK is 0. The message of the last failure on
+ * the calling thread is available from perceptron_last_error().
+ *
+ * Thread safety: a loaded model is immutable. Any number of threads may call the query and forward
+ * functions on the same handle concurrently; perceptron_free must not overlap with any other call on it.
+ *
+ * Buffers are owned by the caller and never retained. Samples are stored one per row of `stride`
+ * elements and are not packed into a batch up front: they are converted to floats one cache-sized
+ * tile at a time as the forward pass reaches them, and results are written straight into the output
+ * arrays.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(PERCEPTRON_BUILD_DLL)
+#define PERCEPTRON_API __declspec(dllexport)
+#else
+#define PERCEPTRON_API __declspec(dllimport)
+#endif
+#else
+#define PERCEPTRON_API __attribute__((visibility("default")))
+#endif
+
+#define PERCEPTRON_ABI_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct perceptron_model perceptron_model;
+
+typedef enum perceptron_status
+{
+    PERCEPTRON_OK = 0,
+    PERCEPTRON_ERROR_INVALID_ARGUMENT = 1,
+    PERCEPTRON_ERROR_IO = 2,
+    PERCEPTRON_ERROR_SHAPE = 3,
+    PERCEPTRON_ERROR_OUT_OF_MEMORY = 4,
+    PERCEPTRON_ERROR_INTERNAL = 5
+} perceptron_status;
+
+/* PERCEPTRON_ABI_VERSION of the loaded library; compare with the header's value */
+PERCEPTRON_API uint32_t perceptron_abi_version(void);
+
+PERCEPTRON_API const char* perceptron_status_string(perceptron_status status);
+
+/* Message of the last failed call on this thread, empty if none; valid until the next call */
+PERCEPTRON_API const char* perceptron_last_error(void);
+
+PERCEPTRON_API perceptron_status perceptron_load(const char* path, perceptron_model** model);
+
+PERCEPTRON_API void perceptron_free(perceptron_model* model);
+
+/* Width of one input sample, number of outputs (classes) and number of layers; any pointer may be NULL */
+PERCEPTRON_API perceptron_status perceptron_shape(const perceptron_model* model, size_t* inputs, size_t* outputs, size_t* layers);
+
+/*
+ * Runs count samples; sample i starts at samples + i * stride (stride in elements, at least the input width).
+ * out_probs receives count rows of `outputs` activations, out_labels the index of the largest one per sample.
+ * Either output may be NULL. The uint8 variant expects raw pixels 0..255, normalized like the training data.
+ */
+PERCEPTRON_API perceptron_status perceptron_forward_batch_f32(const perceptron_model* model, const float* samples, size_t count, size_t stride,
+    float* out_probs, int32_t* out_labels);
+
+PERCEPTRON_API perceptron_status perceptron_forward_batch_u8(const perceptron_model* model, const uint8_t* samples, size_t count, size_t stride,
+    float* out_probs, int32_t* out_labels);
+
+/*
+ * Non-zero enables the sparse-input first layer: blank pixels (0 in the uint8 variant, 0.01 after
+ * normalization) are skipped and only the weights of the drawn pixels are multiplied, several times less
+ * work for MNIST-style digits. Results match the default mode up to float rounding. Must not overlap with
+ * other calls on the handle.
+ */
+PERCEPTRON_API perceptron_status perceptron_set_sparse_input(perceptron_model* model, int enabled);
+
+/*
+ * Applies the kernel parameters the autotuner measured for this model's shape on this host, read from the
+ * tuning cache at `path` (NULL: tuning-<host>.bin in the working directory). A missing or stale cache, or
+ * one without this shape, leaves the defaults and is not an error; `applied` (may be NULL) tells which.
+ * Must not overlap with other calls on the handle.
+ */
+PERCEPTRON_API perceptron_status perceptron_load_tuning(perceptron_model* model, const char* path, int* applied);
+
+typedef struct perceptron_cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t memory_bytes;
+} perceptron_cache_stats;
+
+/*
+ * Answers repeated perceptron_forward_batch_u8 inputs from a cache of up to `entries` results keyed by
+ * a 128-bit hash of the sample bytes; 0 disables it. Memory for all entries is allocated here. Must not
+ * overlap with other calls on the handle; forward calls may then use the cache concurrently.
+ */
+PERCEPTRON_API perceptron_status perceptron_cache_configure(perceptron_model* model, size_t entries);
+
+/* All zero while the cache is disabled */
+PERCEPTRON_API perceptron_status perceptron_cache_get_stats(const perceptron_model* model, perceptron_cache_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
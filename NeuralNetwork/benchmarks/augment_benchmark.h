@@ -0,0 +1,102 @@
+#pragma once
+
+#include <random>
+#include <string>
+#include <vector>
+#include <numeric>
+
+#include "benchmark.h"
+#include "../image/augment.h"
+#include "../utils/thread_pool.h"
+
+namespace ml
+{
+    namespace bench
+    {
+        // Augmentation throughput on synthetic 28 x 28 strokes, next to plain batch packing, which is
+        // what the trainer's loader has to beat. images/s/core divides by the pool size for batches.
+        inline void run_augment_benchmarks(size_t images = 10000, size_t batch_size = 100, size_t repeats = 5)
+        {
+            constexpr size_t side = 28;
+            std::mt19937 gen{ 42 };
+            std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+
+            mnist::training_set set(images);
+
+            for (size_t i = 0; i < images; ++i)
+            {
+                auto& sample = set[i];
+                sample.first = static_cast<mnist::byte>(i % mnist::classes);
+                sample.second.assign(side * side, 0);
+
+                const double cx = 10.0 + 8.0 * unit(gen);
+                const double rx = 3.0 + 3.0 * unit(gen);
+                const double ry = 6.0 + 3.0 * unit(gen);
+
+                for (size_t y = 0; y < side; ++y)
+                {
+                    for (size_t x = 0; x < side; ++x)
+                    {
+                        const double dx = (x - cx) / rx;
+                        const double dy = (y - 14.0) / ry;
+                        const double r = dx * dx + dy * dy;
+
+                        if (r > 0.5 && r <= 1.0)
+                            sample.second[y * side + x] = static_cast<mnist::byte>(255);
+                    }
+                }
+            }
+
+            std::vector<size_t> indices(images);
+            std::iota(indices.begin(), indices.end(), size_t{ 0 });
+
+            const size_t cores = utils::thread_pool::instance().size();
+            math::matrix<float> inputs;
+            math::matrix<float> targets;
+
+            auto report = [&](const result& r, size_t threads)
+            {
+                print(r);
+
+                const double per_second = images / (r.median_ns * 1e-9);
+                std::cout << std::setw(52) << std::fixed << std::setprecision(0) << per_second << " images/s"
+                    << std::setw(12) << per_second / threads << " images/s/core\n";
+            };
+
+            std::cout << "augment benchmarks (" << images << " images, batches of " << batch_size << ", " << cores << " threads):\n";
+
+            report(measure("make_batch (no augmentation)", repeats, [&]
+            {
+                for (size_t first = 0; first < images; first += batch_size)
+                    mnist::make_batch(set, indices, first, std::min(batch_size, images - first), inputs, targets);
+            }), 1);
+
+            image::augment_config affine;
+            affine.elastic_alpha = 0.f;
+
+            image::augment_config elastic;
+
+            for (const auto* config : { &affine, &elastic })
+            {
+                const std::string name = config == &affine ? "affine" : "affine + elastic";
+                std::vector<float> out(side * side);
+                image::augment_scratch scratch;
+
+                report(measure(name + ", one thread", repeats, [&]
+                {
+                    for (size_t i = 0; i < images; ++i)
+                    {
+                        const auto transform = image::draw_transform(*config, 1, 0, i);
+                        image::augment(reinterpret_cast<const uint8_t*>(set[i].second.data()), side, side, transform, out.data(), 1, scratch);
+                    }
+                }), 1);
+
+                report(measure(name + ", augment_batch", repeats, [&]
+                {
+                    for (size_t first = 0; first < images; first += batch_size)
+                        image::augment_batch(set, indices, first, std::min(batch_size, images - first), *config, 1, 0, inputs, targets);
+                }), cores);
+            }
+        }
+    }
+}
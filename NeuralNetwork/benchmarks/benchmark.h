@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+namespace ml
+{
+    namespace bench
+    {
+        struct result
+        {
+            std::string name;
+            double median_ns = 0.0;
+            double min_ns = 0.0;
+        };
+
+        // Runs fn repeats times after one warm-up call and reports the median and best time per call
+        template<typename Fn>
+        result measure(const std::string& name, size_t repeats, Fn&& fn)
+        {
+            std::vector<double> times;
+            times.reserve(repeats);
+
+            fn();
+
+            for (size_t i = 0; i < repeats; ++i)
+            {
+                auto start = std::chrono::steady_clock::now();
+                fn();
+                auto stop = std::chrono::steady_clock::now();
+
+                times.push_back(std::chrono::duration<double, std::nano>(stop - start).count());
+            }
+
+            std::sort(times.begin(), times.end());
+
+            result r;
+            r.name = name;
+            r.median_ns = times[times.size() / 2];
+            r.min_ns = times.front();
+            return r;
+        }
+
+        // bytes is the memory traffic of one call, used for the GB/s column
+        inline void print(const result& r, double bytes = 0.0)
+        {
+            std::cout << std::left << std::setw(40) << r.name << std::right
+                << std::setw(12) << std::fixed << std::setprecision(1) << r.median_ns / 1000.0 << " us"
+                << std::setw(12) << r.min_ns / 1000.0 << " us";
+
+            if (bytes > 0.0)
+                std::cout << std::setw(10) << std::setprecision(2) << bytes / r.median_ns << " GB/s";
+
+            std::cout << '\n';
+        }
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "../ml/trainer.h"
+#include "../ml/distributed.h"
+#include "../utils/thread_pool.h"
+
+namespace ml
+{
+    namespace bench
+    {
+        // Training throughput of the in-process trainer against the same run spread over N local worker
+        // processes joined by ring all-reduce. The workers are forked, so this has to run before anything
+        // in the calling process has started the shared thread pool. False if a worker failed, or
+        // where fork() is not available.
+        inline bool run_scaling_benchmark(const mnist::training_set& set, const std::vector<size_t>& world_sizes,
+            const trainer_config& config, uint16_t base_port = 47000, const std::string& socket_prefix = "")
+        {
+#ifdef _WIN32
+            (void)set; (void)world_sizes; (void)config; (void)base_port; (void)socket_prefix;
+            utils::Logger::Warning("bench", "the multi-process scaling benchmark needs fork(), skipped");
+            return false;
+#else
+            const double samples = static_cast<double>(set.size()) * (1.0 - config.validation_split) * config.max_epochs;
+
+            std::cout << "data-parallel scaling (" << samples << " samples, batch " << config.batch_size << "):\n";
+
+            bool all_ok = true;
+
+            for (size_t world : world_sizes)
+            {
+                const auto peers = dist::local_ring(world, static_cast<uint16_t>(base_port + 100 * world), socket_prefix);
+                const auto start = std::chrono::steady_clock::now();
+
+                std::vector<pid_t> children;
+
+                // the children would print whatever is still buffered
+                std::cout.flush();
+
+                for (size_t rank = 0; rank < world; ++rank)
+                {
+                    const pid_t pid = fork();
+
+                    if (pid == 0)
+                    {
+                        // split the cores between the workers
+                        utils::pool_config pool;
+                        pool.threads = std::max<size_t>(std::thread::hardware_concurrency() / world, 1);
+                        utils::thread_pool::configure(pool);
+
+                        dist::distributed_config dc;
+                        dc.rank = rank;
+                        dc.world_size = world;
+                        dc.peers = peers;
+
+                        dist::ring_communicator ring;
+                        bool ok = ring.connect(dc);
+
+                        if (ok)
+                        {
+                            perceptron model({ 784, 150, 10 });
+                            training_result result;
+                            dist::distributed_trainer trainer(ring, config);
+                            ok = trainer.fit(model, set, result);
+                        }
+
+                        std::cout.flush();
+                        _exit(ok ? 0 : 1);
+                    }
+
+                    children.push_back(pid);
+                }
+
+                bool ok = true;
+                for (pid_t pid : children)
+                {
+                    int status = 0;
+                    waitpid(pid, &status, 0);
+                    ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                }
+
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                all_ok = all_ok && ok;
+
+                std::cout << std::left << std::setw(24) << (std::to_string(world) + " processes") << std::right
+                    << std::setw(12) << std::fixed << std::setprecision(0) << samples / seconds << " samples/s"
+                    << (ok ? "" : "  (failed)") << '\n';
+            }
+
+            // same work in this process on the shared pool
+            perceptron model({ 784, 150, 10 });
+            trainer local(config);
+
+            const auto start = std::chrono::steady_clock::now();
+            local.fit(model, set);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::cout << std::left << std::setw(24) << ("threaded, " + std::to_string(utils::thread_pool::instance().size()) + " threads") << std::right
+                << std::setw(12) << std::fixed << std::setprecision(0) << samples / seconds << " samples/s\n";
+
+            return all_ok;
+#endif
+        }
+    }
+}
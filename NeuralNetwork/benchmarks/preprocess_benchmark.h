@@ -0,0 +1,74 @@
+#pragma once
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark.h"
+#include "../image/preprocess.h"
+
+namespace ml
+{
+    namespace bench
+    {
+        // Preprocessing throughput on synthetic scans: a filled ellipse of random size and position on a
+        // light background, per scan size and filter
+        inline void run_preprocess_benchmarks(size_t images = 2000, size_t repeats = 5)
+        {
+            std::mt19937 gen{ 42 };
+            const size_t sizes[] = { 64, 128, 280 };
+
+            std::cout << "preprocess benchmarks (" << images << " images per call):\n";
+
+            for (size_t side : sizes)
+            {
+                std::vector<uint8_t> pixels(images * side * side, 255);
+                std::vector<image::image_view> views(images);
+                std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+
+                for (size_t i = 0; i < images; ++i)
+                {
+                    uint8_t* img = pixels.data() + i * side * side;
+                    const double cx = side * (0.3 + 0.4 * unit(gen));
+                    const double cy = side * (0.3 + 0.4 * unit(gen));
+                    const double rx = side * (0.08 + 0.15 * unit(gen));
+                    const double ry = side * (0.15 + 0.2 * unit(gen));
+
+                    for (size_t y = 0; y < side; ++y)
+                    {
+                        for (size_t x = 0; x < side; ++x)
+                        {
+                            const double dx = (x - cx) / rx;
+                            const double dy = (y - cy) / ry;
+
+                            if (dx * dx + dy * dy <= 1.0)
+                                img[y * side + x] = 0;
+                        }
+                    }
+
+                    views[i].pixels = img;
+                    views[i].width = side;
+                    views[i].height = side;
+                    views[i].stride = side;
+                }
+
+                std::vector<float> out(images * 28 * 28);
+
+                for (auto filter : { image::resample_filter::area, image::resample_filter::bilinear })
+                {
+                    image::preprocess_config config;
+                    config.invert = true;
+                    config.filter = filter;
+
+                    const std::string label = std::to_string(side) + "x" + std::to_string(side) +
+                        (filter == image::resample_filter::area ? " area" : " bilinear");
+
+                    const result r = measure(label, repeats, [&] { image::preprocess_batch(views.data(), images, config, out.data(), 28 * 28); });
+                    print(r);
+
+                    std::cout << std::setw(52) << std::fixed << std::setprecision(0) << images / (r.median_ns * 1e-9) << " images/s\n";
+                }
+            }
+        }
+    }
+}
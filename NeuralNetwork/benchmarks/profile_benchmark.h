@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+
+#include "../ml/perceptron.h"
+#include "../math/matrix.h"
+#include "../utils/random.h"
+#include "../utils/profiler.h"
+#include "../utils/roofline.h"
+
+namespace ml
+{
+    namespace bench
+    {
+        // Profiles iterations training steps and batch inferences of a random { sizes } perceptron
+        // on random batches and prints the per-kernel and per-layer table against this machine's
+        // roofline. Falls back to timing only where hardware counters cannot be opened.
+        inline void run_profile_benchmark(const std::vector<size_t>& sizes, size_t batch, size_t iterations)
+        {
+            perceptron model(sizes, optim::optimizer_config(), 1);
+
+            math::matrix<float> inputs(sizes.front(), batch);
+            math::matrix<float> targets(sizes.back(), batch);
+            utils::parallel_fill_normal(utils::counter_rng(2, utils::rng_stream::shuffle), inputs.data_ptr(), inputs.size(), 0.5f, 0.2f);
+            std::fill(targets.begin(), targets.end(), 0.01f);
+
+            // warm-up outside the profile
+            model.train_batch(inputs, targets);
+
+            const utils::roofline roof = utils::measure_roofline();
+
+            utils::profiler& profiler = utils::profiler::instance();
+            profiler.reset();
+            profiler.enable();
+
+            for (size_t i = 0; i < iterations; ++i)
+            {
+                model.train_batch(inputs, targets);
+                model.forward_batch(inputs);
+            }
+
+            profiler.disable();
+            profiler.report(std::cout, roof);
+        }
+    }
+}
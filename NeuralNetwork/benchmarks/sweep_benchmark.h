@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+
+#include "../ml/sweep.h"
+#include "../ml/trainer.h"
+#include "../utils/thread_pool.h"
+
+namespace ml
+{
+    namespace bench
+    {
+        // One epoch of every run, trained one after the other with trainer and packed by sweep_runner.
+        // Both see the same batches and end with the same weights, so only the wall time differs.
+        inline void run_sweep_benchmark(const mnist::training_set& set, const std::vector<sweep_run>& runs, const sweep_config& config)
+        {
+            const double samples = static_cast<double>(set.size()) * (1.0 - config.validation_split) * config.max_epochs * runs.size();
+            const size_t cores = utils::thread_pool::instance().size();
+
+            std::cout << "sweep benchmark (" << runs.size() << " runs, batch " << config.batch_size << ", " << cores << " threads):\n";
+
+            auto report = [&](const char* name, std::chrono::steady_clock::duration elapsed)
+            {
+                const double seconds = std::chrono::duration<double>(elapsed).count();
+
+                std::cout << std::left << std::setw(40) << name << std::right
+                    << std::setw(10) << std::fixed << std::setprecision(2) << seconds << " s"
+                    << std::setw(14) << std::setprecision(0) << samples / seconds << " samples/s\n";
+            };
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (const auto& run : runs)
+            {
+                trainer_config separate;
+                separate.validation_split = config.validation_split;
+                separate.batch_size = config.batch_size;
+                separate.max_epochs = config.max_epochs;
+                separate.eval_batch_size = config.eval_batch_size;
+                separate.eval_every = std::numeric_limits<size_t>::max();
+                separate.seed = config.seed;
+
+                perceptron model(run.sizes, run.optimizer, run.seed);
+                trainer(separate).fit(model, set);
+            }
+
+            report("trainer, one run at a time", std::chrono::steady_clock::now() - start);
+
+            start = std::chrono::steady_clock::now();
+            sweep_runner(config).run(runs, set);
+            report("sweep_runner, packed", std::chrono::steady_clock::now() - start);
+        }
+    }
+}
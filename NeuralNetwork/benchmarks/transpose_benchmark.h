@@ -0,0 +1,51 @@
+#pragma once
+
+#include <random>
+#include <string>
+#include <utility>
+
+#include "benchmark.h"
+#include "../math/matrix.h"
+
+namespace ml
+{
+    namespace bench
+    {
+        // the element-by-element loops matrix::transpose used before the blocked kernels
+        inline void transpose_naive(const float* src, float* dst, size_t rows, size_t cols)
+        {
+            for (size_t m = 0; m < rows; ++m)
+            {
+                for (size_t n = 0; n < cols; ++n)
+                    dst[n * rows + m] = src[m * cols + n];
+            }
+        }
+
+        inline void run_transpose_benchmarks(size_t repeats = 200)
+        {
+            std::mt19937 gen{ 42 };
+            std::uniform_real_distribution<float> dist{ -1.f, 1.f };
+
+            const std::pair<size_t, size_t> shapes[] = { { 150, 784 }, { 784, 150 }, { 150, 150 }, { 784, 784 } };
+
+            std::cout << "transpose benchmarks (median, best, read+write bandwidth):\n";
+
+            for (const auto& shape : shapes)
+            {
+                math::matrix<float> source(shape.first, shape.second);
+                std::for_each(source.begin(), source.end(), [&](float& item) { item = dist(gen); });
+
+                math::matrix<float> target;
+                source.transpose_to(target);
+
+                const std::string label = std::to_string(shape.first) + "x" + std::to_string(shape.second);
+                const double bytes = 2.0 * source.size() * sizeof(float);
+
+                print(measure(label + " naive", repeats, [&] { transpose_naive(source.data_ptr(), target.data_ptr(), shape.first, shape.second); }), bytes);
+                print(measure(label + " transpose_to (reused buffer)", repeats, [&] { source.transpose_to(target); }), bytes);
+                print(measure(label + " transposed (allocating)", repeats, [&] { auto t = source.transposed(); (void)t; }), bytes);
+                print(measure(label + " transpose (in place)", repeats, [&] { source.transpose(); }), bytes);
+            }
+        }
+    }
+}
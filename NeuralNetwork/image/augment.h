@@ -0,0 +1,336 @@
+#pragma once
+
+#include <cmath>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "preprocess.h"
+#include "../math/matrix.h"
+#include "../utils/random.h"
+#include "../utils/thread_pool.h"
+#include "../utils/mnist/mnist.h"
+
+namespace ml
+{
+    namespace image
+    {
+        // Random distortions applied to training images. Every parameter is drawn uniformly from
+        // [-max, max]; a zero disables that part.
+        struct augment_config
+        {
+            // translation in pixels
+            float max_shift = 2.f;
+
+            // rotation in radians
+            float max_rotation = 0.2f;
+
+            // relative change of size, 0.1 for 0.9 .. 1.1
+            float max_scale = 0.1f;
+
+            // elastic distortion: random displacements of up to elastic_alpha pixels on an
+            // (elastic_grid + 1)^2 lattice, interpolated bilinearly into a smooth field
+            float elastic_alpha = 1.5f;
+            size_t elastic_grid = 3;
+        };
+
+        namespace detail
+        {
+            // (max_elastic_grid + 1)^2 lattice points of two coordinates, plus four affine draws, fit in 256 values
+            constexpr size_t max_elastic_grid = 8;
+
+            // Parameters of one sample: values sample * 256 + k of the epoch's augmentation stream, so the
+            // result does not depend on which thread or batch handles the sample
+            class sample_random
+            {
+            public:
+                sample_random(uint64_t seed, uint64_t epoch, uint64_t sample)
+                    : rng(seed, utils::rng_stream::augmentation + epoch), next(sample << 8) {}
+
+                // uniform in [-1, 1)
+                float symmetric()
+                {
+                    if (next % 4 == 0)
+                        values = rng.block(next / 4);
+
+                    return 2.f * utils::counter_rng::to_uniform(values[next++ % 4]) - 1.f;
+                }
+
+            private:
+                utils::counter_rng rng;
+                uint64_t next;
+                utils::philox::block values{};
+            };
+        }
+
+        // Output-to-source mapping of one augmented sample
+        struct augment_transform
+        {
+            // source position of output pixel p, both relative to the image centre: m * p + shift
+            float m00 = 1.f, m01 = 0.f, m10 = 0.f, m11 = 1.f;
+            float shift_x = 0.f, shift_y = 0.f;
+
+            size_t grid = 0;
+            std::array<float, (detail::max_elastic_grid + 1) * (detail::max_elastic_grid + 1)> grid_x{};
+            std::array<float, (detail::max_elastic_grid + 1) * (detail::max_elastic_grid + 1)> grid_y{};
+        };
+
+        inline augment_transform draw_transform(const augment_config& config, uint64_t seed, uint64_t epoch, uint64_t sample)
+        {
+            detail::sample_random random(seed, epoch, sample);
+            augment_transform t;
+
+            const float angle = config.max_rotation * random.symmetric();
+            const float scale = 1.f + config.max_scale * random.symmetric();
+            const float c = std::cos(angle) / scale;
+            const float s = std::sin(angle) / scale;
+
+            t.m00 = c;
+            t.m01 = s;
+            t.m10 = -s;
+            t.m11 = c;
+            t.shift_x = config.max_shift * random.symmetric();
+            t.shift_y = config.max_shift * random.symmetric();
+
+            if (config.elastic_alpha > 0.f && config.elastic_grid > 0)
+            {
+                t.grid = std::min(config.elastic_grid, detail::max_elastic_grid);
+                const size_t points = (t.grid + 1) * (t.grid + 1);
+
+                for (size_t i = 0; i < points; ++i)
+                {
+                    t.grid_x[i] = config.elastic_alpha * random.symmetric();
+                    t.grid_y[i] = config.elastic_alpha * random.symmetric();
+                }
+            }
+
+            return t;
+        }
+
+        // Buffers reused between images; one per thread
+        struct augment_scratch
+        {
+            std::vector<float> source;
+            std::vector<float> field_x;
+            std::vector<float> field_y;
+            std::vector<float> row;
+        };
+
+        // Resamples a width x height uint8 image through t with bilinear interpolation and writes it
+        // normalized like mnist::normalize_pixel to out, pixel i at out[i * out_step]. Samples that fall
+        // outside the image read background.
+        inline void augment(const uint8_t* src, size_t width, size_t height, const augment_transform& t, float* out, size_t out_step,
+            augment_scratch& scratch)
+        {
+            // one pixel of zero border on every side plus one on the right and bottom, so clamped
+            // coordinates and their +1 neighbours never leave the buffer
+            const size_t padded = width + 3;
+            scratch.source.assign(padded * (height + 3), 0.f);
+
+            for (size_t y = 0; y < height; ++y)
+            {
+                float* dst = scratch.source.data() + (y + 1) * padded + 1;
+                const uint8_t* row = src + y * width;
+
+                for (size_t x = 0; x < width; ++x)
+                    dst[x] = row[x];
+            }
+
+            const bool elastic = t.grid > 0;
+
+            if (elastic)
+            {
+                scratch.field_x.resize(width * height);
+                scratch.field_y.resize(width * height);
+
+                const size_t stride = t.grid + 1;
+                std::array<float, detail::max_elastic_grid + 1> row_x{};
+                std::array<float, detail::max_elastic_grid + 1> row_y{};
+
+                // the field is bilinear in the lattice: blend two lattice rows per image row, then
+                // interpolate along x
+                for (size_t y = 0; y < height; ++y)
+                {
+                    const float gy = (y + 0.5f) * t.grid / height;
+                    const size_t cy = std::min(static_cast<size_t>(gy), t.grid - 1);
+                    const float fy = gy - cy;
+
+                    for (size_t i = 0; i < stride; ++i)
+                    {
+                        const size_t top = cy * stride + i;
+                        row_x[i] = t.grid_x[top] + fy * (t.grid_x[top + stride] - t.grid_x[top]);
+                        row_y[i] = t.grid_y[top] + fy * (t.grid_y[top + stride] - t.grid_y[top]);
+                    }
+
+                    float* fx_row = scratch.field_x.data() + y * width;
+                    float* fy_row = scratch.field_y.data() + y * width;
+
+                    for (size_t x = 0; x < width; ++x)
+                    {
+                        const float gx = (x + 0.5f) * t.grid / width;
+                        const size_t cx = std::min(static_cast<size_t>(gx), t.grid - 1);
+                        const float fx = gx - cx;
+
+                        fx_row[x] = row_x[cx] + fx * (row_x[cx + 1] - row_x[cx]);
+                        fy_row[x] = row_y[cx] + fx * (row_y[cx + 1] - row_y[cx]);
+                    }
+                }
+            }
+
+            scratch.row.resize(width);
+
+            const float* source = scratch.source.data();
+            const float centre_x = (width - 1) * 0.5f;
+            const float centre_y = (height - 1) * 0.5f;
+            const float limit_x = static_cast<float>(width + 1);
+            const float limit_y = static_cast<float>(height + 1);
+            constexpr float scale = 0.99f / 255.f;
+
+            for (size_t y = 0; y < height; ++y)
+            {
+                const float ry = y - centre_y;
+
+                // source coordinates in the padded buffer are base + m * (x - centre_x)
+                const float base_x = t.m01 * ry + centre_x + t.shift_x + 1.f;
+                const float base_y = t.m11 * ry + centre_y + t.shift_y + 1.f;
+                const float* fx_row = elastic ? scratch.field_x.data() + y * width : nullptr;
+                const float* fy_row = elastic ? scratch.field_y.data() + y * width : nullptr;
+                float* values = scratch.row.data();
+
+                size_t x = 0;
+#ifdef ML_PREPROCESS_SSE
+                const __m128 lane = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+                const __m128 m00 = _mm_set1_ps(t.m00);
+                const __m128 m10 = _mm_set1_ps(t.m10);
+                const __m128 bx = _mm_set1_ps(base_x);
+                const __m128 by = _mm_set1_ps(base_y);
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 max_x = _mm_set1_ps(limit_x);
+                const __m128 max_y = _mm_set1_ps(limit_y);
+                const __m128 row_length = _mm_set1_ps(static_cast<float>(padded));
+                const __m128 s = _mm_set1_ps(scale);
+                const __m128 offset = _mm_set1_ps(0.01f);
+
+                for (; x + 4 <= width; x += 4)
+                {
+                    const __m128 rx = _mm_add_ps(_mm_set1_ps(x - centre_x), lane);
+                    __m128 sx = _mm_add_ps(bx, _mm_mul_ps(m00, rx));
+                    __m128 sy = _mm_add_ps(by, _mm_mul_ps(m10, rx));
+
+                    if (elastic)
+                    {
+                        sx = _mm_add_ps(sx, _mm_loadu_ps(fx_row + x));
+                        sy = _mm_add_ps(sy, _mm_loadu_ps(fy_row + x));
+                    }
+
+                    sx = _mm_min_ps(_mm_max_ps(sx, zero), max_x);
+                    sy = _mm_min_ps(_mm_max_ps(sy, zero), max_y);
+
+                    // coordinates are non-negative, so truncation is floor
+                    const __m128 x0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(sx));
+                    const __m128 y0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(sy));
+                    const __m128 wx = _mm_sub_ps(sx, x0);
+                    const __m128 wy = _mm_sub_ps(sy, y0);
+
+                    alignas(16) int32_t index[4];
+                    _mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(y0, row_length), x0)));
+
+                    const float* p0 = source + index[0];
+                    const float* p1 = source + index[1];
+                    const float* p2 = source + index[2];
+                    const float* p3 = source + index[3];
+
+                    const __m128 a = _mm_set_ps(p3[0], p2[0], p1[0], p0[0]);
+                    const __m128 b = _mm_set_ps(p3[1], p2[1], p1[1], p0[1]);
+                    const __m128 c = _mm_set_ps(p3[padded], p2[padded], p1[padded], p0[padded]);
+                    const __m128 d = _mm_set_ps(p3[padded + 1], p2[padded + 1], p1[padded + 1], p0[padded + 1]);
+
+                    const __m128 top = _mm_add_ps(a, _mm_mul_ps(wx, _mm_sub_ps(b, a)));
+                    const __m128 bottom = _mm_add_ps(c, _mm_mul_ps(wx, _mm_sub_ps(d, c)));
+                    const __m128 v = _mm_add_ps(top, _mm_mul_ps(wy, _mm_sub_ps(bottom, top)));
+
+                    _mm_storeu_ps(values + x, _mm_add_ps(_mm_mul_ps(v, s), offset));
+                }
+#endif
+                for (; x < width; ++x)
+                {
+                    const float rx = x - centre_x;
+                    float sx = base_x + t.m00 * rx + (elastic ? fx_row[x] : 0.f);
+                    float sy = base_y + t.m10 * rx + (elastic ? fy_row[x] : 0.f);
+
+                    sx = std::min(std::max(sx, 0.f), limit_x);
+                    sy = std::min(std::max(sy, 0.f), limit_y);
+
+                    const size_t x0 = static_cast<size_t>(sx);
+                    const size_t y0 = static_cast<size_t>(sy);
+                    const float wx = sx - x0;
+                    const float wy = sy - y0;
+                    const float* p = source + y0 * padded + x0;
+
+                    const float top = p[0] + wx * (p[1] - p[0]);
+                    const float bottom = p[padded] + wx * (p[padded + 1] - p[padded]);
+
+                    values[x] = (top + wy * (bottom - top)) * scale + 0.01f;
+                }
+
+                float* dst = out + y * width * out_step;
+
+                if (out_step == 1)
+                {
+                    std::copy(values, values + width, dst);
+                }
+                else
+                {
+                    for (size_t i = 0; i < width; ++i)
+                        dst[i * out_step] = values[i];
+                }
+            }
+        }
+
+        // Like mnist::make_batch, but every sample is distorted by the transform drawn for
+        // (seed, epoch, set index). Samples are spread over the shared thread pool; the batch is
+        // identical for any thread count. Non-square images are packed without augmentation.
+        inline void augment_batch(const mnist::training_set& set, const std::vector<size_t>& indices, size_t first, size_t count,
+            const augment_config& config, uint64_t seed, uint64_t epoch, math::matrix<float>& inputs, math::matrix<float>& targets)
+        {
+            utils::memory_scope scope(utils::memory_tag::datasets);
+            const size_t pixels = set[indices[first]].second.size();
+            const size_t side = static_cast<size_t>(std::lround(std::sqrt(static_cast<double>(pixels))));
+
+            if (side * side != pixels)
+            {
+                mnist::make_batch(set, indices, first, count, inputs, targets);
+                return;
+            }
+
+            if (inputs.size_m() != pixels || inputs.size_n() != count)
+                inputs = math::matrix<float>(pixels, count);
+
+            if (targets.size_m() != mnist::classes || targets.size_n() != count)
+                targets = math::matrix<float>(mnist::classes, count);
+
+            float* in = inputs.data_ptr();
+            float* out = targets.data_ptr();
+
+            std::fill(out, out + targets.size(), 0.01f);
+
+            for (size_t col = 0; col < count; ++col)
+                out[static_cast<size_t>(set[indices[first + col]].first) * count + col] = 0.99f;
+
+            utils::parallel_for(0, count, 32, [&](size_t first_col, size_t last_col)
+            {
+                augment_scratch scratch;
+
+                for (size_t col = first_col; col < last_col; ++col)
+                {
+                    const size_t sample = indices[first + col];
+                    const auto transform = draw_transform(config, seed, epoch, sample);
+                    const uint8_t* image = reinterpret_cast<const uint8_t*>(set[sample].second.data());
+
+                    augment(image, side, side, transform, in + col, count, scratch);
+                }
+            });
+        }
+    }
+}
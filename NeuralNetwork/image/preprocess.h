@@ -0,0 +1,388 @@
+#pragma once
+
+#include <cmath>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ML_PREPROCESS_SSE
+#endif
+
+#include "../utils/thread_pool.h"
+
+namespace ml
+{
+    namespace image
+    {
+        // Grayscale (channels == 1) or interleaved 3/4 channel image; colour pixels use the mean of
+        // their first three channels. stride is the distance between rows in bytes.
+        struct image_view
+        {
+            const uint8_t* pixels = nullptr;
+            size_t width = 0;
+            size_t height = 0;
+            size_t stride = 0;
+            size_t channels = 1;
+        };
+
+        enum class resample_filter
+        {
+            // box average over the covered source area; enlarging falls back to bilinear
+            area,
+            bilinear
+        };
+
+        struct preprocess_config
+        {
+            size_t output_size = 28;
+
+            // MNIST fits the digit's bounding box into 20 x 20 and centres its mass in the 28 x 28 frame
+            size_t box_size = 20;
+
+            resample_filter filter = resample_filter::area;
+
+            // true for dark ink on a light background, as drawn on the recognizer's canvas
+            bool invert = false;
+
+            // ink values above this belong to the digit when the bounding box is searched
+            uint8_t threshold = 24;
+        };
+
+        namespace detail
+        {
+            // For every output index: first source index and the normalized weights of the sources it reads
+            struct resample_taps
+            {
+                std::vector<size_t> first;
+                std::vector<size_t> count;
+                std::vector<float> weights;
+                size_t max_taps = 0;
+            };
+
+            inline void build_taps(size_t src, size_t dst, resample_filter filter, resample_taps& taps)
+            {
+                const double scale = static_cast<double>(src) / dst;
+                const bool area = filter == resample_filter::area && scale > 1.0;
+
+                taps.max_taps = area ? static_cast<size_t>(std::ceil(scale)) + 1 : 2;
+                taps.first.assign(dst, 0);
+                taps.count.assign(dst, 0);
+                taps.weights.assign(dst * taps.max_taps, 0.f);
+
+                for (size_t i = 0; i < dst; ++i)
+                {
+                    float* w = taps.weights.data() + i * taps.max_taps;
+
+                    if (area)
+                    {
+                        const double begin = i * scale;
+                        const double end = std::min((i + 1) * scale, static_cast<double>(src));
+                        const size_t first = static_cast<size_t>(begin);
+                        size_t n = 0;
+
+                        for (size_t s = first; s < src && s < end; ++s, ++n)
+                            w[n] = static_cast<float>((std::min(end, s + 1.0) - std::max(begin, static_cast<double>(s))) / scale);
+
+                        taps.first[i] = first;
+                        taps.count[i] = n;
+                    }
+                    else
+                    {
+                        // pixel centres map onto each other; edges clamp
+                        const double center = std::clamp((i + 0.5) * scale - 0.5, 0.0, static_cast<double>(src - 1));
+                        const size_t first = std::min(static_cast<size_t>(center), src - 1);
+                        const float frac = static_cast<float>(center - first);
+
+                        taps.first[i] = first;
+                        taps.count[i] = first + 1 < src ? 2 : 1;
+                        w[0] = taps.count[i] == 2 ? 1.f - frac : 1.f;
+                        w[1] = taps.count[i] == 2 ? frac : 0.f;
+                    }
+                }
+            }
+
+            // out[i] += weight * row[i] for n floats
+            inline void axpy(float* out, const float* row, float weight, size_t n)
+            {
+                size_t i = 0;
+#ifdef ML_PREPROCESS_SSE
+                const __m128 w = _mm_set1_ps(weight);
+
+                for (; i + 4 <= n; i += 4)
+                    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(w, _mm_loadu_ps(row + i))));
+#endif
+                for (; i < n; ++i)
+                    out[i] += weight * row[i];
+            }
+
+            // ink in [0, 255] to the network's input range: ink / 255 * 0.99 + 0.01
+            inline void normalize(float* values, size_t n)
+            {
+                constexpr float scale = 0.99f / 255.f;
+                size_t i = 0;
+#ifdef ML_PREPROCESS_SSE
+                const __m128 s = _mm_set1_ps(scale);
+                const __m128 offset = _mm_set1_ps(0.01f);
+
+                for (; i + 4 <= n; i += 4)
+                    _mm_storeu_ps(values + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(values + i), s), offset));
+#endif
+                for (; i < n; ++i)
+                    values[i] = values[i] * scale + 0.01f;
+            }
+
+            // First and last column of a grayscale row whose ink exceeds threshold; false if there is none
+            inline bool ink_extent(const uint8_t* row, size_t width, bool invert, uint8_t threshold, size_t& first, size_t& last)
+            {
+                // ink > threshold, stated on the stored value
+                if (threshold == 255)
+                    return false;
+
+                const uint8_t bound = invert ? static_cast<uint8_t>(254 - threshold) : static_cast<uint8_t>(threshold + 1);
+                auto is_ink = [&](uint8_t v) { return invert ? v <= bound : v >= bound; };
+
+                size_t x = 0;
+                bool found = false;
+
+#ifdef ML_PREPROCESS_SSE
+                const __m128i b = _mm_set1_epi8(static_cast<char>(bound));
+
+                for (; x + 16 <= width; x += 16)
+                {
+                    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+                    const __m128i hit = invert ? _mm_cmpeq_epi8(_mm_min_epu8(v, b), v) : _mm_cmpeq_epi8(_mm_max_epu8(v, b), v);
+                    const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hit));
+
+                    if (mask == 0)
+                        continue;
+
+                    if (!found)
+                    {
+                        unsigned low = 0;
+                        while (!(mask & (1u << low)))
+                            ++low;
+
+                        first = x + low;
+                        found = true;
+                    }
+
+                    unsigned high = 15;
+                    while (!(mask & (1u << high)))
+                        --high;
+
+                    last = x + high;
+                }
+#endif
+                for (; x < width; ++x)
+                {
+                    if (is_ink(row[x]))
+                    {
+                        if (!found)
+                            first = x;
+
+                        last = x;
+                        found = true;
+                    }
+                }
+
+                return found;
+            }
+
+            inline uint8_t ink(const image_view& src, size_t x, size_t y, bool invert)
+            {
+                const uint8_t* p = src.pixels + y * src.stride + x * src.channels;
+                const uint8_t value = src.channels >= 3 ? static_cast<uint8_t>((p[0] + p[1] + p[2]) / 3) : p[0];
+
+                return invert ? static_cast<uint8_t>(255 - value) : value;
+            }
+        }
+
+        // Buffers reused between images; one per thread
+        struct preprocess_scratch
+        {
+            std::vector<float> crop;
+            std::vector<float> vertical;
+            std::vector<float> patch;
+            detail::resample_taps taps_x;
+            detail::resample_taps taps_y;
+        };
+
+        // Crops src to its ink bounding box, resamples it so the longer side is box_size, shifts it so
+        // its centre of mass sits in the middle of the output frame and normalizes the result into out
+        // (output_size * output_size floats, row-major). Returns false for an image without ink; out
+        // then holds background values.
+        inline bool preprocess(const image_view& src, const preprocess_config& config, float* out, preprocess_scratch& scratch)
+        {
+            const size_t size = config.output_size;
+            std::fill(out, out + size * size, 0.f);
+
+            size_t left = src.width, right = 0, top = src.height, bottom = 0;
+
+            for (size_t y = 0; y < src.height; ++y)
+            {
+                if (src.channels == 1)
+                {
+                    size_t first = 0, last = 0;
+
+                    if (detail::ink_extent(src.pixels + y * src.stride, src.width, config.invert, config.threshold, first, last))
+                    {
+                        left = std::min(left, first);
+                        right = std::max(right, last);
+                        top = std::min(top, y);
+                        bottom = std::max(bottom, y);
+                    }
+
+                    continue;
+                }
+
+                for (size_t x = 0; x < src.width; ++x)
+                {
+                    if (detail::ink(src, x, y, config.invert) > config.threshold)
+                    {
+                        left = std::min(left, x);
+                        right = std::max(right, x);
+                        top = std::min(top, y);
+                        bottom = std::max(bottom, y);
+                    }
+                }
+            }
+
+            if (left > right || top > bottom)
+            {
+                detail::normalize(out, size * size);
+                return false;
+            }
+
+            const size_t crop_w = right - left + 1;
+            const size_t crop_h = bottom - top + 1;
+            const size_t box = std::min(config.box_size, size);
+            const double fit = static_cast<double>(box) / std::max(crop_w, crop_h);
+            const size_t patch_w = std::clamp<size_t>(static_cast<size_t>(std::lround(crop_w * fit)), 1, box);
+            const size_t patch_h = std::clamp<size_t>(static_cast<size_t>(std::lround(crop_h * fit)), 1, box);
+
+            detail::build_taps(crop_w, patch_w, config.filter, scratch.taps_x);
+            detail::build_taps(crop_h, patch_h, config.filter, scratch.taps_y);
+
+            // ink of the cropped area as floats
+            scratch.crop.resize(crop_h * crop_w);
+
+            for (size_t y = 0; y < crop_h; ++y)
+            {
+                float* row = scratch.crop.data() + y * crop_w;
+
+                if (src.channels == 1)
+                {
+                    const uint8_t* p = src.pixels + (top + y) * src.stride + left;
+                    const float sign = config.invert ? -1.f : 1.f;
+                    const float base = config.invert ? 255.f : 0.f;
+
+                    for (size_t x = 0; x < crop_w; ++x)
+                        row[x] = base + sign * p[x];
+                }
+                else
+                {
+                    for (size_t x = 0; x < crop_w; ++x)
+                        row[x] = detail::ink(src, left + x, top + y, config.invert);
+                }
+            }
+
+            // vertical pass first, on whole rows, so the gathering horizontal pass only sees patch_h rows
+            scratch.vertical.assign(patch_h * crop_w, 0.f);
+
+            for (size_t y = 0; y < patch_h; ++y)
+            {
+                const float* w = scratch.taps_y.weights.data() + y * scratch.taps_y.max_taps;
+
+                for (size_t t = 0; t < scratch.taps_y.count[y]; ++t)
+                    detail::axpy(scratch.vertical.data() + y * crop_w, scratch.crop.data() + (scratch.taps_y.first[y] + t) * crop_w, w[t], crop_w);
+            }
+
+            scratch.patch.resize(patch_h * patch_w);
+
+            for (size_t y = 0; y < patch_h; ++y)
+            {
+                const float* row = scratch.vertical.data() + y * crop_w;
+                float* dst = scratch.patch.data() + y * patch_w;
+
+                for (size_t x = 0; x < patch_w; ++x)
+                {
+                    const float* w = scratch.taps_x.weights.data() + x * scratch.taps_x.max_taps;
+                    const float* src_row = row + scratch.taps_x.first[x];
+                    const size_t taps = scratch.taps_x.count[x];
+                    float sum = 0.f;
+
+                    for (size_t t = 0; t < taps; ++t)
+                        sum += w[t] * src_row[t];
+
+                    dst[x] = sum;
+                }
+            }
+
+            double mass = 0.0, mass_x = 0.0, mass_y = 0.0;
+
+            for (size_t y = 0; y < patch_h; ++y)
+            {
+                for (size_t x = 0; x < patch_w; ++x)
+                {
+                    const double v = scratch.patch[y * patch_w + x];
+                    mass += v;
+                    mass_x += v * (x + 0.5);
+                    mass_y += v * (y + 0.5);
+                }
+            }
+
+            const double half = size / 2.0;
+            const long long offset_x = mass > 0.0 ? std::llround(half - mass_x / mass) : static_cast<long long>((size - patch_w) / 2);
+            const long long offset_y = mass > 0.0 ? std::llround(half - mass_y / mass) : static_cast<long long>((size - patch_h) / 2);
+
+            for (size_t y = 0; y < patch_h; ++y)
+            {
+                const long long oy = static_cast<long long>(y) + offset_y;
+                if (oy < 0 || oy >= static_cast<long long>(size))
+                    continue;
+
+                for (size_t x = 0; x < patch_w; ++x)
+                {
+                    const long long ox = static_cast<long long>(x) + offset_x;
+                    if (ox >= 0 && ox < static_cast<long long>(size))
+                        out[oy * size + ox] = std::min(scratch.patch[y * patch_w + x], 255.f);
+                }
+            }
+
+            detail::normalize(out, size * size);
+            return true;
+        }
+
+        inline bool preprocess(const image_view& src, const preprocess_config& config, float* out)
+        {
+            preprocess_scratch scratch;
+            return preprocess(src, config, out, scratch);
+        }
+
+        // Preprocesses count images on the shared thread pool; image i is written to out + i * out_stride.
+        // Returns the number of images that contained ink.
+        inline size_t preprocess_batch(const image_view* images, size_t count, const preprocess_config& config, float* out, size_t out_stride)
+        {
+            std::atomic<size_t> found{ 0 };
+
+            utils::parallel_for(0, count, 16, [&](size_t first, size_t last)
+            {
+                preprocess_scratch scratch;
+                size_t local = 0;
+
+                for (size_t i = first; i < last; ++i)
+                {
+                    if (preprocess(images[i], config, out + i * out_stride, scratch))
+                        ++local;
+                }
+
+                found += local;
+            });
+
+            return found;
+        }
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+
+#include "../utils/thread_pool.h"
+
+namespace ml
+{
+    namespace math
+    {
+        // Shape of a 2D convolution or pooling window over a batch of images stored channel-major
+        // (CNHW): channel c of sample n starts at (c * batch + n) * height * width. With this layout
+        // one channel of the whole batch is a single row of a matrix, so a convolution is one GEMM
+        // of the (out_channels x patch) weights with the (patch x batch * out_height * out_width)
+        // column matrix built by im2col.
+        struct conv_geometry
+        {
+            size_t channels = 1;
+            size_t height = 0;
+            size_t width = 0;
+            size_t kernel = 1;
+            size_t stride = 1;
+            size_t padding = 0;
+
+            size_t out_height() const
+            {
+                return (height + 2 * padding - kernel) / stride + 1;
+            }
+
+            size_t out_width() const
+            {
+                return (width + 2 * padding - kernel) / stride + 1;
+            }
+
+            // rows of the column matrix
+            size_t patch() const
+            {
+                return channels * kernel * kernel;
+            }
+
+            bool valid() const
+            {
+                return kernel != 0 && stride != 0 && height + 2 * padding >= kernel && width + 2 * padding >= kernel;
+            }
+        };
+
+        // cols row (c * kernel + ky) * kernel + kx, column (n * out_height + oy) * out_width + ox holds
+        // input pixel (c, n, oy * stride + ky - padding, ox * stride + kx - padding), zero outside
+        template <typename T>
+        void im2col(const T* input, size_t batch, const conv_geometry& g, T* cols)
+        {
+            const size_t oh = g.out_height();
+            const size_t ow = g.out_width();
+            const size_t plane = g.height * g.width;
+            const size_t row_length = batch * oh * ow;
+            const size_t rows = g.patch();
+
+            utils::parallel_for(0, rows, std::max<size_t>(1, (size_t{ 1 } << 15) / std::max<size_t>(row_length, 1)), [&](size_t first, size_t last)
+            {
+                for (size_t r = first; r < last; ++r)
+                {
+                    const size_t c = r / (g.kernel * g.kernel);
+                    const size_t ky = (r / g.kernel) % g.kernel;
+                    const size_t kx = r % g.kernel;
+                    T* dst = cols + r * row_length;
+
+                    for (size_t n = 0; n < batch; ++n)
+                    {
+                        const T* src = input + (c * batch + n) * plane;
+
+                        for (size_t oy = 0; oy < oh; ++oy)
+                        {
+                            const ptrdiff_t y = static_cast<ptrdiff_t>(oy * g.stride + ky) - static_cast<ptrdiff_t>(g.padding);
+                            T* out = dst + (n * oh + oy) * ow;
+
+                            if (y < 0 || y >= static_cast<ptrdiff_t>(g.height))
+                            {
+                                std::fill(out, out + ow, T(0));
+                                continue;
+                            }
+
+                            const T* line = src + y * g.width;
+
+                            for (size_t ox = 0; ox < ow; ++ox)
+                            {
+                                const ptrdiff_t x = static_cast<ptrdiff_t>(ox * g.stride + kx) - static_cast<ptrdiff_t>(g.padding);
+                                out[ox] = x >= 0 && x < static_cast<ptrdiff_t>(g.width) ? line[x] : T(0);
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        // Adjoint of im2col: adds every column entry back onto the input pixel it was copied from.
+        // input must be zeroed by the caller; channels are independent and run in parallel.
+        template <typename T>
+        void col2im(const T* cols, size_t batch, const conv_geometry& g, T* input)
+        {
+            const size_t oh = g.out_height();
+            const size_t ow = g.out_width();
+            const size_t plane = g.height * g.width;
+            const size_t row_length = batch * oh * ow;
+            const size_t window = g.kernel * g.kernel;
+
+            utils::parallel_for(0, g.channels, 1, [&](size_t first, size_t last)
+            {
+                for (size_t c = first; c < last; ++c)
+                {
+                    for (size_t k = 0; k < window; ++k)
+                    {
+                        const size_t ky = k / g.kernel;
+                        const size_t kx = k % g.kernel;
+                        const T* src = cols + (c * window + k) * row_length;
+
+                        for (size_t n = 0; n < batch; ++n)
+                        {
+                            T* dst = input + (c * batch + n) * plane;
+
+                            for (size_t oy = 0; oy < oh; ++oy)
+                            {
+                                const ptrdiff_t y = static_cast<ptrdiff_t>(oy * g.stride + ky) - static_cast<ptrdiff_t>(g.padding);
+                                if (y < 0 || y >= static_cast<ptrdiff_t>(g.height))
+                                    continue;
+
+                                const T* in = src + (n * oh + oy) * ow;
+                                T* line = dst + y * g.width;
+
+                                for (size_t ox = 0; ox < ow; ++ox)
+                                {
+                                    const ptrdiff_t x = static_cast<ptrdiff_t>(ox * g.stride + kx) - static_cast<ptrdiff_t>(g.padding);
+                                    if (x >= 0 && x < static_cast<ptrdiff_t>(g.width))
+                                        line[x] += in[ox];
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cassert>
+
+#include "matrix.h"
+
+namespace ml
+{
+    namespace math
+    {
+        // m x n matrix kept as the product u * v of an m x r and an r x n factor.
+        // Multiplying through the factors costs r * (m + n) per sample instead of m * n.
+        template <typename T>
+        class low_rank_matrix
+        {
+        public:
+            low_rank_matrix() = default;
+
+            low_rank_matrix(matrix<T>&& u, matrix<T>&& v) : u(std::move(u)), v(std::move(v))
+            {
+                assert(this->u.size_n() == this->v.size_m() && "factor sizes are incompatible");
+            }
+
+            size_t size_m() const { return u.size_m(); }
+            size_t size_n() const { return v.size_n(); }
+            size_t rank() const { return u.size_n(); }
+
+            const matrix<T>& left() const { return u; }
+            const matrix<T>& right() const { return v; }
+
+            matrix<T>& left() { return u; }
+            matrix<T>& right() { return v; }
+
+            matrix<T> to_dense() const
+            {
+                return u * v;
+            }
+
+            // this * x, where x holds one sample per column
+            matrix<T> multiply(const matrix<T>& x) const
+            {
+                return u * (v * x);
+            }
+
+        private:
+            matrix<T> u;
+            matrix<T> v;
+        };
+    }
+}
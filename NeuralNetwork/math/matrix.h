@@ -7,13 +7,22 @@
 #include <initializer_list>
 #include <cassert>
 #include <iterator>
+#include <vector>
 
-#include "..\utils\mat_iterator.h"
+#include "transpose.h"
+#include "../utils/mat_iterator.h"
+#include "../utils/memory.h"
+#include "../utils/profiler.h"
+#include "../utils/thread_pool.h"
 
 namespace ml
 {
     namespace math
     {
+        // below these sizes the kernels stay on the calling thread, forking would cost more than it saves
+        constexpr size_t parallel_gemm_work = size_t{ 1 } << 18;
+        constexpr size_t parallel_elementwise_length = size_t{ 1 } << 16;
+
         template <typename T>
         class matrix
         {
@@ -41,7 +50,7 @@ namespace ml
                 assert(m != 0 || n != 1 && "invalid matrix sizes");
                 assert(m != 1 || n != 0 && "invalid matrix sizes");
 
-                data = std::make_unique<T[]>(length);
+                data = utils::allocate_buffer<T>(length);
                 std::fill(data.get(), data.get() + length, static_cast<T>(0));
             }
 
@@ -51,8 +60,11 @@ namespace ml
                 assert(m != 0 || n != 1 && "invalid matrix sizes");
                 assert(m != 1 || n != 0 && "invalid matrix sizes");
 
-                data = std::make_unique<T[]>(length);
-                std::copy(values.cbegin(), values.cend(), data.get());
+                data = utils::allocate_buffer<T>(length);
+
+                const size_t given = std::min(values.size(), length);
+                std::copy(values.cbegin(), values.cbegin() + given, data.get());
+                std::fill(data.get() + given, data.get() + length, static_cast<T>(0));
             }
 
             explicit matrix(std::initializer_list<std::initializer_list<T>> values)
@@ -63,7 +75,7 @@ namespace ml
                 sizeN = values.begin()->size();
                 length = sizeM * sizeN;
 
-                data = std::make_unique<T[]>(sizeM * sizeN);
+                data = utils::allocate_buffer<T>(sizeM * sizeN);
 
                 for (const auto& row : values)
                 {
@@ -82,7 +94,7 @@ namespace ml
                 sizeN = m.sizeN;
                 length = m.length;
 
-                data = std::make_unique<T[]>(length);
+                data = utils::allocate_buffer<T>(length, copy_tag(m));
                 std::copy(m.data.get(), m.data.get() + length, data.get());
             }
 
@@ -90,11 +102,13 @@ namespace ml
             {
                 if (this != &m)
                 {
+                    if (length != m.length || !data)
+                        data = utils::allocate_buffer<T>(m.length, copy_tag(m));
+
                     sizeM = m.sizeM;
                     sizeN = m.sizeN;
                     length = m.length;
 
-                    data = std::make_unique<T[]>(length);
                     std::copy(m.data.get(), m.data.get() + length, data.get());
                 }
 
@@ -147,6 +161,27 @@ namespace ml
                 return length;
             }
 
+            T* data_ptr()
+            {
+                return data.get();
+            }
+
+            const T* data_ptr() const
+            {
+                return data.get();
+            }
+
+            // the counter the storage is accounted under
+            utils::memory_tag tag() const
+            {
+                return data ? data.get_deleter().tag : utils::memory_tag::other;
+            }
+
+            const utils::allocator* storage_allocator() const
+            {
+                return data ? data.get_deleter().source : nullptr;
+            }
+
             void transpose()
             {
                 if ((sizeN == 0 && sizeM == 0) || (sizeN == 1 && sizeM == 1))
@@ -160,17 +195,40 @@ namespace ml
 
             matrix<T> transposed() const
             {
-                matrix<T> copy(*this);
-                copy.transpose();
-                return copy;
+                matrix<T> result;
+                transpose_to(result);
+                return result;
+            }
+
+            // Writes the transpose into dst, reusing its buffer when it already has the right length
+            void transpose_to(matrix<T>& dst) const
+            {
+                assert(&dst != this && "use transpose() to transpose in place");
+
+                utils::profile_scope profile("transpose", 0.0, 2.0 * sizeof(T) * length);
+
+                if (dst.length != length || !dst.data)
+                    dst.data = utils::allocate_buffer<T>(length);
+
+                dst.sizeM = sizeN;
+                dst.sizeN = sizeM;
+                dst.length = length;
+
+                transpose_kernels::transpose(data.get(), sizeN, dst.data.get(), sizeM, sizeM, sizeN);
             }
 
             matrix<T> elem_mul(matrix<T> m1)
             {
                 assert(m1.length == length && "matrix sizes are incompatible");
 
-                for (size_t i = 0; i < length; ++i)
-                    m1.data[i] *= data[i];
+                T* dst = m1.data.get();
+                const T* src = data.get();
+
+                for_each_chunk([dst, src](size_t first, size_t last)
+                {
+                    for (size_t i = first; i < last; ++i)
+                        dst[i] *= src[i];
+                });
 
                 return m1;
             }
@@ -185,10 +243,14 @@ namespace ml
             {
                 assert(sizeN == m.sizeN && sizeM == m.sizeM && "matrix sizes are incompatible");
 
-                for (size_t i = 0; i < length; ++i)
+                T* dst = data.get();
+                const T* src = m.data.get();
+
+                for_each_chunk([dst, src](size_t first, size_t last)
                 {
-                    data[i] += m.data[i];
-                }
+                    for (size_t i = first; i < last; ++i)
+                        dst[i] += src[i];
+                });
 
                 return *this;
             }
@@ -197,10 +259,14 @@ namespace ml
             {
                 assert(sizeN == m.size_n() && sizeM == m.size_m() && "matrix sizes are incompatible");
 
-                for (size_t i = 0; i < length; ++i)
+                T* dst = data.get();
+                const T* src = m.data.get();
+
+                for_each_chunk([dst, src](size_t first, size_t last)
                 {
-                    data[i] -= m.data[i];
-                }
+                    for (size_t i = first; i < last; ++i)
+                        dst[i] -= src[i];
+                });
 
                 return *this;
             }
@@ -208,10 +274,14 @@ namespace ml
             template<typename Number>
             matrix<T>& operator*=(const Number num)
             {
-                for (size_t i = 0; i < length; ++i)
+                T* dst = data.get();
+                const T value = static_cast<T>(num);
+
+                for_each_chunk([dst, value](size_t first, size_t last)
                 {
-                    data[i] *= static_cast<T>(num);
-                }
+                    for (size_t i = first; i < last; ++i)
+                        dst[i] *= value;
+                });
 
                 return *this;
             }
@@ -219,10 +289,14 @@ namespace ml
             template<typename Number>
             matrix<T>& operator/=(const Number num)
             {
-                for (size_t i = 0; i < length; ++i)
+                T* dst = data.get();
+                const T value = static_cast<T>(num);
+
+                for_each_chunk([dst, value](size_t first, size_t last)
                 {
-                    data[i] /= static_cast<T>(num);
-                }
+                    for (size_t i = first; i < last; ++i)
+                        dst[i] /= value;
+                });
 
                 return *this;
             }
@@ -231,26 +305,45 @@ namespace ml
             {
                 assert(sizeN == m.sizeM && "matrix sizes are incompatible");
 
+                utils::profile_scope profile("gemm", 2.0 * sizeM * sizeN * m.sizeN,
+                    static_cast<double>(sizeof(T)) * (sizeM * sizeN + m.sizeM * m.sizeN + sizeM * m.sizeN));
+
                 size_t sizeM1 = sizeM;
                 size_t sizeN1 = m.sizeN;
                 length = sizeM1 * sizeN1;
 
-                auto newData = std::make_unique<T[]>(length);
+                auto newData = utils::allocate_buffer<T>(length);
                 std::fill(newData.get(), newData.get() + length, static_cast<T>(0));
 
-                for (size_t i = 0; i < sizeM; ++i)
-                {
-                    T* c = newData.get() + i * sizeN1;
+                const T* lhs = data.get();
+                const T* rhs = m.data.get();
+                T* out = newData.get();
+                const size_t inner = sizeN;
 
-                    for (size_t k = 0; k < sizeN; ++k)
+                auto rows = [=](size_t first, size_t last)
+                {
+                    for (size_t i = first; i < last; ++i)
                     {
-                        const T* b = m.data.get() + k * sizeN1;
-                        T a = data[i * sizeN + k];
+                        T* c = out + i * sizeN1;
 
-                        for (size_t j = 0; j < sizeN1; ++j)
-                            c[j] += a * b[j];
+                        for (size_t k = 0; k < inner; ++k)
+                        {
+                            const T* b = rhs + k * sizeN1;
+                            T a = lhs[i * inner + k];
+
+                            for (size_t j = 0; j < sizeN1; ++j)
+                                c[j] += a * b[j];
+                        }
                     }
-                }
+                };
+
+                // rows of the result are independent, so large products are split into row blocks
+                const size_t row_work = std::max<size_t>(inner * sizeN1, 1);
+
+                if (sizeM * row_work >= parallel_gemm_work)
+                    utils::parallel_for(0, sizeM, std::max<size_t>(parallel_gemm_work / row_work, 1), rows);
+                else
+                    rows(0, sizeM);
 
                 std::swap(data, newData);
                 sizeN = sizeN1;
@@ -273,44 +366,44 @@ namespace ml
                 return temp;
             }
 
-            template <typename T>
-            friend bool operator==(const matrix<T>& m1, const matrix<T>& m2);
+            template <typename U>
+            friend bool operator==(const matrix<U>& m1, const matrix<U>& m2);
 
-            template <typename T>
-            friend bool operator!=(const matrix<T>& m1, const matrix<T>& m2);
+            template <typename U>
+            friend bool operator!=(const matrix<U>& m1, const matrix<U>& m2);
 
-            template <typename T>
-            friend matrix<T> operator*(matrix<T> m1, const matrix<T>& m2);
+            template <typename U>
+            friend matrix<U> operator*(matrix<U> m1, const matrix<U>& m2);
 
-            template<typename T, typename Number>
-            friend matrix<T> operator*(matrix<T> m, const Number n);
+            template <typename U, typename Number>
+            friend matrix<U> operator*(matrix<U> m, const Number n);
 
-            template<typename T, typename Number>
-            friend matrix<T> operator*(const Number num, matrix<T> m);
+            template <typename U, typename Number>
+            friend matrix<U> operator*(const Number num, matrix<U> m);
 
-            template<typename T, typename Number>
-            friend matrix<T> operator/(matrix<T> m, const Number num);
+            template <typename U, typename Number>
+            friend matrix<U> operator/(matrix<U> m, const Number num);
 
-            template <typename T>
-            friend matrix<T> operator+(matrix<T> m1, const matrix<T>& m2);
+            template <typename U>
+            friend matrix<U> operator+(matrix<U> m1, const matrix<U>& m2);
 
-            template <typename T>
-            friend matrix<T> operator-(matrix<T> m1, const matrix<T>& m2);
+            template <typename U>
+            friend matrix<U> operator-(matrix<U> m1, const matrix<U>& m2);
 
-            template<typename T, typename Number>
-            friend matrix<T> operator+(const Number num, const matrix<T>& m1);
+            template <typename U, typename Number>
+            friend matrix<U> operator+(const Number num, const matrix<U>& m1);
 
-            template<typename T, typename Number>
-            friend matrix<T> operator-(const Number num, const matrix<T>& m1);
+            template <typename U, typename Number>
+            friend matrix<U> operator-(const Number num, const matrix<U>& m1);
 
-            template<typename T, typename Number>
-            friend matrix<T> operator+(const matrix<T>& m1, const Number num);
+            template <typename U, typename Number>
+            friend matrix<U> operator+(const matrix<U>& m1, const Number num);
 
-            template<typename T, typename Number>
-            friend matrix<T> operator-(const matrix<T>& m1, const Number num);
+            template <typename U, typename Number>
+            friend matrix<U> operator-(const matrix<U>& m1, const Number num);
 
-            template <typename T>
-            friend std::ostream& operator<<(std::ostream& out, const matrix<T>& m);
+            template <typename U>
+            friend std::ostream& operator<<(std::ostream& out, const matrix<U>& m);
 
             iterator begin()
             {
@@ -353,39 +446,43 @@ namespace ml
             }
 
         private:
+            template<typename Fn>
+            void for_each_chunk(Fn&& fn) const
+            {
+                if (length >= parallel_elementwise_length)
+                    utils::parallel_for(0, length, parallel_elementwise_length / 4, fn);
+                else
+                    fn(0, length);
+            }
+
             void transpose_sqr()
             {
-                for (size_t m = 0; m < sizeM - 1; ++m)
-                {
-                    for (size_t n = m + 1; n < sizeN; ++n)
-                    {
-                        std::swap(data[m * sizeN + n], data[n * sizeN + m]);
-                    }
-                }
+                transpose_kernels::transpose_square(data.get(), sizeN, sizeN);
             }
 
             void transpose_rect()
             {
-                std::unique_ptr<T[]> newData = std::make_unique<T[]>(sizeM * sizeN);
+                auto newData = utils::allocate_buffer<T>(sizeM * sizeN, tag());
 
-                for (size_t m = 0; m < sizeM; ++m)
-                {
-                    for (size_t n = 0; n < sizeN; ++n)
-                    {
-                        newData[n * sizeM + m] = data[m * sizeN + n];
-                    }
-                }
+                transpose_kernels::transpose(data.get(), sizeN, newData.get(), sizeM, sizeM, sizeN);
 
                 std::swap(sizeM, sizeN);
                 std::swap(data, newData);
             }
 
+            // a copy keeps the tag of its source unless a memory_scope names one
+            static utils::memory_tag copy_tag(const matrix<T>& source)
+            {
+                const utils::memory_tag current = utils::memory_scope::current_tag();
+                return current == utils::memory_tag::other ? source.tag() : current;
+            }
+
         private:
             size_t sizeN;
             size_t sizeM;
             size_t length;
 
-            std::unique_ptr<T[]> data;
+            utils::buffer<T> data;
         };
 
         template <typename T>
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cassert>
+
+#include "matrix.h"
+
+namespace ml
+{
+    namespace math
+    {
+        // Block compressed sparse row matrix. Nonzero block_m x block_n blocks are stored densely,
+        // row-major inside the block; 1x1 blocks make it plain CSR. Blocks on the right and bottom
+        // edges are zero padded when the sizes are not multiples of the block shape.
+        template <typename T>
+        class bsr_matrix
+        {
+        public:
+            bsr_matrix() = default;
+
+            // keeps every block of m that has at least one nonzero element
+            explicit bsr_matrix(const matrix<T>& m, size_t block_m = 1, size_t block_n = 1)
+                : sizeM(m.size_m()), sizeN(m.size_n()), blockM(block_m), blockN(block_n)
+            {
+                assert(block_m > 0 && block_n > 0 && "invalid block shape");
+
+                const size_t block_rows = (sizeM + blockM - 1) / blockM;
+                const size_t block_cols = (sizeN + blockN - 1) / blockN;
+                const T* data = m.data_ptr();
+
+                row_ptr.reserve(block_rows + 1);
+                row_ptr.push_back(0);
+
+                for (size_t br = 0; br < block_rows; ++br)
+                {
+                    for (size_t bc = 0; bc < block_cols; ++bc)
+                    {
+                        if (!block_is_zero(data, br, bc))
+                        {
+                            col_idx.push_back(static_cast<uint32_t>(bc));
+
+                            for (size_t r = 0; r < blockM; ++r)
+                            {
+                                for (size_t c = 0; c < blockN; ++c)
+                                {
+                                    const size_t i = br * blockM + r;
+                                    const size_t j = bc * blockN + c;
+                                    values.push_back(i < sizeM && j < sizeN ? data[i * sizeN + j] : static_cast<T>(0));
+                                }
+                            }
+                        }
+                    }
+
+                    row_ptr.push_back(static_cast<uint32_t>(col_idx.size()));
+                }
+            }
+
+            bsr_matrix(size_t m, size_t n, size_t block_m, size_t block_n,
+                std::vector<uint32_t>&& rows, std::vector<uint32_t>&& cols, std::vector<T>&& vals)
+                : sizeM(m), sizeN(n), blockM(block_m), blockN(block_n),
+                  row_ptr(std::move(rows)), col_idx(std::move(cols)), values(std::move(vals))
+            { }
+
+            size_t size_m() const { return sizeM; }
+            size_t size_n() const { return sizeN; }
+            size_t block_m() const { return blockM; }
+            size_t block_n() const { return blockN; }
+            size_t blocks() const { return col_idx.size(); }
+
+            // fraction of blocks that are stored
+            float density() const
+            {
+                const size_t total = ((sizeM + blockM - 1) / blockM) * ((sizeN + blockN - 1) / blockN);
+                return total == 0 ? 0.f : static_cast<float>(col_idx.size()) / total;
+            }
+
+            const std::vector<uint32_t>& row_offsets() const { return row_ptr; }
+            const std::vector<uint32_t>& column_indices() const { return col_idx; }
+            const std::vector<T>& block_values() const { return values; }
+
+            matrix<T> to_dense() const
+            {
+                matrix<T> result(sizeM, sizeN);
+                T* out = result.data_ptr();
+
+                for (size_t br = 0; br + 1 < row_ptr.size(); ++br)
+                {
+                    for (uint32_t k = row_ptr[br]; k < row_ptr[br + 1]; ++k)
+                    {
+                        const T* block = values.data() + k * blockM * blockN;
+
+                        for (size_t r = 0; r < blockM && br * blockM + r < sizeM; ++r)
+                        {
+                            for (size_t c = 0; c < blockN && col_idx[k] * blockN + c < sizeN; ++c)
+                                out[(br * blockM + r) * sizeN + col_idx[k] * blockN + c] = block[r * blockN + c];
+                        }
+                    }
+                }
+
+                return result;
+            }
+
+            // this * x, where x holds one sample per column
+            matrix<T> multiply(const matrix<T>& x) const
+            {
+                assert(x.size_m() == sizeN && "matrix sizes are incompatible");
+
+                matrix<T> y(sizeM, x.size_n());
+
+                if (x.size_n() == 1)
+                    multiply_vector(x.data_ptr(), y.data_ptr());
+                else
+                    multiply_batch(x.data_ptr(), x.size_n(), y.data_ptr());
+
+                return y;
+            }
+
+        private:
+            bool block_is_zero(const T* data, size_t br, size_t bc) const
+            {
+                for (size_t i = br * blockM; i < std::min(sizeM, (br + 1) * blockM); ++i)
+                {
+                    for (size_t j = bc * blockN; j < std::min(sizeN, (bc + 1) * blockN); ++j)
+                    {
+                        if (data[i * sizeN + j] != static_cast<T>(0))
+                            return false;
+                    }
+                }
+
+                return true;
+            }
+
+            // single sample: each block row is a short dot product against a contiguous slice of x
+            void multiply_vector(const T* x, T* y) const
+            {
+                std::vector<T> acc(blockM);
+
+                for (size_t br = 0; br + 1 < row_ptr.size(); ++br)
+                {
+                    std::fill(acc.begin(), acc.end(), static_cast<T>(0));
+
+                    for (uint32_t k = row_ptr[br]; k < row_ptr[br + 1]; ++k)
+                    {
+                        const T* block = values.data() + k * blockM * blockN;
+                        const size_t col = col_idx[k] * blockN;
+                        const size_t cols = std::min(blockN, sizeN - col);
+
+                        for (size_t r = 0; r < blockM; ++r)
+                        {
+                            T sum = static_cast<T>(0);
+
+                            for (size_t c = 0; c < cols; ++c)
+                                sum += block[r * blockN + c] * x[col + c];
+
+                            acc[r] += sum;
+                        }
+                    }
+
+                    for (size_t r = 0; r < blockM && br * blockM + r < sizeM; ++r)
+                        y[br * blockM + r] = acc[r];
+                }
+            }
+
+            // batch: every stored weight scales a whole row of x, so the inner loop runs over samples
+            void multiply_batch(const T* x, size_t batch, T* y) const
+            {
+                for (size_t br = 0; br + 1 < row_ptr.size(); ++br)
+                {
+                    for (uint32_t k = row_ptr[br]; k < row_ptr[br + 1]; ++k)
+                    {
+                        const T* block = values.data() + k * blockM * blockN;
+                        const size_t col = col_idx[k] * blockN;
+
+                        for (size_t r = 0; r < blockM && br * blockM + r < sizeM; ++r)
+                        {
+                            T* out = y + (br * blockM + r) * batch;
+
+                            for (size_t c = 0; c < blockN && col + c < sizeN; ++c)
+                            {
+                                const T a = block[r * blockN + c];
+                                const T* in = x + (col + c) * batch;
+
+                                for (size_t j = 0; j < batch; ++j)
+                                    out[j] += a * in[j];
+                            }
+                        }
+                    }
+                }
+            }
+
+        private:
+            size_t sizeM = 0;
+            size_t sizeN = 0;
+            size_t blockM = 1;
+            size_t blockN = 1;
+
+            std::vector<uint32_t> row_ptr;
+            std::vector<uint32_t> col_idx;
+            std::vector<T> values;
+        };
+    }
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include "matrix.h"
+
+namespace ml
+{
+    namespace math
+    {
+        namespace detail
+        {
+            // Cyclic Jacobi eigen decomposition of a symmetric n x n matrix (row-major, modified in place).
+            // On return the diagonal of a holds the eigenvalues and the columns of vectors the eigenvectors.
+            inline void jacobi_eigen(std::vector<double>& a, size_t n, std::vector<double>& vectors, size_t max_sweeps = 60)
+            {
+                vectors.assign(n * n, 0.0);
+                for (size_t i = 0; i < n; ++i)
+                    vectors[i * n + i] = 1.0;
+
+                for (size_t sweep = 0; sweep < max_sweeps; ++sweep)
+                {
+                    double off = 0.0;
+                    double diag = 0.0;
+
+                    for (size_t p = 0; p < n; ++p)
+                    {
+                        diag += a[p * n + p] * a[p * n + p];
+
+                        for (size_t q = p + 1; q < n; ++q)
+                            off += a[p * n + q] * a[p * n + q];
+                    }
+
+                    if (off <= 1e-22 * diag)
+                        return;
+
+                    for (size_t p = 0; p + 1 < n; ++p)
+                    {
+                        for (size_t q = p + 1; q < n; ++q)
+                        {
+                            const double apq = a[p * n + q];
+                            if (std::fabs(apq) < 1e-300)
+                                continue;
+
+                            const double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+                            const double t = (theta >= 0 ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                            const double c = 1.0 / std::sqrt(t * t + 1.0);
+                            const double s = t * c;
+
+                            for (size_t k = 0; k < n; ++k)
+                            {
+                                const double akp = a[k * n + p];
+                                const double akq = a[k * n + q];
+                                a[k * n + p] = c * akp - s * akq;
+                                a[k * n + q] = s * akp + c * akq;
+                            }
+
+                            for (size_t k = 0; k < n; ++k)
+                            {
+                                const double apk = a[p * n + k];
+                                const double aqk = a[q * n + k];
+                                a[p * n + k] = c * apk - s * aqk;
+                                a[q * n + k] = s * apk + c * aqk;
+                            }
+
+                            for (size_t k = 0; k < n; ++k)
+                            {
+                                const double vkp = vectors[k * n + p];
+                                const double vkq = vectors[k * n + q];
+                                vectors[k * n + p] = c * vkp - s * vkq;
+                                vectors[k * n + q] = s * vkp + c * vkq;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        // Rank-r truncated SVD of a (m x n) in factored form: a ~= u * v, with u m x r and v r x n.
+        // The eigen decomposition runs on the smaller Gram matrix; the singular values end up folded
+        // into v when m <= n and into u otherwise. Returns the singular values in descending order.
+        template <typename T>
+        std::vector<double> truncated_svd(const matrix<T>& a, size_t rank, matrix<T>& u, matrix<T>& v)
+        {
+            const size_t m = a.size_m();
+            const size_t n = a.size_n();
+            const bool wide = m <= n;
+            const size_t k = wide ? m : n;
+            const T* data = a.data_ptr();
+
+            rank = std::min(rank, k);
+
+            std::vector<double> gram(k * k, 0.0);
+
+            for (size_t i = 0; i < k; ++i)
+            {
+                for (size_t j = i; j < k; ++j)
+                {
+                    double sum = 0.0;
+
+                    if (wide)
+                    {
+                        for (size_t l = 0; l < n; ++l)
+                            sum += static_cast<double>(data[i * n + l]) * data[j * n + l];
+                    }
+                    else
+                    {
+                        for (size_t l = 0; l < m; ++l)
+                            sum += static_cast<double>(data[l * n + i]) * data[l * n + j];
+                    }
+
+                    gram[i * k + j] = sum;
+                    gram[j * k + i] = sum;
+                }
+            }
+
+            std::vector<double> vectors;
+            detail::jacobi_eigen(gram, k, vectors);
+
+            std::vector<size_t> order(k);
+            std::iota(order.begin(), order.end(), size_t{ 0 });
+            std::sort(order.begin(), order.end(), [&](size_t x, size_t y) { return gram[x * k + x] > gram[y * k + y]; });
+
+            std::vector<double> singular(k);
+            for (size_t i = 0; i < k; ++i)
+                singular[i] = std::sqrt(std::max(0.0, gram[order[i] * k + order[i]]));
+
+            u = matrix<T>(m, rank);
+            v = matrix<T>(rank, n);
+
+            T* pu = u.data_ptr();
+            T* pv = v.data_ptr();
+
+            if (wide)
+            {
+                // u = E_r, v = E_r^T * a
+                for (size_t r = 0; r < rank; ++r)
+                {
+                    for (size_t i = 0; i < m; ++i)
+                        pu[i * rank + r] = static_cast<T>(vectors[i * k + order[r]]);
+
+                    for (size_t j = 0; j < n; ++j)
+                    {
+                        double sum = 0.0;
+
+                        for (size_t i = 0; i < m; ++i)
+                            sum += vectors[i * k + order[r]] * data[i * n + j];
+
+                        pv[r * n + j] = static_cast<T>(sum);
+                    }
+                }
+            }
+            else
+            {
+                // v = E_r^T, u = a * E_r
+                for (size_t r = 0; r < rank; ++r)
+                {
+                    for (size_t j = 0; j < n; ++j)
+                        pv[r * n + j] = static_cast<T>(vectors[j * k + order[r]]);
+
+                    for (size_t i = 0; i < m; ++i)
+                    {
+                        double sum = 0.0;
+
+                        for (size_t j = 0; j < n; ++j)
+                            sum += static_cast<double>(data[i * n + j]) * vectors[j * k + order[r]];
+
+                        pu[i * rank + r] = static_cast<T>(sum);
+                    }
+                }
+            }
+
+            return singular;
+        }
+    }
+}
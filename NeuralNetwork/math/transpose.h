@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define ML_TRANSPOSE_AVX
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define ML_TRANSPOSE_SSE
+#endif
+
+namespace ml
+{
+    namespace math
+    {
+        namespace transpose_kernels
+        {
+            // leaves of the recursion: a 16 x 16 float tile is 1 KB, so source and destination tiles stay in L1
+            constexpr size_t leaf_size = 16;
+
+            // splits a side near its middle on a multiple of 8, so most leaves are whole SIMD tiles
+            inline size_t split(size_t n)
+            {
+                const size_t half = (n / 2) & ~static_cast<size_t>(7);
+                return half != 0 ? half : n / 2;
+            }
+
+            template <typename T>
+            void transpose_leaf(const T* src, size_t src_stride, T* dst, size_t dst_stride, size_t rows, size_t cols)
+            {
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    for (size_t j = 0; j < cols; ++j)
+                        dst[j * dst_stride + i] = src[i * src_stride + j];
+                }
+            }
+
+#ifdef ML_TRANSPOSE_SSE
+            inline void transpose4x4(const float* src, size_t src_stride, float* dst, size_t dst_stride)
+            {
+                __m128 r0 = _mm_loadu_ps(src);
+                __m128 r1 = _mm_loadu_ps(src + src_stride);
+                __m128 r2 = _mm_loadu_ps(src + 2 * src_stride);
+                __m128 r3 = _mm_loadu_ps(src + 3 * src_stride);
+
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+                _mm_storeu_ps(dst, r0);
+                _mm_storeu_ps(dst + dst_stride, r1);
+                _mm_storeu_ps(dst + 2 * dst_stride, r2);
+                _mm_storeu_ps(dst + 3 * dst_stride, r3);
+            }
+#endif
+
+#ifdef ML_TRANSPOSE_AVX
+            inline void transpose8x8(const float* src, size_t src_stride, float* dst, size_t dst_stride)
+            {
+                __m256 r0 = _mm256_loadu_ps(src);
+                __m256 r1 = _mm256_loadu_ps(src + src_stride);
+                __m256 r2 = _mm256_loadu_ps(src + 2 * src_stride);
+                __m256 r3 = _mm256_loadu_ps(src + 3 * src_stride);
+                __m256 r4 = _mm256_loadu_ps(src + 4 * src_stride);
+                __m256 r5 = _mm256_loadu_ps(src + 5 * src_stride);
+                __m256 r6 = _mm256_loadu_ps(src + 6 * src_stride);
+                __m256 r7 = _mm256_loadu_ps(src + 7 * src_stride);
+
+                __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+                __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+                __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+                __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+                __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+                __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+                __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+                __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+                r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+                r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+                r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+                r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+                r4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+                r5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+                r6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+                r7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+                _mm256_storeu_ps(dst, _mm256_permute2f128_ps(r0, r4, 0x20));
+                _mm256_storeu_ps(dst + dst_stride, _mm256_permute2f128_ps(r1, r5, 0x20));
+                _mm256_storeu_ps(dst + 2 * dst_stride, _mm256_permute2f128_ps(r2, r6, 0x20));
+                _mm256_storeu_ps(dst + 3 * dst_stride, _mm256_permute2f128_ps(r3, r7, 0x20));
+                _mm256_storeu_ps(dst + 4 * dst_stride, _mm256_permute2f128_ps(r0, r4, 0x31));
+                _mm256_storeu_ps(dst + 5 * dst_stride, _mm256_permute2f128_ps(r1, r5, 0x31));
+                _mm256_storeu_ps(dst + 6 * dst_stride, _mm256_permute2f128_ps(r2, r6, 0x31));
+                _mm256_storeu_ps(dst + 7 * dst_stride, _mm256_permute2f128_ps(r3, r7, 0x31));
+            }
+#endif
+
+            inline void transpose_leaf(const float* src, size_t src_stride, float* dst, size_t dst_stride, size_t rows, size_t cols)
+            {
+                size_t i = 0;
+
+#if defined(ML_TRANSPOSE_AVX)
+                for (; i + 8 <= rows; i += 8)
+                {
+                    size_t j = 0;
+
+                    for (; j + 8 <= cols; j += 8)
+                        transpose8x8(src + i * src_stride + j, src_stride, dst + j * dst_stride + i, dst_stride);
+
+                    transpose_leaf<float>(src + i * src_stride + j, src_stride, dst + j * dst_stride + i, dst_stride, 8, cols - j);
+                }
+#elif defined(ML_TRANSPOSE_SSE)
+                for (; i + 4 <= rows; i += 4)
+                {
+                    size_t j = 0;
+
+                    for (; j + 4 <= cols; j += 4)
+                        transpose4x4(src + i * src_stride + j, src_stride, dst + j * dst_stride + i, dst_stride);
+
+                    transpose_leaf<float>(src + i * src_stride + j, src_stride, dst + j * dst_stride + i, dst_stride, 4, cols - j);
+                }
+#endif
+
+                transpose_leaf<float>(src + i * src_stride, src_stride, dst + i, dst_stride, rows - i, cols);
+            }
+
+            // Cache-oblivious out-of-place transpose: halves the longer side until the block is a leaf
+            template <typename T>
+            void transpose(const T* src, size_t src_stride, T* dst, size_t dst_stride, size_t rows, size_t cols)
+            {
+                if (rows <= leaf_size && cols <= leaf_size)
+                {
+                    transpose_leaf(src, src_stride, dst, dst_stride, rows, cols);
+                }
+                else if (rows >= cols)
+                {
+                    const size_t half = split(rows);
+                    transpose(src, src_stride, dst, dst_stride, half, cols);
+                    transpose(src + half * src_stride, src_stride, dst + half, dst_stride, rows - half, cols);
+                }
+                else
+                {
+                    const size_t half = split(cols);
+                    transpose(src, src_stride, dst, dst_stride, rows, half);
+                    transpose(src + half, src_stride, dst + half * dst_stride, dst_stride, rows, cols - half);
+                }
+            }
+
+            // Swaps block a (rows x cols) with the transpose of block b (cols x rows) of the same matrix
+            template <typename T>
+            void swap_transpose(T* a, T* b, size_t stride, size_t rows, size_t cols)
+            {
+                if (rows <= leaf_size && cols <= leaf_size)
+                {
+                    for (size_t i = 0; i < rows; ++i)
+                    {
+                        for (size_t j = 0; j < cols; ++j)
+                            std::swap(a[i * stride + j], b[j * stride + i]);
+                    }
+                }
+                else if (rows >= cols)
+                {
+                    const size_t half = split(rows);
+                    swap_transpose(a, b, stride, half, cols);
+                    swap_transpose(a + half * stride, b + half, stride, rows - half, cols);
+                }
+                else
+                {
+                    const size_t half = split(cols);
+                    swap_transpose(a, b, stride, rows, half);
+                    swap_transpose(a + half, b + half * stride, stride, rows, cols - half);
+                }
+            }
+
+#ifdef ML_TRANSPOSE_SSE
+            inline void swap_transpose(float* a, float* b, size_t stride, size_t rows, size_t cols)
+            {
+                if (rows <= leaf_size && cols <= leaf_size)
+                {
+                    const size_t rows4 = rows & ~static_cast<size_t>(3);
+                    const size_t cols4 = cols & ~static_cast<size_t>(3);
+
+                    for (size_t i = 0; i < rows4; i += 4)
+                    {
+                        for (size_t j = 0; j < cols4; j += 4)
+                        {
+                            float* pa = a + i * stride + j;
+                            float* pb = b + j * stride + i;
+
+                            __m128 a0 = _mm_loadu_ps(pa);
+                            __m128 a1 = _mm_loadu_ps(pa + stride);
+                            __m128 a2 = _mm_loadu_ps(pa + 2 * stride);
+                            __m128 a3 = _mm_loadu_ps(pa + 3 * stride);
+                            __m128 b0 = _mm_loadu_ps(pb);
+                            __m128 b1 = _mm_loadu_ps(pb + stride);
+                            __m128 b2 = _mm_loadu_ps(pb + 2 * stride);
+                            __m128 b3 = _mm_loadu_ps(pb + 3 * stride);
+
+                            _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+                            _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+
+                            _mm_storeu_ps(pb, a0);
+                            _mm_storeu_ps(pb + stride, a1);
+                            _mm_storeu_ps(pb + 2 * stride, a2);
+                            _mm_storeu_ps(pb + 3 * stride, a3);
+                            _mm_storeu_ps(pa, b0);
+                            _mm_storeu_ps(pa + stride, b1);
+                            _mm_storeu_ps(pa + 2 * stride, b2);
+                            _mm_storeu_ps(pa + 3 * stride, b3);
+                        }
+                    }
+
+                    // ragged right and bottom edges
+                    for (size_t i = 0; i < rows; ++i)
+                    {
+                        for (size_t j = (i < rows4 ? cols4 : 0); j < cols; ++j)
+                            std::swap(a[i * stride + j], b[j * stride + i]);
+                    }
+                }
+                else if (rows >= cols)
+                {
+                    const size_t half = split(rows);
+                    swap_transpose(a, b, stride, half, cols);
+                    swap_transpose(a + half * stride, b + half, stride, rows - half, cols);
+                }
+                else
+                {
+                    const size_t half = split(cols);
+                    swap_transpose(a, b, stride, rows, half);
+                    swap_transpose(a + half, b + half * stride, stride, rows, cols - half);
+                }
+            }
+#endif
+
+            // Cache-oblivious in-place transpose of the n x n block at a
+            template <typename T>
+            void transpose_square(T* a, size_t stride, size_t n)
+            {
+                if (n <= leaf_size)
+                {
+                    for (size_t i = 0; i + 1 < n; ++i)
+                    {
+                        for (size_t j = i + 1; j < n; ++j)
+                            std::swap(a[i * stride + j], a[j * stride + i]);
+                    }
+
+                    return;
+                }
+
+                const size_t half = split(n);
+
+                transpose_square(a, stride, half);
+                transpose_square(a + half * stride + half, stride, n - half);
+                swap_transpose(a + half, a + half * stride, stride, half, n - half);
+            }
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+#include "perceptron.h"
+#include "perceptron_async.h"
+#include "model_registry.h"
+#include "../utils/async.h"
+#include "../utils/async_file.h"
+#include "../utils/logger.h"
+
+namespace ml
+{
+    struct inference_result
+    {
+        // registry version that answered
+        uint64_t version = 0;
+        size_t label = 0;
+        float confidence = 0.f;
+        std::vector<float> outputs;
+    };
+
+    // Awaitable front end of a model_registry entry:
+    //
+    //     auto result = co_await engine.infer(input);
+    //     auto version = co_await engine.load_async("model.bin");
+    //
+    // Forward passes run on the executor's pool; the model reference is acquired and released there
+    // with no suspension in between, as model_ref requires. Loading reads the file through
+    // read_file_async and publishes it like model_registry::load, so inferences in flight finish on
+    // the version they started with. The engine must outlive its tasks.
+    class async_engine
+    {
+    public:
+        async_engine(model_registry& registry, std::string name, utils::executor& ex = utils::executor::shared())
+            : registry(registry), name(std::move(name)), ex(ex) {}
+
+        // Empty when nothing is published under the name, the input size does not match the model,
+        // or token was cancelled before the pass started
+        utils::task<std::optional<inference_result>> infer(std::vector<float> input, utils::cancellation_token token = {})
+        {
+            co_await ex.schedule();
+
+            if (token.cancelled())
+                co_return std::nullopt;
+
+            co_return infer_now(input);
+        }
+
+        // The published version, or empty if the file could not be loaded or token was cancelled
+        // before publishing
+        utils::task<std::optional<uint64_t>> load_async(std::string path, utils::cancellation_token token = {})
+        {
+            perceptron loaded;
+
+            if (!co_await ml::load_async(loaded, path, token, ex) || token.cancelled())
+                co_return std::nullopt;
+
+            co_return std::optional<uint64_t>(registry.publish_loaded(name, std::move(loaded), path));
+        }
+
+        const std::string& model_name() const
+        {
+            return name;
+        }
+
+    private:
+        std::optional<inference_result> infer_now(const std::vector<float>& input) const
+        {
+            const auto current = registry.acquire(name);
+            if (!current)
+                return std::nullopt;
+
+            const perceptron& model = current.model();
+
+            if (model.layer_count() == 0 || input.size() != model.layer(0).size_n())
+            {
+                utils::Logger::Error("async", name + ": input size " + std::to_string(input.size()) + " does not match the model");
+                return std::nullopt;
+            }
+
+            const auto outputs = model.forward(input);
+
+            inference_result result;
+            result.version = current->version;
+            result.outputs.assign(outputs.data_ptr(), outputs.data_ptr() + outputs.size());
+
+            for (size_t i = 1; i < result.outputs.size(); ++i)
+            {
+                if (result.outputs[i] > result.outputs[result.label])
+                    result.label = i;
+            }
+
+            result.confidence = result.outputs.empty() ? 0.f : result.outputs[result.label];
+            return result;
+        }
+
+        model_registry& registry;
+        const std::string name;
+        utils::executor& ex;
+    };
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include "perceptron.h"
+#include "model_file.h"
+#include "tuning_cache.h"
+#include "../math/matrix.h"
+#include "../utils/logger.h"
+#include "../utils/random.h"
+#include "../utils/thread_pool.h"
+
+namespace ml
+{
+    struct autotune_config
+    {
+        // batch sizes to tune; each tuning then serves from its batch size up to the next one
+        std::vector<size_t> batches = { 1, 8, 64, 256 };
+        // a candidate runs for rounds rounds of round_seconds each, its fastest round counting
+        double round_seconds = 0.02;
+        size_t rounds = 3;
+        // weights and inputs of the benchmark model
+        uint64_t seed = 1;
+    };
+
+    // Finds the fastest forward_tuning of a model shape on this machine by timing forward passes of a
+    // model of that shape with random weights; every candidate computes the same outputs, so only
+    // their speed is compared. Per batch size the parameters are searched one at a time from the
+    // defaults: the fused kernel's row block, its tile, its thread count, then the layered kernel
+    // against the best fused one. The kernel ISA is fixed at build time and is part of the host
+    // signature rather than a parameter.
+    class autotuner
+    {
+    public:
+        // fraction a candidate must gain over the best so far to replace it
+        static constexpr double min_gain = 0.02;
+
+        explicit autotuner(const autotune_config& config = autotune_config()) : config(config) {}
+
+        std::vector<tuning_entry> tune(const std::vector<size_t>& sizes) const
+        {
+            std::vector<tuning_entry> result;
+
+            if (sizes.size() < 2)
+                return result;
+
+            perceptron model(sizes, optim::optimizer_config(), config.seed);
+            const size_t pool = utils::thread_pool::instance().size();
+
+            for (size_t batch : config.batches)
+            {
+                batch = std::max<size_t>(batch, 1);
+
+                math::matrix<float> inputs(sizes.front(), batch);
+                utils::parallel_fill_normal(utils::counter_rng(config.seed, utils::rng_stream::shuffle), inputs.data_ptr(), inputs.size(), 0.5f, 0.2f);
+
+                tuning_entry entry;
+                entry.sizes = sizes;
+                entry.batch = batch;
+                entry.default_microseconds = measure(model, forward_tuning(), inputs);
+                entry.microseconds = entry.default_microseconds;
+
+                auto attempt = [&](const forward_tuning& candidate)
+                {
+                    const double time = measure(model, candidate, inputs);
+
+                    // differences within the timing noise keep the earlier, simpler choice
+                    if (time < entry.microseconds * (1.0 - min_gain))
+                    {
+                        entry.tuning = candidate;
+                        entry.microseconds = time;
+                    }
+                };
+
+                for (size_t rows : { 1, 2, 8 })
+                {
+                    forward_tuning candidate = entry.tuning;
+                    candidate.row_block = rows;
+                    attempt(candidate);
+                }
+
+                // a single sample is one tile on one thread whatever these are
+                if (batch > 1)
+                {
+                    const forward_tuning base = entry.tuning;
+
+                    for (size_t tile = 1; tile <= std::min(batch, perceptron::max_fused_tile); tile *= 2)
+                    {
+                        forward_tuning candidate = base;
+                        candidate.tile = tile;
+                        attempt(candidate);
+                    }
+
+                    const forward_tuning tiled = entry.tuning;
+
+                    for (size_t threads = 1; threads < pool; threads *= 2)
+                    {
+                        forward_tuning candidate = tiled;
+                        candidate.threads = threads;
+                        attempt(candidate);
+                    }
+                }
+
+                forward_tuning layered = entry.tuning;
+                layered.fused = false;
+                attempt(layered);
+
+                utils::Logger::Info("autotune", describe(entry));
+                result.push_back(std::move(entry));
+            }
+
+            return result;
+        }
+
+        // Tunes the shape of the model file at modelPath and merges the results into the tuning
+        // cache at cachePath, starting over if that cache is missing or stale
+        bool tune_model_file(const std::string& modelPath, const std::string& cachePath) const
+        {
+            std::vector<size_t> sizes;
+            if (!model_file::read_shape(modelPath, sizes))
+                return false;
+
+            tuning_cache cache;
+            cache.load(cachePath);
+
+            for (const auto& entry : tune(sizes))
+                cache.store(entry);
+
+            if (!cache.save(cachePath))
+            {
+                utils::Logger::Error("autotune", "could not write the tuning cache " + cachePath);
+                return false;
+            }
+
+            return true;
+        }
+
+        // "784-150-10 batch 64: fused, tile 32, 8 rows, 4 threads: 812.3 us, defaults 950.1 us"
+        static std::string describe(const tuning_entry& entry)
+        {
+            std::ostringstream out;
+
+            for (size_t i = 0; i < entry.sizes.size(); ++i)
+                out << (i ? "-" : "") << entry.sizes[i];
+
+            out << " batch " << entry.batch << ": ";
+
+            if (entry.tuning.fused)
+            {
+                out << "fused, tile " << (entry.tuning.tile ? std::to_string(entry.tuning.tile) : std::string("auto"))
+                    << ", " << entry.tuning.row_block << " rows";
+            }
+            else
+            {
+                out << "layered";
+            }
+
+            out << ", " << (entry.tuning.threads ? std::to_string(entry.tuning.threads) : std::string("all")) << " threads: "
+                << std::fixed << std::setprecision(1) << entry.microseconds << " us, defaults " << entry.default_microseconds << " us";
+
+            return out.str();
+        }
+
+    private:
+        // microseconds per forward_batch of inputs under tuning, the fastest of the rounds
+        double measure(perceptron& model, const forward_tuning& tuning, const math::matrix<float>& inputs) const
+        {
+            using clock = std::chrono::steady_clock;
+
+            model.clear_tuning();
+            model.set_tuning(tuning);
+            model.forward_batch(inputs);
+
+            double best = 0.0;
+
+            for (size_t round = 0; round < std::max<size_t>(config.rounds, 1); ++round)
+            {
+                const auto start = clock::now();
+                size_t calls = 0;
+                double elapsed = 0.0;
+
+                do
+                {
+                    model.forward_batch(inputs);
+                    ++calls;
+                    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+                } while (elapsed < config.round_seconds);
+
+                const double per_call = elapsed * 1e6 / static_cast<double>(calls);
+                if (round == 0 || per_call < best)
+                    best = per_call;
+            }
+
+            return best;
+        }
+
+        autotune_config config;
+    };
+}
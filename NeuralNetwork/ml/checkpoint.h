@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "perceptron.h"
+#include "model_file.h"
+#include "../utils/atomic_file.h"
+#include "../utils/memory_stream.h"
+
+namespace ml
+{
+    // Writes perceptron checkpoints on a background thread.
+    // submit() only copies the weights into a spare snapshot; serialization, the CRCs and the
+    // atomic file replacement happen on the writer thread. If a checkpoint is still being written
+    // when the next one is submitted, the pending one is overwritten, so at most one write is queued.
+    class checkpoint_writer
+    {
+    public:
+        explicit checkpoint_writer(std::string fileName)
+            : fileName(std::move(fileName)), worker([this] { run(); })
+        { }
+
+        ~checkpoint_writer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+
+            wake.notify_all();
+            worker.join();
+        }
+
+        checkpoint_writer(const checkpoint_writer&) = delete;
+        checkpoint_writer& operator=(const checkpoint_writer&) = delete;
+
+        void submit(const perceptron& model)
+        {
+            model.snapshot(back);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::swap(back, pending);
+                has_pending = true;
+            }
+
+            wake.notify_all();
+        }
+
+        // Blocks until every submitted checkpoint is on disk; returns false if any write failed since the last call
+        bool flush()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return !has_pending && !writing; });
+
+            bool result = !failed;
+            failed = false;
+            return result;
+        }
+
+    private:
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while (true)
+            {
+                wake.wait(lock, [this] { return has_pending || stopping; });
+
+                if (!has_pending)
+                    break;
+
+                std::swap(pending, writing_snapshot);
+                has_pending = false;
+                writing = true;
+
+                lock.unlock();
+
+                model_file::serialize(writing_snapshot, buffer);
+                bool written = utils::write_file_atomic(fileName, buffer.data(), buffer.size());
+
+                lock.lock();
+
+                writing = false;
+                failed = failed || !written;
+                done.notify_all();
+            }
+        }
+
+    private:
+        const std::string fileName;
+
+        // back is filled by the training thread, pending waits for the writer, writing_snapshot is on its way to disk
+        model_snapshot back;
+        model_snapshot pending;
+        model_snapshot writing_snapshot;
+        utils::memory_stream buffer;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        bool has_pending = false;
+        bool writing = false;
+        bool stopping = false;
+        bool failed = false;
+
+        std::thread worker;
+    };
+}
@@ -0,0 +1,853 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "model_file.h"
+#include "optimizer.h"
+#include "../math/matrix.h"
+#include "../math/im2col.h"
+#include "../math/functions.h"
+#include "../utils/atomic_file.h"
+#include "../utils/logger.h"
+#include "../utils/memory.h"
+#include "../utils/memory_stream.h"
+#include "../utils/random.h"
+#include "../utils/thread_pool.h"
+
+namespace ml
+{
+    // Memory order of a batch of images handed to convnet::forward_images
+    enum class tensor_layout
+    {
+        nchw,
+        nhwc
+    };
+
+    namespace layers
+    {
+        inline layer_spec conv2d(uint32_t out_channels, uint32_t kernel, uint32_t stride = 1, uint32_t padding = 0,
+            activation_kind activation = activation_kind::relu)
+        {
+            return { layer_kind::conv2d, activation, out_channels, kernel, stride, padding };
+        }
+
+        // stride 0 means non-overlapping windows (stride = size)
+        inline layer_spec max_pool(uint32_t size, uint32_t stride = 0)
+        {
+            return { layer_kind::max_pool, activation_kind::identity, 0, size, stride != 0 ? stride : size, 0 };
+        }
+
+        inline layer_spec avg_pool(uint32_t size, uint32_t stride = 0)
+        {
+            return { layer_kind::avg_pool, activation_kind::identity, 0, size, stride != 0 ? stride : size, 0 };
+        }
+
+        inline layer_spec flatten()
+        {
+            return { layer_kind::flatten, activation_kind::identity, 0, 0, 1, 0 };
+        }
+
+        inline layer_spec dense(uint32_t units, activation_kind activation = activation_kind::sigmoid)
+        {
+            return { layer_kind::dense, activation, units, 0, 1, 0 };
+        }
+    }
+
+    // Convolutional network: conv2d, pooling and flatten layers followed by dense layers, trained
+    // with the same squared error, optimizers and batch conventions as perceptron (inputs and
+    // outputs hold one sample per column, pixels in CHW order), so trainer and make_batch work
+    // unchanged.
+    //
+    // Between spatial layers a batch is kept channel-major (CNHW, one row per channel), which turns
+    // every convolution into one GEMM over the im2col matrix and its backward pass into two GEMMs
+    // and a col2im. Convolution and dense layers have a bias per output.
+    class convnet
+    {
+    public:
+        convnet() {}
+
+        convnet(uint32_t channels, uint32_t height, uint32_t width, const std::vector<layer_spec>& specs,
+            const optim::optimizer_config& config, uint64_t seed = utils::random_seed())
+        {
+            network_topology topology;
+            topology.channels = channels;
+            topology.height = height;
+            topology.width = width;
+            topology.layers = specs;
+
+            if (!configure(topology))
+                return;
+
+            optimizer = optim::optimizer(config);
+            weight_initialization(seed);
+        }
+
+        size_t layer_count() const
+        {
+            return net.layers.size();
+        }
+
+        const network_topology& topology() const
+        {
+            return net;
+        }
+
+        size_t input_size() const
+        {
+            return shapes.empty() ? 0 : shapes.front().size();
+        }
+
+        size_t output_size() const
+        {
+            return shapes.empty() ? 0 : shapes.back().size();
+        }
+
+        size_t parameter_count() const
+        {
+            size_t count = 0;
+            for (const auto& p : params)
+                count += p.size();
+
+            return count;
+        }
+
+        uint64_t seed() const
+        {
+            return initial_seed;
+        }
+
+        void set_optimizer(const optim::optimizer_config& config)
+        {
+            optimizer = optim::optimizer(config);
+        }
+
+        const optim::optimizer& get_optimizer() const
+        {
+            return optimizer;
+        }
+
+        // inputs hold one sample per column (CHW order), the result one output per column
+        math::matrix<float> forward_batch(const math::matrix<float>& inputs) const
+        {
+            return run(to_first_layer(inputs), inputs.size_n(), nullptr);
+        }
+
+        // count images of input shape stored back to back in layout
+        math::matrix<float> forward_images(const float* images, size_t count, tensor_layout layout) const
+        {
+            if (shapes.empty() || count == 0)
+                return math::matrix<float>();
+
+            const shape& in = shapes.front();
+            const size_t plane = in.height * in.width;
+            math::matrix<float> spatial(in.channels, count * plane);
+            float* dst = spatial.data_ptr();
+
+            utils::parallel_for(0, in.channels, 1, [&](size_t first, size_t last)
+            {
+                for (size_t c = first; c < last; ++c)
+                {
+                    for (size_t n = 0; n < count; ++n)
+                    {
+                        float* out = dst + (c * count + n) * plane;
+
+                        if (layout == tensor_layout::nchw)
+                        {
+                            const float* src = images + (n * in.channels + c) * plane;
+                            std::copy(src, src + plane, out);
+                        }
+                        else
+                        {
+                            const float* src = images + n * plane * in.channels + c;
+                            for (size_t p = 0; p < plane; ++p)
+                                out[p] = src[p * in.channels];
+                        }
+                    }
+                }
+            });
+
+            return run(std::move(spatial), count, nullptr);
+        }
+
+        void train_batch(const math::matrix<float>& inputs, const math::matrix<float>& targets)
+        {
+            compute_gradients(inputs, targets, gradients);
+            apply_gradients(gradients);
+        }
+
+        void apply_gradients(const std::vector<math::matrix<float>>& grads)
+        {
+            optimizer.step(params, grads);
+        }
+
+        // Gradients of the squared error averaged over the batch, one matrix per parameter
+        // (weights, then bias, of every convolution and dense layer in order)
+        void compute_gradients(const math::matrix<float>& inputs, const math::matrix<float>& targets,
+            std::vector<math::matrix<float>>& grads) const
+        {
+            const size_t batch = inputs.size_n();
+
+            trace t;
+            t.outputs.resize(net.layers.size() + 1);
+            t.cols.resize(net.layers.size());
+            t.argmax.resize(net.layers.size());
+
+            t.outputs.back() = run(to_first_layer(inputs), batch, &t);
+
+            const float scale = 1.f / static_cast<float>(batch);
+            math::matrix<float> delta = t.outputs.back() - targets;
+
+            grads.resize(params.size());
+            utils::memory_scope scope(utils::memory_tag::gradients);
+
+            for (size_t i = net.layers.size(); i-- > 0; )
+            {
+                const layer_spec& spec = net.layers[i];
+                const math::matrix<float>& x = t.outputs[i];
+                const bool need_input_delta = i > 0;
+
+                switch (spec.kind)
+                {
+                case layer_kind::conv2d:
+                case layer_kind::dense:
+                {
+                    activation_derivative(spec.activation, t.outputs[i + 1], delta);
+
+                    const size_t p = first_param[i];
+                    const math::matrix<float>& source = spec.kind == layer_kind::conv2d ? t.cols[i] : x;
+
+                    grads[p] = delta * source.transposed();
+                    grads[p] *= scale;
+                    grads[p + 1] = row_sums(delta, scale);
+
+                    if (!need_input_delta)
+                        break;
+
+                    auto back = params[p].transposed() * delta;
+
+                    if (spec.kind == layer_kind::dense)
+                    {
+                        delta = std::move(back);
+                        break;
+                    }
+
+                    math::matrix<float> dx(x.size_m(), x.size_n());
+                    math::col2im(back.data_ptr(), batch, geometry(i), dx.data_ptr());
+                    delta = std::move(dx);
+                    break;
+                }
+
+                case layer_kind::max_pool:
+                {
+                    if (!need_input_delta)
+                        break;
+
+                    math::matrix<float> dx(x.size_m(), x.size_n());
+                    const auto& indices = t.argmax[i];
+                    const float* d = delta.data_ptr();
+                    float* out = dx.data_ptr();
+
+                    // windows of one row (channel) only reach that row, so rows run in parallel
+                    const size_t row = delta.size_n();
+                    utils::parallel_for(0, delta.size_m(), 1, [&](size_t first, size_t last)
+                    {
+                        for (size_t k = first * row; k < last * row; ++k)
+                            out[indices[k]] += d[k];
+                    });
+
+                    delta = std::move(dx);
+                    break;
+                }
+
+                case layer_kind::avg_pool:
+                {
+                    if (!need_input_delta)
+                        break;
+
+                    math::matrix<float> dx(x.size_m(), x.size_n());
+                    pool_backward_average(i, batch, delta, dx);
+                    delta = std::move(dx);
+                    break;
+                }
+
+                case layer_kind::flatten:
+                {
+                    if (need_input_delta)
+                        delta = columns_to_spatial(delta, shapes[i]);
+                    break;
+                }
+                }
+            }
+        }
+
+        // Copies the weights into snapshot, reusing its buffers when the shapes match
+        void snapshot(model_snapshot& snapshot) const
+        {
+            snapshot.learning_rate = optimizer.config().learning_rate;
+            snapshot.layers.resize(params.size());
+
+            for (size_t i = 0; i < params.size(); ++i)
+                snapshot.layers[i] = params[i];
+
+            snapshot.formats.assign(params.size(), layer_format{});
+            snapshot.factors.assign(params.size(), std::nullopt);
+            snapshot.optimizer = optimizer;
+            snapshot.seed = initial_seed;
+            snapshot.topology = net;
+        }
+
+        // Takes the weights over from snapshot; its buffers are left with the previous weights
+        void restore(model_snapshot& snapshot)
+        {
+            adopt(snapshot);
+        }
+
+        bool save(const std::string& fileName) const
+        {
+            model_snapshot current;
+            snapshot(current);
+
+            utils::memory_stream out;
+            model_file::serialize(current, out);
+
+            return utils::write_file_atomic(fileName, out.data(), out.size());
+        }
+
+        bool load(const std::string& fileName)
+        {
+            std::vector<char> bytes;
+
+            if (!utils::read_file(fileName, bytes))
+                return false;
+
+            utils::memory_stream in(std::move(bytes));
+            model_snapshot loaded;
+            bool parsed = false;
+
+            {
+                utils::memory_scope scope(utils::memory_tag::weights);
+                parsed = model_file::deserialize(in, loaded);
+            }
+
+            if (!parsed)
+            {
+                utils::Logger::Error("convnet", "could not load model: " + fileName);
+                return false;
+            }
+
+            if (loaded.topology.empty())
+            {
+                utils::Logger::Error("convnet", "model file holds no network topology: " + fileName);
+                return false;
+            }
+
+            return adopt(loaded);
+        }
+
+    private:
+        // channels x height x width of a spatial tensor, or a flat vector of `channels` features
+        struct shape
+        {
+            size_t channels = 0;
+            size_t height = 1;
+            size_t width = 1;
+            bool flat = false;
+
+            size_t size() const
+            {
+                return channels * height * width;
+            }
+        };
+
+        // what backward needs from the forward pass
+        struct trace
+        {
+            std::vector<math::matrix<float>> outputs;
+            std::vector<math::matrix<float>> cols;
+            std::vector<std::vector<uint32_t>> argmax;
+        };
+
+        static constexpr size_t no_params = std::numeric_limits<size_t>::max();
+
+        // Validates topology and derives the layer shapes and parameter layout; no weights are touched
+        bool configure(const network_topology& topology)
+        {
+            std::vector<shape> derived;
+            std::vector<size_t> param_index;
+            std::vector<std::pair<size_t, size_t>> param_shapes;
+
+            shape current;
+            current.channels = topology.channels;
+            current.height = topology.height;
+            current.width = topology.width;
+            derived.push_back(current);
+
+            auto fail = [&](size_t layer, const std::string& message)
+            {
+                utils::Logger::Error("convnet", "layer " + std::to_string(layer) + ": " + message);
+                return false;
+            };
+
+            if (current.size() == 0 || topology.layers.empty())
+                return fail(0, "empty input shape or no layers");
+
+            for (size_t i = 0; i < topology.layers.size(); ++i)
+            {
+                const layer_spec& spec = topology.layers[i];
+                shape next;
+                param_index.push_back(no_params);
+
+                switch (spec.kind)
+                {
+                case layer_kind::conv2d:
+                case layer_kind::max_pool:
+                case layer_kind::avg_pool:
+                {
+                    if (current.flat)
+                        return fail(i, "spatial layer after flatten");
+
+                    math::conv_geometry g = make_geometry(current, spec);
+                    if (!g.valid())
+                        return fail(i, "kernel does not fit the input");
+
+                    if (spec.kind == layer_kind::conv2d)
+                    {
+                        if (spec.units == 0)
+                            return fail(i, "convolution without output channels");
+
+                        param_index.back() = param_shapes.size();
+                        param_shapes.emplace_back(spec.units, g.patch());
+                        param_shapes.emplace_back(spec.units, 1);
+                    }
+
+                    next.channels = spec.kind == layer_kind::conv2d ? spec.units : current.channels;
+                    next.height = g.out_height();
+                    next.width = g.out_width();
+                    break;
+                }
+
+                case layer_kind::flatten:
+                    next.channels = current.size();
+                    next.flat = true;
+                    break;
+
+                case layer_kind::dense:
+                    if (!current.flat)
+                        return fail(i, "dense layer needs a flatten before it");
+
+                    if (spec.units == 0)
+                        return fail(i, "dense layer without units");
+
+                    param_index.back() = param_shapes.size();
+                    param_shapes.emplace_back(spec.units, current.size());
+                    param_shapes.emplace_back(spec.units, 1);
+
+                    next.channels = spec.units;
+                    next.flat = true;
+                    break;
+
+                default:
+                    return fail(i, "unknown layer kind");
+                }
+
+                derived.push_back(next);
+                current = next;
+            }
+
+            if (!current.flat)
+                return fail(topology.layers.size() - 1, "the network must end with a flatten or dense layer");
+
+            net = topology;
+            shapes = std::move(derived);
+            first_param = std::move(param_index);
+
+            utils::memory_scope scope(utils::memory_tag::weights);
+
+            params.clear();
+            for (const auto& [m, n] : param_shapes)
+                params.emplace_back(m, n);
+
+            return true;
+        }
+
+        // Normal weights scaled by fan-in (He for relu), parameter p from stream weights + p; zero biases
+        void weight_initialization(uint64_t seed)
+        {
+            initial_seed = seed;
+
+            for (size_t i = 0; i < net.layers.size(); ++i)
+            {
+                if (first_param[i] == no_params)
+                    continue;
+
+                const size_t p = first_param[i];
+                const float fan_in = static_cast<float>(params[p].size_n());
+                const float std_dev = net.layers[i].activation == activation_kind::relu ? std::sqrt(2.f / fan_in) : 1.f / std::sqrt(fan_in);
+
+                utils::parallel_fill_normal(utils::counter_rng(seed, utils::rng_stream::weights + p), params[p].data_ptr(), params[p].size(), 0.f, std_dev);
+                std::fill(params[p + 1].begin(), params[p + 1].end(), 0.f);
+            }
+        }
+
+        bool adopt(model_snapshot& snapshot)
+        {
+            convnet candidate;
+
+            if (!candidate.configure(snapshot.topology))
+                return false;
+
+            if (candidate.params.size() != snapshot.layers.size())
+            {
+                utils::Logger::Error("convnet", "parameter count does not match the topology");
+                return false;
+            }
+
+            for (size_t i = 0; i < candidate.params.size(); ++i)
+            {
+                if (candidate.params[i].size_m() != snapshot.layers[i].size_m() || candidate.params[i].size_n() != snapshot.layers[i].size_n())
+                {
+                    utils::Logger::Error("convnet", "parameter " + std::to_string(i) + " does not match the topology");
+                    return false;
+                }
+            }
+
+            net = std::move(candidate.net);
+            shapes = std::move(candidate.shapes);
+            first_param = std::move(candidate.first_param);
+
+            std::swap(params, snapshot.layers);
+            std::swap(optimizer, snapshot.optimizer);
+            std::swap(initial_seed, snapshot.seed);
+
+            if (!optimizer.fits(params))
+            {
+                utils::Logger::Warning("convnet", "optimizer state does not match the parameters, starting it over");
+                optimizer.reset();
+            }
+
+            return true;
+        }
+
+        static math::conv_geometry make_geometry(const shape& in, const layer_spec& spec)
+        {
+            math::conv_geometry g;
+            g.channels = in.channels;
+            g.height = in.height;
+            g.width = in.width;
+            g.kernel = spec.kernel;
+            g.stride = spec.stride;
+            g.padding = spec.padding;
+            return g;
+        }
+
+        math::conv_geometry geometry(size_t layer) const
+        {
+            return make_geometry(shapes[layer], net.layers[layer]);
+        }
+
+        math::matrix<float> to_first_layer(const math::matrix<float>& inputs) const
+        {
+            return shapes.front().flat ? inputs : columns_to_spatial(inputs, shapes.front());
+        }
+
+        // (C * H * W) x N, one sample per column -> C x (N * H * W)
+        static math::matrix<float> columns_to_spatial(const math::matrix<float>& columns, const shape& s)
+        {
+            const size_t batch = columns.size_n();
+            const size_t plane = s.height * s.width;
+            math::matrix<float> spatial(s.channels, batch * plane);
+
+            const float* src = columns.data_ptr();
+            float* dst = spatial.data_ptr();
+
+            utils::parallel_for(0, s.channels, 1, [&](size_t first, size_t last)
+            {
+                for (size_t c = first; c < last; ++c)
+                {
+                    for (size_t p = 0; p < plane; ++p)
+                    {
+                        const float* in = src + (c * plane + p) * batch;
+                        for (size_t n = 0; n < batch; ++n)
+                            dst[(c * batch + n) * plane + p] = in[n];
+                    }
+                }
+            });
+
+            return spatial;
+        }
+
+        static math::matrix<float> spatial_to_columns(const math::matrix<float>& spatial, const shape& s, size_t batch)
+        {
+            const size_t plane = s.height * s.width;
+            math::matrix<float> columns(s.channels * plane, batch);
+
+            const float* src = spatial.data_ptr();
+            float* dst = columns.data_ptr();
+
+            utils::parallel_for(0, s.channels, 1, [&](size_t first, size_t last)
+            {
+                for (size_t c = first; c < last; ++c)
+                {
+                    for (size_t p = 0; p < plane; ++p)
+                    {
+                        float* out = dst + (c * plane + p) * batch;
+                        for (size_t n = 0; n < batch; ++n)
+                            out[n] = src[(c * batch + n) * plane + p];
+                    }
+                }
+            });
+
+            return columns;
+        }
+
+        static void activate(activation_kind activation, math::matrix<float>& values)
+        {
+            float* v = values.data_ptr();
+            const size_t n = values.size();
+
+            switch (activation)
+            {
+            case activation_kind::sigmoid:
+                for (size_t i = 0; i < n; ++i)
+                    v[i] = function::sigmoid_function(v[i]);
+                break;
+
+            case activation_kind::relu:
+                for (size_t i = 0; i < n; ++i)
+                    v[i] = std::max(v[i], 0.f);
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        // delta *= f'(z), written in terms of the activation's output y
+        static void activation_derivative(activation_kind activation, const math::matrix<float>& outputs, math::matrix<float>& delta)
+        {
+            const float* y = outputs.data_ptr();
+            float* d = delta.data_ptr();
+            const size_t n = delta.size();
+
+            switch (activation)
+            {
+            case activation_kind::sigmoid:
+                for (size_t i = 0; i < n; ++i)
+                    d[i] *= y[i] * (1.f - y[i]);
+                break;
+
+            case activation_kind::relu:
+                for (size_t i = 0; i < n; ++i)
+                    d[i] = y[i] > 0.f ? d[i] : 0.f;
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        static void add_bias(math::matrix<float>& values, const math::matrix<float>& bias)
+        {
+            float* v = values.data_ptr();
+            const size_t row = values.size_n();
+
+            for (size_t r = 0; r < values.size_m(); ++r)
+            {
+                const float b = bias.data_ptr()[r];
+                for (size_t k = 0; k < row; ++k)
+                    v[r * row + k] += b;
+            }
+        }
+
+        static math::matrix<float> row_sums(const math::matrix<float>& values, float scale)
+        {
+            math::matrix<float> sums(values.size_m(), 1);
+            const float* v = values.data_ptr();
+            const size_t row = values.size_n();
+
+            for (size_t r = 0; r < values.size_m(); ++r)
+            {
+                double sum = 0.0;
+                for (size_t k = 0; k < row; ++k)
+                    sum += v[r * row + k];
+
+                sums.data_ptr()[r] = static_cast<float>(sum) * scale;
+            }
+
+            return sums;
+        }
+
+        // Forward pass from the first layer's input representation; records what backward needs in t
+        math::matrix<float> run(math::matrix<float> input, size_t batch, trace* t) const
+        {
+            utils::memory_scope scope(utils::memory_tag::activations);
+
+            for (size_t i = 0; i < net.layers.size(); ++i)
+            {
+                const layer_spec& spec = net.layers[i];
+                math::matrix<float> output;
+
+                switch (spec.kind)
+                {
+                case layer_kind::conv2d:
+                {
+                    const auto g = geometry(i);
+                    math::matrix<float> cols(g.patch(), batch * g.out_height() * g.out_width());
+                    math::im2col(input.data_ptr(), batch, g, cols.data_ptr());
+
+                    output = params[first_param[i]] * cols;
+                    add_bias(output, params[first_param[i] + 1]);
+                    activate(spec.activation, output);
+
+                    if (t)
+                        t->cols[i] = std::move(cols);
+                    break;
+                }
+
+                case layer_kind::dense:
+                    output = params[first_param[i]] * input;
+                    add_bias(output, params[first_param[i] + 1]);
+                    activate(spec.activation, output);
+                    break;
+
+                case layer_kind::max_pool:
+                case layer_kind::avg_pool:
+                    output = pool_forward(i, batch, input, t ? &t->argmax[i] : nullptr);
+                    break;
+
+                case layer_kind::flatten:
+                    output = spatial_to_columns(input, shapes[i], batch);
+                    break;
+                }
+
+                if (t)
+                    t->outputs[i] = std::move(input);
+
+                input = std::move(output);
+            }
+
+            return input;
+        }
+
+        math::matrix<float> pool_forward(size_t layer, size_t batch, const math::matrix<float>& input, std::vector<uint32_t>* argmax) const
+        {
+            const auto g = geometry(layer);
+            const bool max = net.layers[layer].kind == layer_kind::max_pool;
+            const size_t oh = g.out_height();
+            const size_t ow = g.out_width();
+            const size_t plane = g.height * g.width;
+            const float area = static_cast<float>(g.kernel * g.kernel);
+
+            math::matrix<float> output(g.channels, batch * oh * ow);
+            if (argmax)
+                argmax->assign(output.size(), 0);
+
+            const float* src = input.data_ptr();
+            float* dst = output.data_ptr();
+
+            utils::parallel_for(0, g.channels * batch, 1, [&](size_t first, size_t last)
+            {
+                for (size_t image = first; image < last; ++image)
+                {
+                    const float* in = src + image * plane;
+
+                    for (size_t oy = 0; oy < oh; ++oy)
+                    {
+                        for (size_t ox = 0; ox < ow; ++ox)
+                        {
+                            const size_t out_index = (image * oh + oy) * ow + ox;
+                            float best = -std::numeric_limits<float>::infinity();
+                            size_t best_index = 0;
+                            float sum = 0.f;
+
+                            for (size_t ky = 0; ky < g.kernel; ++ky)
+                            {
+                                const ptrdiff_t y = static_cast<ptrdiff_t>(oy * g.stride + ky) - static_cast<ptrdiff_t>(g.padding);
+                                if (y < 0 || y >= static_cast<ptrdiff_t>(g.height))
+                                    continue;
+
+                                for (size_t kx = 0; kx < g.kernel; ++kx)
+                                {
+                                    const ptrdiff_t x = static_cast<ptrdiff_t>(ox * g.stride + kx) - static_cast<ptrdiff_t>(g.padding);
+                                    if (x < 0 || x >= static_cast<ptrdiff_t>(g.width))
+                                        continue;
+
+                                    const float v = in[y * g.width + x];
+                                    sum += v;
+
+                                    if (v > best)
+                                    {
+                                        best = v;
+                                        best_index = image * plane + y * g.width + x;
+                                    }
+                                }
+                            }
+
+                            dst[out_index] = max ? best : sum / area;
+
+                            if (argmax)
+                                (*argmax)[out_index] = static_cast<uint32_t>(best_index);
+                        }
+                    }
+                }
+            });
+
+            return output;
+        }
+
+        void pool_backward_average(size_t layer, size_t batch, const math::matrix<float>& delta, math::matrix<float>& dx) const
+        {
+            const auto g = geometry(layer);
+            const size_t oh = g.out_height();
+            const size_t ow = g.out_width();
+            const size_t plane = g.height * g.width;
+            const float inv_area = 1.f / static_cast<float>(g.kernel * g.kernel);
+
+            const float* d = delta.data_ptr();
+            float* out = dx.data_ptr();
+
+            utils::parallel_for(0, g.channels * batch, 1, [&](size_t first, size_t last)
+            {
+                for (size_t image = first; image < last; ++image)
+                {
+                    float* in = out + image * plane;
+
+                    for (size_t oy = 0; oy < oh; ++oy)
+                    {
+                        for (size_t ox = 0; ox < ow; ++ox)
+                        {
+                            const float share = d[(image * oh + oy) * ow + ox] * inv_area;
+
+                            for (size_t ky = 0; ky < g.kernel; ++ky)
+                            {
+                                const ptrdiff_t y = static_cast<ptrdiff_t>(oy * g.stride + ky) - static_cast<ptrdiff_t>(g.padding);
+                                if (y < 0 || y >= static_cast<ptrdiff_t>(g.height))
+                                    continue;
+
+                                for (size_t kx = 0; kx < g.kernel; ++kx)
+                                {
+                                    const ptrdiff_t x = static_cast<ptrdiff_t>(ox * g.stride + kx) - static_cast<ptrdiff_t>(g.padding);
+                                    if (x >= 0 && x < static_cast<ptrdiff_t>(g.width))
+                                        in[y * g.width + x] += share;
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        network_topology net;
+        std::vector<shape> shapes;
+        std::vector<size_t> first_param;
+        std::vector<math::matrix<float>> params;
+        std::vector<math::matrix<float>> gradients;
+        optim::optimizer optimizer;
+        uint64_t initial_seed = 0;
+    };
+}
@@ -0,0 +1,518 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <condition_variable>
+
+#include "perceptron.h"
+#include "trainer.h"
+#include "model_file.h"
+#include "../utils/socket.h"
+#include "../utils/logger.h"
+#include "../utils/random.h"
+#include "../utils/mnist/mnist.h"
+
+namespace ml
+{
+    namespace dist
+    {
+        struct distributed_config
+        {
+            size_t rank = 0;
+            size_t world_size = 1;
+
+            // peers[r] is where rank r listens; rank r sends to rank r + 1 and receives from rank r - 1
+            std::vector<utils::endpoint> peers;
+
+            size_t connect_retries = 300;
+        };
+
+        // Endpoints for world_size processes on this host: TCP ports from base_port, or Unix-domain
+        // sockets named socket_prefix<rank> when socket_prefix is set
+        inline std::vector<utils::endpoint> local_ring(size_t world_size, uint16_t base_port, const std::string& socket_prefix = "")
+        {
+            std::vector<utils::endpoint> peers(world_size);
+
+            for (size_t r = 0; r < world_size; ++r)
+            {
+                if (socket_prefix.empty())
+                    peers[r].port = static_cast<uint16_t>(base_port + r);
+                else
+                    peers[r].path = socket_prefix + std::to_string(r);
+            }
+
+            return peers;
+        }
+
+        // Ring of worker processes. all_reduce runs the bandwidth-optimal ring algorithm: a reduce-scatter
+        // followed by an all-gather, each world_size - 1 steps that move 1 / world_size of the buffer.
+        // Sends go through a dedicated thread so that every rank sends and receives at the same time.
+        class ring_communicator
+        {
+        public:
+            ring_communicator() = default;
+
+            ~ring_communicator()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(send_mutex);
+                    stopping = true;
+                }
+
+                send_ready.notify_all();
+
+                if (sender.joinable())
+                    sender.join();
+            }
+
+            ring_communicator(const ring_communicator&) = delete;
+            ring_communicator& operator=(const ring_communicator&) = delete;
+
+            bool connect(const distributed_config& config)
+            {
+                world = std::max<size_t>(config.world_size, 1);
+                self = config.rank;
+
+                if (world == 1)
+                    return true;
+
+                if (config.peers.size() != world || self >= world)
+                {
+                    utils::Logger::Error("distributed", "peer list does not match the world size");
+                    return false;
+                }
+
+                if (!listener.listen(config.peers[self]))
+                    return false;
+
+                // connecting and accepting at once: with blocking accept first, every rank would wait for its left neighbour
+                std::thread connector([&] { right = utils::connect_to(config.peers[(self + 1) % world], config.connect_retries); });
+                left = listener.accept();
+                connector.join();
+
+                if (!left.valid() || !right.valid())
+                {
+                    utils::Logger::Error("distributed", "rank " + std::to_string(self) + " could not join the ring");
+                    return false;
+                }
+
+                sender = std::thread([this] { send_loop(); });
+                return true;
+            }
+
+            size_t rank() const
+            {
+                return self;
+            }
+
+            size_t size() const
+            {
+                return world;
+            }
+
+            // Element-wise sum over all ranks; every rank ends up with bitwise identical results
+            template<typename T>
+            bool all_reduce(T* data, size_t count)
+            {
+                if (world == 1 || count == 0)
+                    return true;
+
+                auto chunk_begin = [&](size_t chunk) { return chunk * count / world; };
+                auto chunk_size = [&](size_t chunk) { return chunk_begin(chunk + 1) - chunk_begin(chunk); };
+
+                scratch.resize(((count + world - 1) / world + 1) * sizeof(T));
+                T* incoming = reinterpret_cast<T*>(scratch.data());
+
+                // reduce-scatter: after world - 1 steps rank r owns the full sum of chunk r + 1
+                for (size_t step = 0; step + 1 < world; ++step)
+                {
+                    const size_t send_chunk = (self + world - step) % world;
+                    const size_t recv_chunk = (self + world - step - 1) % world;
+
+                    post_send(data + chunk_begin(send_chunk), chunk_size(send_chunk) * sizeof(T));
+
+                    if (!left.recv_all(incoming, chunk_size(recv_chunk) * sizeof(T)) || !wait_sent())
+                        return fail();
+
+                    T* target = data + chunk_begin(recv_chunk);
+                    for (size_t i = 0; i < chunk_size(recv_chunk); ++i)
+                        target[i] += incoming[i];
+                }
+
+                // all-gather: the finished chunks travel once around the ring
+                for (size_t step = 0; step + 1 < world; ++step)
+                {
+                    const size_t send_chunk = (self + 1 + world - step) % world;
+                    const size_t recv_chunk = (self + world - step) % world;
+
+                    post_send(data + chunk_begin(send_chunk), chunk_size(send_chunk) * sizeof(T));
+
+                    if (!left.recv_all(data + chunk_begin(recv_chunk), chunk_size(recv_chunk) * sizeof(T)) || !wait_sent())
+                        return fail();
+                }
+
+                return true;
+            }
+
+            // Copies root's buffer to every rank, passing it along the ring
+            template<typename T>
+            bool broadcast(T* data, size_t count, size_t root = 0)
+            {
+                if (world == 1 || count == 0)
+                    return true;
+
+                const size_t last = (root + world - 1) % world;
+
+                if (self != root && !left.recv_all(data, count * sizeof(T)))
+                    return fail();
+
+                if (self != last)
+                {
+                    post_send(data, count * sizeof(T));
+
+                    if (!wait_sent())
+                        return fail();
+                }
+
+                return true;
+            }
+
+        private:
+            void post_send(const void* data, size_t size)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(send_mutex);
+                    send_data = data;
+                    send_size = size;
+                    send_pending = true;
+                }
+
+                send_ready.notify_all();
+            }
+
+            bool wait_sent()
+            {
+                std::unique_lock<std::mutex> lock(send_mutex);
+                send_done.wait(lock, [this] { return !send_pending; });
+
+                return send_ok;
+            }
+
+            void send_loop()
+            {
+                while (true)
+                {
+                    std::unique_lock<std::mutex> lock(send_mutex);
+                    send_ready.wait(lock, [this] { return send_pending || stopping; });
+
+                    if (stopping)
+                        return;
+
+                    const void* data = send_data;
+                    const size_t size = send_size;
+                    lock.unlock();
+
+                    const bool ok = right.send_all(data, size);
+
+                    lock.lock();
+                    send_ok = ok;
+                    send_pending = false;
+                    lock.unlock();
+
+                    send_done.notify_all();
+                }
+            }
+
+            bool fail()
+            {
+                utils::Logger::Error("distributed", "rank " + std::to_string(self) + " lost its ring connection");
+                return false;
+            }
+
+        private:
+            size_t world = 1;
+            size_t self = 0;
+
+            utils::socket_listener listener;
+            utils::socket_connection left;
+            utils::socket_connection right;
+            std::vector<char> scratch;
+
+            std::thread sender;
+            std::mutex send_mutex;
+            std::condition_variable send_ready;
+            std::condition_variable send_done;
+            const void* send_data = nullptr;
+            size_t send_size = 0;
+            bool send_pending = false;
+            bool send_ok = true;
+            bool stopping = false;
+        };
+
+        // All-reduces layer gradients on a background thread as backprop finishes them, so the last
+        // layers are on the wire while the first ones are still being computed
+        class gradient_reducer
+        {
+        public:
+            explicit gradient_reducer(ring_communicator& ring) : ring(ring)
+            {
+                worker = std::thread([this] { reduce_loop(); });
+            }
+
+            ~gradient_reducer()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+
+                ready.notify_all();
+                worker.join();
+            }
+
+            gradient_reducer(const gradient_reducer&) = delete;
+            gradient_reducer& operator=(const gradient_reducer&) = delete;
+
+            void begin(std::vector<math::matrix<float>>& grads)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                gradients = &grads;
+                outstanding = 0;
+                ok = true;
+            }
+
+            void enqueue(size_t layer)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push_back(layer);
+                    ++outstanding;
+                }
+
+                ready.notify_all();
+            }
+
+            // Waits for every enqueued layer; the gradients are then averaged over the ranks
+            bool wait()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [this] { return outstanding == 0; });
+
+                return ok;
+            }
+
+        private:
+            void reduce_loop()
+            {
+                while (true)
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this] { return !queue.empty() || stopping; });
+
+                    if (queue.empty())
+                        return;
+
+                    const size_t layer = queue.front();
+                    queue.pop_front();
+                    auto& grad = (*gradients)[layer];
+                    const bool healthy = ok;
+                    lock.unlock();
+
+                    bool reduced = false;
+
+                    if (healthy && ring.all_reduce(grad.data_ptr(), grad.size()))
+                    {
+                        grad *= 1.f / static_cast<float>(ring.size());
+                        reduced = true;
+                    }
+
+                    lock.lock();
+                    ok = ok && reduced;
+                    --outstanding;
+
+                    if (outstanding == 0)
+                        done.notify_all();
+                }
+            }
+
+        private:
+            ring_communicator& ring;
+            std::vector<math::matrix<float>>* gradients = nullptr;
+
+            std::thread worker;
+            std::mutex mutex;
+            std::condition_variable ready;
+            std::condition_variable done;
+            std::deque<size_t> queue;
+            size_t outstanding = 0;
+            bool ok = true;
+            bool stopping = false;
+        };
+
+        // Data-parallel counterpart of ml::trainer: every rank trains on its shard of the training split,
+        // gradients are averaged through the ring after each batch, and all ranks keep identical weights.
+        // The validation split is sharded as well and its loss reduced, so early stopping agrees on all ranks.
+        class distributed_trainer
+        {
+        public:
+            distributed_trainer(ring_communicator& ring, const trainer_config& config) : ring(ring), config(config), evaluator(config) {}
+
+            // false when the ring broke; the model then holds the weights of the last completed batch
+            template<typename OnBatch>
+            bool fit(perceptron& model, const mnist::training_set& set, training_result& result, OnBatch on_batch)
+            {
+                result = training_result{};
+
+                if (!broadcast_weights(model))
+                    return false;
+
+                std::vector<size_t> indices(set.size());
+                std::iota(indices.begin(), indices.end(), size_t{ 0 });
+
+                // every rank draws the same permutations, the shards are strided slices of them
+                utils::shuffle(indices, utils::counter_rng(config.seed, utils::rng_stream::shuffle));
+
+                const size_t world = ring.size();
+                const size_t validation_size = static_cast<size_t>(set.size() * config.validation_split);
+                const size_t train_size = set.size() - validation_size;
+
+                std::vector<size_t> validation;
+                for (size_t i = train_size + ring.rank(); i < set.size(); i += world)
+                    validation.push_back(indices[i]);
+
+                indices.resize(train_size);
+
+                // equal shard sizes keep every rank at the same number of batches
+                const size_t shard_size = train_size / world;
+
+                if (shard_size == 0)
+                {
+                    utils::Logger::Error("distributed", "training split is smaller than the number of ranks");
+                    return false;
+                }
+
+                const size_t batch_size = std::max<size_t>(config.batch_size, 1);
+                std::vector<size_t> shard(shard_size);
+                std::vector<math::matrix<float>> grads;
+                gradient_reducer reducer(ring);
+
+                size_t evaluations_without_improvement = 0;
+                bool has_best = false;
+
+                for (size_t epoch = 0; epoch < config.max_epochs && !result.stopped_early; ++epoch)
+                {
+                    if (epoch > 0)
+                        utils::shuffle(indices, utils::counter_rng(config.seed, utils::rng_stream::shuffle + epoch));
+
+                    for (size_t i = 0; i < shard_size; ++i)
+                        shard[i] = indices[i * world + ring.rank()];
+
+                    for (size_t first = 0; first < shard_size && !result.stopped_early; first += batch_size)
+                    {
+                        const size_t count = std::min(batch_size, shard_size - first);
+
+                        if (config.augment)
+                            image::augment_batch(set, shard, first, count, config.augmentation, config.seed, epoch, inputs, targets);
+                        else
+                            mnist::make_batch(set, shard, first, count, inputs, targets);
+
+                        reducer.begin(grads);
+                        model.compute_gradients(inputs, targets, grads, [&](size_t layer) { reducer.enqueue(layer); });
+
+                        if (!reducer.wait())
+                            return false;
+
+                        model.apply_gradients(grads);
+
+                        ++result.batches;
+                        on_batch(result.batches);
+
+                        const bool epoch_end = first + count >= shard_size;
+
+                        if (validation_size == 0 || (result.batches % std::max<size_t>(config.eval_every, 1) != 0 && !epoch_end))
+                            continue;
+
+                        evaluation score;
+                        if (!evaluate(model, set, validation, score))
+                            return false;
+
+                        ++result.evaluations;
+
+                        if (score.loss < result.best_loss - config.min_delta)
+                        {
+                            result.best_loss = score.loss;
+                            result.best_accuracy = score.accuracy;
+                            evaluations_without_improvement = 0;
+
+                            model.snapshot(best);
+                            has_best = true;
+                        }
+                        else if (++evaluations_without_improvement >= config.patience)
+                        {
+                            result.stopped_early = true;
+
+                            if (ring.rank() == 0)
+                            {
+                                utils::Logger::Info("distributed", "early stop after " + std::to_string(result.batches) + " batches, best validation loss " +
+                                    std::to_string(result.best_loss));
+                            }
+                        }
+                    }
+                }
+
+                if (has_best)
+                    model.restore(best);
+
+                return true;
+            }
+
+            bool fit(perceptron& model, const mnist::training_set& set, training_result& result)
+            {
+                return fit(model, set, result, [](size_t) {});
+            }
+
+        private:
+            // Starts every rank from rank 0's weights
+            bool broadcast_weights(perceptron& model)
+            {
+                for (size_t i = 0; i < model.layer_count(); ++i)
+                {
+                    if (!ring.broadcast(model.layer(i).data_ptr(), model.layer(i).size()))
+                        return false;
+                }
+
+                model.refresh_sparsity();
+                return true;
+            }
+
+            // Loss and accuracy over the union of the validation shards
+            bool evaluate(const perceptron& model, const mnist::training_set& set, const std::vector<size_t>& validation, evaluation& score)
+            {
+                const evaluation local = evaluator.evaluate(model, set, validation);
+                const double samples = static_cast<double>(validation.size());
+
+                double totals[3] = { local.loss * samples, local.accuracy * samples, samples };
+
+                if (!ring.all_reduce(totals, 3))
+                    return false;
+
+                score.loss = totals[2] > 0 ? static_cast<float>(totals[0] / totals[2]) : 0.f;
+                score.accuracy = totals[2] > 0 ? static_cast<float>(totals[1] / totals[2]) : 0.f;
+                return true;
+            }
+
+        private:
+            ring_communicator& ring;
+            trainer_config config;
+            trainer evaluator;
+
+            model_snapshot best;
+            math::matrix<float> inputs;
+            math::matrix<float> targets;
+        };
+    }
+}
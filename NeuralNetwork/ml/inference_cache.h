@@ -0,0 +1,322 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "perceptron.h"
+#include "model_registry.h"
+#include "../utils/hash128.h"
+#include "../utils/mnist/mnist.h"
+
+namespace ml
+{
+    struct inference_cache_config
+    {
+        // total number of cached results, split evenly over the shards
+        size_t capacity = 1 << 16;
+        // rounded up to a power of two
+        size_t shards = 16;
+        // width of one cached result (classes of the model)
+        size_t outputs = mnist::classes;
+    };
+
+    struct inference_cache_stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        // entries dropped because a newer model version was seen
+        uint64_t invalidations = 0;
+        size_t entries = 0;
+        size_t memory_bytes = 0;
+
+        double hit_rate() const
+        {
+            const uint64_t lookups = hits + misses;
+            return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+        }
+    };
+
+    // Results of forward passes keyed by the 128-bit hash of the raw input bytes, for traffic with
+    // many exact duplicates. Every shard holds results of a single model version: the first insert
+    // under a newer version empties it, lookups under any other version miss, so loading a new
+    // model invalidates the cache without a call. Registry versions are only counted per name, so a
+    // shard is also tagged with the model it serves (model_tag() of the registry name, 0 for a
+    // model outside the registry); an insert for another model takes the shard over. One cache per
+    // model name is the intended use, several names sharing one stay correct but evict each other.
+    // Lookups share the shard lock and only set the entry's CLOCK reference bit; inserts take it
+    // exclusively and evict with the CLOCK hand. All memory is allocated up front.
+    //
+    // Two different inputs with the same 128-bit hash would share a result; at 2^-128 per pair this
+    // is ignored.
+    class inference_cache
+    {
+    public:
+        explicit inference_cache(const inference_cache_config& config = inference_cache_config())
+            : outputs(std::max<size_t>(config.outputs, 1))
+        {
+            size_t shard_count = 1;
+            while (shard_count < config.shards)
+                shard_count <<= 1;
+
+            const size_t per_shard = std::max<size_t>((config.capacity + shard_count - 1) / shard_count, 1);
+
+            shards.reserve(shard_count);
+            for (size_t i = 0; i < shard_count; ++i)
+                shards.push_back(std::make_unique<shard>(per_shard, outputs));
+        }
+
+        size_t output_width() const
+        {
+            return outputs;
+        }
+
+        static utils::hash128 key(const uint8_t* input, size_t size)
+        {
+            return utils::murmur3_128(input, size);
+        }
+
+        // Tag of the registry entry name; never 0
+        static uint64_t model_tag(const std::string& name)
+        {
+            return utils::murmur3_128(reinterpret_cast<const uint8_t*>(name.data()), name.size()).low | 1;
+        }
+
+        // Copies the cached result for key under version of model into out (output_width() floats)
+        bool lookup(const utils::hash128& key, uint64_t version, float* out, uint64_t model = 0)
+        {
+            shard& s = shard_for(key);
+            {
+                std::shared_lock<std::shared_mutex> lock(s.mutex);
+
+                if (s.model == model && s.version == version)
+                {
+                    auto it = s.index.find(key);
+
+                    if (it != s.index.end())
+                    {
+                        const float* values = s.values.data() + it->second * outputs;
+                        std::copy(values, values + outputs, out);
+
+                        s.referenced[it->second].store(1, std::memory_order_relaxed);
+                        hits.fetch_add(1, std::memory_order_relaxed);
+                        return true;
+                    }
+                }
+            }
+
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        // Stores a result computed with version of model; results of a version older than the shard's
+        // are dropped
+        void insert(const utils::hash128& key, uint64_t version, const float* values, uint64_t model = 0)
+        {
+            shard& s = shard_for(key);
+            std::unique_lock<std::shared_mutex> lock(s.mutex);
+
+            if (model == s.model && version < s.version)
+                return;
+
+            if (model != s.model || version > s.version)
+            {
+                invalidations.fetch_add(s.index.size(), std::memory_order_relaxed);
+                s.clear();
+                s.model = model;
+                s.version = version;
+            }
+
+            if (s.index.count(key) != 0)
+                return;
+
+            uint32_t slot;
+
+            if (s.used < s.capacity)
+            {
+                slot = static_cast<uint32_t>(s.used++);
+            }
+            else
+            {
+                // CLOCK: clear reference bits until an entry without one comes round
+                while (s.referenced[s.hand].exchange(0, std::memory_order_relaxed) != 0)
+                    s.hand = (s.hand + 1) % s.capacity;
+
+                slot = static_cast<uint32_t>(s.hand);
+                s.hand = (s.hand + 1) % s.capacity;
+
+                s.index.erase(s.keys[slot]);
+                evictions.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            s.keys[slot] = key;
+            s.referenced[slot].store(0, std::memory_order_relaxed);
+            std::copy(values, values + outputs, s.values.data() + slot * outputs);
+            s.index.emplace(key, slot);
+
+            insertions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void clear()
+        {
+            for (auto& s : shards)
+            {
+                std::unique_lock<std::shared_mutex> lock(s->mutex);
+                invalidations.fetch_add(s->index.size(), std::memory_order_relaxed);
+                s->clear();
+            }
+        }
+
+        inference_cache_stats stats() const
+        {
+            inference_cache_stats result;
+            result.hits = hits.load(std::memory_order_relaxed);
+            result.misses = misses.load(std::memory_order_relaxed);
+            result.insertions = insertions.load(std::memory_order_relaxed);
+            result.evictions = evictions.load(std::memory_order_relaxed);
+            result.invalidations = invalidations.load(std::memory_order_relaxed);
+            result.memory_bytes = sizeof(*this);
+
+            for (const auto& s : shards)
+            {
+                std::shared_lock<std::shared_mutex> lock(s->mutex);
+                result.entries += s->index.size();
+                result.memory_bytes += s->memory_bytes();
+            }
+
+            return result;
+        }
+
+        // Forward pass over count uint8 samples (sample i at samples + i * stride, inputs bytes, pixels
+        // normalized like the training data) through model, which must be version. Cached samples
+        // are copied, the rest, deduplicated, go through one forward_rows call and are cached.
+        // out receives count rows of output_width() values.
+        void forward_u8(const perceptron& model, uint64_t version, const uint8_t* samples, size_t count, size_t stride, size_t inputs, float* out)
+        {
+            forward_tagged(model, 0, version, samples, count, stride, inputs, out);
+        }
+
+        // As above through a published version; a newly published version invalidates its predecessor's results
+        void forward_u8(const model_version& current, const uint8_t* samples, size_t count, size_t stride, size_t inputs, float* out)
+        {
+            forward_tagged(current.model, model_tag(current.name), current.version, samples, count, stride, inputs, out);
+        }
+
+    private:
+        void forward_tagged(const perceptron& model, uint64_t tag, uint64_t version, const uint8_t* samples, size_t count, size_t stride, size_t inputs, float* out)
+        {
+            std::vector<utils::hash128> keys(count);
+            std::vector<size_t> computed;
+            std::unordered_map<utils::hash128, size_t, utils::hash128_hasher> first_seen;
+            // sample -> column of the packed batch for every missed sample
+            std::vector<std::pair<size_t, size_t>> pending;
+
+            for (size_t s = 0; s < count; ++s)
+            {
+                keys[s] = key(samples + s * stride, inputs);
+
+                if (lookup(keys[s], version, out + s * outputs, tag))
+                    continue;
+
+                auto found = first_seen.emplace(keys[s], computed.size());
+                if (found.second)
+                    computed.push_back(s);
+
+                pending.emplace_back(s, found.first->second);
+            }
+
+            if (computed.empty())
+                return;
+
+            std::vector<uint8_t> packed(computed.size() * inputs);
+            for (size_t i = 0; i < computed.size(); ++i)
+                std::copy(samples + computed[i] * stride, samples + computed[i] * stride + inputs, packed.data() + i * inputs);
+
+            const auto result = model.forward_rows(packed.data(), computed.size(), inputs,
+                [](uint8_t pixel) { return mnist::normalize_pixel(static_cast<mnist::byte>(pixel)); });
+
+            const float* values = result.data_ptr();
+            const size_t columns = computed.size();
+            const size_t width = std::min(outputs, result.size_m());
+            std::vector<float> row(outputs, 0.f);
+
+            for (size_t i = 0; i < columns; ++i)
+            {
+                for (size_t k = 0; k < width; ++k)
+                    row[k] = values[k * columns + i];
+
+                insert(keys[computed[i]], version, row.data(), tag);
+            }
+
+            for (const auto& [sample, column] : pending)
+            {
+                for (size_t k = 0; k < width; ++k)
+                    out[sample * outputs + k] = values[k * columns + column];
+            }
+        }
+
+        struct shard
+        {
+            shard(size_t capacity, size_t outputs)
+                : capacity(capacity), keys(capacity), referenced(new std::atomic<uint8_t>[capacity]), values(capacity * outputs)
+            {
+                index.reserve(capacity);
+
+                for (size_t i = 0; i < capacity; ++i)
+                    referenced[i].store(0, std::memory_order_relaxed);
+            }
+
+            void clear()
+            {
+                index.clear();
+                used = 0;
+                hand = 0;
+            }
+
+            size_t memory_bytes() const
+            {
+                // nodes of the index: key, slot and the next pointer, plus the bucket array
+                const size_t node = sizeof(std::pair<const utils::hash128, uint32_t>) + 2 * sizeof(void*);
+
+                return sizeof(*this) + keys.capacity() * sizeof(utils::hash128) + capacity * sizeof(std::atomic<uint8_t>) +
+                    values.capacity() * sizeof(float) + index.bucket_count() * sizeof(void*) + index.size() * node;
+            }
+
+            mutable std::shared_mutex mutex;
+            uint64_t model = 0;
+            uint64_t version = 0;
+
+            const size_t capacity;
+            size_t used = 0;
+            size_t hand = 0;
+
+            std::unordered_map<utils::hash128, uint32_t, utils::hash128_hasher> index;
+            std::vector<utils::hash128> keys;
+            std::unique_ptr<std::atomic<uint8_t>[]> referenced;
+            std::vector<float> values;
+        };
+
+        shard& shard_for(const utils::hash128& key)
+        {
+            // the high half picks the shard, the low half the bucket inside it
+            return *shards[static_cast<size_t>(key.high) & (shards.size() - 1)];
+        }
+
+        const size_t outputs;
+        std::vector<std::unique_ptr<shard>> shards;
+
+        std::atomic<uint64_t> hits{ 0 };
+        std::atomic<uint64_t> misses{ 0 };
+        std::atomic<uint64_t> insertions{ 0 };
+        std::atomic<uint64_t> evictions{ 0 };
+        std::atomic<uint64_t> invalidations{ 0 };
+    };
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "perceptron.h"
+#include "trainer.h"
+#include "../math/svd.h"
+#include "../math/low_rank_matrix.h"
+#include "../utils/logger.h"
+
+namespace ml
+{
+    struct low_rank_config
+    {
+        // largest validation accuracy drop accepted for each factored layer
+        float accuracy_budget = 0.005f;
+
+        // tried in ascending order; ranks that would not reduce the layer's FLOPs are skipped
+        std::vector<size_t> candidate_ranks = { 8, 16, 24, 32, 48, 64, 96, 128 };
+
+        // layers to factor; empty means every layer
+        std::vector<size_t> layers;
+
+        // short retraining after each factored layer, with every factored layer kept at its rank
+        bool fine_tune = false;
+        trainer_config tuning;
+    };
+
+    struct low_rank_report
+    {
+        size_t layer = 0;
+        size_t rank = 0;
+        float accuracy_before = 0.f;
+        float accuracy_after = 0.f;
+    };
+
+    // Replaces dense layers W (m x n) with factors U (m x r) and V (r x n) from a truncated SVD,
+    // choosing per layer the smallest candidate rank whose validation accuracy stays within the budget.
+    class low_rank_compressor
+    {
+    public:
+        explicit low_rank_compressor(const low_rank_config& config) : config(config), evaluator(config.tuning) {}
+
+        std::vector<low_rank_report> compress(perceptron& model, const mnist::training_set& set, const std::vector<size_t>& validation)
+        {
+            std::vector<low_rank_report> reports;
+
+            std::vector<size_t> targets = config.layers;
+            if (targets.empty())
+            {
+                for (size_t i = 0; i < model.layer_count(); ++i)
+                    targets.push_back(i);
+            }
+
+            std::vector<size_t> ranks = config.candidate_ranks;
+            std::sort(ranks.begin(), ranks.end());
+
+            for (size_t index : targets)
+            {
+                if (index >= model.layer_count())
+                    continue;
+
+                const auto& weights = model.layer(index);
+                const size_t size_m = weights.size_m();
+                const size_t size_n = weights.size_n();
+
+                std::vector<size_t> useful;
+                for (size_t rank : ranks)
+                {
+                    if (rank > 0 && rank * (size_m + size_n) < size_m * size_n)
+                        useful.push_back(rank);
+                }
+
+                if (useful.empty())
+                    continue;
+
+                low_rank_report report;
+                report.layer = index;
+                report.accuracy_before = evaluator.evaluate(model, set, validation).accuracy;
+
+                // one decomposition at the largest rank; smaller ranks are its leading columns/rows
+                math::matrix<float> u;
+                math::matrix<float> v;
+                math::truncated_svd(weights, useful.back(), u, v);
+
+                for (size_t rank : useful)
+                {
+                    perceptron trial = model;
+                    trial.set_factors(index, truncate(u, v, rank));
+
+                    const float accuracy = evaluator.evaluate(trial, set, validation).accuracy;
+
+                    if (report.accuracy_before - accuracy <= config.accuracy_budget || rank == useful.back())
+                    {
+                        report.rank = rank;
+                        report.accuracy_after = accuracy;
+                        break;
+                    }
+                }
+
+                if (report.accuracy_before - report.accuracy_after > config.accuracy_budget)
+                {
+                    utils::Logger::Info("low_rank", "layer " + std::to_string(index) + " kept dense, no rank meets the budget");
+                    continue;
+                }
+
+                model.set_factors(index, truncate(u, v, report.rank));
+
+                if (config.fine_tune)
+                {
+                    fine_tune(model, set, validation);
+                    report.accuracy_after = evaluator.evaluate(model, set, validation).accuracy;
+                }
+
+                utils::Logger::Info("low_rank", "layer " + std::to_string(index) + ": rank " + std::to_string(report.rank) +
+                    ", accuracy " + std::to_string(report.accuracy_before) + " -> " + std::to_string(report.accuracy_after));
+
+                reports.push_back(report);
+            }
+
+            return reports;
+        }
+
+    private:
+        static math::low_rank_matrix<float> truncate(const math::matrix<float>& u, const math::matrix<float>& v, size_t rank)
+        {
+            math::matrix<float> left(u.size_m(), rank);
+            math::matrix<float> right(rank, v.size_n());
+
+            for (size_t i = 0; i < u.size_m(); ++i)
+                std::copy(u.data_ptr() + i * u.size_n(), u.data_ptr() + i * u.size_n() + rank, left.data_ptr() + i * rank);
+
+            std::copy(v.data_ptr(), v.data_ptr() + rank * v.size_n(), right.data_ptr());
+
+            return math::low_rank_matrix<float>(std::move(left), std::move(right));
+        }
+
+        // Keeps the factored layer's rank while the model trains: after every batch it is projected back
+        // onto the span of its orthonormal factor (u for wide layers, v for tall ones, as truncated_svd
+        // leaves them), and the other factor is refit at the end
+        struct rank_constraint
+        {
+            size_t index;
+            bool wide;
+            math::matrix<float> basis;
+            math::matrix<float> basis_t;
+
+            math::low_rank_matrix<float> project(const math::matrix<float>& w) const
+            {
+                return wide
+                    ? math::low_rank_matrix<float>(math::matrix<float>(basis), basis_t * w)
+                    : math::low_rank_matrix<float>(w * basis_t, math::matrix<float>(basis));
+            }
+        };
+
+        // Retrains the whole model on the samples outside validation, so the accuracy measured after it
+        // is not taken on training data; every layer factored so far, not only the newest one, stays at its rank
+        void fine_tune(perceptron& model, const mnist::training_set& set, const std::vector<size_t>& validation)
+        {
+            std::vector<rank_constraint> constraints;
+
+            for (size_t i = 0; i < model.layer_count(); ++i)
+            {
+                if (!model.is_low_rank(i))
+                    continue;
+
+                const auto& factors = model.factors(i);
+                const bool wide = factors.size_m() <= factors.size_n();
+                math::matrix<float> basis = wide ? factors.left() : factors.right();
+                math::matrix<float> basis_t = basis.transposed();
+
+                constraints.push_back({ i, wide, std::move(basis), std::move(basis_t) });
+            }
+
+            trainer tuner(config.tuning);
+
+            tuner.fit(model, set, trainer::indices_except(set.size(), validation), [&](size_t)
+            {
+                for (const auto& constraint : constraints)
+                    model.layer(constraint.index) = constraint.project(model.layer(constraint.index)).to_dense();
+            });
+
+            for (const auto& constraint : constraints)
+                model.set_factors(constraint.index, constraint.project(model.layer(constraint.index)));
+        }
+
+    private:
+        low_rank_config config;
+        trainer evaluator;
+    };
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+namespace ml
+{
+    namespace optim
+    {
+        enum class schedule_type : uint32_t
+        {
+            constant = 0,
+            step = 1,
+            cosine = 2
+        };
+
+        // Learning rate as a function of the optimizer step, optionally preceded by a linear warmup
+        struct lr_schedule
+        {
+            schedule_type type = schedule_type::constant;
+
+            // step: rate is multiplied by gamma every step_size steps (0 counts as 1)
+            uint64_t step_size = 1;
+            float gamma = 1.f;
+
+            // cosine: anneals from the base rate to min_rate over total_steps (0 counts as 1)
+            uint64_t total_steps = 1;
+            float min_rate = 0.f;
+
+            uint64_t warmup_steps = 0;
+
+            static lr_schedule constant()
+            {
+                return lr_schedule{};
+            }
+
+            static lr_schedule step_decay(uint64_t step_size, float gamma)
+            {
+                lr_schedule schedule;
+                schedule.type = schedule_type::step;
+                schedule.step_size = std::max<uint64_t>(step_size, 1);
+                schedule.gamma = gamma;
+                return schedule;
+            }
+
+            static lr_schedule cosine(uint64_t total_steps, float min_rate = 0.f)
+            {
+                lr_schedule schedule;
+                schedule.type = schedule_type::cosine;
+                schedule.total_steps = std::max<uint64_t>(total_steps, 1);
+                schedule.min_rate = min_rate;
+                return schedule;
+            }
+
+            lr_schedule& with_warmup(uint64_t steps)
+            {
+                warmup_steps = steps;
+                return *this;
+            }
+
+            float rate(float base_rate, uint64_t step) const
+            {
+                if (step < warmup_steps)
+                    return base_rate * static_cast<float>(step + 1) / static_cast<float>(warmup_steps);
+
+                const uint64_t t = step - warmup_steps;
+
+                switch (type)
+                {
+                case schedule_type::step:
+                    return base_rate * std::pow(gamma, static_cast<float>(t / std::max<uint64_t>(step_size, 1)));
+
+                case schedule_type::cosine:
+                {
+                    const double progress = std::min(1.0, static_cast<double>(t) / static_cast<double>(std::max<uint64_t>(total_steps, 1)));
+                    const double pi = 3.14159265358979323846;
+                    return static_cast<float>(min_rate + 0.5 * (base_rate - min_rate) * (1.0 + std::cos(pi * progress)));
+                }
+
+                default:
+                    return base_rate;
+                }
+            }
+        };
+    }
+}
@@ -0,0 +1,676 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <algorithm>
+
+#include "optimizer.h"
+#include "../math/matrix.h"
+#include "../math/sparse_matrix.h"
+#include "../math/low_rank_matrix.h"
+#include "../utils/atomic_file.h"
+#include "../utils/binary.h"
+#include "../utils/crc32c.h"
+#include "../utils/logger.h"
+#include "../utils/memory_stream.h"
+
+namespace ml
+{
+    enum class layer_encoding : uint32_t
+    {
+        dense = 0,
+        block_sparse = 1,
+        low_rank = 2
+    };
+
+    // How a layer is stored in the model file; block shape only applies to block_sparse,
+    // low_rank layers are written as their factors
+    struct layer_format
+    {
+        layer_encoding encoding = layer_encoding::dense;
+        uint32_t block_m = 1;
+        uint32_t block_n = 1;
+    };
+
+    enum class layer_kind : uint32_t
+    {
+        dense = 0,
+        conv2d = 1,
+        max_pool = 2,
+        avg_pool = 3,
+        flatten = 4
+    };
+
+    enum class activation_kind : uint32_t
+    {
+        sigmoid = 0,
+        relu = 1,
+        identity = 2
+    };
+
+    // One layer of a convolutional network; units is the output width of a dense layer or the
+    // output channels of a convolution, kernel / stride / padding apply to conv2d and pooling
+    struct layer_spec
+    {
+        layer_kind kind = layer_kind::dense;
+        activation_kind activation = activation_kind::sigmoid;
+        uint32_t units = 0;
+        uint32_t kernel = 0;
+        uint32_t stride = 1;
+        uint32_t padding = 0;
+    };
+
+    // Input shape and layers of a convolutional network; empty for a plain perceptron
+    struct network_topology
+    {
+        uint32_t channels = 0;
+        uint32_t height = 0;
+        uint32_t width = 0;
+        std::vector<layer_spec> layers;
+
+        bool empty() const
+        {
+            return layers.empty();
+        }
+    };
+
+    // Everything a model writes to disk, detached from the live model
+    // so it can be serialized on another thread
+    struct model_snapshot
+    {
+        float learning_rate = 0.f;
+        std::vector<math::matrix<float>> layers;
+        std::vector<layer_format> formats;
+        // factors of the low_rank layers, empty for the others
+        std::vector<std::optional<math::low_rank_matrix<float>>> factors;
+        optim::optimizer optimizer;
+        // seed the initial weights were drawn from, 0 when unknown
+        uint64_t seed = 0;
+        // set for convolutional networks, whose layers then hold each layer's weights and biases in order
+        network_topology topology;
+    };
+
+    namespace model_file
+    {
+        // "SPNN"; files written before the header existed start directly with the learning rate
+        constexpr uint32_t magic = 0x4E4E5053u;
+        // 2: dense layers with CRC, 3: each layer is an encoded record (encoding, size, CRC, payload)
+        constexpr uint32_t version = 3;
+
+        // Optional data follows the layers as tagged sections: tag, payload size, payload CRC32C, payload.
+        // Readers skip tags they do not know.
+        namespace section
+        {
+            constexpr uint32_t optimizer = 0x4D54504Fu; // "OPTM"
+            constexpr uint32_t seed = 0x44454553u; // "SEED"
+            constexpr uint32_t topology = 0x4F504F54u; // "TOPO"
+        }
+
+        inline uint32_t layer_crc(uint64_t size_m, uint64_t size_n, const float* values)
+        {
+            uint32_t crc = utils::crc32c(&size_m, sizeof(size_m));
+            crc = utils::crc32c(&size_n, sizeof(size_n), crc);
+            return utils::crc32c(values, static_cast<size_t>(size_m * size_n) * sizeof(float), crc);
+        }
+
+        namespace detail
+        {
+            inline void write_matrix(const math::matrix<float>& m, utils::memory_stream& out)
+            {
+                write_data(static_cast<uint64_t>(m.size_m()), out);
+                write_data(static_cast<uint64_t>(m.size_n()), out);
+                out.write(reinterpret_cast<const char*>(m.data_ptr()), m.size() * sizeof(float));
+            }
+
+            inline bool read_matrix(utils::memory_stream& in, math::matrix<float>& m)
+            {
+                const uint64_t size_m = read_data<uint64_t>(in);
+                const uint64_t size_n = read_data<uint64_t>(in);
+
+                if (!in.good() || size_m == 0 || size_n == 0 || size_m > (in.size() / sizeof(float)) / size_n)
+                    return false;
+
+                const char* bytes = in.consume(static_cast<size_t>(size_m * size_n) * sizeof(float));
+                if (!bytes)
+                    return false;
+
+                if (m.size_m() != size_m || m.size_n() != size_n)
+                    m = math::matrix<float>(static_cast<size_t>(size_m), static_cast<size_t>(size_n));
+
+                std::memcpy(m.data_ptr(), bytes, m.size() * sizeof(float));
+                return true;
+            }
+
+            inline void write_section(uint32_t tag, const utils::memory_stream& payload, utils::memory_stream& out)
+            {
+                write_data(tag, out);
+                write_data(static_cast<uint64_t>(payload.size()), out);
+                write_data(utils::crc32c(payload.data(), payload.size()), out);
+                out.write(payload.data(), payload.size());
+            }
+
+            inline void write_optimizer(const optim::optimizer& optimizer, utils::memory_stream& out)
+            {
+                const auto& config = optimizer.config();
+
+                write_data(static_cast<uint32_t>(config.type), out);
+                write_data(config.learning_rate, out);
+                write_data(config.momentum, out);
+                write_data(config.beta1, out);
+                write_data(config.beta2, out);
+                write_data(config.epsilon, out);
+                write_data(config.weight_decay, out);
+
+                // rate() treats a zero period as 1; written as such, since the reader rejects 0
+                write_data(static_cast<uint32_t>(config.schedule.type), out);
+                write_data(std::max<uint64_t>(config.schedule.step_size, 1), out);
+                write_data(config.schedule.gamma, out);
+                write_data(std::max<uint64_t>(config.schedule.total_steps, 1), out);
+                write_data(config.schedule.min_rate, out);
+                write_data(config.schedule.warmup_steps, out);
+
+                write_data(optimizer.steps(), out);
+                write_data(static_cast<uint64_t>(optimizer.state().size()), out);
+
+                for (const auto& slot : optimizer.state())
+                    write_matrix(slot, out);
+            }
+
+            inline bool read_optimizer(utils::memory_stream& in, optim::optimizer& optimizer)
+            {
+                optim::optimizer_config config;
+
+                config.type = static_cast<optim::optimizer_type>(read_data<uint32_t>(in));
+                config.learning_rate = read_data<float>(in);
+                config.momentum = read_data<float>(in);
+                config.beta1 = read_data<float>(in);
+                config.beta2 = read_data<float>(in);
+                config.epsilon = read_data<float>(in);
+                config.weight_decay = read_data<float>(in);
+
+                config.schedule.type = static_cast<optim::schedule_type>(read_data<uint32_t>(in));
+                config.schedule.step_size = read_data<uint64_t>(in);
+                config.schedule.gamma = read_data<float>(in);
+                config.schedule.total_steps = read_data<uint64_t>(in);
+                config.schedule.min_rate = read_data<float>(in);
+                config.schedule.warmup_steps = read_data<uint64_t>(in);
+
+                const uint64_t steps = read_data<uint64_t>(in);
+                const uint64_t slots_num = read_data<uint64_t>(in);
+
+                if (!in.good() || slots_num > in.size())
+                    return false;
+
+                // the schedule factories never produce a zero period, and rate() divides by it
+                if (config.schedule.step_size == 0 || config.schedule.total_steps == 0)
+                    return false;
+
+                std::vector<math::matrix<float>> slots(static_cast<size_t>(slots_num));
+
+                for (auto& slot : slots)
+                {
+                    if (!read_matrix(in, slot))
+                        return false;
+                }
+
+                optimizer.restore(config, steps, std::move(slots));
+                return true;
+            }
+
+            inline void write_topology(const network_topology& topology, utils::memory_stream& out)
+            {
+                write_data(topology.channels, out);
+                write_data(topology.height, out);
+                write_data(topology.width, out);
+                write_data(static_cast<uint64_t>(topology.layers.size()), out);
+
+                for (const auto& layer : topology.layers)
+                {
+                    write_data(static_cast<uint32_t>(layer.kind), out);
+                    write_data(static_cast<uint32_t>(layer.activation), out);
+                    write_data(layer.units, out);
+                    write_data(layer.kernel, out);
+                    write_data(layer.stride, out);
+                    write_data(layer.padding, out);
+                }
+            }
+
+            inline bool read_topology(utils::memory_stream& in, network_topology& topology)
+            {
+                topology.channels = read_data<uint32_t>(in);
+                topology.height = read_data<uint32_t>(in);
+                topology.width = read_data<uint32_t>(in);
+
+                const uint64_t layers_num = read_data<uint64_t>(in);
+                if (!in.good() || layers_num > in.size())
+                    return false;
+
+                topology.layers.resize(static_cast<size_t>(layers_num));
+
+                for (auto& layer : topology.layers)
+                {
+                    layer.kind = static_cast<layer_kind>(read_data<uint32_t>(in));
+                    layer.activation = static_cast<activation_kind>(read_data<uint32_t>(in));
+                    layer.units = read_data<uint32_t>(in);
+                    layer.kernel = read_data<uint32_t>(in);
+                    layer.stride = read_data<uint32_t>(in);
+                    layer.padding = read_data<uint32_t>(in);
+                }
+
+                return in.good();
+            }
+
+            // legacy files store sizes as the size_t of the platform that wrote them
+            inline uint64_t read_size(utils::memory_stream& in, size_t width)
+            {
+                return width == sizeof(uint32_t) ? read_data<uint32_t>(in) : read_data<uint64_t>(in);
+            }
+
+            inline bool read_layer(utils::memory_stream& in, bool checked, size_t width, math::matrix<float>& layer)
+            {
+                const uint64_t size_m = read_size(in, width);
+                const uint64_t size_n = read_size(in, width);
+                const uint32_t crc = checked ? read_data<uint32_t>(in) : 0;
+
+                if (!in.good() || size_m == 0 || size_n == 0 || size_m > (in.size() / sizeof(float)) / size_n)
+                    return false;
+
+                const char* bytes = in.consume(static_cast<size_t>(size_m * size_n) * sizeof(float));
+                if (!bytes)
+                    return false;
+
+                if (layer.size_m() != size_m || layer.size_n() != size_n)
+                    layer = math::matrix<float>(static_cast<size_t>(size_m), static_cast<size_t>(size_n));
+
+                std::memcpy(layer.data_ptr(), bytes, layer.size() * sizeof(float));
+
+                return !checked || layer_crc(size_m, size_n, layer.data_ptr()) == crc;
+            }
+
+            inline void write_layer(const math::matrix<float>& layer, layer_format format,
+                const std::optional<math::low_rank_matrix<float>>& factors, utils::memory_stream& out)
+            {
+                const uint64_t size_m = layer.size_m();
+                const uint64_t size_n = layer.size_n();
+
+                if (format.encoding == layer_encoding::low_rank && !factors)
+                    format.encoding = layer_encoding::dense;
+
+                write_data(static_cast<uint32_t>(format.encoding), out);
+
+                if (format.encoding == layer_encoding::low_rank)
+                {
+                    utils::memory_stream payload;
+                    write_matrix(factors->left(), payload);
+                    write_matrix(factors->right(), payload);
+
+                    write_data(static_cast<uint64_t>(payload.size()), out);
+                    write_data(utils::crc32c(payload.data(), payload.size()), out);
+                    out.write(payload.data(), payload.size());
+                    return;
+                }
+
+                if (format.encoding == layer_encoding::dense)
+                {
+                    // the payload is size_m, size_n, values, which is exactly what layer_crc covers
+                    write_data(static_cast<uint64_t>(2 * sizeof(uint64_t) + layer.size() * sizeof(float)), out);
+                    write_data(layer_crc(size_m, size_n, layer.data_ptr()), out);
+                    write_matrix(layer, out);
+                    return;
+                }
+
+                const math::bsr_matrix<float> sparse(layer, format.block_m, format.block_n);
+                utils::memory_stream payload;
+
+                write_data(size_m, payload);
+                write_data(size_n, payload);
+                write_data(format.block_m, payload);
+                write_data(format.block_n, payload);
+                write_data(static_cast<uint64_t>(sparse.blocks()), payload);
+
+                payload.write(reinterpret_cast<const char*>(sparse.row_offsets().data()), sparse.row_offsets().size() * sizeof(uint32_t));
+                payload.write(reinterpret_cast<const char*>(sparse.column_indices().data()), sparse.column_indices().size() * sizeof(uint32_t));
+                payload.write(reinterpret_cast<const char*>(sparse.block_values().data()), sparse.block_values().size() * sizeof(float));
+
+                write_data(static_cast<uint64_t>(payload.size()), out);
+                write_data(utils::crc32c(payload.data(), payload.size()), out);
+                out.write(payload.data(), payload.size());
+            }
+
+            template<typename T>
+            bool read_array(utils::memory_stream& in, uint64_t count, std::vector<T>& values)
+            {
+                if (count > in.size() / sizeof(T))
+                    return false;
+
+                const char* bytes = in.consume(static_cast<size_t>(count) * sizeof(T));
+                if (!bytes)
+                    return false;
+
+                values.resize(static_cast<size_t>(count));
+                std::memcpy(values.data(), bytes, values.size() * sizeof(T));
+                return true;
+            }
+
+            inline bool read_block_sparse(utils::memory_stream& in, math::matrix<float>& layer, layer_format& format)
+            {
+                const uint64_t size_m = read_data<uint64_t>(in);
+                const uint64_t size_n = read_data<uint64_t>(in);
+                format.block_m = read_data<uint32_t>(in);
+                format.block_n = read_data<uint32_t>(in);
+                const uint64_t blocks = read_data<uint64_t>(in);
+
+                if (!in.good() || size_m == 0 || size_n == 0 || format.block_m == 0 || format.block_n == 0)
+                    return false;
+
+                const uint64_t block_rows = (size_m + format.block_m - 1) / format.block_m;
+
+                std::vector<uint32_t> rows;
+                std::vector<uint32_t> cols;
+                std::vector<float> values;
+
+                if (!read_array(in, block_rows + 1, rows) || !read_array(in, blocks, cols) ||
+                    !read_array(in, blocks * format.block_m * format.block_n, values) || rows.back() != blocks)
+                    return false;
+
+                const uint64_t block_cols = (size_n + format.block_n - 1) / format.block_n;
+
+                for (size_t i = 0; i + 1 < rows.size(); ++i)
+                {
+                    if (rows[i] > rows[i + 1])
+                        return false;
+                }
+
+                for (uint32_t col : cols)
+                {
+                    if (col >= block_cols)
+                        return false;
+                }
+
+                math::bsr_matrix<float> sparse(static_cast<size_t>(size_m), static_cast<size_t>(size_n), format.block_m, format.block_n,
+                    std::move(rows), std::move(cols), std::move(values));
+
+                layer = sparse.to_dense();
+                return true;
+            }
+
+            inline bool read_low_rank(utils::memory_stream& in, math::matrix<float>& layer,
+                std::optional<math::low_rank_matrix<float>>& factors)
+            {
+                math::matrix<float> u;
+                math::matrix<float> v;
+
+                if (!read_matrix(in, u) || !read_matrix(in, v) || u.size_n() != v.size_m())
+                    return false;
+
+                factors.emplace(std::move(u), std::move(v));
+                layer = factors->to_dense();
+                return true;
+            }
+
+            inline bool read_encoded_layer(utils::memory_stream& in, math::matrix<float>& layer, layer_format& format,
+                std::optional<math::low_rank_matrix<float>>& factors)
+            {
+                factors.reset();
+
+                format = layer_format{};
+                format.encoding = static_cast<layer_encoding>(read_data<uint32_t>(in));
+
+                const uint64_t size = read_data<uint64_t>(in);
+                const uint32_t crc = read_data<uint32_t>(in);
+
+                if (!in.good() || size > in.size())
+                    return false;
+
+                const char* bytes = in.consume(static_cast<size_t>(size));
+                if (!bytes || utils::crc32c(bytes, static_cast<size_t>(size)) != crc)
+                    return false;
+
+                utils::memory_stream payload(std::vector<char>(bytes, bytes + size));
+
+                switch (format.encoding)
+                {
+                case layer_encoding::dense:
+                    return read_matrix(payload, layer);
+                case layer_encoding::block_sparse:
+                    return read_block_sparse(payload, layer, format);
+                case layer_encoding::low_rank:
+                    return read_low_rank(payload, layer, factors);
+                default:
+                    return false;
+                }
+            }
+
+            // plain SGD at the stored rate, for files without an optimizer section
+            inline void default_optimizer(model_snapshot& snapshot)
+            {
+                optim::optimizer_config config;
+                config.learning_rate = snapshot.learning_rate;
+                snapshot.optimizer = optim::optimizer(config);
+            }
+
+            inline bool read_sections(utils::memory_stream& in, model_snapshot& snapshot)
+            {
+                while (!in.eof())
+                {
+                    const uint32_t tag = read_data<uint32_t>(in);
+                    const uint64_t size = read_data<uint64_t>(in);
+                    const uint32_t crc = read_data<uint32_t>(in);
+
+                    if (!in.good() || size > in.size())
+                        return false;
+
+                    const char* bytes = in.consume(static_cast<size_t>(size));
+                    if (!bytes || utils::crc32c(bytes, static_cast<size_t>(size)) != crc)
+                        return false;
+
+                    utils::memory_stream payload(std::vector<char>(bytes, bytes + size));
+
+                    if (tag == section::optimizer && !read_optimizer(payload, snapshot.optimizer))
+                        return false;
+
+                    if (tag == section::topology && !read_topology(payload, snapshot.topology))
+                        return false;
+
+                    if (tag == section::seed)
+                    {
+                        snapshot.seed = read_data<uint64_t>(payload);
+
+                        if (!payload.good())
+                            return false;
+                    }
+                }
+
+                return true;
+            }
+
+            // file_version 0 is the headerless legacy layout
+            inline bool read_layers(utils::memory_stream& in, uint32_t file_version, size_t width, model_snapshot& snapshot)
+            {
+                const uint64_t layers_num = read_size(in, width);
+                if (!in.good() || layers_num > in.size())
+                    return false;
+
+                snapshot.layers.resize(static_cast<size_t>(layers_num));
+                snapshot.formats.assign(snapshot.layers.size(), layer_format{});
+                snapshot.factors.assign(snapshot.layers.size(), std::nullopt);
+
+                for (size_t i = 0; i < snapshot.layers.size(); ++i)
+                {
+                    const bool valid = file_version >= 3
+                        ? read_encoded_layer(in, snapshot.layers[i], snapshot.formats[i], snapshot.factors[i])
+                        : read_layer(in, file_version != 0, width, snapshot.layers[i]);
+
+                    if (!valid)
+                        return false;
+                }
+
+                return file_version != 0 || in.eof();
+            }
+        }
+
+        inline void serialize(const model_snapshot& snapshot, utils::memory_stream& out)
+        {
+            size_t total = 0;
+            for (const auto& layer : snapshot.layers)
+                total += layer.size() * sizeof(float) + 3 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+            out.clear();
+            out.reserve(total + 64);
+
+            write_data(magic, out);
+            write_data(version, out);
+            write_data(snapshot.learning_rate, out);
+            write_data(static_cast<uint64_t>(snapshot.layers.size()), out);
+
+            for (size_t i = 0; i < snapshot.layers.size(); ++i)
+            {
+                detail::write_layer(snapshot.layers[i],
+                    i < snapshot.formats.size() ? snapshot.formats[i] : layer_format{},
+                    i < snapshot.factors.size() ? snapshot.factors[i] : std::nullopt, out);
+            }
+
+            utils::memory_stream payload;
+            detail::write_optimizer(snapshot.optimizer, payload);
+            detail::write_section(section::optimizer, payload, out);
+
+            payload.clear();
+            write_data(snapshot.seed, payload);
+            detail::write_section(section::seed, payload, out);
+
+            if (!snapshot.topology.empty())
+            {
+                payload.clear();
+                detail::write_topology(snapshot.topology, payload);
+                detail::write_section(section::topology, payload, out);
+            }
+        }
+
+        // Parses a model file; snapshot is only meaningful when true is returned
+        inline bool deserialize(utils::memory_stream& in, model_snapshot& snapshot)
+        {
+            const uint32_t head = read_data<uint32_t>(in);
+            snapshot.seed = 0;
+            snapshot.topology = network_topology{};
+
+            if (head != magic)
+            {
+                std::memcpy(&snapshot.learning_rate, &head, sizeof(float));
+
+                const size_t layers_start = in.tell();
+
+                for (size_t width : { sizeof(uint32_t), sizeof(uint64_t) })
+                {
+                    in.rewind();
+                    in.consume(layers_start);
+
+                    if (detail::read_layers(in, 0, width, snapshot))
+                    {
+                        detail::default_optimizer(snapshot);
+                        return true;
+                    }
+                }
+
+                utils::Logger::Error("model", "unrecognized model file layout");
+                return false;
+            }
+
+            const uint32_t file_version = read_data<uint32_t>(in);
+            if (file_version > version)
+            {
+                utils::Logger::Error("model", "unsupported model file version: " + std::to_string(file_version));
+                return false;
+            }
+
+            snapshot.learning_rate = read_data<float>(in);
+            detail::default_optimizer(snapshot);
+
+            if (!detail::read_layers(in, file_version, sizeof(uint64_t), snapshot) || !detail::read_sections(in, snapshot))
+            {
+                utils::Logger::Error("model", "model file is truncated or corrupted");
+                return false;
+            }
+
+            return true;
+        }
+
+        // Layer sizes of a perceptron file, inputs first, from the layer headers alone: the payloads
+        // are skipped unread and unchecked. Files older than version 3 are parsed in full. False if
+        // the file cannot be read or its layers do not chain, as in a convolutional network.
+        inline bool read_shape(const std::string& fileName, std::vector<size_t>& sizes)
+        {
+            sizes.clear();
+            std::ifstream file(fileName, std::ios::binary);
+
+            if (!file)
+            {
+                utils::Logger::Error("model", "could not open model file: " + fileName);
+                return false;
+            }
+
+            const uint32_t head = read_data<uint32_t>(file);
+            const uint32_t file_version = read_data<uint32_t>(file);
+            read_data<float>(file);
+            const uint64_t layers_num = read_data<uint64_t>(file);
+
+            if (file && head == magic && file_version >= 3 && file_version <= version)
+            {
+                for (uint64_t i = 0; i < layers_num && file; ++i)
+                {
+                    const auto encoding = static_cast<layer_encoding>(read_data<uint32_t>(file));
+                    const uint64_t size = read_data<uint64_t>(file);
+                    read_data<uint32_t>(file);
+                    const std::streamoff payload = file.tellg();
+
+                    // every encoding starts with size_m, size_n, except low rank: left (size_m x rank), right (rank x size_n)
+                    uint64_t size_m = read_data<uint64_t>(file);
+                    uint64_t size_n = read_data<uint64_t>(file);
+
+                    if (encoding == layer_encoding::low_rank)
+                    {
+                        file.seekg(static_cast<std::streamoff>(size_m * size_n * sizeof(float)), std::ios::cur);
+                        read_data<uint64_t>(file);
+                        size_n = read_data<uint64_t>(file);
+                    }
+
+                    if (i == 0)
+                        sizes.push_back(static_cast<size_t>(size_n));
+                    else if (sizes.back() != size_n)
+                        break;
+
+                    sizes.push_back(static_cast<size_t>(size_m));
+                    file.seekg(payload + static_cast<std::streamoff>(size), std::ios::beg);
+                }
+
+                if (file && sizes.size() == layers_num + 1)
+                    return true;
+            }
+            else
+            {
+                std::vector<char> bytes;
+                model_snapshot snapshot;
+
+                if (utils::read_file(fileName, bytes))
+                {
+                    utils::memory_stream in(std::move(bytes));
+
+                    if (deserialize(in, snapshot) && snapshot.topology.empty() && !snapshot.layers.empty())
+                    {
+                        sizes.push_back(snapshot.layers.front().size_n());
+                        for (const auto& layer : snapshot.layers)
+                            sizes.push_back(layer.size_m());
+
+                        return true;
+                    }
+                }
+            }
+
+            sizes.clear();
+            utils::Logger::Error("model", "could not read the layer sizes of " + fileName);
+            return false;
+        }
+    }
+}
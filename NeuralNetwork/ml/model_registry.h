@@ -0,0 +1,282 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <unordered_map>
+#include <algorithm>
+
+#include "perceptron.h"
+#include "tuning_cache.h"
+#include "../utils/epoch.h"
+#include "../utils/logger.h"
+
+namespace ml
+{
+    // One published model; never modified after publication
+    struct model_version
+    {
+        std::string name;
+        uint64_t version = 0;
+        perceptron model;
+    };
+
+    // A pinned reference to a published version. The version stays alive while any reference to it
+    // exists, even after a newer one is published; a reference must be released on the thread that
+    // acquired it, and holding one delays the reclamation of every version retired meanwhile.
+    class model_ref
+    {
+    public:
+        model_ref() = default;
+
+        model_ref(model_ref&& other) noexcept : guard(std::move(other.guard)), current(other.current)
+        {
+            other.current = nullptr;
+        }
+
+        model_ref& operator=(model_ref&&) = delete;
+
+        explicit operator bool() const
+        {
+            return current != nullptr;
+        }
+
+        const model_version* operator->() const
+        {
+            return current;
+        }
+
+        const model_version& operator*() const
+        {
+            return *current;
+        }
+
+        const perceptron& model() const
+        {
+            return current->model;
+        }
+
+    private:
+        friend class model_registry;
+
+        model_ref(utils::epoch_guard&& guard, const model_version* current) : guard(std::move(guard)), current(current) {}
+
+        std::optional<utils::epoch_guard> guard;
+        const model_version* current = nullptr;
+    };
+
+    // Named, versioned, immutable models that can be replaced while they serve requests.
+    //
+    // acquire() takes no lock: it pins the epoch, looks the name up in the current directory and
+    // loads the current version, all through atomic pointers. publish() builds the new version off
+    // to the side, swaps it in atomically and retires the old one, which is destroyed once the last
+    // inference started on it has finished. Writers are serialized by a mutex.
+    class model_registry
+    {
+    public:
+        model_registry() : directory(new entries_list()) {}
+
+        model_registry(const model_registry&) = delete;
+        model_registry& operator=(const model_registry&) = delete;
+
+        // No acquire() may run concurrently with destruction
+        ~model_registry()
+        {
+            const entries_list* list = directory.load();
+
+            for (entry* e : *list)
+            {
+                delete e->current.load();
+                delete e;
+            }
+
+            delete list;
+        }
+
+        // Makes model the current version of name and returns its version number (1 for a new name)
+        uint64_t publish(const std::string& name, perceptron&& model)
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+            return install(find_or_add(name), std::move(model));
+        }
+
+        // publish() only while expected is still the current version of name, so that a model derived
+        // from that version does not overwrite one published in the meantime. Empty, with model left
+        // untouched, if another version was published or name was removed.
+        std::optional<uint64_t> publish_if(const std::string& name, uint64_t expected, perceptron&& model)
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+
+            entry* e = find(name);
+            const model_version* current = e ? e->current.load() : nullptr;
+
+            if (!current || current->version != expected)
+                return {};
+
+            return install(e, std::move(model));
+        }
+
+        // Kernel tunings that publish_loaded() installs in the models read from files, e.g. the host's
+        // tuning cache loaded at startup; models of shapes the cache does not cover keep the defaults
+        void set_tuning(const tuning_cache& cache)
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+            tuning = cache;
+        }
+
+        // Loads a model file and publishes it; the current version keeps serving until the file is
+        // fully read and verified. Empty if the file could not be loaded.
+        std::optional<uint64_t> load(const std::string& name, const std::string& path)
+        {
+            perceptron loaded;
+
+            if (!loaded.load(path))
+                return {};
+
+            return publish_loaded(name, std::move(loaded), path);
+        }
+
+        // publish() for a model read from path by load() or an asynchronous loader: applies the
+        // tuning set by set_tuning() first
+        uint64_t publish_loaded(const std::string& name, perceptron&& model, const std::string& path)
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+
+            if (tuning && tuning->apply(model))
+                utils::Logger::Info("registry", name + " uses the tuned kernel parameters of this host");
+
+            const uint64_t version = install(find_or_add(name), std::move(model));
+            utils::Logger::Info("registry", name + " version " + std::to_string(version) + " published from " + path);
+            return version;
+        }
+
+        // Current version of name; an empty reference if there is none
+        model_ref acquire(const std::string& name) const
+        {
+            utils::epoch_guard guard;
+
+            const entries_list* list = directory.load(std::memory_order_seq_cst);
+            auto it = std::lower_bound(list->begin(), list->end(), name, [](const entry* e, const std::string& key) { return e->name < key; });
+
+            if (it == list->end() || (*it)->name != name)
+                return model_ref();
+
+            const model_version* current = (*it)->current.load(std::memory_order_seq_cst);
+            if (!current)
+                return model_ref();
+
+            return model_ref(std::move(guard), current);
+        }
+
+        // Unpublishes name; references already handed out stay valid
+        bool remove(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(writer_mutex);
+
+            const entries_list* list = directory.load();
+            auto it = std::find_if(list->begin(), list->end(), [&](const entry* e) { return e->name == name; });
+
+            if (it == list->end())
+                return false;
+
+            entry* e = *it;
+            auto next = new entries_list(*list);
+            next->erase(next->begin() + (it - list->begin()));
+
+            directory.store(next, std::memory_order_seq_cst);
+
+            const model_version* old = e->current.exchange(nullptr);
+
+            // readers reach entries only through a directory, so the entry goes with the old one
+            removed_versions[name] = e->last_version;
+            utils::epoch_domain::instance().retire([list, old, e] { delete list; delete old; delete e; });
+            return true;
+        }
+
+        // Names with their current version numbers, sorted by name
+        std::vector<std::pair<std::string, uint64_t>> versions() const
+        {
+            utils::epoch_guard guard;
+            std::vector<std::pair<std::string, uint64_t>> result;
+
+            for (const entry* e : *directory.load(std::memory_order_seq_cst))
+            {
+                if (const model_version* current = e->current.load(std::memory_order_seq_cst))
+                    result.emplace_back(e->name, current->version);
+            }
+
+            return result;
+        }
+
+    private:
+        struct entry
+        {
+            std::string name;
+            std::atomic<const model_version*> current{ nullptr };
+            uint64_t last_version = 0;
+        };
+
+        // sorted by name, replaced as a whole when a name is added or removed
+        using entries_list = std::vector<entry*>;
+
+        // writer_mutex held
+        uint64_t install(entry* e, perceptron&& model)
+        {
+            const model_version* old = e->current.load();
+
+            auto next = new model_version();
+            next->name = e->name;
+            next->version = ++e->last_version;
+            next->model = std::move(model);
+
+            e->current.store(next, std::memory_order_seq_cst);
+
+            if (old)
+                utils::epoch_domain::instance().retire([old] { delete old; });
+
+            return next->version;
+        }
+
+        // writer_mutex held; nullptr if name is not published
+        entry* find(const std::string& name) const
+        {
+            const entries_list* list = directory.load();
+            auto it = std::lower_bound(list->begin(), list->end(), name, [](const entry* e, const std::string& key) { return e->name < key; });
+
+            return it != list->end() && (*it)->name == name ? *it : nullptr;
+        }
+
+        entry* find_or_add(const std::string& name)
+        {
+            const entries_list* list = directory.load();
+            auto it = std::lower_bound(list->begin(), list->end(), name, [](const entry* e, const std::string& key) { return e->name < key; });
+
+            if (it != list->end() && (*it)->name == name)
+                return *it;
+
+            auto e = new entry();
+            e->name = name;
+
+            // a re-added name continues its version numbers
+            auto previous = removed_versions.find(name);
+            if (previous != removed_versions.end())
+                e->last_version = previous->second;
+
+            auto next = new entries_list(*list);
+            next->insert(next->begin() + (it - list->begin()), e);
+
+            directory.store(next, std::memory_order_seq_cst);
+            utils::epoch_domain::instance().retire([list] { delete list; });
+            return e;
+        }
+
+        std::atomic<const entries_list*> directory;
+
+        std::mutex writer_mutex;
+        std::unordered_map<std::string, uint64_t> removed_versions;
+        std::optional<tuning_cache> tuning;
+    };
+}
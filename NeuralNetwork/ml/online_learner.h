@@ -0,0 +1,467 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <condition_variable>
+
+#include "perceptron.h"
+#include "model_registry.h"
+#include "../math/matrix.h"
+#include "../utils/logger.h"
+
+namespace ml
+{
+    // small steps: the stream fine-tunes a trained model
+    inline optim::optimizer_config online_optimizer()
+    {
+        optim::optimizer_config config;
+        config.type = optim::optimizer_type::sgd;
+        config.learning_rate = 0.05f;
+        return config;
+    }
+
+    struct online_config
+    {
+        // clamped to queue_capacity, which a batch has to fit in
+        size_t batch_size = 16;
+        // optimizer steps per second at most; 0 removes the cap
+        float max_updates_per_second = 10.f;
+
+        // labeled samples waiting for training; beyond this the oldest are dropped
+        size_t queue_capacity = 4096;
+        // every holdout_every-th sample goes to the holdout buffer instead of training (0 disables)
+        size_t holdout_every = 5;
+        // the holdout keeps the latest samples up to this count
+        size_t holdout_capacity = 1000;
+
+        // the shadow weights become a publication candidate every publish_every updates
+        size_t publish_every = 20;
+        // a candidate is only judged, and published, once the holdout has this many samples
+        size_t min_holdout = 50;
+        // a candidate more than this much below the live model's holdout accuracy is rolled back
+        float max_accuracy_drop = 0.01f;
+
+        optim::optimizer_config optimizer = online_optimizer();
+    };
+
+    struct online_stats
+    {
+        uint64_t received = 0;
+        // samples pushed out of a full queue before being trained on
+        uint64_t dropped = 0;
+        uint64_t trained = 0;
+        uint64_t updates = 0;
+        uint64_t published = 0;
+        uint64_t rollbacks = 0;
+        // restarts from a version published by someone else (e.g. a model loaded from disk)
+        uint64_t rebases = 0;
+
+        size_t queued = 0;
+        size_t holdout = 0;
+        // accuracies on the holdout at the last candidate check
+        float live_accuracy = 0.f;
+        float candidate_accuracy = 0.f;
+
+        // queued and held-out samples, the holdout copy judged at checks, and the shadow weights with
+        // their gradients and optimizer state; the published versions belong to the registry
+        size_t memory_bytes = 0;
+    };
+
+    // Fine-tunes a served perceptron from a stream of labeled samples (e.g. user corrections)
+    // without interrupting inference.
+    //
+    // submit() only copies the sample into a bounded queue. A background thread trains a shadow
+    // copy of the published weights with mini-batch updates, at most max_updates_per_second of them.
+    // Every publish_every updates the shadow is compared with the live model on the holdout buffer:
+    // a candidate that keeps its accuracy is published through the registry, so readers switch to it
+    // without locking, one that lost more than max_accuracy_drop is rolled back to the live weights.
+    // A version published by anyone else replaces the shadow. The live model is read from the
+    // registry rather than copied, so memory is bounded by the queue and holdout capacities plus one
+    // training copy of the model.
+    class online_learner
+    {
+    public:
+        online_learner(model_registry& registry, const std::string& name, const online_config& config = online_config())
+            : registry(registry), name(name), config(config) {}
+
+        online_learner(const online_learner&) = delete;
+        online_learner& operator=(const online_learner&) = delete;
+
+        ~online_learner()
+        {
+            stop();
+        }
+
+        // Starts training on the current version of name; false if nothing is published under it
+        bool start()
+        {
+            if (worker.joinable())
+                return true;
+
+            if (!rebase())
+            {
+                utils::Logger::Error("online", "no model published as " + name);
+                return false;
+            }
+
+            stopping = false;
+            worker = std::thread([this] { loop(); });
+            return true;
+        }
+
+        // Finishes the update in progress; queued samples are kept for a later start()
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+
+            wake.notify_all();
+
+            if (worker.joinable())
+                worker.join();
+        }
+
+        // Queues a copy of one sample (model inputs, normalized like the training data); never waits
+        // for training. False if size or label does not fit the model.
+        bool submit(const float* input, size_t size, size_t label)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                // checked under the lock so that a rebase to another shape drops it with the rest
+                if (size != input_size || label >= output_size)
+                    return false;
+
+                ++counters.received;
+
+                if (config.holdout_every != 0 && counters.received % config.holdout_every == 0)
+                {
+                    if (holdout_labels.size() < config.holdout_capacity)
+                    {
+                        holdout_inputs.insert(holdout_inputs.end(), input, input + size);
+                        holdout_labels.push_back(label);
+                    }
+                    else if (config.holdout_capacity != 0)
+                    {
+                        const size_t slot = holdout_next++ % config.holdout_capacity;
+                        std::copy(input, input + size, holdout_inputs.begin() + slot * size);
+                        holdout_labels[slot] = label;
+                    }
+
+                    return true;
+                }
+
+                if (queue.size() >= std::max<size_t>(config.queue_capacity, 1))
+                {
+                    queue.pop_front();
+                    ++counters.dropped;
+                }
+
+                queue.push_back(sample{ std::vector<float>(input, input + size), label });
+            }
+
+            wake.notify_one();
+            return true;
+        }
+
+        online_stats stats() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            online_stats result = counters;
+            result.queued = queue.size();
+            result.holdout = holdout_labels.size();
+            result.memory_bytes = queue.size() * (sizeof(sample) + input_size * sizeof(float))
+                + holdout_inputs.capacity() * sizeof(float) + holdout_labels.capacity() * sizeof(size_t)
+                + judged_bytes.load() + shadow_bytes.load();
+            return result;
+        }
+
+    private:
+        struct sample
+        {
+            std::vector<float> input;
+            size_t label = 0;
+        };
+
+        // A full queue could never reach a larger batch
+        size_t batch_size() const
+        {
+            return std::min(std::max<size_t>(config.batch_size, 1), std::max<size_t>(config.queue_capacity, 1));
+        }
+
+        // Makes the registry's current version the shadow
+        bool rebase()
+        {
+            const auto current = registry.acquire(name);
+            if (!current)
+                return false;
+
+            live_version = current->version;
+
+            shadow = current.model();
+            shadow.set_optimizer(config.optimizer);
+
+            // training keeps a gradient per weight besides the optimizer's state
+            size_t weights = 0;
+            for (size_t i = 0; i < shadow.layer_count(); ++i)
+                weights += shadow.layer(i).size();
+
+            shadow_bytes = weights * sizeof(float) * (2 + shadow.get_optimizer().slots_per_param());
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                const size_t inputs = shadow.layer(0).size_n();
+                const size_t outputs = shadow.layer(shadow.layer_count() - 1).size_m();
+
+                // samples for a model of another shape cannot train or judge this one
+                if (inputs != input_size || outputs != output_size)
+                {
+                    input_size = inputs;
+                    output_size = outputs;
+
+                    queue.erase(std::remove_if(queue.begin(), queue.end(), [this](const sample& s) { return !fits(s); }), queue.end());
+                    holdout_inputs.clear();
+                    holdout_labels.clear();
+                    holdout_next = 0;
+                }
+            }
+
+            updates_since_check = 0;
+            return true;
+        }
+
+        void loop()
+        {
+            const auto interval = config.max_updates_per_second > 0.f
+                ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / config.max_updates_per_second))
+                : std::chrono::steady_clock::duration::zero();
+
+            auto next_update = std::chrono::steady_clock::now();
+            std::vector<sample> batch;
+
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+
+                    if (wake.wait_until(lock, next_update, [this] { return stopping; }))
+                        return;
+
+                    wake.wait(lock, [this] { return stopping || queue.size() >= batch_size(); });
+                    if (stopping)
+                        return;
+
+                    batch.clear();
+                    for (size_t i = 0; i < batch_size(); ++i)
+                    {
+                        batch.push_back(std::move(queue.front()));
+                        queue.pop_front();
+                    }
+                }
+
+                next_update = std::chrono::steady_clock::now() + interval;
+
+                // somebody else published (e.g. a model loaded from disk): continue from it
+                {
+                    const auto current = registry.acquire(name);
+
+                    if (current && current->version != live_version)
+                    {
+                        rebase();
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ++counters.rebases;
+                    }
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    batch.erase(std::remove_if(batch.begin(), batch.end(), [this](const sample& s) { return !fits(s); }), batch.end());
+                }
+
+                if (batch.empty())
+                    continue;
+
+                math::matrix<float> inputs;
+                math::matrix<float> targets;
+                pack(batch, output_size, inputs, targets);
+
+                shadow.train_batch(inputs, targets);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    counters.trained += batch.size();
+                    ++counters.updates;
+                }
+
+                if (++updates_since_check >= std::max<size_t>(config.publish_every, 1))
+                    check_candidate();
+            }
+        }
+
+        void check_candidate()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (holdout_labels.size() < config.min_holdout || holdout_labels.empty())
+                    return;
+
+                // the rows are evaluated in place from this copy; its buffers are reused across checks
+                judged_inputs.assign(holdout_inputs.begin(), holdout_inputs.end());
+                judged_labels.assign(holdout_labels.begin(), holdout_labels.end());
+            }
+
+            judged_bytes = judged_inputs.capacity() * sizeof(float) + judged_labels.capacity() * sizeof(size_t);
+            updates_since_check = 0;
+
+            float live_accuracy = 0.f;
+            float candidate_accuracy = 0.f;
+            bool rolled_back = false;
+            bool rebased = false;
+
+            {
+                const auto current = registry.acquire(name);
+
+                if (!current || current->version != live_version)
+                {
+                    rebased = true;
+                }
+                else
+                {
+                    live_accuracy = accuracy(current.model());
+                    candidate_accuracy = accuracy(shadow);
+
+                    if (candidate_accuracy + config.max_accuracy_drop < live_accuracy)
+                    {
+                        // keep the shadow's optimizer settings, drop its weights
+                        shadow = current.model();
+                        shadow.set_optimizer(config.optimizer);
+                        rolled_back = true;
+
+                        utils::Logger::Warning("online", name + ": candidate holdout accuracy " + std::to_string(candidate_accuracy) +
+                            " below live " + std::to_string(live_accuracy) + ", rolled back");
+                    }
+                }
+            }
+
+            if (!rebased && !rolled_back)
+            {
+                // the copy becomes the registry's version; the shadow trains on
+                if (const auto version = registry.publish_if(name, live_version, perceptron(shadow)))
+                    live_version = *version;
+                else
+                    rebased = true;
+            }
+
+            // published by someone else meanwhile: the candidate is based on a replaced version
+            if (rebased)
+                rebase();
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (rebased)
+            {
+                ++counters.rebases;
+                return;
+            }
+
+            counters.live_accuracy = live_accuracy;
+            counters.candidate_accuracy = candidate_accuracy;
+
+            if (rolled_back)
+                ++counters.rollbacks;
+            else
+                ++counters.published;
+        }
+
+        // called with mutex held
+        bool fits(const sample& s) const
+        {
+            return s.input.size() == input_size && s.label < output_size;
+        }
+
+        // one sample per column, targets encoded like mnist::make_batch over the model's outputs
+        static void pack(const std::vector<sample>& samples, size_t outputs, math::matrix<float>& inputs, math::matrix<float>& targets)
+        {
+            const size_t count = samples.size();
+            const size_t size = samples.front().input.size();
+            inputs = math::matrix<float>(size, count);
+            targets = math::matrix<float>(outputs, count);
+
+            std::fill(targets.begin(), targets.end(), 0.01f);
+
+            for (size_t col = 0; col < count; ++col)
+            {
+                for (size_t k = 0; k < size; ++k)
+                    inputs.data_ptr()[k * count + col] = samples[col].input[k];
+
+                targets.data_ptr()[samples[col].label * count + col] = 0.99f;
+            }
+        }
+
+        // share of the judged holdout rows that model labels correctly
+        float accuracy(const perceptron& model) const
+        {
+            const size_t count = judged_labels.size();
+            const auto outputs = model.forward_rows(judged_inputs.data(), count, judged_inputs.size() / count, [](float value) { return value; });
+            const size_t classes = outputs.size_m();
+            size_t right = 0;
+
+            for (size_t col = 0; col < count; ++col)
+            {
+                size_t predicted = 0;
+
+                for (size_t row = 1; row < classes; ++row)
+                {
+                    if (outputs.data_ptr()[row * count + col] > outputs.data_ptr()[predicted * count + col])
+                        predicted = row;
+                }
+
+                right += predicted == judged_labels[col];
+            }
+
+            return static_cast<float>(right) / static_cast<float>(count);
+        }
+
+        model_registry& registry;
+        const std::string name;
+        const online_config config;
+
+        // owned by the worker thread once it runs
+        perceptron shadow;
+        uint64_t live_version = 0;
+        size_t updates_since_check = 0;
+        std::vector<float> judged_inputs;
+        std::vector<size_t> judged_labels;
+
+        std::atomic<size_t> shadow_bytes{ 0 };
+        std::atomic<size_t> judged_bytes{ 0 };
+
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+        // shape of the model being trained; samples must fit it
+        size_t input_size = 0;
+        size_t output_size = 0;
+        std::deque<sample> queue;
+        // holdout_labels.size() rows of input_size values, replaced round robin once full
+        std::vector<float> holdout_inputs;
+        std::vector<size_t> holdout_labels;
+        size_t holdout_next = 0;
+        online_stats counters;
+
+        std::thread worker;
+    };
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+
+#include "lr_schedule.h"
+#include "../math/matrix.h"
+
+namespace ml
+{
+    namespace optim
+    {
+        enum class optimizer_type : uint32_t
+        {
+            sgd = 0,
+            momentum = 1,
+            nesterov = 2,
+            adam = 3,
+            adamw = 4
+        };
+
+        struct optimizer_config
+        {
+            optimizer_type type = optimizer_type::sgd;
+            float learning_rate = 0.3f;
+            float momentum = 0.9f;
+            float beta1 = 0.9f;
+            float beta2 = 0.999f;
+            float epsilon = 1e-8f;
+            // L2 penalty for sgd/momentum/nesterov/adam, decoupled decay for adamw
+            float weight_decay = 0.f;
+            lr_schedule schedule;
+        };
+
+        // Fused update kernels: one pass over weights, gradient and optimizer state.
+        // Plain indexed loops over restrict pointers so the compiler vectorizes them.
+        namespace kernels
+        {
+            inline void sgd(float* __restrict w, const float* __restrict g, size_t n, float lr, float decay)
+            {
+                for (size_t i = 0; i < n; ++i)
+                    w[i] -= lr * (g[i] + decay * w[i]);
+            }
+
+            inline void momentum(float* __restrict w, const float* __restrict g, float* __restrict v,
+                size_t n, float lr, float mu, float decay)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    const float grad = g[i] + decay * w[i];
+                    v[i] = mu * v[i] + grad;
+                    w[i] -= lr * v[i];
+                }
+            }
+
+            inline void nesterov(float* __restrict w, const float* __restrict g, float* __restrict v,
+                size_t n, float lr, float mu, float decay)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    const float grad = g[i] + decay * w[i];
+                    v[i] = mu * v[i] + grad;
+                    w[i] -= lr * (grad + mu * v[i]);
+                }
+            }
+
+            // l2 is added to the gradient (Adam), decoupled is applied to the weights directly (AdamW)
+            inline void adam(float* __restrict w, const float* __restrict g, float* __restrict m, float* __restrict v,
+                size_t n, float lr, float beta1, float beta2, float epsilon, float correction1, float correction2,
+                float l2, float decoupled)
+            {
+                const float step = lr / correction1;
+                const float inv_correction2 = 1.f / correction2;
+
+                for (size_t i = 0; i < n; ++i)
+                {
+                    const float grad = g[i] + l2 * w[i];
+                    m[i] = beta1 * m[i] + (1.f - beta1) * grad;
+                    v[i] = beta2 * v[i] + (1.f - beta2) * grad * grad;
+                    w[i] -= step * m[i] / (std::sqrt(v[i] * inv_correction2) + epsilon) + lr * decoupled * w[i];
+                }
+            }
+        }
+
+        // Applies gradients to a set of parameter matrices. The per-parameter state (velocity,
+        // Adam moments) is kept as matrices of the same shape so it is stored like the weights.
+        class optimizer
+        {
+        public:
+            optimizer() = default;
+
+            explicit optimizer(const optimizer_config& config) : settings(config) {}
+
+            const optimizer_config& config() const
+            {
+                return settings;
+            }
+
+            uint64_t steps() const
+            {
+                return step_count;
+            }
+
+            float current_rate() const
+            {
+                return settings.schedule.rate(settings.learning_rate, step_count);
+            }
+
+            // number of state matrices kept per parameter
+            size_t slots_per_param() const
+            {
+                switch (settings.type)
+                {
+                case optimizer_type::momentum:
+                case optimizer_type::nesterov:
+                    return 1;
+                case optimizer_type::adam:
+                case optimizer_type::adamw:
+                    return 2;
+                default:
+                    return 0;
+                }
+            }
+
+            void step(std::vector<math::matrix<float>>& params, const std::vector<math::matrix<float>>& grads)
+            {
+                assert(params.size() == grads.size() && "parameters and gradients do not match");
+
+                prepare_state(params);
+
+                const float lr = current_rate();
+                ++step_count;
+
+                const float correction1 = 1.f - std::pow(settings.beta1, static_cast<float>(step_count));
+                const float correction2 = 1.f - std::pow(settings.beta2, static_cast<float>(step_count));
+
+                for (size_t p = 0; p < params.size(); ++p)
+                {
+                    assert(params[p].size() == grads[p].size() && "gradient size mismatch");
+
+                    float* w = params[p].data_ptr();
+                    const float* g = grads[p].data_ptr();
+                    const size_t n = params[p].size();
+
+                    switch (settings.type)
+                    {
+                    case optimizer_type::momentum:
+                        kernels::momentum(w, g, slot(p, 0), n, lr, settings.momentum, settings.weight_decay);
+                        break;
+
+                    case optimizer_type::nesterov:
+                        kernels::nesterov(w, g, slot(p, 0), n, lr, settings.momentum, settings.weight_decay);
+                        break;
+
+                    case optimizer_type::adam:
+                    case optimizer_type::adamw:
+                    {
+                        const bool decoupled = settings.type == optimizer_type::adamw;
+
+                        kernels::adam(w, g, slot(p, 0), slot(p, 1), n, lr, settings.beta1, settings.beta2,
+                            settings.epsilon, correction1, correction2,
+                            decoupled ? 0.f : settings.weight_decay, decoupled ? settings.weight_decay : 0.f);
+                        break;
+                    }
+
+                    default:
+                        kernels::sgd(w, g, n, lr, settings.weight_decay);
+                        break;
+                    }
+                }
+            }
+
+            // state access for checkpoints
+            std::vector<math::matrix<float>>& state()
+            {
+                return slots;
+            }
+
+            const std::vector<math::matrix<float>>& state() const
+            {
+                return slots;
+            }
+
+            void restore(const optimizer_config& config, uint64_t steps, std::vector<math::matrix<float>>&& state)
+            {
+                settings = config;
+                step_count = steps;
+                slots = std::move(state);
+            }
+
+            void reset()
+            {
+                step_count = 0;
+                slots.clear();
+            }
+
+            // True when the state is empty or holds slots_per_param() matrices shaped like each of
+            // params, i.e. state restored from a file belongs to these parameters
+            bool fits(const std::vector<math::matrix<float>>& params) const
+            {
+                const size_t per_param = slots_per_param();
+
+                if (slots.empty())
+                    return true;
+
+                if (slots.size() != params.size() * per_param)
+                    return false;
+
+                for (size_t p = 0; p < params.size(); ++p)
+                {
+                    for (size_t i = 0; i < per_param; ++i)
+                    {
+                        const auto& state = slots[p * per_param + i];
+
+                        if (state.size_m() != params[p].size_m() || state.size_n() != params[p].size_n())
+                            return false;
+                    }
+                }
+
+                return true;
+            }
+
+        private:
+            float* slot(size_t param, size_t index)
+            {
+                return slots[param * slots_per_param() + index].data_ptr();
+            }
+
+            void prepare_state(const std::vector<math::matrix<float>>& params)
+            {
+                const size_t per_param = slots_per_param();
+
+                if (slots.size() == params.size() * per_param && fits(params))
+                    return;
+
+                slots.clear();
+                slots.reserve(params.size() * per_param);
+
+                for (const auto& param : params)
+                {
+                    for (size_t i = 0; i < per_param; ++i)
+                        slots.emplace_back(param.size_m(), param.size_n());
+                }
+            }
+
+        private:
+            optimizer_config settings;
+            uint64_t step_count = 0;
+            std::vector<math::matrix<float>> slots;
+        };
+    }
+}
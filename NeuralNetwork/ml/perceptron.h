@@ -2,164 +2,1060 @@
 
 #include <vector>
 #include <stack>
-#include <random>
-#include <iostream>
+#include <atomic>
+#include <utility>
+#include <type_traits>
 #include <math.h>
-#include <fstream>
+#include <optional>
 #include <initializer_list>
 
-#include "..\math\matrix.h"
-#include "..\math\functions.h"
-#include "..\utils\binary.h"
+#include "model_file.h"
+#include "optimizer.h"
+#include "../math/matrix.h"
+#include "../math/sparse_matrix.h"
+#include "../math/low_rank_matrix.h"
+#include "../math/functions.h"
+#include "../utils/atomic_file.h"
+#include "../utils/cpu_caches.h"
+#include "../utils/logger.h"
+#include "../utils/memory.h"
+#include "../utils/memory_stream.h"
+#include "../utils/profiler.h"
+#include "../utils/thread_pool.h"
+#include "../utils/random.h"
 
 namespace ml
 {
+    // Inference kernel parameters of a perceptron, measured per machine by ml::autotuner. Every
+    // choice gives the same outputs; zeros leave a parameter to its built-in heuristic.
+    struct forward_tuning
+    {
+        // the fused tile kernel, or one GEMM per layer
+        bool fused = true;
+        // samples per fused tile, the micro-batch that goes through all layers at once
+        size_t tile = 0;
+        // output rows the fused kernel accumulates together: 1, 2, 4 or 8
+        size_t row_block = 4;
+        // pool threads one forward pass may occupy
+        size_t threads = 0;
+    };
+
     class perceptron
     {
     public:
+        // the sparse kernels beat the dense product below this fraction of stored blocks
+        static constexpr float sparse_density_threshold = 0.3f;
+
+        // a blank MNIST pixel after mnist::normalize_pixel, the default background of set_sparse_input
+        static constexpr float normalized_blank_pixel = 0.01f;
+
+        // upper bound of the samples per tile of the fused forward pass
+        static constexpr size_t max_fused_tile = 128;
+
         perceptron() {}
 
-        explicit perceptron(std::initializer_list<size_t> list, float learning_rate = 0.3)
+        // The initial weights are a function of seed alone; without one a random seed is drawn.
+        // Either way seed() reports it and save() records it.
+        explicit perceptron(std::initializer_list<size_t> list, float learning_rate = 0.3, uint64_t seed = utils::random_seed())
         {
-            this->learning_rate = learning_rate;
+            optim::optimizer_config config;
+            config.learning_rate = learning_rate;
 
-            for (auto it = list.begin(); it != list.end() - 1; ++it)
-            {
-                layers.emplace_back(math::matrix<float>(*(it + 1), *it));
-            }
+            build(list, config, seed);
+        }
 
-            weight_initialization();
+        perceptron(std::initializer_list<size_t> list, const optim::optimizer_config& config, uint64_t seed = utils::random_seed())
+        {
+            build(list, config, seed);
+        }
+
+        // layer sizes known only at run time, inputs first
+        perceptron(const std::vector<size_t>& sizes, const optim::optimizer_config& config, uint64_t seed = utils::random_seed())
+        {
+            build(sizes, config, seed);
         }
 
         void train(const std::vector<float>& input_values, const std::vector<float>& target_values)
         {
-            math::matrix<float> output(input_values.size(), 1, input_values);
+            math::matrix<float> input(input_values.size(), 1, input_values);
             math::matrix<float> target(target_values.size(), 1, target_values);
 
-            std::vector<math::matrix<float>> outputs;
+            train_batch(input, target);
+        }
 
-            outputs.push_back(output);
+        // inputs and targets hold one sample per column
+        void train_batch(const math::matrix<float>& inputs, const math::matrix<float>& targets)
+        {
+            compute_gradients(inputs, targets, gradients);
+            apply_gradients(gradients);
+        }
 
-            for (auto& layer : layers)
+        // One optimizer step with externally computed (e.g. all-reduced) gradients
+        void apply_gradients(const std::vector<math::matrix<float>>& grads)
+        {
+            optimizer.step(layers, grads);
+
+            // the inference copies no longer match the weights; low rank layers fall back to dense
+            sparse_layers.clear();
+            refresh_sparse_input();
+
+            for (size_t i = 0; i < factored_layers.size(); ++i)
             {
-                auto layer_outputs = layer * output;
+                if (factored_layers[i])
+                {
+                    factored_layers[i].reset();
+                    formats[i] = layer_format{};
+                }
+            }
+        }
 
-                std::for_each(layer_outputs.begin(), layer_outputs.end(),
-                    [](float& item) { item = function::sigmoid_function(item); });
+        // Gradients of the squared error averaged over the batch, one matrix per layer
+        void compute_gradients(const math::matrix<float>& inputs, const math::matrix<float>& targets,
+            std::vector<math::matrix<float>>& grads) const
+        {
+            compute_gradients(inputs, targets, grads, [](size_t) {});
+        }
+
+        // As above; on_layer(i) is called as soon as grads[i] is final, from the last layer down,
+        // so the caller can start using it while the earlier layers are still being backpropagated
+        template<typename OnLayer>
+        void compute_gradients(const math::matrix<float>& inputs, const math::matrix<float>& targets,
+            std::vector<math::matrix<float>>& grads, OnLayer on_layer) const
+        {
+            utils::memory_scope forward_scope(utils::memory_tag::activations);
+            std::vector<math::matrix<float>> outputs;
+            outputs.reserve(layers.size() + 1);
+            outputs.push_back(inputs);
+
+            for (size_t i = 0; i < layers.size(); ++i)
+            {
+                utils::profile_scope profile("layer forward", static_cast<int>(i), forward_flops(i, inputs.size_n()), forward_bytes(i, inputs.size_n()));
 
-                outputs.push_back(layer_outputs);
-                output = layer_outputs;
+                auto layer_outputs = layers[i] * outputs.back();
+                activate(layer_outputs);
+                outputs.push_back(std::move(layer_outputs));
             }
 
-            auto errors = target - output;
+            auto errors = outputs.back() - targets;
+            const float scale = 1.f / static_cast<float>(inputs.size_n());
+
+            grads.resize(layers.size());
+            utils::memory_scope backward_scope(utils::memory_tag::gradients);
 
             for (size_t iter = layers.size(); iter >= 1; --iter)
             {
-                layers[iter - 1] += learning_rate * math::elem_mult(math::elem_mult(errors, outputs[iter]), 1.0 - outputs[iter]) * outputs[iter - 1].transposed();
-                errors = layers[iter - 1].transposed() * errors;
+                utils::profile_scope profile("layer backward", static_cast<int>(iter - 1), backward_flops(iter - 1, inputs.size_n()), backward_bytes(iter - 1, inputs.size_n()));
+
+                auto delta = math::elem_mult(math::elem_mult(errors, outputs[iter]), 1.0 - outputs[iter]);
+
+                if (iter > 1)
+                    errors = layers[iter - 1].transposed() * delta;
+
+                grads[iter - 1] = scale * delta * outputs[iter - 1].transposed();
+                on_layer(iter - 1);
             }
         }
 
-        math::matrix<float> forward(const std::vector<float>& input_values)
+        size_t layer_count() const
         {
-            math::matrix<float> input(input_values.size(), 1, input_values);
+            return layers.size();
+        }
 
-            for (auto& layer : layers)
+        // Direct weight access; call refresh_sparsity() after modifying weights used for inference
+        math::matrix<float>& layer(size_t index)
+        {
+            return layers[index];
+        }
+
+        const math::matrix<float>& layer(size_t index) const
+        {
+            return layers[index];
+        }
+
+        const layer_format& get_layer_format(size_t index) const
+        {
+            return formats[index];
+        }
+
+        void set_layer_format(size_t index, const layer_format& format)
+        {
+            formats[index] = format;
+        }
+
+        // Rebuilds the sparse inference copies: a layer whose stored blocks (with its format's block
+        // shape, 1x1 for dense layers) make up at most sparse_density_threshold of the matrix is
+        // multiplied through its bsr copy, any other layer stays dense.
+        void refresh_sparsity()
+        {
+            sparse_layers.assign(layers.size(), std::nullopt);
+
+            for (size_t i = 0; i < layers.size(); ++i)
             {
-                auto layer_outputs = layer * input;
+                if (is_low_rank(i))
+                    continue;
+
+                math::bsr_matrix<float> sparse(layers[i], formats[i].block_m, formats[i].block_n);
 
-                std::for_each(layer_outputs.begin(), layer_outputs.end(), 
-                    [](float& item) { item = function::sigmoid_function(item); });
+                if (sparse.density() <= sparse_density_threshold)
+                    sparse_layers[i] = std::move(sparse);
+            }
 
+            refresh_sparse_input();
+        }
+
+        // Sparse-input mode of the first layer, for inputs that are mostly one background value, e.g.
+        // MNIST digits, about 80% of whose pixels are blank and normalize to 0.01. The response to an
+        // all-background input, W * (background * 1), is computed once per weight update, and
+        // forward(), forward_batch() and forward_rows() then add to it the weights of only the inputs
+        // that differ from background, each scaled by the difference. The outputs match the dense
+        // product up to float reassociation. A sparse or low rank first layer keeps its own kernel.
+        void set_sparse_input(bool enabled, float background = normalized_blank_pixel)
+        {
+            if (enabled)
+                input_background = background;
+            else
+                input_background.reset();
+
+            refresh_sparse_input();
+        }
+
+        // whether the first layer currently runs in sparse-input mode
+        bool uses_sparse_input() const
+        {
+            return input_background.has_value() && !layers.empty() && !is_sparse(0) && !is_low_rank(0);
+        }
+
+        // Fused forward pass, on by default: while every layer is dense (or the first one in sparse-input
+        // mode), forward(), forward_batch() and forward_rows() take tiles of samples through all layers
+        // at once, each layer's product and sigmoid computed together into per-thread buffers, so the
+        // activations between layers stay in cache instead of going through one matrix per layer. The
+        // sums run in the order of the layered path, whose outputs it reproduces.
+        void set_fused_forward(bool enabled)
+        {
+            fused_forward = enabled;
+        }
+
+        // whether a forward pass over count samples takes the fused kernel
+        bool uses_fused_forward(size_t count = 1) const
+        {
+            if (!fused_forward || layers.empty() || !tuning_for(count).fused)
+                return false;
+
+            for (size_t i = 0; i < layers.size(); ++i)
+            {
+                if (is_sparse(i) || is_low_rank(i))
+                    return false;
+            }
+
+            return true;
+        }
+
+        // Kernel parameters for forward passes of from_batch samples or more, up to the next batch
+        // size with a tuning of its own; passes smaller than every tuned batch use the defaults.
+        void set_tuning(const forward_tuning& tuning, size_t from_batch = 1)
+        {
+            auto it = std::find_if(tunings.begin(), tunings.end(), [&](const auto& t) { return t.first >= from_batch; });
+
+            if (it != tunings.end() && it->first == from_batch)
+                it->second = tuning;
+            else
+                tunings.insert(it, { from_batch, tuning });
+        }
+
+        void clear_tuning()
+        {
+            tunings.clear();
+        }
+
+        const forward_tuning& tuning_for(size_t count) const
+        {
+            static const forward_tuning defaults;
+            const forward_tuning* result = &defaults;
+
+            for (const auto& t : tunings)
+            {
+                if (t.first > count)
+                    break;
+
+                result = &t.second;
+            }
+
+            return *result;
+        }
+
+        // Samples per tile of the fused pass over count samples: the tuned tile, or as many as let the
+        // inputs and outputs of the widest layer share half of this core's L2 cache, a multiple of 8
+        // for the vector units; either way few enough to give each thread of the pass a tile.
+        size_t fused_tile_samples(size_t count) const
+        {
+            const forward_tuning& tuning = tuning_for(count);
+            size_t tile = tuning.tile;
+
+            if (tile == 0)
+            {
+                size_t widest = 1;
+                for (const auto& layer : layers)
+                    widest = std::max(widest, layer.size_m() + layer.size_n());
+
+                tile = std::clamp<size_t>(utils::cpu_caches().l2 / 2 / (sizeof(float) * widest), 1, max_fused_tile);
+                if (tile >= 8)
+                    tile -= tile % 8;
+            }
+
+            const size_t threads = std::max<size_t>(fused_threads(tuning), 1);
+            const size_t per_thread = ((count + threads - 1) / threads + 7) / 8 * 8;
+
+            return std::max<size_t>(std::min({ tile, per_thread, count }), 1);
+        }
+
+        // Replaces the layer with the product of factors, which is then used for inference and saving
+        void set_factors(size_t index, math::low_rank_matrix<float>&& factors)
+        {
+            assert(factors.size_m() == layers[index].size_m() && factors.size_n() == layers[index].size_n() && "factor sizes are incompatible");
+
+            layers[index] = factors.to_dense();
+            formats[index] = layer_format{};
+            formats[index].encoding = layer_encoding::low_rank;
+
+            factored_layers.resize(layers.size());
+            factored_layers[index] = std::move(factors);
+
+            if (index < sparse_layers.size())
+                sparse_layers[index].reset();
+
+            if (index == 0)
+                refresh_sparse_input();
+        }
+
+        // Drops the factors of a low rank layer, keeping their product as a dense layer
+        void clear_factors(size_t index)
+        {
+            if (index < factored_layers.size())
+                factored_layers[index].reset();
+
+            formats[index] = layer_format{};
+        }
+
+        bool is_low_rank(size_t index) const
+        {
+            return index < factored_layers.size() && factored_layers[index].has_value();
+        }
+
+        const math::low_rank_matrix<float>& factors(size_t index) const
+        {
+            return *factored_layers[index];
+        }
+
+        bool is_sparse(size_t index) const
+        {
+            return index < sparse_layers.size() && sparse_layers[index].has_value();
+        }
+
+        void set_optimizer(const optim::optimizer_config& config)
+        {
+            optimizer = optim::optimizer(config);
+        }
+
+        const optim::optimizer& get_optimizer() const
+        {
+            return optimizer;
+        }
+
+        // Allocates the weights from source from now on (e.g. a huge_page_allocator for large layers)
+        // and moves the current ones there. source must outlive the model; copies of the model
+        // allocate from the copying thread's allocator.
+        void set_allocator(utils::allocator& source)
+        {
+            weight_allocator = &source;
+            adopt_weights();
+            refresh_sparse_input();
+        }
+
+        // seed of the initial weights, 0 for models loaded from files that predate it
+        uint64_t seed() const
+        {
+            return initial_seed;
+        }
+
+        math::matrix<float> forward(const std::vector<float>& input_values) const
+        {
+            utils::memory_scope scope(utils::memory_tag::activations);
+
+            if (uses_fused_forward(1))
+            {
+                assert(input_values.size() == layers.front().size_n() && "input size does not match the first layer");
+                return forward_fused(1, [&](size_t, size_t, float* tile) { std::copy(input_values.begin(), input_values.end(), tile); });
+            }
+
+            math::matrix<float> input;
+            size_t first = 0;
+
+            if (uses_sparse_input())
+            {
+                assert(input_values.size() == layers.front().size_n() && "input size does not match the first layer");
+                input = forward_sparse_input(1, [&](size_t, size_t k) { return input_values[k]; });
+                first = 1;
+            }
+            else
+            {
+                input = math::matrix<float>(input_values.size(), 1, input_values);
+            }
+
+            for (size_t i = first; i < layers.size(); ++i)
+            {
+                utils::profile_scope profile("layer forward", static_cast<int>(i), forward_flops(i, input.size_n()), forward_bytes(i, input.size_n()));
+
+                auto layer_outputs = multiply(i, input);
+                activate(layer_outputs);
                 input = std::move(layer_outputs);
             }
 
             return input;
         }
 
-        void save(const std::string& fileName)
+        // inputs hold one sample per column, the result one output per column
+        math::matrix<float> forward_batch(const math::matrix<float>& inputs) const
         {
-            std::ofstream outFile(fileName, std::ios::binary | std::ios::out);
+            utils::memory_scope scope(utils::memory_tag::activations);
 
-            if (!outFile.is_open())
+            if (uses_fused_forward(inputs.size_n()))
             {
-                std::cout << "file " << fileName << " can't to open\n";
-                return;
+                const float* values = inputs.data_ptr();
+                const size_t count = inputs.size_n();
+
+                return forward_fused(count, [&](size_t first, size_t last, float* tile)
+                {
+                    const size_t n = last - first;
+                    for (size_t k = 0; k < inputs.size_m(); ++k)
+                        std::copy(values + k * count + first, values + k * count + last, tile + k * n);
+                });
+            }
+
+            math::matrix<float> input;
+            size_t first = 0;
+
+            if (uses_sparse_input())
+            {
+                const float* values = inputs.data_ptr();
+                const size_t count = inputs.size_n();
+
+                input = forward_sparse_input(count, [&](size_t s, size_t k) { return values[k * count + s]; });
+                first = 1;
+            }
+            else
+            {
+                input = inputs;
+            }
+
+            for (size_t i = first; i < layers.size(); ++i)
+            {
+                utils::profile_scope profile("layer forward", static_cast<int>(i), forward_flops(i, input.size_n()), forward_bytes(i, input.size_n()));
+
+                auto layer_outputs = multiply(i, input);
+                activate(layer_outputs);
+                input = std::move(layer_outputs);
+            }
+
+            return input;
+        }
+
+        // Forward pass over caller-owned samples stored one per row, sample s starting at samples + s * stride;
+        // convert maps a stored element to its input value. The fused path converts one tile of samples
+        // at a time, the layered path reads float samples of a dense first layer in place and packs them
+        // into columns only for sparse or low rank ones. The result holds one output per column, like
+        // forward_batch.
+        template<typename Input, typename Convert>
+        math::matrix<float> forward_rows(const Input* samples, size_t count, size_t stride, Convert convert) const
+        {
+            if (layers.empty() || count == 0)
+                return math::matrix<float>();
+
+            utils::memory_scope scope(utils::memory_tag::activations);
+            const size_t inputs = layers.front().size_n();
+
+            if (uses_fused_forward(count))
+            {
+                return forward_fused(count, [&](size_t first, size_t last, float* tile)
+                {
+                    const size_t n = last - first;
+                    for (size_t s = first; s < last; ++s)
+                    {
+                        const Input* x = samples + s * stride;
+                        for (size_t k = 0; k < inputs; ++k)
+                            tile[k * n + s - first] = convert(x[k]);
+                    }
+                });
             }
 
-            write_data(learning_rate, outFile);
-            write_data(layers.size(), outFile);
+            math::matrix<float> input;
 
-            for (const auto& layer : layers)
+            if (uses_sparse_input())
+            {
+                input = forward_sparse_input(count, [&](size_t s, size_t k) { return convert(samples[s * stride + k]); });
+            }
+            else if (is_sparse(0) || is_low_rank(0))
             {
-                write_data(layer.size_m(), outFile);
-                write_data(layer.size_n(), outFile);
+                // the packed kernels need the samples as columns
+                math::matrix<float> columns(inputs, count);
+                float* dst = columns.data_ptr();
 
-                for (auto it = layer.cbegin(); it != layer.cend(); ++it)
+                for (size_t s = 0; s < count; ++s)
                 {
-                    write_data(*it, outFile);
+                    for (size_t k = 0; k < inputs; ++k)
+                        dst[k * count + s] = convert(samples[s * stride + k]);
                 }
+
+                input = multiply(0, columns);
             }
+            else
+            {
+                const auto& weights = layers.front();
+                input = math::matrix<float>(weights.size_m(), count);
+
+                const float* w = weights.data_ptr();
+                float* out = input.data_ptr();
+                const size_t rows = weights.size_m();
+
+                utils::parallel_for(0, count, std::max<size_t>(math::parallel_gemm_work / std::max<size_t>(rows * inputs, 1), 1),
+                    [&](size_t first, size_t last)
+                {
+                    // other element types are converted once per sample rather than once per row
+                    std::vector<float> converted(std::is_same_v<Input, float> ? 0 : inputs);
+
+                    for (size_t s = first; s < last; ++s)
+                    {
+                        const Input* x = samples + s * stride;
+
+                        if constexpr (!std::is_same_v<Input, float>)
+                        {
+                            for (size_t k = 0; k < inputs; ++k)
+                                converted[k] = convert(x[k]);
+                        }
 
-            outFile.close();
+                        for (size_t i = 0; i < rows; ++i)
+                        {
+                            const float* row = w + i * inputs;
+                            float sum = 0.f;
+
+                            if constexpr (std::is_same_v<Input, float>)
+                            {
+                                for (size_t k = 0; k < inputs; ++k)
+                                    sum += row[k] * convert(x[k]);
+                            }
+                            else
+                            {
+                                for (size_t k = 0; k < inputs; ++k)
+                                    sum += row[k] * converted[k];
+                            }
+
+                            out[i * count + s] = sum;
+                        }
+                    }
+                });
+            }
+
+            if (!uses_sparse_input())
+                activate(input);
+
+            for (size_t i = 1; i < layers.size(); ++i)
+            {
+                auto layer_outputs = multiply(i, input);
+                activate(layer_outputs);
+                input = std::move(layer_outputs);
+            }
+
+            return input;
         }
 
-        void load(const std::string& fileName)
+        // Copies the weights into snapshot, reusing its buffers when the shapes match
+        void snapshot(model_snapshot& snapshot) const
         {
-            std::ifstream inFile(fileName, std::ios::binary | std::ios::in);
+            snapshot.learning_rate = optimizer.config().learning_rate;
+            snapshot.layers.resize(layers.size());
+
+            for (size_t i = 0; i < layers.size(); ++i)
+                snapshot.layers[i] = layers[i];
+
+            snapshot.formats = formats;
+            snapshot.factors = factored_layers;
+            snapshot.factors.resize(layers.size());
 
-            if (!inFile.is_open())
+            snapshot.optimizer = optimizer;
+            snapshot.seed = initial_seed;
+            snapshot.topology = network_topology{};
+        }
+
+        // Takes the weights over from snapshot; its buffers are left with the previous weights
+        void restore(model_snapshot& snapshot)
+        {
+            std::swap(layers, snapshot.layers);
+            std::swap(formats, snapshot.formats);
+            std::swap(factored_layers, snapshot.factors);
+            std::swap(optimizer, snapshot.optimizer);
+            std::swap(initial_seed, snapshot.seed);
+
+            formats.resize(layers.size());
+            factored_layers.resize(layers.size());
+
+            // state saved for other layer shapes would send the optimizer kernels past its buffers
+            if (!optimizer.fits(layers))
             {
-                std::cout << "file " << fileName << " can't to open\n";
-                return;
+                utils::Logger::Warning("model", "optimizer state does not match the layers, starting it over");
+                optimizer.reset();
             }
 
-            layers.clear();
+            adopt_weights();
+            refresh_sparsity();
+        }
 
-            learning_rate = read_data<float>(inFile);
-            const size_t layersNum = read_data<size_t>(inFile);
-            size_t size_m = 0;
-            size_t size_n = 0;
-            std::vector<float> data;
+        bool save(const std::string& fileName) const
+        {
+            model_snapshot current;
+            snapshot(current);
 
-            for (size_t layerNum = 0; layerNum < layersNum; ++layerNum)
-            {
-                size_m = read_data<size_t>(inFile);
-                size_n = read_data<size_t>(inFile);
-                const size_t data_length = size_m * size_n;
+            utils::memory_stream out;
+            model_file::serialize(current, out);
 
-                data.clear();
-                data.shrink_to_fit();
-                data.reserve(data_length);
-                data.resize(data_length);
+            return utils::write_file_atomic(fileName, out.data(), out.size());
+        }
 
-                inFile.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float));
+        bool load(const std::string& fileName)
+        {
+            std::vector<char> bytes;
 
-                layers.emplace_back(size_m, size_n, data);
+            if (!utils::read_file(fileName, bytes))
+                return false;
+
+            return load_bytes(std::move(bytes), fileName);
+        }
+
+        // load() of a file already read into bytes; fileName only names it in error messages
+        bool load_bytes(std::vector<char>&& bytes, const std::string& fileName)
+        {
+            utils::memory_stream in(std::move(bytes));
+            model_snapshot loaded;
+            bool parsed = false;
+
+            {
+                const auto scope = weight_scope();
+                parsed = model_file::deserialize(in, loaded);
+            }
+
+            if (!parsed)
+            {
+                utils::Logger::Error("model", "could not load model: " + fileName);
+                return false;
+            }
+
+            if (!loaded.topology.empty())
+            {
+                utils::Logger::Error("model", "model file holds a convolutional network, load it with ml::convnet: " + fileName);
+                return false;
             }
 
-            inFile.close();
+            restore(loaded);
+            return true;
         }
 
     private:
-        void weight_initialization()
+        template<typename Sizes>
+        void build(const Sizes& list, const optim::optimizer_config& config, uint64_t seed)
         {
-            std::random_device rd{};
-            std::mt19937 gen{ rd() };
+            const auto scope = weight_scope();
+
+            for (auto it = list.begin(); it + 1 < list.end(); ++it)
+            {
+                layers.emplace_back(math::matrix<float>(*(it + 1), *it));
+            }
+
+            formats.assign(layers.size(), layer_format{});
+            optimizer = optim::optimizer(config);
+            weight_initialization(seed);
+        }
+
+        utils::memory_scope weight_scope() const
+        {
+            if (weight_allocator)
+                return utils::memory_scope(utils::memory_tag::weights, *weight_allocator);
+
+            return utils::memory_scope(utils::memory_tag::weights);
+        }
+
+        // moves layers allocated elsewhere (a snapshot, another allocator) into the weight storage
+        void adopt_weights()
+        {
+            const auto scope = weight_scope();
+            const utils::allocator& target = utils::memory_scope::current_allocator();
 
             for (auto& layer : layers)
             {
-                float std_dev = powf(static_cast<float>(layer.size()), -0.5f);
+                if (layer.size() != 0 && (layer.tag() != utils::memory_tag::weights || layer.storage_allocator() != &target))
+                {
+                    math::matrix<float> moved(layer);
+                    layer = std::move(moved);
+                }
+            }
+        }
+
+        // Recomputes the sparse-input state from the first layer: its response to an all-background
+        // input, accumulated in double, and its transpose, so that the weights of one input are
+        // contiguous. Clears it when the mode is off.
+        void refresh_sparse_input()
+        {
+            if (!input_background || layers.empty())
+            {
+                background_response.clear();
+                first_layer_columns = math::matrix<float>();
+                return;
+            }
+
+            const auto scope = weight_scope();
+            const auto& weights = layers.front();
+            const size_t inputs = weights.size_n();
+
+            background_response.resize(weights.size_m());
+
+            for (size_t i = 0; i < weights.size_m(); ++i)
+            {
+                const float* row = weights.data_ptr() + i * inputs;
+                double sum = 0.0;
+
+                for (size_t k = 0; k < inputs; ++k)
+                    sum += row[k];
+
+                background_response[i] = static_cast<float>(sum * *input_background);
+            }
+
+            first_layer_columns = weights.transposed();
+        }
+
+        // One sample of the first layer in sparse-input mode, before the activation: sum becomes the
+        // background response plus the weights of every input k whose value(k) differs from the
+        // background, scaled by the difference. Returns the number of such inputs.
+        template<typename Value>
+        size_t sparse_input_column(Value value, float* sum) const
+        {
+            const size_t inputs = first_layer_columns.size_m();
+            const size_t rows = first_layer_columns.size_n();
+            const float background = *input_background;
+            const float* columns = first_layer_columns.data_ptr();
+
+            std::copy(background_response.begin(), background_response.end(), sum);
+            size_t active = 0;
+
+            for (size_t k = 0; k < inputs; ++k)
+            {
+                const float v = value(k);
+                if (v == background)
+                    continue;
+
+                const float d = v - background;
+                const float* column = columns + k * rows;
+
+                for (size_t i = 0; i < rows; ++i)
+                    sum[i] += d * column[i];
+
+                ++active;
+            }
+
+            return active;
+        }
+
+        // First layer in sparse-input mode over count samples, value(s, k) being input k of sample s,
+        // for models the fused pass does not cover. Returns the activated outputs, one sample per column.
+        template<typename Value>
+        math::matrix<float> forward_sparse_input(size_t count, Value value) const
+        {
+            const size_t inputs = first_layer_columns.size_m();
+            const size_t rows = first_layer_columns.size_n();
+
+            utils::profile_scope profile("layer forward", 0, forward_flops(0, count), forward_bytes(0, count));
+
+            math::matrix<float> result(rows, count);
+            float* out = result.data_ptr();
+            std::atomic<size_t> active{ 0 };
+
+            utils::parallel_for(0, count, std::max<size_t>(math::parallel_gemm_work / std::max<size_t>(rows * inputs, 1), 1),
+                [&](size_t first, size_t last)
+            {
+                // a single sample is accumulated in place, batches column by column
+                std::vector<float> scratch(count == 1 ? 0 : rows);
+                float* sum = count == 1 ? out : scratch.data();
+                size_t touched = 0;
+
+                for (size_t s = first; s < last; ++s)
+                {
+                    touched += sparse_input_column([&](size_t k) { return value(s, k); }, sum);
+
+                    if (count != 1)
+                    {
+                        for (size_t i = 0; i < rows; ++i)
+                            out[i * count + s] = sum[i];
+                    }
+                }
+
+                active.fetch_add(touched, std::memory_order_relaxed);
+            });
+
+            activate(result);
+
+            const double macs = static_cast<double>(active.load()) * rows;
+            profile.set_work(2.0 * macs + sigmoid_flops * rows * count,
+                sizeof(float) * (macs + static_cast<double>(rows) * (count + 1) + static_cast<double>(inputs) * count));
+
+            return result;
+        }
+
+        // Forward pass through every layer a tile of samples at a time (see set_fused_forward);
+        // load(first, last, tile) writes the inputs of samples first..last into tile, input k of
+        // sample first + t at tile[k * (last - first) + t]. One output per column in the result.
+        template<typename Load>
+        math::matrix<float> forward_fused(size_t count, Load load) const
+        {
+            const size_t outputs = layers.back().size_m();
+            math::matrix<float> result(outputs, count);
+
+            if (count == 0)
+                return result;
+
+            const forward_tuning& tuning = tuning_for(count);
+            const size_t tile = fused_tile_samples(count);
+            const size_t tiles = (count + tile - 1) / tile;
+            const size_t threads = std::max<size_t>(fused_threads(tuning), 1);
+            const bool sparse_first = uses_sparse_input();
+
+            size_t widest = 0;
+            double flops = 0.0;
+            double weight_bytes = 0.0;
+
+            for (size_t i = 0; i < layers.size(); ++i)
+            {
+                widest = std::max({ widest, layers[i].size_m(), layers[i].size_n() });
+                flops += forward_flops(i, count);
+                weight_bytes += sizeof(float) * static_cast<double>(layers[i].size());
+            }
+
+            // the weights are read once per tile, the inputs and outputs once
+            const double io_bytes = sizeof(float) * static_cast<double>(layers.front().size_n() + outputs) * count;
+            utils::profile_scope profile("fused forward", flops, weight_bytes * tiles + io_bytes);
+
+            float* out = result.data_ptr();
+            std::atomic<size_t> active{ 0 };
+
+            utils::parallel_for(0, tiles, (tiles + threads - 1) / threads, [&](size_t first_tile, size_t last_tile)
+            {
+                // two tiles of activations, and one sample of a sparse-input first layer
+                auto& scratch = fused_scratch();
+                if (scratch.size() < (2 * tile + 1) * widest)
+                    scratch.resize((2 * tile + 1) * widest);
+
+                size_t touched = 0;
+
+                for (size_t t = first_tile; t < last_tile; ++t)
+                {
+                    const size_t first = t * tile;
+                    const size_t n = std::min(tile, count - first);
+
+                    float* in = scratch.data();
+                    float* next = in + tile * widest;
+                    load(first, first + n, in);
+
+                    size_t i = 0;
+
+                    if (sparse_first)
+                    {
+                        float* column = next + tile * widest;
+                        const size_t rows = layers.front().size_m();
+
+                        for (size_t s = 0; s < n; ++s)
+                        {
+                            touched += sparse_input_column([&](size_t k) { return in[k * n + s]; }, column);
+
+                            for (size_t r = 0; r < rows; ++r)
+                                next[r * n + s] = function::sigmoid_function(column[r]);
+                        }
 
-                std::normal_distribution<float> normal_distribution{ 0.f, std_dev };
+                        std::swap(in, next);
+                        i = 1;
+                    }
 
-                std::for_each(layer.begin(), layer.end(), 
-                    [&normal_distribution, &gen](float& item) { item = normal_distribution(gen); });
+                    for (; i < layers.size(); ++i)
+                    {
+                        dense_tile(layers[i], in, n, next, tuning.row_block);
+                        std::swap(in, next);
+                    }
+
+                    for (size_t r = 0; r < outputs; ++r)
+                        std::copy(in + r * n, in + r * n + n, out + r * count + first);
+                }
+
+                active.fetch_add(touched, std::memory_order_relaxed);
+            });
+
+            if (sparse_first)
+            {
+                // only the weights of the non-background inputs were multiplied
+                const double rows = static_cast<double>(layers.front().size_m());
+                const double skipped = static_cast<double>(layers.front().size_n()) * count - static_cast<double>(active.load());
+
+                profile.set_work(flops - 2.0 * rows * skipped,
+                    (weight_bytes - sizeof(float) * static_cast<double>(layers.front().size())) * tiles
+                    + sizeof(float) * rows * static_cast<double>(active.load()) + io_bytes);
+            }
+
+            return result;
+        }
+
+        // Accumulates weights * in into out for rows first.. of the tile, sizeof...(R) output rows at
+        // a time sharing each input load, as far as whole blocks go; returns the first row left over
+        template<size_t... R>
+        static size_t dense_tile_rows(const math::matrix<float>& weights, const float* in, size_t n, float* out, size_t first,
+            std::index_sequence<R...>)
+        {
+            constexpr size_t block = sizeof...(R);
+            const size_t rows = weights.size_m();
+            const size_t inputs = weights.size_n();
+            const float* w = weights.data_ptr();
+            size_t i = first;
+
+            for (; i + block <= rows; i += block)
+            {
+                float* c[block] = { (out + (i + R) * n)... };
+                const float* wi = w + i * inputs;
+
+                for (size_t k = 0; k < inputs; ++k)
+                {
+                    const float a[block] = { wi[R * inputs + k]... };
+                    const float* x = in + k * n;
+
+                    for (size_t t = 0; t < n; ++t)
+                        ((c[R][t] += a[R] * x[t]), ...);
+                }
             }
+
+            return i;
+        }
+
+        // out = sigmoid(weights * in) for a tile of n samples, input k of sample t at in[k * n + t] and
+        // output i at out[i * n + t]. Summing row_block output rows at a time shares each input load
+        // and gives a single sample independent chains; every row still adds its inputs in order, as
+        // matrix::operator* does, and is activated while it is in cache.
+        static void dense_tile(const math::matrix<float>& weights, const float* in, size_t n, float* out, size_t row_block)
+        {
+            const size_t rows = weights.size_m();
+            std::fill(out, out + rows * n, 0.f);
+
+            size_t i = 0;
+
+            switch (row_block)
+            {
+            case 8: i = dense_tile_rows(weights, in, n, out, i, std::make_index_sequence<8>()); break;
+            case 4: i = dense_tile_rows(weights, in, n, out, i, std::make_index_sequence<4>()); break;
+            case 2: i = dense_tile_rows(weights, in, n, out, i, std::make_index_sequence<2>()); break;
+            default: break;
+            }
+
+            dense_tile_rows(weights, in, n, out, i, std::make_index_sequence<1>());
+
+            for (size_t j = 0; j < rows * n; ++j)
+                out[j] = function::sigmoid_function(out[j]);
+        }
+
+        // pool threads a fused pass may use
+        static size_t fused_threads(const forward_tuning& tuning)
+        {
+            const size_t pool = utils::thread_pool::instance().size();
+            return tuning.threads != 0 ? std::min(tuning.threads, pool) : pool;
+        }
+
+        // activation tiles of the fused pass, kept per thread between calls so that a forward pass
+        // allocates only its result
+        static std::vector<float, utils::tracking_allocator<float, utils::memory_tag::activations>>& fused_scratch()
+        {
+            static thread_local std::vector<float, utils::tracking_allocator<float, utils::memory_tag::activations>> scratch;
+            return scratch;
+        }
+
+        math::matrix<float> multiply(size_t index, const math::matrix<float>& input) const
+        {
+            if (is_sparse(index))
+                return sparse_layers[index]->multiply(input);
+
+            if (is_low_rank(index))
+                return factored_layers[index]->multiply(input);
+
+            return layers[index] * input;
+        }
+
+        // negation, exp, add and divide, counted as one FLOP each
+        static constexpr double sigmoid_flops = 4.0;
+
+        static void activate(math::matrix<float>& values)
+        {
+            utils::profile_scope profile("sigmoid", sigmoid_flops * values.size(), 2.0 * sizeof(float) * values.size());
+
+            std::for_each(values.begin(), values.end(),
+                [](float& item) { item = function::sigmoid_function(item); });
+        }
+
+        // Nominal work of layer i over batch samples, for the profiler: the product, the activation
+        // and the traffic of weights, inputs and outputs
+        double forward_flops(size_t i, size_t batch) const
+        {
+            return (2.0 * layers[i].size_n() + sigmoid_flops) * layers[i].size_m() * batch;
+        }
+
+        double forward_bytes(size_t i, size_t batch) const
+        {
+            return sizeof(float) * (static_cast<double>(layers[i].size()) + (layers[i].size_n() + layers[i].size_m()) * static_cast<double>(batch));
+        }
+
+        // the delta, the weight gradient and, above the first layer, the errors of the layer below
+        double backward_flops(size_t i, size_t batch) const
+        {
+            return ((i > 0 ? 4.0 : 2.0) * layers[i].size_n() + 4.0) * layers[i].size_m() * batch;
+        }
+
+        double backward_bytes(size_t i, size_t batch) const
+        {
+            return sizeof(float) * (2.0 * layers[i].size() + (2.0 * layers[i].size_n() + 3.0 * layers[i].size_m()) * batch);
+        }
+
+        // Normal weights, layer i from stream weights + i of seed, generated over the shared thread pool
+        void weight_initialization(uint64_t seed)
+        {
+            initial_seed = seed;
+
+            for (size_t i = 0; i < layers.size(); ++i)
+            {
+                float std_dev = powf(static_cast<float>(layers[i].size()), -0.5f);
+
+                utils::parallel_fill_normal(utils::counter_rng(seed, utils::rng_stream::weights + i),
+                    layers[i].data_ptr(), layers[i].size(), 0.f, std_dev);
+            }
+        }
+
+        void weight_initialization()
+        {
+            weight_initialization(initial_seed);
         }
 
     private:
         std::vector<math::matrix<float>> layers;
-        float learning_rate;
+        std::vector<layer_format> formats;
+        std::vector<std::optional<math::bsr_matrix<float>>> sparse_layers;
+        std::vector<std::optional<math::low_rank_matrix<float>>> factored_layers;
+        std::vector<math::matrix<float>> gradients;
+        optim::optimizer optimizer;
+        uint64_t initial_seed = 0;
+        // null: the allocator of the thread that builds or loads the model
+        utils::allocator* weight_allocator = nullptr;
+        // sparse-input mode: the background value, the first layer's response to it and its transpose
+        std::optional<float> input_background;
+        std::vector<float> background_response;
+        math::matrix<float> first_layer_columns;
+        bool fused_forward = true;
+        // (smallest batch, tuning) by batch, see set_tuning
+        std::vector<std::pair<size_t, forward_tuning>> tunings;
     };
 }
\ No newline at end of file
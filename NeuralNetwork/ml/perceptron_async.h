@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "perceptron.h"
+#include "model_file.h"
+#include "../utils/async.h"
+#include "../utils/async_file.h"
+#include "../utils/memory_stream.h"
+
+namespace ml
+{
+    // Awaitable save and load of a perceptron, kept out of perceptron.h: coroutines need C++20 and
+    // <coroutine>, while the C API and the Python module build perceptron.h as C++17.
+
+    // model.save() with the file written on a pool thread; the weights are captured when the task starts
+    inline utils::task<bool> save_async(const perceptron& model, std::string fileName, utils::cancellation_token token = {}, utils::executor& ex = utils::executor::shared())
+    {
+        model_snapshot current;
+        model.snapshot(current);
+
+        utils::memory_stream out;
+        model_file::serialize(current, out);
+
+        co_return co_await utils::write_file_async(std::move(fileName), std::vector<char>(out.data(), out.data() + out.size()), token, ex);
+    }
+
+    // model.load() without blocking: the file is read through read_file_async and parsed on the pool
+    // thread that resumes. The model must outlive the task and is left unchanged if token is
+    // cancelled before the weights are replaced.
+    inline utils::task<bool> load_async(perceptron& model, std::string fileName, utils::cancellation_token token = {}, utils::executor& ex = utils::executor::shared())
+    {
+        auto bytes = co_await utils::read_file_async(fileName, token, ex);
+
+        if (!bytes || token.cancelled())
+            co_return false;
+
+        co_return model.load_bytes(std::move(*bytes), fileName);
+    }
+}
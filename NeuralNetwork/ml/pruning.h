@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "perceptron.h"
+#include "trainer.h"
+#include "model_file.h"
+#include "../utils/logger.h"
+
+namespace ml
+{
+    struct pruning_config
+    {
+        // fraction of blocks removed from every pruned layer
+        float sparsity = 0.8f;
+
+        // 1x1 prunes single weights; 4x4 or 8x1 keeps whole blocks for the block sparse kernels.
+        // 0 counts as 1.
+        uint32_t block_m = 1;
+        uint32_t block_n = 1;
+
+        // layers to prune; empty means every layer but the output one
+        std::vector<size_t> layers;
+    };
+
+    // Magnitude pruning: blocks with the smallest L1 norm are zeroed and the layer is marked
+    // block_sparse, so it is saved in bsr form and multiplied through the sparse kernels.
+    // The masks are kept so fine-tuning can train the remaining weights without regrowing pruned ones.
+    class pruner
+    {
+    public:
+        explicit pruner(const pruning_config& config) : config(config)
+        {
+            // the layer formats written by prune() take the block size as is
+            this->config.block_m = std::max<uint32_t>(config.block_m, 1);
+            this->config.block_n = std::max<uint32_t>(config.block_n, 1);
+        }
+
+        void prune(perceptron& model)
+        {
+            masks.assign(model.layer_count(), {});
+
+            std::vector<size_t> targets = config.layers;
+            if (targets.empty())
+            {
+                for (size_t i = 0; i + 1 < model.layer_count(); ++i)
+                    targets.push_back(i);
+            }
+
+            for (size_t index : targets)
+            {
+                if (index >= model.layer_count())
+                {
+                    utils::Logger::Warning("pruning", "no layer " + std::to_string(index));
+                    continue;
+                }
+
+                prune_layer(model.layer(index), masks[index]);
+
+                layer_format format;
+                format.encoding = layer_encoding::block_sparse;
+                format.block_m = config.block_m;
+                format.block_n = config.block_n;
+                model.set_layer_format(index, format);
+            }
+
+            model.refresh_sparsity();
+        }
+
+        // zeroes the pruned weights again, e.g. after an optimizer step
+        void apply_masks(perceptron& model) const
+        {
+            for (size_t index = 0; index < masks.size() && index < model.layer_count(); ++index)
+            {
+                if (masks[index].empty())
+                    continue;
+
+                float* w = model.layer(index).data_ptr();
+                const auto& mask = masks[index];
+
+                for (size_t i = 0; i < mask.size(); ++i)
+                    w[i] *= mask[i];
+            }
+        }
+
+        // Short retraining of the surviving weights with the masks reapplied after every batch. Samples
+        // in held_out, e.g. those the pruned model is then judged on, are left out of the training.
+        training_result fine_tune(perceptron& model, const mnist::training_set& set, const trainer_config& trainer_settings,
+            const std::vector<size_t>& held_out = {})
+        {
+            trainer tuner(trainer_settings);
+
+            auto result = tuner.fit(model, set, trainer::indices_except(set.size(), held_out), [this, &model](size_t) { apply_masks(model); });
+
+            apply_masks(model);
+            model.refresh_sparsity();
+
+            return result;
+        }
+
+    private:
+        void prune_layer(math::matrix<float>& layer, std::vector<float>& mask) const
+        {
+            const size_t size_m = layer.size_m();
+            const size_t size_n = layer.size_n();
+            const size_t block_m = config.block_m;
+            const size_t block_n = config.block_n;
+            const size_t block_rows = (size_m + block_m - 1) / block_m;
+            const size_t block_cols = (size_n + block_n - 1) / block_n;
+
+            float* w = layer.data_ptr();
+
+            std::vector<float> norms(block_rows * block_cols, 0.f);
+
+            for (size_t i = 0; i < size_m; ++i)
+            {
+                for (size_t j = 0; j < size_n; ++j)
+                    norms[(i / block_m) * block_cols + j / block_n] += std::fabs(w[i * size_n + j]);
+            }
+
+            const size_t removed = static_cast<size_t>(norms.size() * std::min(std::max(config.sparsity, 0.f), 1.f));
+            mask.assign(layer.size(), 1.f);
+
+            if (removed == 0)
+                return;
+
+            std::vector<float> sorted = norms;
+            std::nth_element(sorted.begin(), sorted.begin() + (removed - 1), sorted.end());
+            const float threshold = sorted[removed - 1];
+
+            auto zero_block = [&](size_t b)
+            {
+                const size_t br = b / block_cols;
+                const size_t bc = b % block_cols;
+
+                for (size_t i = br * block_m; i < std::min(size_m, (br + 1) * block_m); ++i)
+                {
+                    for (size_t j = bc * block_n; j < std::min(size_n, (bc + 1) * block_n); ++j)
+                    {
+                        w[i * size_n + j] = 0.f;
+                        mask[i * size_n + j] = 0.f;
+                    }
+                }
+            };
+
+            // everything below the threshold goes, then ties at the threshold until the budget is spent
+            size_t remaining = removed;
+
+            for (size_t b = 0; b < norms.size(); ++b)
+            {
+                if (norms[b] < threshold)
+                {
+                    zero_block(b);
+                    --remaining;
+                }
+            }
+
+            for (size_t b = 0; b < norms.size() && remaining > 0; ++b)
+            {
+                if (norms[b] == threshold)
+                {
+                    zero_block(b);
+                    --remaining;
+                }
+            }
+        }
+
+    private:
+        pruning_config config;
+        std::vector<std::vector<float>> masks;
+    };
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <map>
+#include <limits>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include "perceptron.h"
+#include "trainer.h"
+#include "model_file.h"
+#include "../math/matrix.h"
+#include "../utils/logger.h"
+#include "../utils/random.h"
+#include "../utils/thread_pool.h"
+#include "../utils/mnist/mnist.h"
+
+namespace ml
+{
+    // One point of a hyperparameter sweep
+    struct sweep_run
+    {
+        // layer sizes, inputs first, e.g. { 784, 150, 10 }
+        std::vector<size_t> sizes;
+        optim::optimizer_config optimizer;
+        // initial weights; the data order is shared by the whole sweep
+        uint64_t seed = 0;
+    };
+
+    struct sweep_config
+    {
+        // fraction of the set held out for validation, taken from the end after one shuffle
+        float validation_split = 0.1f;
+        size_t batch_size = 32;
+        size_t max_epochs = 1;
+        size_t eval_batch_size = 500;
+        // drives the split and the epoch shuffles of every run
+        uint64_t seed = 0;
+    };
+
+    struct sweep_result
+    {
+        sweep_run run;
+        // best validation loss and accuracy over the epoch-end evaluations
+        training_result training;
+        // weights of the best evaluation
+        perceptron model;
+    };
+
+    // Trains many small perceptrons in one process over one shared, read-only dataset.
+    //
+    // Runs with the same layer sizes form a group that trains in lockstep: their first layers are
+    // stacked into one (K * hidden) x inputs matrix, so the forward product and the first layer's
+    // weight gradient, which dominate the cost of a { 784, H, 10 } network, are one GEMM each over
+    // the shared batch instead of K narrow ones. The small upper layers run per model, spread over
+    // the thread pool. Every run steps its own optimizer, and all runs see the same batches in the
+    // same order, each batch assembled once. Each run ends with the weights a separate trainer would
+    // reach on the same batches.
+    class sweep_runner
+    {
+    public:
+        explicit sweep_runner(const sweep_config& config) : config(config) {}
+
+        // on_batch(batches) is called after every training batch
+        template<typename OnBatch>
+        std::vector<sweep_result> run(const std::vector<sweep_run>& runs, const mnist::training_set& set, OnBatch on_batch)
+        {
+            std::vector<sweep_result> results(runs.size());
+            std::vector<group> groups;
+            std::map<std::vector<size_t>, size_t> group_of_shape;
+
+            for (size_t i = 0; i < runs.size(); ++i)
+            {
+                results[i].run = runs[i];
+
+                if (runs[i].sizes.size() < 2)
+                {
+                    utils::Logger::Error("sweep", "run " + std::to_string(i) + " needs at least an input and an output layer");
+                    continue;
+                }
+
+                results[i].model = perceptron(runs[i].sizes, runs[i].optimizer, runs[i].seed);
+
+                auto found = group_of_shape.emplace(runs[i].sizes, groups.size());
+                if (found.second)
+                    groups.emplace_back();
+
+                groups[found.first->second].members.push_back(i);
+            }
+
+            std::vector<size_t> indices(set.size());
+            std::iota(indices.begin(), indices.end(), size_t{ 0 });
+            utils::shuffle(indices, utils::counter_rng(config.seed, utils::rng_stream::shuffle));
+
+            const size_t validation_size = static_cast<size_t>(set.size() * config.validation_split);
+            const size_t train_size = set.size() - validation_size;
+
+            validation.assign(indices.begin() + train_size, indices.end());
+            indices.resize(train_size);
+
+            if (train_size == 0 || groups.empty())
+            {
+                utils::Logger::Error("sweep", "nothing to train");
+                return results;
+            }
+
+            for (auto& g : groups)
+            {
+                g.grads.resize(g.members.size());
+                g.best.resize(g.members.size());
+            }
+
+            const size_t batch_size = std::max<size_t>(config.batch_size, 1);
+            size_t batches = 0;
+
+            for (size_t epoch = 0; epoch < config.max_epochs; ++epoch)
+            {
+                if (epoch > 0)
+                    utils::shuffle(indices, utils::counter_rng(config.seed, utils::rng_stream::shuffle + epoch));
+
+                mnist::make_batch(set, indices, 0, std::min(batch_size, train_size), inputs, targets);
+
+                for (size_t first = 0; first < train_size; first += batch_size)
+                {
+                    const size_t count = std::min(batch_size, train_size - first);
+                    const size_t next = first + count;
+
+                    if (next < train_size)
+                    {
+                        loader.run([&, next]
+                        {
+                            mnist::make_batch(set, indices, next, std::min(batch_size, train_size - next), next_inputs, next_targets);
+                        });
+                    }
+
+                    // shared by the weight gradients of every group
+                    inputs.transpose_to(inputs_t);
+
+                    for (auto& g : groups)
+                        train_group(g, results);
+
+                    loader.wait();
+
+                    std::swap(inputs, next_inputs);
+                    std::swap(targets, next_targets);
+
+                    on_batch(++batches);
+                }
+
+                evaluate_all(groups, results, set);
+            }
+
+            for (auto& g : groups)
+            {
+                for (size_t k = 0; k < g.members.size(); ++k)
+                {
+                    sweep_result& r = results[g.members[k]];
+                    r.training.batches = batches;
+
+                    if (!g.best[k].layers.empty())
+                        r.model.restore(g.best[k]);
+                }
+            }
+
+            return results;
+        }
+
+        std::vector<sweep_result> run(const std::vector<sweep_run>& runs, const mnist::training_set& set)
+        {
+            return run(runs, set, [](size_t) {});
+        }
+
+        const std::vector<size_t>& validation_indices() const
+        {
+            return validation;
+        }
+
+    private:
+        // runs of one shape, trained together
+        struct group
+        {
+            std::vector<size_t> members;
+            // first layers of all members, member k in rows k * hidden ... (k + 1) * hidden
+            math::matrix<float> stacked;
+            // first layer deltas, stacked the same way
+            math::matrix<float> deltas;
+            std::vector<std::vector<math::matrix<float>>> grads;
+            std::vector<model_snapshot> best;
+        };
+
+        static void sigmoid(float* values, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                values[i] = function::sigmoid_function(values[i]);
+        }
+
+        // One batch for every member of g; the arithmetic matches perceptron::train_batch operation
+        // for operation, since every row of a product depends on its own row of the left operand only
+        void train_group(group& g, std::vector<sweep_result>& results)
+        {
+            const size_t members = g.members.size();
+            const size_t batch = inputs.size_n();
+            const float scale = 1.f / static_cast<float>(batch);
+
+            const perceptron& front = results[g.members.front()].model;
+            const size_t hidden = front.layer(0).size_m();
+            const size_t input_size = front.layer(0).size_n();
+            const size_t layer_count = front.layer_count();
+
+            if (g.stacked.size_m() != members * hidden || g.stacked.size_n() != input_size)
+                g.stacked = math::matrix<float>(members * hidden, input_size);
+
+            utils::parallel_for(0, members, 1, [&](size_t first, size_t last)
+            {
+                for (size_t k = first; k < last; ++k)
+                {
+                    const auto& w = results[g.members[k]].model.layer(0);
+                    std::copy(w.data_ptr(), w.data_ptr() + w.size(), g.stacked.data_ptr() + k * w.size());
+                }
+            });
+
+            auto activations = g.stacked * inputs;
+
+            utils::parallel_for(0, activations.size_m(), std::max<size_t>(1, (size_t{ 1 } << 14) / std::max<size_t>(batch, 1)), [&](size_t first, size_t last)
+            {
+                sigmoid(activations.data_ptr() + first * batch, (last - first) * batch);
+            });
+
+            if (g.deltas.size_m() != members * hidden || g.deltas.size_n() != batch)
+                g.deltas = math::matrix<float>(members * hidden, batch);
+
+            // layers above the first, then the first layer's delta, per member
+            utils::parallel_for(0, members, 1, [&](size_t first, size_t last)
+            {
+                for (size_t k = first; k < last; ++k)
+                {
+                    const perceptron& model = results[g.members[k]].model;
+                    auto& grads = g.grads[k];
+                    grads.resize(layer_count);
+
+                    std::vector<math::matrix<float>> outputs;
+                    outputs.reserve(layer_count);
+                    outputs.emplace_back(hidden, batch);
+                    std::copy(activations.data_ptr() + k * hidden * batch, activations.data_ptr() + (k + 1) * hidden * batch, outputs.back().data_ptr());
+
+                    for (size_t l = 1; l < layer_count; ++l)
+                    {
+                        auto layer_outputs = model.layer(l) * outputs.back();
+                        sigmoid(layer_outputs.data_ptr(), layer_outputs.size());
+                        outputs.push_back(std::move(layer_outputs));
+                    }
+
+                    auto errors = outputs.back() - targets;
+
+                    for (size_t l = layer_count - 1; l >= 1; --l)
+                    {
+                        auto delta = math::elem_mult(math::elem_mult(errors, outputs[l]), 1.0 - outputs[l]);
+                        errors = model.layer(l).transposed() * delta;
+                        grads[l] = scale * delta * outputs[l - 1].transposed();
+                    }
+
+                    auto delta = scale * math::elem_mult(math::elem_mult(errors, outputs[0]), 1.0 - outputs[0]);
+                    std::copy(delta.data_ptr(), delta.data_ptr() + delta.size(), g.deltas.data_ptr() + k * hidden * batch);
+                }
+            });
+
+            const auto first_layer = g.deltas * inputs_t;
+
+            utils::parallel_for(0, members, 1, [&](size_t first, size_t last)
+            {
+                for (size_t k = first; k < last; ++k)
+                {
+                    auto& grad = g.grads[k][0];
+                    grad = math::matrix<float>(hidden, input_size);
+
+                    const float* src = first_layer.data_ptr() + k * hidden * input_size;
+                    std::copy(src, src + hidden * input_size, grad.data_ptr());
+
+                    results[g.members[k]].model.apply_gradients(g.grads[k]);
+                }
+            });
+        }
+
+        void evaluate_all(std::vector<group>& groups, std::vector<sweep_result>& results, const mnist::training_set& set)
+        {
+            if (validation.empty())
+                return;
+
+            trainer_config eval_config;
+            eval_config.eval_batch_size = config.eval_batch_size;
+            trainer evaluator(eval_config);
+
+            for (auto& g : groups)
+            {
+                for (size_t k = 0; k < g.members.size(); ++k)
+                {
+                    sweep_result& r = results[g.members[k]];
+                    const evaluation score = evaluator.evaluate(r.model, set, validation);
+                    ++r.training.evaluations;
+
+                    if (score.loss < r.training.best_loss)
+                    {
+                        r.training.best_loss = score.loss;
+                        r.training.best_accuracy = score.accuracy;
+                        r.model.snapshot(g.best[k]);
+                    }
+                }
+            }
+        }
+
+        sweep_config config;
+        std::vector<size_t> validation;
+
+        math::matrix<float> inputs;
+        math::matrix<float> inputs_t;
+        math::matrix<float> targets;
+        math::matrix<float> next_inputs;
+        math::matrix<float> next_targets;
+        utils::task_group loader;
+    };
+}
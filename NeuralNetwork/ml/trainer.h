@@ -0,0 +1,280 @@
+#pragma once
+
+#include <mutex>
+#include <limits>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include "perceptron.h"
+#include "model_file.h"
+#include "../utils/logger.h"
+#include "../utils/random.h"
+#include "../utils/thread_pool.h"
+#include "../utils/mnist/mnist.h"
+#include "../image/augment.h"
+
+namespace ml
+{
+    struct trainer_config
+    {
+        // fraction of the set held out for validation, taken from the end after one shuffle
+        float validation_split = 0.1f;
+        size_t batch_size = 1;
+        size_t max_epochs = 1;
+
+        // validation runs every eval_every batches and at the end of each epoch
+        size_t eval_every = 5000;
+        size_t eval_batch_size = 500;
+
+        // stop after patience evaluations without the loss improving by more than min_delta
+        size_t patience = 5;
+        float min_delta = 1e-4f;
+
+        // drives the split, the epoch shuffles and augmentation; the same seed gives the same run at any thread count
+        uint64_t seed = 0;
+
+        // distort training batches on the fly; validation always sees the original images
+        bool augment = false;
+        image::augment_config augmentation;
+    };
+
+    struct training_result
+    {
+        float best_loss = std::numeric_limits<float>::infinity();
+        float best_accuracy = 0.f;
+        size_t batches = 0;
+        size_t evaluations = 0;
+        bool stopped_early = false;
+    };
+
+    struct evaluation
+    {
+        float loss = 0.f;
+        float accuracy = 0.f;
+    };
+
+    // Trains a perceptron or convnet on an MNIST set with a held-out validation split and early stopping.
+    // The best weights seen are copied into a preallocated snapshot and swapped back into the
+    // model at the end, so the caller can save() the best model directly.
+    // The next batch is assembled on the shared thread pool while the current one trains.
+    class trainer
+    {
+    public:
+        explicit trainer(const trainer_config& config) : config(config) {}
+
+        template<typename Model, typename OnBatch>
+        training_result fit(Model& model, const mnist::training_set& set, OnBatch on_batch)
+        {
+            std::vector<size_t> indices(set.size());
+            std::iota(indices.begin(), indices.end(), size_t{ 0 });
+
+            return fit(model, set, std::move(indices), on_batch);
+        }
+
+        // fit() on set[indices] only, e.g. leaving out samples the caller judges the result on; the
+        // validation split is taken from these samples too
+        template<typename Model, typename OnBatch>
+        training_result fit(Model& model, const mnist::training_set& set, std::vector<size_t> indices, OnBatch on_batch)
+        {
+            training_result result;
+
+            utils::shuffle(indices, utils::counter_rng(config.seed, utils::rng_stream::shuffle));
+
+            const size_t validation_size = static_cast<size_t>(indices.size() * config.validation_split);
+            const size_t train_size = indices.size() - validation_size;
+
+            validation.assign(indices.begin() + train_size, indices.end());
+            indices.resize(train_size);
+
+            if (train_size == 0)
+            {
+                utils::Logger::Error("trainer", "training split is empty");
+                return result;
+            }
+
+            const size_t batch_size = std::max<size_t>(config.batch_size, 1);
+            size_t evaluations_without_improvement = 0;
+            bool has_best = false;
+
+            for (size_t epoch = 0; epoch < config.max_epochs && !result.stopped_early; ++epoch)
+            {
+                if (epoch > 0)
+                    utils::shuffle(indices, utils::counter_rng(config.seed, utils::rng_stream::shuffle + epoch));
+
+                make_batch(set, indices, 0, std::min(batch_size, train_size), epoch, inputs, targets);
+
+                for (size_t first = 0; first < train_size && !result.stopped_early; first += batch_size)
+                {
+                    const size_t count = std::min(batch_size, train_size - first);
+                    const size_t next = first + count;
+
+                    if (next < train_size)
+                    {
+                        loader.run([&, next, epoch]
+                        {
+                            make_batch(set, indices, next, std::min(batch_size, train_size - next), epoch, next_inputs, next_targets);
+                        });
+                    }
+
+                    model.train_batch(inputs, targets);
+                    loader.wait();
+
+                    std::swap(inputs, next_inputs);
+                    std::swap(targets, next_targets);
+
+                    ++result.batches;
+                    on_batch(result.batches);
+
+                    const bool epoch_end = first + count >= train_size;
+
+                    if (validation.empty() || (result.batches % std::max<size_t>(config.eval_every, 1) != 0 && !epoch_end))
+                        continue;
+
+                    const evaluation score = evaluate(model, set, validation);
+                    ++result.evaluations;
+
+                    if (score.loss < result.best_loss - config.min_delta)
+                    {
+                        result.best_loss = score.loss;
+                        result.best_accuracy = score.accuracy;
+                        evaluations_without_improvement = 0;
+
+                        model.snapshot(best);
+                        has_best = true;
+                    }
+                    else if (++evaluations_without_improvement >= config.patience)
+                    {
+                        result.stopped_early = true;
+
+                        utils::Logger::Info("trainer", "early stop after " + std::to_string(result.batches) + " batches, best validation loss " +
+                            std::to_string(result.best_loss));
+                    }
+                }
+            }
+
+            if (has_best)
+                model.restore(best);
+
+            return result;
+        }
+
+        template<typename Model>
+        training_result fit(Model& model, const mnist::training_set& set)
+        {
+            return fit(model, set, [](size_t) {});
+        }
+
+        // 0..count-1 without excluded, in order
+        static std::vector<size_t> indices_except(size_t count, const std::vector<size_t>& excluded)
+        {
+            std::vector<bool> skip(count, false);
+            for (size_t index : excluded)
+            {
+                if (index < count)
+                    skip[index] = true;
+            }
+
+            std::vector<size_t> result;
+            result.reserve(count);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!skip[i])
+                    result.push_back(i);
+            }
+
+            return result;
+        }
+
+        // Mean squared error and accuracy over set[indices], computed in batches through forward_batch.
+        // Batches are independent and are spread over the shared thread pool.
+        template<typename Model>
+        evaluation evaluate(const Model& model, const mnist::training_set& set, const std::vector<size_t>& indices)
+        {
+            evaluation score;
+
+            if (indices.empty())
+                return score;
+
+            const size_t batch_size = std::max<size_t>(config.eval_batch_size, 1);
+            const size_t batches = (indices.size() + batch_size - 1) / batch_size;
+
+            std::mutex totals_mutex;
+            double squared_error = 0.0;
+            size_t right_answers = 0;
+
+            utils::parallel_for(0, batches, 1, [&](size_t first_batch, size_t last_batch)
+            {
+                math::matrix<float> batch_inputs;
+                math::matrix<float> batch_targets;
+                double batch_error = 0.0;
+                size_t batch_right = 0;
+
+                for (size_t batch = first_batch; batch < last_batch; ++batch)
+                {
+                    const size_t first = batch * batch_size;
+                    const size_t count = std::min(batch_size, indices.size() - first);
+
+                    mnist::make_batch(set, indices, first, count, batch_inputs, batch_targets);
+                    const auto outputs = model.forward_batch(batch_inputs);
+
+                    const float* out = outputs.data_ptr();
+                    const float* target = batch_targets.data_ptr();
+                    const size_t classes = outputs.size_m();
+
+                    for (size_t col = 0; col < count; ++col)
+                    {
+                        size_t predicted = 0;
+
+                        for (size_t row = 0; row < classes; ++row)
+                        {
+                            const float diff = out[row * count + col] - target[row * count + col];
+                            batch_error += diff * diff;
+
+                            if (out[row * count + col] > out[predicted * count + col])
+                                predicted = row;
+                        }
+
+                        if (predicted == static_cast<size_t>(set[indices[first + col]].first))
+                            ++batch_right;
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(totals_mutex);
+                squared_error += batch_error;
+                right_answers += batch_right;
+            });
+
+            score.loss = static_cast<float>(squared_error / indices.size());
+            score.accuracy = static_cast<float>(right_answers) / indices.size();
+            return score;
+        }
+
+        const std::vector<size_t>& validation_indices() const
+        {
+            return validation;
+        }
+
+    private:
+        void make_batch(const mnist::training_set& set, const std::vector<size_t>& indices, size_t first, size_t count, size_t epoch,
+            math::matrix<float>& batch_inputs, math::matrix<float>& batch_targets) const
+        {
+            if (config.augment)
+                image::augment_batch(set, indices, first, count, config.augmentation, config.seed, epoch, batch_inputs, batch_targets);
+            else
+                mnist::make_batch(set, indices, first, count, batch_inputs, batch_targets);
+        }
+
+        trainer_config config;
+        std::vector<size_t> validation;
+
+        model_snapshot best;
+        math::matrix<float> inputs;
+        math::matrix<float> targets;
+        math::matrix<float> next_inputs;
+        math::matrix<float> next_targets;
+
+        utils::task_group loader;
+    };
+}
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <intrin.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "perceptron.h"
+#include "../utils/atomic_file.h"
+#include "../utils/binary.h"
+#include "../utils/cpu_caches.h"
+#include "../utils/crc32c.h"
+#include "../utils/logger.h"
+#include "../utils/memory_stream.h"
+#include "../utils/thread_pool.h"
+
+namespace ml
+{
+    // The machine and build a tuning was measured on; a cache measured under another signature is stale
+    struct host_signature
+    {
+        std::string host;
+        std::string cpu;
+        // instruction sets the kernels were compiled for
+        std::string isa;
+        uint64_t hardware_threads = 0;
+        uint64_t pool_threads = 0;
+        uint64_t l1d = 0;
+        uint64_t l2 = 0;
+        uint64_t l3 = 0;
+
+        bool operator==(const host_signature& other) const
+        {
+            return host == other.host && cpu == other.cpu && isa == other.isa
+                && hardware_threads == other.hardware_threads && pool_threads == other.pool_threads
+                && l1d == other.l1d && l2 == other.l2 && l3 == other.l3;
+        }
+
+        bool operator!=(const host_signature& other) const
+        {
+            return !(*this == other);
+        }
+
+        static host_signature current()
+        {
+            const utils::cache_hierarchy& caches = utils::cpu_caches();
+
+            host_signature signature;
+            signature.host = host_name();
+            signature.cpu = cpu_name();
+            signature.isa = build_isa();
+            signature.hardware_threads = std::thread::hardware_concurrency();
+            signature.pool_threads = utils::thread_pool::instance().size();
+            signature.l1d = caches.l1d;
+            signature.l2 = caches.l2;
+            signature.l3 = caches.l3;
+            return signature;
+        }
+
+        static std::string host_name()
+        {
+#ifdef _WIN32
+            char name[MAX_COMPUTERNAME_LENGTH + 1] = {};
+            DWORD length = sizeof(name);
+
+            return GetComputerNameA(name, &length) ? std::string(name, length) : std::string();
+#else
+            char name[256] = {};
+            return ::gethostname(name, sizeof(name) - 1) == 0 ? std::string(name) : std::string();
+#endif
+        }
+
+        static std::string cpu_name()
+        {
+#ifdef _WIN32
+            int regs[4] = {};
+            __cpuid(regs, 0x80000000);
+
+            if (static_cast<unsigned>(regs[0]) < 0x80000004)
+                return std::string();
+
+            char brand[49] = {};
+            for (int i = 0; i < 3; ++i)
+            {
+                __cpuid(regs, 0x80000002 + i);
+                std::memcpy(brand + 16 * i, regs, sizeof(regs));
+            }
+
+            return brand;
+#else
+            std::ifstream cpuinfo("/proc/cpuinfo");
+            std::string line;
+
+            while (std::getline(cpuinfo, line))
+            {
+                if (line.rfind("model name", 0) == 0)
+                {
+                    const size_t colon = line.find(':');
+                    const size_t name = colon == std::string::npos ? colon : line.find_first_not_of(" \t", colon + 1);
+
+                    return name == std::string::npos ? std::string() : line.substr(name);
+                }
+            }
+
+            return std::string();
+#endif
+        }
+
+        static std::string build_isa()
+        {
+            std::string isa;
+#if defined(__x86_64__) || defined(_M_X64)
+            isa += "x64";
+#elif defined(__aarch64__) || defined(_M_ARM64)
+            isa += "arm64";
+#endif
+#if defined(__AVX512F__)
+            isa += " avx512f";
+#endif
+#if defined(__AVX2__)
+            isa += " avx2";
+#endif
+#if defined(__FMA__)
+            isa += " fma";
+#endif
+#if defined(__AVX__)
+            isa += " avx";
+#endif
+            return isa;
+        }
+    };
+
+    // The fastest tuning found for a model shape at one batch size
+    struct tuning_entry
+    {
+        // layer sizes, inputs first
+        std::vector<size_t> sizes;
+        size_t batch = 1;
+        forward_tuning tuning;
+        // per forward pass, with tuning and with the defaults
+        double microseconds = 0.0;
+        double default_microseconds = 0.0;
+    };
+
+    inline std::vector<size_t> layer_sizes(const perceptron& model)
+    {
+        std::vector<size_t> sizes;
+
+        if (model.layer_count() != 0)
+            sizes.push_back(model.layer(0).size_n());
+
+        for (size_t i = 0; i < model.layer_count(); ++i)
+            sizes.push_back(model.layer(i).size_m());
+
+        return sizes;
+    }
+
+    // Per-host file of the tunings autotuner found, read by engines at startup.
+    //
+    // The file is "TUNE", version, payload size, payload CRC32C, payload; the payload holds the
+    // host_signature it was measured under and the entries. A file that is missing, corrupted,
+    // of another version or measured under another signature loads as empty, which leaves models
+    // on the defaults.
+    class tuning_cache
+    {
+    public:
+        static constexpr uint32_t magic = 0x454E5554u; // "TUNE"
+        // bump when the kernels change enough to invalidate measured tunings
+        static constexpr uint32_t version = 1;
+
+        tuning_cache() : signature(host_signature::current()) {}
+
+        // tuning-<host>.bin in directory, so that hosts can share one directory
+        static std::string default_path(const std::string& directory = std::string())
+        {
+            std::string host = host_signature::host_name();
+            std::replace_if(host.begin(), host.end(), [](char c) { return c == '/' || c == '\\' || c == ':'; }, '_');
+
+            const std::string name = "tuning-" + (host.empty() ? std::string("host") : host) + ".bin";
+
+            if (directory.empty())
+                return name;
+
+            const char last = directory.back();
+            return last == '/' || last == '\\' ? directory + name : directory + "/" + name;
+        }
+
+        // True if fileName held tunings for this host; otherwise the cache is left empty
+        bool load(const std::string& fileName)
+        {
+            entries_list.clear();
+
+            std::vector<char> bytes;
+            {
+                // a missing file is the normal first start, not an error
+                std::ifstream probe(fileName, std::ios::binary);
+                if (!probe)
+                {
+                    utils::Logger::Info("tuning", "no tuning cache at " + fileName + ", using default kernel parameters");
+                    return false;
+                }
+            }
+
+            if (!utils::read_file(fileName, bytes))
+                return false;
+
+            utils::memory_stream in(std::move(bytes));
+
+            const uint32_t head = read_data<uint32_t>(in);
+            const uint32_t file_version = read_data<uint32_t>(in);
+            const uint64_t size = read_data<uint64_t>(in);
+            const uint32_t crc = read_data<uint32_t>(in);
+
+            if (!in.good() || head != magic)
+            {
+                utils::Logger::Error("tuning", "not a tuning cache: " + fileName);
+                return false;
+            }
+
+            if (file_version != version)
+            {
+                utils::Logger::Warning("tuning", "tuning cache " + fileName + " is version " + std::to_string(file_version) +
+                    ", expected " + std::to_string(version) + "; using default kernel parameters");
+                return false;
+            }
+
+            const char* payload_bytes = size <= in.size() ? in.consume(static_cast<size_t>(size)) : nullptr;
+
+            if (!payload_bytes || utils::crc32c(payload_bytes, static_cast<size_t>(size)) != crc)
+            {
+                utils::Logger::Error("tuning", "tuning cache is truncated or corrupted: " + fileName);
+                return false;
+            }
+
+            utils::memory_stream payload(std::vector<char>(payload_bytes, payload_bytes + size));
+            host_signature measured;
+            std::vector<tuning_entry> loaded;
+
+            if (!read_signature(payload, measured) || !read_entries(payload, loaded))
+            {
+                utils::Logger::Error("tuning", "tuning cache is truncated or corrupted: " + fileName);
+                return false;
+            }
+
+            if (measured != signature)
+            {
+                utils::Logger::Warning("tuning", "tuning cache " + fileName + " was measured on " + measured.host + " (" + measured.cpu +
+                    ", " + measured.isa + "), not on this host or build; using default kernel parameters");
+                return false;
+            }
+
+            entries_list = std::move(loaded);
+            return true;
+        }
+
+        bool save(const std::string& fileName) const
+        {
+            utils::memory_stream payload;
+            write_signature(signature, payload);
+            write_data(static_cast<uint64_t>(entries_list.size()), payload);
+
+            for (const auto& e : entries_list)
+            {
+                write_data(static_cast<uint64_t>(e.sizes.size()), payload);
+                for (size_t size : e.sizes)
+                    write_data(static_cast<uint64_t>(size), payload);
+
+                write_data(static_cast<uint64_t>(e.batch), payload);
+                write_data(static_cast<uint32_t>(e.tuning.fused ? 1 : 0), payload);
+                write_data(static_cast<uint64_t>(e.tuning.tile), payload);
+                write_data(static_cast<uint64_t>(e.tuning.row_block), payload);
+                write_data(static_cast<uint64_t>(e.tuning.threads), payload);
+                write_data(e.microseconds, payload);
+                write_data(e.default_microseconds, payload);
+            }
+
+            utils::memory_stream out;
+            write_data(magic, out);
+            write_data(version, out);
+            write_data(static_cast<uint64_t>(payload.size()), out);
+            write_data(utils::crc32c(payload.data(), payload.size()), out);
+            out.write(payload.data(), payload.size());
+
+            return utils::write_file_atomic(fileName, out.data(), out.size());
+        }
+
+        // adds entry, replacing the one of the same shape and batch
+        void store(const tuning_entry& entry)
+        {
+            auto it = std::find_if(entries_list.begin(), entries_list.end(), [&](const tuning_entry& e)
+            {
+                return e.sizes == entry.sizes && e.batch == entry.batch;
+            });
+
+            if (it != entries_list.end())
+                *it = entry;
+            else
+                entries_list.push_back(entry);
+        }
+
+        // entries of the shape, by batch
+        std::vector<tuning_entry> find(const std::vector<size_t>& sizes) const
+        {
+            std::vector<tuning_entry> result;
+            for (const auto& e : entries_list)
+            {
+                if (e.sizes == sizes)
+                    result.push_back(e);
+            }
+
+            std::sort(result.begin(), result.end(), [](const tuning_entry& a, const tuning_entry& b) { return a.batch < b.batch; });
+            return result;
+        }
+
+        // Installs the tunings of the model's shape, each from its batch size up; false, leaving the
+        // model as it is, when the cache has none
+        bool apply(perceptron& model) const
+        {
+            const auto found = find(layer_sizes(model));
+            if (found.empty())
+                return false;
+
+            model.clear_tuning();
+            for (const auto& e : found)
+                model.set_tuning(e.tuning, e.batch);
+
+            return true;
+        }
+
+        const std::vector<tuning_entry>& entries() const
+        {
+            return entries_list;
+        }
+
+        const host_signature& host() const
+        {
+            return signature;
+        }
+
+    private:
+        static void write_string(const std::string& value, utils::memory_stream& out)
+        {
+            write_data(static_cast<uint64_t>(value.size()), out);
+            out.write(value.data(), value.size());
+        }
+
+        static bool read_string(utils::memory_stream& in, std::string& value)
+        {
+            const uint64_t size = read_data<uint64_t>(in);
+            const char* bytes = in.good() && size <= in.size() ? in.consume(static_cast<size_t>(size)) : nullptr;
+
+            if (!bytes)
+                return false;
+
+            value.assign(bytes, static_cast<size_t>(size));
+            return true;
+        }
+
+        static void write_signature(const host_signature& s, utils::memory_stream& out)
+        {
+            write_string(s.host, out);
+            write_string(s.cpu, out);
+            write_string(s.isa, out);
+            write_data(s.hardware_threads, out);
+            write_data(s.pool_threads, out);
+            write_data(s.l1d, out);
+            write_data(s.l2, out);
+            write_data(s.l3, out);
+        }
+
+        static bool read_signature(utils::memory_stream& in, host_signature& s)
+        {
+            if (!read_string(in, s.host) || !read_string(in, s.cpu) || !read_string(in, s.isa))
+                return false;
+
+            s.hardware_threads = read_data<uint64_t>(in);
+            s.pool_threads = read_data<uint64_t>(in);
+            s.l1d = read_data<uint64_t>(in);
+            s.l2 = read_data<uint64_t>(in);
+            s.l3 = read_data<uint64_t>(in);
+            return in.good();
+        }
+
+        static bool read_entries(utils::memory_stream& in, std::vector<tuning_entry>& entries)
+        {
+            const uint64_t count = read_data<uint64_t>(in);
+            if (!in.good() || count > in.size())
+                return false;
+
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                tuning_entry e;
+                const uint64_t layers = read_data<uint64_t>(in);
+
+                if (!in.good() || layers > in.size())
+                    return false;
+
+                for (uint64_t l = 0; l < layers; ++l)
+                    e.sizes.push_back(static_cast<size_t>(read_data<uint64_t>(in)));
+
+                e.batch = static_cast<size_t>(read_data<uint64_t>(in));
+                e.tuning.fused = read_data<uint32_t>(in) != 0;
+                e.tuning.tile = static_cast<size_t>(read_data<uint64_t>(in));
+                e.tuning.row_block = static_cast<size_t>(read_data<uint64_t>(in));
+                e.tuning.threads = static_cast<size_t>(read_data<uint64_t>(in));
+                e.microseconds = read_data<double>(in);
+                e.default_microseconds = read_data<double>(in);
+
+                if (!in.good())
+                    return false;
+
+                entries.push_back(std::move(e));
+            }
+
+            return in.eof();
+        }
+
+        host_signature signature;
+        std::vector<tuning_entry> entries_list;
+    };
+}
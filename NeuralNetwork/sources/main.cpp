@@ -11,9 +11,10 @@
 #include <vector>
 #include <optional>
 
-#include "..\utils\mnist\mnist.h"
-#include "..\utils\progress_bar.h"
-#include "..\ml\perceptron.h"
+#include "../utils/mnist/mnist.h"
+#include "../utils/progress_bar.h"
+#include "../ml/perceptron.h"
+#include "../ml/trainer.h"
 
 constexpr char train_images[] = "D:\\train_images.idx";
 constexpr char train_labels[] = "D:\\train_labels.idx";
@@ -33,35 +34,30 @@ int main(int argc, char* argv[])
 
     if (mnist_training_set)
     {
-        size_t training_set_size = mnist_training_set->size();
-        progress_bar p_bar(training_set_size, 70);
+        ml::trainer_config config;
+        config.validation_split = 0.1f;
+        config.max_epochs = 5;
+        config.eval_every = 5000;
+        config.patience = 3;
 
-        std::cout << "network training:" << std::endl;
-
-        for (size_t step = 0; step < training_set_size; ++step)
-        {
-            std::vector<float> target_values(10, 0.01f);
+        ml::trainer trainer(config);
 
-            size_t index = static_cast<size_t>((*mnist_training_set)[step].first);
-            target_values[index] = 0.99f;
-
-            size_t train_size = (*mnist_training_set)[step].second.size();
-            std::vector<float> train_image(train_size);
-
-            for (size_t pix = 0; pix < train_size; ++pix)
-            {
-                auto color = static_cast<unsigned char>((*mnist_training_set)[step].second[pix]);
-                train_image[pix] = (color / 255.f) * 0.99f + 0.01f;
-            }
+        size_t training_set_size = mnist_training_set->size() - static_cast<size_t>(mnist_training_set->size() * config.validation_split);
+        progress_bar p_bar(training_set_size * config.max_epochs, 70);
 
-            neural_network.train(train_image, target_values);
+        std::cout << "network training:" << std::endl;
 
+        auto result = trainer.fit(neural_network, *mnist_training_set, [&p_bar](size_t)
+        {
             ++p_bar;
             p_bar.display();
-        }
+        });
 
-        neural_network.save(save_path);
         p_bar.done();
+
+        std::cout << "best validation accuracy: " << result.best_accuracy * 100.f << "%" << std::endl;
+
+        neural_network.save(save_path);
     }
     else
     {
@@ -0,0 +1,379 @@
+#pragma once
+
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "memory.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        namespace detail
+        {
+            inline size_t align_up(size_t value, size_t alignment)
+            {
+                return (value + alignment - 1) / alignment * alignment;
+            }
+        }
+
+        // Bump allocator for buffers that die together, e.g. the activations of a batch: allocate()
+        // advances a pointer within chunks taken from upstream, deallocate() does nothing, and reset()
+        // makes all chunks reusable at once. reset() must only be called once no buffer from the
+        // arena is alive.
+        class arena_allocator : public allocator
+        {
+        public:
+            explicit arena_allocator(size_t chunk_bytes = size_t{ 1 } << 22, allocator& upstream = heap())
+                : chunk_bytes(std::max(detail::align_up(chunk_bytes, allocation_alignment), allocation_alignment)), upstream(upstream) {}
+
+            arena_allocator(const arena_allocator&) = delete;
+            arena_allocator& operator=(const arena_allocator&) = delete;
+
+            ~arena_allocator() override
+            {
+                for (const auto& c : chunks)
+                    upstream.deallocate(c.base, c.size);
+            }
+
+            void* allocate(size_t bytes) override
+            {
+                bytes = detail::align_up(std::max<size_t>(bytes, 1), allocation_alignment);
+
+                std::lock_guard<std::mutex> lock(mutex);
+
+                while (current < chunks.size() && chunks[current].used + bytes > chunks[current].size)
+                    ++current;
+
+                if (current == chunks.size())
+                {
+                    const size_t size = std::max(chunk_bytes, bytes);
+                    chunks.push_back({ static_cast<char*>(upstream.allocate(size)), size, 0 });
+                }
+
+                chunk& c = chunks[current];
+                void* ptr = c.base + c.used;
+                c.used += bytes;
+                in_use += bytes;
+                return ptr;
+            }
+
+            void deallocate(void*, size_t) noexcept override {}
+
+            const char* name() const override
+            {
+                return "arena";
+            }
+
+            void reset()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (auto& c : chunks)
+                    c.used = 0;
+
+                current = 0;
+                in_use = 0;
+            }
+
+            // bytes handed out since the last reset, and bytes held from upstream
+            size_t used_bytes() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return in_use;
+            }
+
+            size_t reserved_bytes() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                size_t total = 0;
+                for (const auto& c : chunks)
+                    total += c.size;
+
+                return total;
+            }
+
+        private:
+            struct chunk
+            {
+                char* base;
+                size_t size;
+                size_t used;
+            };
+
+            const size_t chunk_bytes;
+            allocator& upstream;
+
+            mutable std::mutex mutex;
+            std::vector<chunk> chunks;
+            size_t current = 0;
+            size_t in_use = 0;
+        };
+
+        // Size-class pool for buffers of recurring sizes, e.g. the per-batch matrices of a training
+        // loop: requests are rounded up to a power of two and freed blocks are kept on a list per
+        // class for the next request of that class. Requests above max_class_bytes go straight to
+        // upstream. trim() returns the cached blocks.
+        class pool_allocator : public allocator
+        {
+        public:
+            explicit pool_allocator(size_t max_class_bytes = size_t{ 1 } << 26, allocator& upstream = heap())
+                : upstream(upstream)
+            {
+                size_t size = allocation_alignment;
+                while (size < max_class_bytes)
+                {
+                    size *= 2;
+                    ++largest_class;
+                }
+
+                free_lists.resize(largest_class + 1);
+            }
+
+            pool_allocator(const pool_allocator&) = delete;
+            pool_allocator& operator=(const pool_allocator&) = delete;
+
+            ~pool_allocator() override
+            {
+                trim();
+            }
+
+            void* allocate(size_t bytes) override
+            {
+                const size_t index = size_class(bytes);
+
+                if (index > largest_class)
+                    return upstream.allocate(bytes);
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    auto& list = free_lists[index];
+
+                    if (!list.empty())
+                    {
+                        void* ptr = list.back();
+                        list.pop_back();
+                        cached -= class_bytes(index);
+                        ++hits;
+                        return ptr;
+                    }
+                }
+
+                return upstream.allocate(class_bytes(index));
+            }
+
+            void deallocate(void* ptr, size_t bytes) noexcept override
+            {
+                const size_t index = size_class(bytes);
+
+                if (index > largest_class)
+                {
+                    upstream.deallocate(ptr, bytes);
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+
+                try
+                {
+                    free_lists[index].push_back(ptr);
+                    cached += class_bytes(index);
+                }
+                catch (...)
+                {
+                    upstream.deallocate(ptr, class_bytes(index));
+                }
+            }
+
+            const char* name() const override
+            {
+                return "pool";
+            }
+
+            void trim()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                for (size_t index = 0; index < free_lists.size(); ++index)
+                {
+                    for (void* ptr : free_lists[index])
+                        upstream.deallocate(ptr, class_bytes(index));
+
+                    free_lists[index].clear();
+                }
+
+                cached = 0;
+            }
+
+            // bytes kept on the free lists, and allocations served from them
+            size_t cached_bytes() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return cached;
+            }
+
+            uint64_t reused() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return hits;
+            }
+
+        private:
+            static size_t class_bytes(size_t index)
+            {
+                return allocation_alignment << index;
+            }
+
+            static size_t size_class(size_t bytes)
+            {
+                size_t index = 0;
+                while (class_bytes(index) < bytes)
+                    ++index;
+
+                return index;
+            }
+
+            allocator& upstream;
+            size_t largest_class = 0;
+
+            mutable std::mutex mutex;
+            std::vector<std::vector<void*>> free_lists;
+            size_t cached = 0;
+            uint64_t hits = 0;
+        };
+
+        // Backs large buffers (weights, dataset batches) with huge pages to cut TLB misses: a request
+        // of at least min_bytes is rounded up to whole 2 MB pages and first tried as explicit huge
+        // pages (MAP_HUGETLB on Linux, MEM_LARGE_PAGES on Windows, both need pages or privileges set
+        // up by the administrator), then as ordinary memory aligned to 2 MB with MADV_HUGEPAGE so that
+        // transparent huge pages can back it. Smaller requests go to upstream.
+        class huge_page_allocator : public allocator
+        {
+        public:
+            static constexpr size_t huge_page_bytes = size_t{ 1 } << 21;
+
+            explicit huge_page_allocator(size_t min_bytes = huge_page_bytes, allocator& upstream = heap())
+                : min_bytes(min_bytes), upstream(upstream) {}
+
+            void* allocate(size_t bytes) override
+            {
+                if (bytes < min_bytes)
+                    return upstream.allocate(bytes);
+
+                const size_t size = detail::align_up(bytes, huge_page_bytes);
+                void* ptr = map(size);
+
+                if (!ptr)
+                    throw std::bad_alloc();
+
+                return ptr;
+            }
+
+            void deallocate(void* ptr, size_t bytes) noexcept override
+            {
+                if (bytes < min_bytes)
+                {
+                    upstream.deallocate(ptr, bytes);
+                    return;
+                }
+
+#ifdef _WIN32
+                VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+                ::munmap(ptr, detail::align_up(bytes, huge_page_bytes));
+#endif
+            }
+
+            const char* name() const override
+            {
+                return "huge pages";
+            }
+
+            // bytes mapped so far as explicit huge pages and as transparent huge page candidates
+            size_t explicit_bytes() const
+            {
+                return explicit_mapped.load(std::memory_order_relaxed);
+            }
+
+            size_t transparent_bytes() const
+            {
+                return transparent_mapped.load(std::memory_order_relaxed);
+            }
+
+        private:
+            void* map(size_t size)
+            {
+#ifdef _WIN32
+                const size_t large_page = GetLargePageMinimum();
+
+                if (large_page != 0 && size % large_page == 0)
+                {
+                    if (void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE))
+                    {
+                        explicit_mapped.fetch_add(size, std::memory_order_relaxed);
+                        return ptr;
+                    }
+                }
+
+                void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+                if (ptr)
+                    transparent_mapped.fetch_add(size, std::memory_order_relaxed);
+
+                return ptr;
+#else
+#ifdef MAP_HUGETLB
+                void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (ptr != MAP_FAILED)
+                {
+                    explicit_mapped.fetch_add(size, std::memory_order_relaxed);
+                    return ptr;
+                }
+#endif
+                // over-map by one huge page and cut the ends so the block starts on a 2 MB boundary
+                void* raw = ::mmap(nullptr, size + huge_page_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (raw == MAP_FAILED)
+                    return nullptr;
+
+                const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+                const uintptr_t aligned = detail::align_up(start, huge_page_bytes);
+
+                if (aligned != start)
+                    ::munmap(raw, aligned - start);
+
+                const size_t tail = huge_page_bytes - (aligned - start);
+                if (tail != 0)
+                    ::munmap(reinterpret_cast<void*>(aligned + size), tail);
+
+#ifdef MADV_HUGEPAGE
+                ::madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+                transparent_mapped.fetch_add(size, std::memory_order_relaxed);
+                return reinterpret_cast<void*>(aligned);
+#endif
+            }
+
+            const size_t min_bytes;
+            allocator& upstream;
+
+            std::atomic<size_t> explicit_mapped{ 0 };
+            std::atomic<size_t> transparent_mapped{ 0 };
+        };
+    }
+}
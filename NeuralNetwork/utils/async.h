@@ -0,0 +1,415 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <optional>
+#include <exception>
+#include <coroutine>
+#include <type_traits>
+#include <condition_variable>
+
+#include "logger.h"
+#include "thread_pool.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        // Observes a cancellation_source. A default constructed token is never cancelled.
+        // Cancellation is cooperative: operations check the token at their suspension points and
+        // complete with an empty result, so nothing throws and no in-flight read is abandoned.
+        class cancellation_token
+        {
+        public:
+            cancellation_token() = default;
+
+            bool cancelled() const
+            {
+                return state && state->load(std::memory_order_acquire);
+            }
+
+            bool can_be_cancelled() const
+            {
+                return state != nullptr;
+            }
+
+        private:
+            friend class cancellation_source;
+
+            explicit cancellation_token(std::shared_ptr<std::atomic<bool>> state) : state(std::move(state)) {}
+
+            std::shared_ptr<std::atomic<bool>> state;
+        };
+
+        class cancellation_source
+        {
+        public:
+            cancellation_source() : state(std::make_shared<std::atomic<bool>>(false)) {}
+
+            cancellation_token token() const
+            {
+                return cancellation_token(state);
+            }
+
+            void cancel()
+            {
+                state->store(true, std::memory_order_release);
+            }
+
+            bool cancelled() const
+            {
+                return state->load(std::memory_order_acquire);
+            }
+
+        private:
+            std::shared_ptr<std::atomic<bool>> state;
+        };
+
+        template<typename T = void>
+        class task;
+
+        namespace detail
+        {
+            struct task_promise_base
+            {
+                // resumes whoever awaited the task, without growing the stack
+                struct final_awaiter
+                {
+                    bool await_ready() noexcept
+                    {
+                        return false;
+                    }
+
+                    template<typename Promise>
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+                    {
+                        const auto continuation = handle.promise().continuation;
+                        return continuation ? continuation : std::noop_coroutine();
+                    }
+
+                    void await_resume() noexcept {}
+                };
+
+                std::suspend_always initial_suspend() noexcept
+                {
+                    return {};
+                }
+
+                final_awaiter final_suspend() noexcept
+                {
+                    return {};
+                }
+
+                void unhandled_exception() noexcept
+                {
+                    error = std::current_exception();
+                }
+
+                std::coroutine_handle<> continuation;
+                std::exception_ptr error;
+            };
+
+            template<typename T>
+            struct task_promise : task_promise_base
+            {
+                task<T> get_return_object() noexcept;
+
+                template<typename Value>
+                void return_value(Value&& result)
+                {
+                    value.emplace(std::forward<Value>(result));
+                }
+
+                T take()
+                {
+                    if (error)
+                        std::rethrow_exception(error);
+
+                    return std::move(*value);
+                }
+
+                std::optional<T> value;
+            };
+
+            template<>
+            struct task_promise<void> : task_promise_base
+            {
+                task<void> get_return_object() noexcept;
+
+                void return_void() noexcept {}
+
+                void take()
+                {
+                    if (error)
+                        std::rethrow_exception(error);
+                }
+            };
+
+            // eager, self-destroying coroutine that drives a task to completion
+            struct detached
+            {
+                struct promise_type
+                {
+                    detached get_return_object() noexcept
+                    {
+                        return {};
+                    }
+
+                    std::suspend_never initial_suspend() noexcept
+                    {
+                        return {};
+                    }
+
+                    std::suspend_never final_suspend() noexcept
+                    {
+                        return {};
+                    }
+
+                    void return_void() noexcept {}
+
+                    void unhandled_exception() noexcept
+                    {
+                        std::terminate();
+                    }
+                };
+            };
+        }
+
+        // Lazily started coroutine: the body runs when the task is awaited and the awaiter resumes on
+        // whichever thread finishes it. Exceptions propagate to the awaiter. Move-only.
+        template<typename T>
+        class task
+        {
+        public:
+            using promise_type = detail::task_promise<T>;
+            using value_type = T;
+
+            task() = default;
+
+            explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+            task(task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+            task& operator=(task&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    if (handle)
+                        handle.destroy();
+
+                    handle = std::exchange(other.handle, {});
+                }
+
+                return *this;
+            }
+
+            task(const task&) = delete;
+            task& operator=(const task&) = delete;
+
+            ~task()
+            {
+                if (handle)
+                    handle.destroy();
+            }
+
+            bool valid() const
+            {
+                return static_cast<bool>(handle);
+            }
+
+            auto operator co_await() && noexcept
+            {
+                struct awaiter
+                {
+                    bool await_ready() noexcept
+                    {
+                        return !handle || handle.done();
+                    }
+
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+                    {
+                        handle.promise().continuation = awaiting;
+                        return handle;
+                    }
+
+                    T await_resume()
+                    {
+                        return handle.promise().take();
+                    }
+
+                    std::coroutine_handle<promise_type> handle;
+                };
+
+                return awaiter{ handle };
+            }
+
+            auto operator co_await() & noexcept
+            {
+                return std::move(*this).operator co_await();
+            }
+
+        private:
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        namespace detail
+        {
+            template<typename T>
+            task<T> task_promise<T>::get_return_object() noexcept
+            {
+                return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+            }
+
+            inline task<void> task_promise<void>::get_return_object() noexcept
+            {
+                return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+            }
+
+            template<typename T>
+            struct sync_state
+            {
+                std::mutex mutex;
+                std::condition_variable done_signal;
+                bool done = false;
+                std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+                std::exception_ptr error;
+
+                void finish()
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done = true;
+                    done_signal.notify_all();
+                }
+            };
+
+            template<typename T>
+            detached sync_driver(task<T> work, sync_state<T>* state)
+            {
+                try
+                {
+                    if constexpr (std::is_void_v<T>)
+                    {
+                        co_await std::move(work);
+                        state->value.emplace(true);
+                    }
+                    else
+                    {
+                        state->value.emplace(co_await std::move(work));
+                    }
+                }
+                catch (...)
+                {
+                    state->error = std::current_exception();
+                }
+
+                state->finish();
+            }
+
+            template<typename T>
+            detached spawn_driver(task<T> work)
+            {
+                try
+                {
+                    co_await std::move(work);
+                }
+                catch (const std::exception& e)
+                {
+                    Logger::Error("async", std::string("detached task failed: ") + e.what());
+                }
+                catch (...)
+                {
+                    Logger::Error("async", "detached task failed");
+                }
+            }
+        }
+
+        // Runs coroutines on a thread_pool. Awaiting schedule() moves the coroutine onto a pool thread,
+        // so everything after it runs there; offload(fn) does the same around a single call.
+        class executor
+        {
+        public:
+            explicit executor(thread_pool& pool = thread_pool::instance()) : pool(pool) {}
+
+            // the executor of the shared pool
+            static executor& shared()
+            {
+                static executor instance;
+                return instance;
+            }
+
+            auto schedule() noexcept
+            {
+                struct awaiter
+                {
+                    bool await_ready() noexcept
+                    {
+                        return false;
+                    }
+
+                    void await_suspend(std::coroutine_handle<> handle)
+                    {
+                        self->post(handle);
+                    }
+
+                    void await_resume() noexcept {}
+
+                    executor* self;
+                };
+
+                return awaiter{ this };
+            }
+
+            // resumes handle on a pool thread
+            void post(std::coroutine_handle<> handle)
+            {
+                pool.submit([handle] { handle.resume(); });
+            }
+
+            // fn() on a pool thread; the awaiter continues there with its result
+            template<typename Fn>
+            auto offload(Fn fn) -> task<std::invoke_result_t<Fn&>>
+            {
+                co_await schedule();
+                co_return fn();
+            }
+
+            // starts work now and forgets it; failures are logged
+            template<typename T>
+            void spawn(task<T> work)
+            {
+                detail::spawn_driver(std::move(work));
+            }
+
+            thread_pool& threads()
+            {
+                return pool;
+            }
+
+        private:
+            thread_pool& pool;
+        };
+
+        // Blocks the calling thread until work finished and returns its result. Meant for the edges of
+        // a program (main, tests, the C API); never call it from a pool thread, which the wait would
+        // take away from the tasks it is waiting for.
+        template<typename T>
+        T sync_wait(task<T> work)
+        {
+            detail::sync_state<T> state;
+            detail::sync_driver(std::move(work), &state);
+
+            {
+                std::unique_lock<std::mutex> lock(state.mutex);
+                state.done_signal.wait(lock, [&] { return state.done; });
+            }
+
+            if (state.error)
+                std::rethrow_exception(state.error);
+
+            if constexpr (!std::is_void_v<T>)
+                return std::move(*state.value);
+        }
+    }
+}
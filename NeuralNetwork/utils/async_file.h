@@ -0,0 +1,380 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <condition_variable>
+
+#include "async.h"
+#include "logger.h"
+#include "atomic_file.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ML_ASYNC_IO_URING 1
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+namespace ml
+{
+    namespace utils
+    {
+#ifdef ML_ASYNC_IO_URING
+        namespace detail
+        {
+            // One read in flight; lives in the awaiting coroutine's frame until it is resumed
+            struct uring_read
+            {
+                std::coroutine_handle<> handle;
+                executor* resume_on = nullptr;
+                int result = 0;
+            };
+
+            // Process-wide io_uring driven through the raw system calls, so no liburing is needed.
+            // Reads are submitted by the awaiting coroutine; one reaper thread sleeps in
+            // io_uring_enter for completions and resumes their coroutines on the thread pool.
+            // instance() is null when the kernel or a sandbox refuses io_uring_setup; callers then
+            // fall back to blocking reads on the pool.
+            class uring_queue
+            {
+            public:
+                static uring_queue* instance()
+                {
+                    static uring_queue queue;
+                    return queue.ring_fd >= 0 ? &queue : nullptr;
+                }
+
+                ~uring_queue()
+                {
+                    if (ring_fd < 0)
+                        return;
+
+                    // a no-op completion with user data 0 wakes the reaper and tells it to quit
+                    stopping = true;
+                    push(IORING_OP_NOP, -1, nullptr, 0, 0, 0);
+
+                    if (reaper.joinable())
+                        reaper.join();
+
+                    ::munmap(sqes, sqe_bytes);
+                    if (cq_ptr != sq_ptr)
+                        ::munmap(cq_ptr, cq_bytes);
+                    ::munmap(sq_ptr, sq_bytes);
+                    ::close(ring_fd);
+                }
+
+                // False when the read could not be queued; read is resumed once it completed otherwise,
+                // and must not be touched by the caller after this returns true
+                bool submit_read(int fd, void* buffer, unsigned size, uint64_t offset, uring_read* read)
+                {
+                    return push(IORING_OP_READ, fd, buffer, size, offset, reinterpret_cast<uint64_t>(read));
+                }
+
+            private:
+                static constexpr unsigned entries = 64;
+
+                uring_queue()
+                {
+                    io_uring_params params{};
+                    ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+
+                    if (ring_fd < 0)
+                    {
+                        Logger::Info("async", "io_uring unavailable (" + std::string(std::strerror(errno)) + "), file reads run on the thread pool");
+                        return;
+                    }
+
+                    sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                    cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+                    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                    if (single_mmap)
+                        sq_bytes = cq_bytes = std::max(sq_bytes, cq_bytes);
+
+                    sq_ptr = ::mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+                    cq_ptr = single_mmap ? sq_ptr
+                        : ::mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+                    sqe_bytes = params.sq_entries * sizeof(io_uring_sqe);
+                    void* sqe_ptr = ::mmap(nullptr, sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+
+                    if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqe_ptr == MAP_FAILED)
+                    {
+                        Logger::Info("async", "io_uring rings could not be mapped, file reads run on the thread pool");
+
+                        if (sqe_ptr != MAP_FAILED)
+                            ::munmap(sqe_ptr, sqe_bytes);
+                        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+                            ::munmap(cq_ptr, cq_bytes);
+                        if (sq_ptr != MAP_FAILED)
+                            ::munmap(sq_ptr, sq_bytes);
+
+                        ::close(ring_fd);
+                        ring_fd = -1;
+                        return;
+                    }
+
+                    char* sq = static_cast<char*>(sq_ptr);
+                    char* cq = static_cast<char*>(cq_ptr);
+
+                    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+                    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                    sq_capacity = params.sq_entries;
+                    sqes = static_cast<io_uring_sqe*>(sqe_ptr);
+
+                    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+                    reaper = std::thread([this] { reap(); });
+                }
+
+                bool push(uint8_t opcode, int fd, void* buffer, unsigned size, uint64_t offset, uint64_t user_data)
+                {
+                    std::unique_lock<std::mutex> lock(submit_mutex);
+
+                    // the completion queue holds twice the submission entries; capping what is in
+                    // flight at the submission size keeps it from overflowing
+                    slot_free.wait(lock, [this] { return in_flight < sq_capacity; });
+                    ++in_flight;
+
+                    const unsigned tail = *sq_tail;
+                    const unsigned index = tail & sq_mask;
+
+                    io_uring_sqe& sqe = sqes[index];
+                    std::memset(&sqe, 0, sizeof(sqe));
+                    sqe.opcode = opcode;
+                    sqe.fd = fd;
+                    sqe.addr = reinterpret_cast<uint64_t>(buffer);
+                    sqe.len = size;
+                    sqe.off = offset;
+                    sqe.user_data = user_data;
+
+                    sq_array[index] = index;
+                    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+                    long submitted;
+                    do
+                    {
+                        submitted = ::syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0);
+                    } while (submitted < 0 && errno == EINTR);
+
+                    if (submitted == 1)
+                        return true;
+
+                    // not consumed by the kernel: take the entry back
+                    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+                    --in_flight;
+                    slot_free.notify_one();
+                    return false;
+                }
+
+                void reap()
+                {
+                    for (;;)
+                    {
+                        long waited = ::syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                        if (waited < 0 && errno != EINTR)
+                        {
+                            Logger::Error("async", "io_uring wait failed: " + std::string(std::strerror(errno)));
+                            return;
+                        }
+
+                        // the submitter wrote the read's handle before queueing it under this lock;
+                        // taking it orders those writes before the resume without relying on the ring
+                        std::lock_guard<std::mutex> lock(submit_mutex);
+
+                        unsigned head = *cq_head;
+                        const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+                        bool quit = false;
+                        unsigned completed = 0;
+
+                        for (; head != tail; ++head, ++completed)
+                        {
+                            const io_uring_cqe& cqe = cqes[head & cq_mask];
+
+                            if (cqe.user_data == 0)
+                            {
+                                quit = stopping;
+                                continue;
+                            }
+
+                            auto* read = reinterpret_cast<uring_read*>(cqe.user_data);
+                            read->result = cqe.res;
+                            read->resume_on->post(read->handle);
+                        }
+
+                        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+                        if (completed != 0)
+                        {
+                            in_flight -= completed;
+                            slot_free.notify_all();
+                        }
+
+                        if (quit)
+                            return;
+                    }
+                }
+
+                int ring_fd = -1;
+
+                void* sq_ptr = nullptr;
+                void* cq_ptr = nullptr;
+                size_t sq_bytes = 0;
+                size_t cq_bytes = 0;
+                size_t sqe_bytes = 0;
+
+                unsigned* sq_head = nullptr;
+                unsigned* sq_tail = nullptr;
+                unsigned* sq_array = nullptr;
+                unsigned sq_mask = 0;
+                unsigned sq_capacity = 0;
+                io_uring_sqe* sqes = nullptr;
+
+                unsigned* cq_head = nullptr;
+                unsigned* cq_tail = nullptr;
+                unsigned cq_mask = 0;
+                io_uring_cqe* cqes = nullptr;
+
+                std::mutex submit_mutex;
+                std::condition_variable slot_free;
+                unsigned in_flight = 0;
+                std::atomic<bool> stopping{ false };
+
+                std::thread reaper;
+            };
+
+            struct uring_read_awaiter
+            {
+                bool await_ready() noexcept
+                {
+                    return false;
+                }
+
+                bool await_suspend(std::coroutine_handle<> handle)
+                {
+                    read.handle = handle;
+                    read.resume_on = resume_on;
+
+                    if (queue->submit_read(fd, buffer, size, offset, &read))
+                        return true;
+
+                    read.result = -EAGAIN;
+                    return false;
+                }
+
+                int await_resume() noexcept
+                {
+                    return read.result;
+                }
+
+                uring_queue* queue;
+                int fd;
+                void* buffer;
+                unsigned size;
+                uint64_t offset;
+                executor* resume_on;
+                uring_read read;
+            };
+
+            // the ring reads in chunks of this size; cancellation is checked between them
+            constexpr size_t async_read_chunk = size_t{ 1 } << 20;
+        }
+#endif
+
+        // Reads a whole file without blocking a pool thread. On Linux the reads go through io_uring;
+        // elsewhere, or when io_uring is not available, read_file runs on the pool. Empty if the file
+        // could not be read or token was cancelled; the awaiter resumes on a pool thread.
+        inline task<std::optional<std::vector<char>>> read_file_async(std::string fileName, cancellation_token token = {}, executor& ex = executor::shared())
+        {
+            if (token.cancelled())
+                co_return std::nullopt;
+
+#ifdef ML_ASYNC_IO_URING
+            if (detail::uring_queue* queue = detail::uring_queue::instance())
+            {
+                const int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+                struct stat info{};
+
+                if (fd < 0 || ::fstat(fd, &info) != 0)
+                {
+                    if (fd >= 0)
+                        ::close(fd);
+
+                    Logger::Error("file", "could not open file: " + fileName);
+                    co_return std::nullopt;
+                }
+
+                std::vector<char> bytes(static_cast<size_t>(info.st_size));
+                size_t done = 0;
+                bool fallback = false;
+
+                while (done < bytes.size() && !token.cancelled())
+                {
+                    const size_t chunk = std::min(detail::async_read_chunk, bytes.size() - done);
+                    const int result = co_await detail::uring_read_awaiter{ queue, fd, bytes.data() + done, static_cast<unsigned>(chunk), done, &ex, {} };
+
+                    // kernels before 5.6 have the ring but not the read operation
+                    if (result == -EINVAL || result == -EOPNOTSUPP || result == -EAGAIN)
+                    {
+                        fallback = true;
+                        break;
+                    }
+
+                    if (result <= 0)
+                    {
+                        ::close(fd);
+                        Logger::Error("file", "could not read file: " + fileName);
+                        co_return std::nullopt;
+                    }
+
+                    done += static_cast<size_t>(result);
+                }
+
+                ::close(fd);
+
+                if (!fallback)
+                {
+                    if (token.cancelled())
+                        co_return std::nullopt;
+
+                    co_return std::optional<std::vector<char>>(std::move(bytes));
+                }
+            }
+#endif
+
+            co_await ex.schedule();
+
+            std::vector<char> bytes;
+            if (token.cancelled() || !read_file(fileName, bytes))
+                co_return std::nullopt;
+
+            co_return std::optional<std::vector<char>>(std::move(bytes));
+        }
+
+        // write_file_atomic on a pool thread; false if it failed or token was cancelled before it started
+        inline task<bool> write_file_async(std::string fileName, std::vector<char> bytes, cancellation_token token = {}, executor& ex = executor::shared())
+        {
+            co_await ex.schedule();
+
+            if (token.cancelled())
+                co_return false;
+
+            co_return write_file_atomic(fileName, bytes.data(), bytes.size());
+        }
+    }
+}
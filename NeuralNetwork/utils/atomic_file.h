@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+
+#ifdef _WIN32
+#include <io.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "logger.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        namespace detail
+        {
+            struct file_closer
+            {
+                void operator()(FILE* file) const { if (file) fclose(file); }
+            };
+
+            using file_handle = std::unique_ptr<FILE, file_closer>;
+
+            inline bool flush_to_disk(FILE* file)
+            {
+                if (fflush(file) != 0)
+                    return false;
+#ifdef _WIN32
+                return _commit(_fileno(file)) == 0;
+#else
+                return fsync(fileno(file)) == 0;
+#endif
+            }
+
+            inline bool replace_file(const std::string& from, const std::string& to)
+            {
+#ifdef _WIN32
+                return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+                return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+            }
+        }
+
+        // Writes the buffer to fileName + ".tmp", flushes it to disk and renames it over fileName,
+        // so a crash leaves either the previous file or the complete new one
+        inline bool write_file_atomic(const std::string& fileName, const char* bytes, size_t size)
+        {
+            const std::string tempName = fileName + ".tmp";
+
+            {
+                detail::file_handle file(fopen(tempName.c_str(), "wb"));
+
+                if (!file)
+                {
+                    Logger::Error("file", "could not open file: " + tempName);
+                    return false;
+                }
+
+                if (fwrite(bytes, 1, size, file.get()) != size || !detail::flush_to_disk(file.get()))
+                {
+                    Logger::Error("file", "could not write file: " + tempName);
+                    file.reset();
+                    std::remove(tempName.c_str());
+                    return false;
+                }
+            }
+
+            if (!detail::replace_file(tempName, fileName))
+            {
+                Logger::Error("file", "could not replace file: " + fileName);
+                std::remove(tempName.c_str());
+                return false;
+            }
+
+            return true;
+        }
+
+        inline bool read_file(const std::string& fileName, std::vector<char>& bytes)
+        {
+            detail::file_handle file(fopen(fileName.c_str(), "rb"));
+
+            if (!file)
+            {
+                Logger::Error("file", "could not open file: " + fileName);
+                return false;
+            }
+
+            fseek(file.get(), 0, SEEK_END);
+            const long size = ftell(file.get());
+            fseek(file.get(), 0, SEEK_SET);
+
+            if (size < 0)
+            {
+                Logger::Error("file", "could not read file: " + fileName);
+                return false;
+            }
+
+            bytes.resize(static_cast<size_t>(size));
+
+            if (fread(bytes.data(), 1, bytes.size(), file.get()) != bytes.size())
+            {
+                Logger::Error("file", "could not read file: " + fileName);
+                return false;
+            }
+
+            return true;
+        }
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 inline uint32_t swap_endian(uint32_t val) noexcept
 {
     val = ((val << 8) & 0xFF00FF00) | ((val >> 8) & 0xFF00FF);
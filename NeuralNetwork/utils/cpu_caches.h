@@ -0,0 +1,122 @@
+#pragma once
+
+#include <string>
+#include <cstdlib>
+#include <fstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <vector>
+#include <windows.h>
+#endif
+
+namespace ml
+{
+    namespace utils
+    {
+        // Data cache sizes of one core in bytes; levels that cannot be detected keep these defaults
+        struct cache_hierarchy
+        {
+            size_t line = 64;
+            size_t l1d = size_t{ 32 } << 10;
+            size_t l2 = size_t{ 256 } << 10;
+            size_t l3 = size_t{ 8 } << 20;
+        };
+
+        namespace detail
+        {
+            // "48K", "2048K", "32M" as found in sysfs
+            inline size_t parse_cache_size(const std::string& text)
+            {
+                char* end = nullptr;
+                size_t value = std::strtoull(text.c_str(), &end, 10);
+
+                if (end && (*end == 'K' || *end == 'k'))
+                    value <<= 10;
+                else if (end && (*end == 'M' || *end == 'm'))
+                    value <<= 20;
+
+                return value;
+            }
+
+            inline void store_cache_level(cache_hierarchy& caches, unsigned level, size_t size, size_t line)
+            {
+                if (size == 0)
+                    return;
+
+                if (level == 1)
+                    caches.l1d = size;
+                else if (level == 2)
+                    caches.l2 = size;
+                else if (level == 3)
+                    caches.l3 = size;
+
+                if (level == 1 && line != 0)
+                    caches.line = line;
+            }
+        }
+
+        // Reads the data and unified caches of the first CPU: sysfs on Linux, the logical processor
+        // information on Windows
+        inline cache_hierarchy detect_caches()
+        {
+            cache_hierarchy caches;
+
+#ifdef _WIN32
+            DWORD length = 0;
+            GetLogicalProcessorInformation(nullptr, &length);
+
+            std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+
+            if (!info.empty() && GetLogicalProcessorInformation(info.data(), &length))
+            {
+                for (const auto& item : info)
+                {
+                    if (item.Relationship != RelationCache || item.Cache.Type == CacheInstruction)
+                        continue;
+
+                    detail::store_cache_level(caches, item.Cache.Level, item.Cache.Size, item.Cache.LineSize);
+                }
+            }
+#else
+            for (int index = 0; index < 8; ++index)
+            {
+                const std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+
+                std::ifstream type_file(dir + "type");
+                std::string type;
+
+                if (!(type_file >> type))
+                    break;
+
+                if (type == "Instruction")
+                    continue;
+
+                unsigned level = 0;
+                std::string size;
+                size_t line = 0;
+
+                std::ifstream(dir + "level") >> level;
+                std::ifstream(dir + "size") >> size;
+                std::ifstream(dir + "coherency_line_size") >> line;
+
+                detail::store_cache_level(caches, level, detail::parse_cache_size(size), line);
+            }
+#endif
+
+            return caches;
+        }
+
+        // detect_caches() of the first call, kept for the life of the process
+        inline const cache_hierarchy& cpu_caches()
+        {
+            static const cache_hierarchy caches = detect_caches();
+            return caches;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE4_2__) || defined(__AVX__)
+#include <nmmintrin.h>
+#define ML_CRC32C_HARDWARE
+#endif
+
+namespace ml
+{
+    namespace utils
+    {
+        namespace detail
+        {
+            // Castagnoli polynomial, reflected
+            constexpr uint32_t crc32c_poly = 0x82F63B78u;
+
+            inline const std::array<std::array<uint32_t, 256>, 4>& crc32c_tables()
+            {
+                static const auto tables = []
+                {
+                    std::array<std::array<uint32_t, 256>, 4> t{};
+
+                    for (uint32_t i = 0; i < 256; ++i)
+                    {
+                        uint32_t crc = i;
+
+                        for (int bit = 0; bit < 8; ++bit)
+                            crc = (crc >> 1) ^ (crc32c_poly & (0u - (crc & 1u)));
+
+                        t[0][i] = crc;
+                    }
+
+                    for (uint32_t i = 0; i < 256; ++i)
+                    {
+                        for (size_t k = 1; k < 4; ++k)
+                            t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                    }
+
+                    return t;
+                }();
+
+                return tables;
+            }
+        }
+
+        // CRC32C of a byte range; pass the previous result as crc to continue a running checksum
+        inline uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0) noexcept
+        {
+            auto bytes = static_cast<const unsigned char*>(data);
+            crc = ~crc;
+
+#ifdef ML_CRC32C_HARDWARE
+            while (size >= sizeof(uint32_t))
+            {
+                uint32_t word;
+                std::memcpy(&word, bytes, sizeof(word));
+                crc = _mm_crc32_u32(crc, word);
+                bytes += sizeof(word);
+                size -= sizeof(word);
+            }
+
+            while (size--)
+                crc = _mm_crc32_u8(crc, *bytes++);
+#else
+            const auto& t = detail::crc32c_tables();
+
+            // slicing-by-4, little-endian
+            while (size >= sizeof(uint32_t))
+            {
+                uint32_t word;
+                std::memcpy(&word, bytes, sizeof(word));
+                word ^= crc;
+
+                crc = t[3][word & 0xFF] ^ t[2][(word >> 8) & 0xFF] ^ t[1][(word >> 16) & 0xFF] ^ t[0][word >> 24];
+
+                bytes += sizeof(word);
+                size -= sizeof(word);
+            }
+
+            while (size--)
+                crc = (crc >> 8) ^ t[0][(crc ^ *bytes++) & 0xFF];
+#endif
+
+            return ~crc;
+        }
+    }
+}
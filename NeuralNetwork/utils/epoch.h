@@ -0,0 +1,213 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+namespace ml
+{
+    namespace utils
+    {
+        // Epoch-based reclamation for read-mostly data published through atomic pointers.
+        //
+        // Readers pin the current epoch for the duration of a read (two atomic stores, no locks);
+        // writers swap the pointer, then retire the old object. A retired object is destroyed once
+        // every thread that could still hold it has unpinned, i.e. when no pinned epoch is older
+        // than the one it was retired in. Pins nest on a thread.
+        //
+        // There is one domain per process: threads keep a record in it for their whole life, and
+        // records are recycled, never freed, so a thread can outlive any data structure using it.
+        class epoch_domain
+        {
+        public:
+            static constexpr uint64_t idle = std::numeric_limits<uint64_t>::max();
+
+            epoch_domain(const epoch_domain&) = delete;
+            epoch_domain& operator=(const epoch_domain&) = delete;
+
+            static epoch_domain& instance()
+            {
+                static epoch_domain domain;
+                return domain;
+            }
+
+            void pin()
+            {
+                thread_slot& slot = local_slot();
+
+                if (slot.depth++ == 0)
+                {
+                    // seq_cst orders the pin before the (seq_cst) pointer loads of the read that follows
+                    slot.owned->epoch.store(global_epoch.load(), std::memory_order_seq_cst);
+                }
+            }
+
+            void unpin()
+            {
+                thread_slot& slot = local_slot();
+
+                if (--slot.depth == 0)
+                    slot.owned->epoch.store(idle, std::memory_order_release);
+            }
+
+            // Destroys object with destroy once no reader can reach it; call after it was unpublished
+            void retire(std::function<void()> destroy)
+            {
+                std::lock_guard<std::mutex> lock(retired_mutex);
+
+                const uint64_t epoch = global_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+                retired.push_back({ epoch, std::move(destroy) });
+
+                collect_locked();
+            }
+
+            // Destroys the retired objects that became unreachable; returns how many are still pending
+            size_t collect()
+            {
+                std::lock_guard<std::mutex> lock(retired_mutex);
+                return collect_locked();
+            }
+
+            size_t pending() const
+            {
+                std::lock_guard<std::mutex> lock(retired_mutex);
+                return retired.size();
+            }
+
+        private:
+            epoch_domain() = default;
+
+            // pending objects are released at exit; records stay, threads may still be finishing
+            ~epoch_domain()
+            {
+                for (auto& item : retired)
+                    item.destroy();
+            }
+
+            struct alignas(64) record
+            {
+                std::atomic<uint64_t> epoch{ idle };
+                std::atomic<bool> in_use{ false };
+                record* next = nullptr;
+            };
+
+            struct retired_object
+            {
+                uint64_t epoch;
+                std::function<void()> destroy_fn;
+
+                void destroy()
+                {
+                    if (destroy_fn)
+                        destroy_fn();
+                }
+            };
+
+            // The thread's record, handed back for reuse when the thread exits
+            struct thread_slot
+            {
+                record* owned = nullptr;
+                size_t depth = 0;
+
+                ~thread_slot()
+                {
+                    if (owned)
+                    {
+                        owned->epoch.store(idle, std::memory_order_release);
+                        owned->in_use.store(false, std::memory_order_release);
+                    }
+                }
+            };
+
+            thread_slot& local_slot()
+            {
+                thread_local thread_slot slot;
+
+                if (!slot.owned)
+                    slot.owned = acquire_record();
+
+                return slot;
+            }
+
+            record* acquire_record()
+            {
+                for (record* r = records.load(std::memory_order_acquire); r; r = r->next)
+                {
+                    bool expected = false;
+                    if (!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(expected, true))
+                        return r;
+                }
+
+                record* r = new record();
+                r->in_use.store(true, std::memory_order_relaxed);
+                r->next = records.load(std::memory_order_relaxed);
+
+                while (!records.compare_exchange_weak(r->next, r, std::memory_order_release, std::memory_order_relaxed))
+                {
+                }
+
+                return r;
+            }
+
+            size_t collect_locked()
+            {
+                uint64_t oldest = idle;
+
+                for (record* r = records.load(std::memory_order_acquire); r; r = r->next)
+                    oldest = std::min(oldest, r->epoch.load(std::memory_order_seq_cst));
+
+                // an object retired in epoch e is unreachable once every pin is at least e
+                size_t kept = 0;
+
+                for (size_t i = 0; i < retired.size(); ++i)
+                {
+                    if (retired[i].epoch <= oldest)
+                        retired[i].destroy();
+                    else
+                        retired[kept++] = std::move(retired[i]);
+                }
+
+                retired.resize(kept);
+                return kept;
+            }
+
+            std::atomic<uint64_t> global_epoch{ 0 };
+            std::atomic<record*> records{ nullptr };
+
+            mutable std::mutex retired_mutex;
+            std::vector<retired_object> retired;
+        };
+
+        // Pins the epoch for its lifetime; must be released on the thread that created it
+        class epoch_guard
+        {
+        public:
+            epoch_guard() : domain(&epoch_domain::instance())
+            {
+                domain->pin();
+            }
+
+            epoch_guard(epoch_guard&& other) noexcept : domain(other.domain)
+            {
+                other.domain = nullptr;
+            }
+
+            epoch_guard(const epoch_guard&) = delete;
+            epoch_guard& operator=(const epoch_guard&) = delete;
+            epoch_guard& operator=(epoch_guard&&) = delete;
+
+            ~epoch_guard()
+            {
+                if (domain)
+                    domain->unpin();
+            }
+
+        private:
+            epoch_domain* domain;
+        };
+    }
+}
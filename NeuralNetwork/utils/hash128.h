@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+namespace ml
+{
+    namespace utils
+    {
+        struct hash128
+        {
+            uint64_t low = 0;
+            uint64_t high = 0;
+
+            bool operator==(const hash128& other) const
+            {
+                return low == other.low && high == other.high;
+            }
+
+            bool operator!=(const hash128& other) const
+            {
+                return !(*this == other);
+            }
+        };
+
+        // for unordered containers: the halves are already well mixed
+        struct hash128_hasher
+        {
+            size_t operator()(const hash128& h) const
+            {
+                return static_cast<size_t>(h.low ^ h.high);
+            }
+        };
+
+        namespace detail
+        {
+            inline uint64_t rotl64(uint64_t x, int r)
+            {
+                return (x << r) | (x >> (64 - r));
+            }
+
+            inline uint64_t fmix64(uint64_t k)
+            {
+                k ^= k >> 33;
+                k *= 0xFF51AFD7ED558CCDull;
+                k ^= k >> 33;
+                k *= 0xC4CEB9FE1A85EC53ull;
+                k ^= k >> 33;
+                return k;
+            }
+
+            inline uint64_t load64(const uint8_t* p)
+            {
+                uint64_t v;
+                std::memcpy(&v, p, sizeof(v));
+                return v;
+            }
+        }
+
+        // MurmurHash3 x64 128 (Austin Appleby, public domain); processes 16 bytes per step, which
+        // keeps hashing a 784 byte MNIST image well below the cost of one forward pass
+        inline hash128 murmur3_128(const void* data, size_t length, uint64_t seed = 0)
+        {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            const size_t blocks = length / 16;
+
+            uint64_t h1 = seed;
+            uint64_t h2 = seed;
+
+            constexpr uint64_t c1 = 0x87C37B91114253D5ull;
+            constexpr uint64_t c2 = 0x4CF5AD432745937Full;
+
+            for (size_t i = 0; i < blocks; ++i)
+            {
+                uint64_t k1 = detail::load64(bytes + i * 16);
+                uint64_t k2 = detail::load64(bytes + i * 16 + 8);
+
+                k1 *= c1; k1 = detail::rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+                h1 = detail::rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52DCE729;
+
+                k2 *= c2; k2 = detail::rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                h2 = detail::rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495AB5;
+            }
+
+            const uint8_t* tail = bytes + blocks * 16;
+            uint64_t k1 = 0;
+            uint64_t k2 = 0;
+
+            switch (length & 15)
+            {
+            case 15: k2 ^= static_cast<uint64_t>(tail[14]) << 48; [[fallthrough]];
+            case 14: k2 ^= static_cast<uint64_t>(tail[13]) << 40; [[fallthrough]];
+            case 13: k2 ^= static_cast<uint64_t>(tail[12]) << 32; [[fallthrough]];
+            case 12: k2 ^= static_cast<uint64_t>(tail[11]) << 24; [[fallthrough]];
+            case 11: k2 ^= static_cast<uint64_t>(tail[10]) << 16; [[fallthrough]];
+            case 10: k2 ^= static_cast<uint64_t>(tail[9]) << 8; [[fallthrough]];
+            case 9:
+                k2 ^= static_cast<uint64_t>(tail[8]);
+                k2 *= c2; k2 = detail::rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                [[fallthrough]];
+            case 8: k1 ^= static_cast<uint64_t>(tail[7]) << 56; [[fallthrough]];
+            case 7: k1 ^= static_cast<uint64_t>(tail[6]) << 48; [[fallthrough]];
+            case 6: k1 ^= static_cast<uint64_t>(tail[5]) << 40; [[fallthrough]];
+            case 5: k1 ^= static_cast<uint64_t>(tail[4]) << 32; [[fallthrough]];
+            case 4: k1 ^= static_cast<uint64_t>(tail[3]) << 24; [[fallthrough]];
+            case 3: k1 ^= static_cast<uint64_t>(tail[2]) << 16; [[fallthrough]];
+            case 2: k1 ^= static_cast<uint64_t>(tail[1]) << 8; [[fallthrough]];
+            case 1:
+                k1 ^= static_cast<uint64_t>(tail[0]);
+                k1 *= c1; k1 = detail::rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+            }
+
+            h1 ^= length;
+            h2 ^= length;
+
+            h1 += h2;
+            h2 += h1;
+
+            h1 = detail::fmix64(h1);
+            h2 = detail::fmix64(h2);
+
+            h1 += h2;
+            h2 += h1;
+
+            return { h1, h2 };
+        }
+    }
+}
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <new>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <algorithm>
+
+namespace ml
+{
+    namespace utils
+    {
+        // What a buffer holds, for the per-subsystem byte counters
+        enum class memory_tag
+        {
+            other,
+            weights,
+            activations,
+            gradients,
+            datasets
+        };
+
+        constexpr size_t memory_tags = 5;
+
+        inline const char* memory_tag_name(memory_tag tag)
+        {
+            switch (tag)
+            {
+            case memory_tag::other: return "other";
+            case memory_tag::weights: return "weights";
+            case memory_tag::activations: return "activations";
+            case memory_tag::gradients: return "gradients";
+            case memory_tag::datasets: return "datasets";
+            }
+
+            return "";
+        }
+
+        struct memory_usage
+        {
+            size_t bytes = 0;
+            size_t peak_bytes = 0;
+            uint64_t allocations = 0;
+        };
+
+        namespace detail
+        {
+            struct memory_counters
+            {
+                std::atomic<size_t> bytes{ 0 };
+                std::atomic<size_t> peak{ 0 };
+                std::atomic<uint64_t> allocations{ 0 };
+            };
+
+            inline std::array<memory_counters, memory_tags> memory_table{};
+        }
+
+        // Process-wide live and peak bytes per tag, updated by every tracked allocation
+        class memory_accounting
+        {
+        public:
+            static void allocated(memory_tag tag, size_t bytes)
+            {
+                detail::memory_counters& c = detail::memory_table[static_cast<size_t>(tag)];
+                const size_t now = c.bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+                c.allocations.fetch_add(1, std::memory_order_relaxed);
+
+                size_t peak = c.peak.load(std::memory_order_relaxed);
+                while (now > peak && !c.peak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+            }
+
+            static void released(memory_tag tag, size_t bytes)
+            {
+                detail::memory_table[static_cast<size_t>(tag)].bytes.fetch_sub(bytes, std::memory_order_relaxed);
+            }
+
+            static memory_usage usage(memory_tag tag)
+            {
+                const detail::memory_counters& c = detail::memory_table[static_cast<size_t>(tag)];
+
+                memory_usage result;
+                result.bytes = c.bytes.load(std::memory_order_relaxed);
+                result.peak_bytes = c.peak.load(std::memory_order_relaxed);
+                result.allocations = c.allocations.load(std::memory_order_relaxed);
+                return result;
+            }
+
+            static size_t total_bytes()
+            {
+                size_t total = 0;
+                for (const auto& c : detail::memory_table)
+                    total += c.bytes.load(std::memory_order_relaxed);
+
+                return total;
+            }
+
+            // peaks restart from the current sizes
+            static void reset_peaks()
+            {
+                for (auto& c : detail::memory_table)
+                    c.peak.store(c.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+
+            static void report(std::ostream& out)
+            {
+                out << std::left << std::setw(14) << "memory" << std::right
+                    << std::setw(12) << "MB" << std::setw(12) << "peak MB" << std::setw(14) << "allocations" << '\n';
+
+                for (size_t i = 0; i < memory_tags; ++i)
+                {
+                    const memory_usage u = usage(static_cast<memory_tag>(i));
+
+                    out << std::left << std::setw(14) << memory_tag_name(static_cast<memory_tag>(i)) << std::right
+                        << std::setw(12) << std::fixed << std::setprecision(2) << u.bytes / 1048576.0
+                        << std::setw(12) << u.peak_bytes / 1048576.0 << std::setw(14) << u.allocations << '\n';
+                }
+            }
+        };
+
+        // every allocator hands out blocks aligned to this, a cache line and a full AVX-512 vector
+        constexpr size_t allocation_alignment = 64;
+
+        // Source of matrix storage. deallocate() gets the size that was requested from allocate().
+        // Implementations must be thread-safe: buffers are released on whichever thread drops them.
+        class allocator
+        {
+        public:
+            virtual ~allocator() = default;
+
+            // aligned to allocation_alignment; throws std::bad_alloc when out of memory
+            virtual void* allocate(size_t bytes) = 0;
+            virtual void deallocate(void* ptr, size_t bytes) noexcept = 0;
+            virtual const char* name() const = 0;
+        };
+
+        class heap_allocator : public allocator
+        {
+        public:
+            void* allocate(size_t bytes) override
+            {
+                return ::operator new(std::max<size_t>(bytes, 1), std::align_val_t(allocation_alignment));
+            }
+
+            void deallocate(void* ptr, size_t) noexcept override
+            {
+                ::operator delete(ptr, std::align_val_t(allocation_alignment));
+            }
+
+            const char* name() const override
+            {
+                return "heap";
+            }
+        };
+
+        inline heap_allocator& heap()
+        {
+            static heap_allocator instance;
+            return instance;
+        }
+
+        namespace detail
+        {
+            inline std::atomic<allocator*>& process_allocator()
+            {
+                static std::atomic<allocator*> current{ &heap() };
+                return current;
+            }
+
+            struct memory_context
+            {
+                memory_tag tag = memory_tag::other;
+                // null: the process default
+                allocator* source = nullptr;
+            };
+
+            inline memory_context& thread_memory_context()
+            {
+                static thread_local memory_context context;
+                return context;
+            }
+        }
+
+        // Allocator of every buffer not created inside a memory_scope that names one. It must outlive
+        // all buffers allocated from it.
+        inline void set_default_allocator(allocator& source)
+        {
+            detail::process_allocator().store(&source);
+        }
+
+        inline allocator& default_allocator()
+        {
+            return *detail::process_allocator().load();
+        }
+
+        // Sets the tag, and optionally the allocator, of the buffers allocated on this thread until
+        // the scope ends; scopes nest. Work forked onto the thread pool runs outside the scope.
+        class memory_scope
+        {
+        public:
+            explicit memory_scope(memory_tag tag) : saved(detail::thread_memory_context())
+            {
+                detail::thread_memory_context().tag = tag;
+            }
+
+            memory_scope(memory_tag tag, allocator& source) : saved(detail::thread_memory_context())
+            {
+                detail::thread_memory_context() = { tag, &source };
+            }
+
+            memory_scope(const memory_scope&) = delete;
+            memory_scope& operator=(const memory_scope&) = delete;
+
+            ~memory_scope()
+            {
+                detail::thread_memory_context() = saved;
+            }
+
+            static memory_tag current_tag()
+            {
+                return detail::thread_memory_context().tag;
+            }
+
+            static allocator& current_allocator()
+            {
+                allocator* source = detail::thread_memory_context().source;
+                return source ? *source : default_allocator();
+            }
+
+        private:
+            detail::memory_context saved;
+        };
+
+        // Returns a buffer to the allocator it came from and takes it off its tag's counter
+        template<typename T>
+        struct buffer_deleter
+        {
+            allocator* source = nullptr;
+            size_t count = 0;
+            memory_tag tag = memory_tag::other;
+
+            void operator()(T* ptr) const noexcept
+            {
+                std::destroy_n(ptr, count);
+                source->deallocate(ptr, count * sizeof(T));
+                memory_accounting::released(tag, count * sizeof(T));
+            }
+        };
+
+        template<typename T>
+        using buffer = std::unique_ptr<T[], buffer_deleter<T>>;
+
+        // count default-initialized elements (left uninitialized for arithmetic T) from the current
+        // scope's allocator, counted under tag
+        template<typename T>
+        buffer<T> allocate_buffer(size_t count, memory_tag tag = memory_scope::current_tag())
+        {
+            allocator& source = memory_scope::current_allocator();
+            T* ptr = static_cast<T*>(source.allocate(count * sizeof(T)));
+
+            std::uninitialized_default_construct_n(ptr, count);
+            memory_accounting::allocated(tag, count * sizeof(T));
+
+            return buffer<T>(ptr, buffer_deleter<T>{ &source, count, tag });
+        }
+
+        // Standard allocator that counts its bytes under Tag, for containers outside matrix
+        template<typename T, memory_tag Tag>
+        class tracking_allocator
+        {
+        public:
+            using value_type = T;
+
+            template<typename U>
+            struct rebind
+            {
+                using other = tracking_allocator<U, Tag>;
+            };
+
+            tracking_allocator() noexcept = default;
+
+            template<typename U>
+            tracking_allocator(const tracking_allocator<U, Tag>&) noexcept {}
+
+            T* allocate(size_t count)
+            {
+                T* ptr = std::allocator<T>().allocate(count);
+                memory_accounting::allocated(Tag, count * sizeof(T));
+                return ptr;
+            }
+
+            void deallocate(T* ptr, size_t count) noexcept
+            {
+                std::allocator<T>().deallocate(ptr, count);
+                memory_accounting::released(Tag, count * sizeof(T));
+            }
+
+            template<typename U>
+            bool operator==(const tracking_allocator<U, Tag>&) const noexcept
+            {
+                return true;
+            }
+
+            template<typename U>
+            bool operator!=(const tracking_allocator<U, Tag>&) const noexcept
+            {
+                return false;
+            }
+        };
+    }
+}
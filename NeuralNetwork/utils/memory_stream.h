@@ -0,0 +1,108 @@
+#pragma once
+
+#include <ios>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+namespace ml
+{
+    namespace utils
+    {
+        // In-memory byte stream exposing the read/write subset of the fstream interface,
+        // so read_data/write_data from binary.h can serialize into one contiguous buffer
+        class memory_stream
+        {
+        public:
+            memory_stream() = default;
+
+            explicit memory_stream(std::vector<char>&& bytes) : buffer(std::move(bytes)) {}
+
+            memory_stream& write(const char* bytes, std::streamsize count)
+            {
+                buffer.insert(buffer.end(), bytes, bytes + count);
+                return *this;
+            }
+
+            memory_stream& read(char* bytes, std::streamsize count)
+            {
+                const size_t available = buffer.size() - std::min(position, buffer.size());
+                const size_t requested = static_cast<size_t>(count);
+
+                if (requested > available)
+                {
+                    failed = true;
+                    std::fill(bytes, bytes + requested, static_cast<char>(0));
+                    position = buffer.size();
+                    return *this;
+                }
+
+                std::memcpy(bytes, buffer.data() + position, requested);
+                position += requested;
+                return *this;
+            }
+
+            // pointer to the next count unread bytes, or nullptr if the stream is shorter
+            const char* consume(size_t count)
+            {
+                if (count > buffer.size() - std::min(position, buffer.size()))
+                {
+                    failed = true;
+                    return nullptr;
+                }
+
+                const char* bytes = buffer.data() + position;
+                position += count;
+                return bytes;
+            }
+
+            void reserve(size_t capacity)
+            {
+                buffer.reserve(capacity);
+            }
+
+            void clear()
+            {
+                buffer.clear();
+                position = 0;
+                failed = false;
+            }
+
+            void rewind()
+            {
+                position = 0;
+                failed = false;
+            }
+
+            bool good() const
+            {
+                return !failed;
+            }
+
+            bool eof() const
+            {
+                return position >= buffer.size();
+            }
+
+            const char* data() const
+            {
+                return buffer.data();
+            }
+
+            size_t size() const
+            {
+                return buffer.size();
+            }
+
+            size_t tell() const
+            {
+                return position;
+            }
+
+        private:
+            std::vector<char> buffer;
+            size_t position = 0;
+            bool failed = false;
+        };
+    }
+}
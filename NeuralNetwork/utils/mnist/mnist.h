@@ -1,19 +1,24 @@
 #pragma once
 
 #include <chrono>
+#include <cstring>
 #include <vector>
 #include <fstream>
 #include <optional>
 
-#include "..\logger.h"
-#include "..\binary.h"
+#include "../logger.h"
+#include "../memory.h"
+#include "../binary.h"
+#include "../../math/matrix.h"
 
 namespace ml
 {
     namespace mnist
     {
         using byte = char;
-        using training_set = std::vector<std::pair<byte, std::vector<byte>>>;
+        // pixels of one sample, counted under memory_tag::datasets
+        using image = std::vector<byte, utils::tracking_allocator<byte, utils::memory_tag::datasets>>;
+        using training_set = std::vector<std::pair<byte, image>>;
 
         std::optional<training_set> load_mnist_db(const std::string& image_file, const std::string& label_file)
         {
@@ -83,7 +88,7 @@ namespace ml
             image_width = read_data_swap_endian<int>(images_in);
             sequence_length = image_height * image_width;
 
-            std::vector<byte> pixels;
+            image pixels;
             pixels.reserve(sequence_length);
             pixels.resize(sequence_length);
 
@@ -115,5 +120,97 @@ namespace ml
 
             return std::optional<training_set>(std::move(set));
         }
+
+        // The idx files already in memory, as read_file_async delivers them; same checks as load_mnist_db
+        inline std::optional<training_set> parse_mnist_db(const std::vector<byte>& images, const std::vector<byte>& labels)
+        {
+            auto header = [](const std::vector<byte>& bytes, size_t field)
+            {
+                uint32_t value = 0;
+                std::memcpy(&value, bytes.data() + field * sizeof(uint32_t), sizeof(uint32_t));
+                return static_cast<int>(swap_endian(value));
+            };
+
+            if (images.size() < 4 * sizeof(uint32_t) || header(images, 0) != 2051)
+            {
+                ml::utils::Logger::Error("mnist", "incorrect image file magic");
+                return {};
+            }
+
+            if (labels.size() < 2 * sizeof(uint32_t) || header(labels, 0) != 2049)
+            {
+                ml::utils::Logger::Error("mnist", "incorrect label file magic");
+                return {};
+            }
+
+            const int image_number = header(images, 1);
+            const int label_number = header(labels, 1);
+            const int image_height = header(images, 2);
+            const int image_width = header(images, 3);
+
+            if (image_number < 0 || label_number < 0 || image_number != label_number || image_height <= 0 || image_width <= 0)
+            {
+                ml::utils::Logger::Error("mnist", "number of images and labels must match\n");
+                return {};
+            }
+
+            const size_t count = static_cast<size_t>(label_number);
+            const size_t sequence_length = static_cast<size_t>(image_height) * static_cast<size_t>(image_width);
+            const byte* pixels = images.data() + 4 * sizeof(uint32_t);
+            const byte* label = labels.data() + 2 * sizeof(uint32_t);
+
+            if (images.size() < 4 * sizeof(uint32_t) + count * sequence_length || labels.size() < 2 * sizeof(uint32_t) + count)
+            {
+                ml::utils::Logger::Error("mnist", "mnist files are truncated");
+                return {};
+            }
+
+            training_set set;
+            set.reserve(count);
+
+            for (size_t i = 0; i < count; ++i)
+                set.emplace_back(label[i], image(pixels + i * sequence_length, pixels + (i + 1) * sequence_length));
+
+            ml::utils::Logger::Info("mnist", "loaded items: " + std::to_string(count));
+
+            return std::optional<training_set>(std::move(set));
+        }
+
+        constexpr size_t classes = 10;
+
+        inline float normalize_pixel(byte pixel)
+        {
+            return (static_cast<unsigned char>(pixel) / 255.f) * 0.99f + 0.01f;
+        }
+
+        // Packs set[indices[first .. first + count)] into one sample per column:
+        // normalized pixels into inputs, one-hot 0.99/0.01 labels into targets
+        inline void make_batch(const training_set& set, const std::vector<size_t>& indices, size_t first, size_t count,
+            math::matrix<float>& inputs, math::matrix<float>& targets)
+        {
+            utils::memory_scope scope(utils::memory_tag::datasets);
+            const size_t pixels = set[indices[first]].second.size();
+
+            if (inputs.size_m() != pixels || inputs.size_n() != count)
+                inputs = math::matrix<float>(pixels, count);
+
+            if (targets.size_m() != classes || targets.size_n() != count)
+                targets = math::matrix<float>(classes, count);
+
+            float* in = inputs.data_ptr();
+            float* out = targets.data_ptr();
+
+            std::fill(out, out + targets.size(), 0.01f);
+
+            for (size_t col = 0; col < count; ++col)
+            {
+                const auto& sample = set[indices[first + col]];
+
+                for (size_t pix = 0; pix < pixels; ++pix)
+                    in[pix * count + col] = normalize_pixel(sample.second[pix]);
+
+                out[static_cast<size_t>(sample.first) * count + col] = 0.99f;
+            }
+        }
     }
 }
\ No newline at end of file
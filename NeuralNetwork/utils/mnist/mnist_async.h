@@ -0,0 +1,193 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <coroutine>
+
+#include "mnist.h"
+#include "../async.h"
+#include "../async_file.h"
+#include "../../math/matrix.h"
+
+namespace ml
+{
+    namespace mnist
+    {
+        // load_mnist_db without blocking: both files are read through read_file_async and parsed on
+        // the pool thread that resumes. Empty on failure or when token was cancelled.
+        inline utils::task<std::optional<training_set>> load_mnist_db_async(std::string image_file, std::string label_file,
+            utils::cancellation_token token = {}, utils::executor& ex = utils::executor::shared())
+        {
+            auto images = co_await utils::read_file_async(image_file, token, ex);
+            if (!images)
+                co_return std::nullopt;
+
+            auto labels = co_await utils::read_file_async(label_file, token, ex);
+            if (!labels || token.cancelled())
+                co_return std::nullopt;
+
+            co_return parse_mnist_db(*images, *labels);
+        }
+
+        // Serves set[indices] as consecutive make_batch batches:
+        //
+        //     while (auto batch = co_await stream.next_batch())
+        //         model.train_batch(batch->inputs, batch->targets);
+        //
+        // The following batch is assembled on the pool while the current one is in use, as trainer
+        // does with its loader. One consumer at a time; the stream and the set must outlive its tasks.
+        class batch_stream
+        {
+        public:
+            struct batch
+            {
+                math::matrix<float> inputs;
+                math::matrix<float> targets;
+            };
+
+            batch_stream(const training_set& set, std::vector<size_t> indices, size_t batch_size, utils::executor& ex = utils::executor::shared())
+                : set(set), indices(std::move(indices)), batch_size(std::max<size_t>(batch_size, 1)), ex(ex)
+            {
+                prefetch();
+            }
+
+            batch_stream(const batch_stream&) = delete;
+            batch_stream& operator=(const batch_stream&) = delete;
+
+            ~batch_stream()
+            {
+                settle();
+            }
+
+            // Empty after the last batch, or when token was cancelled; a cancelled call does not
+            // consume a batch
+            utils::task<std::optional<batch>> next_batch(utils::cancellation_token token = {})
+            {
+                if (token.cancelled() || !next)
+                    co_return std::nullopt;
+
+                std::shared_ptr<pending> current = std::move(next);
+                co_await ready_awaiter{ current.get() };
+
+                if (token.cancelled())
+                {
+                    next = std::move(current);
+                    co_return std::nullopt;
+                }
+
+                prefetch();
+                co_return std::optional<batch>(std::move(current->value));
+            }
+
+            // Starts over with a new order, e.g. for the next epoch
+            void rewind(std::vector<size_t> order)
+            {
+                settle();
+                next.reset();
+
+                indices = std::move(order);
+                position = 0;
+                prefetch();
+            }
+
+            size_t remaining_samples() const
+            {
+                return indices.size() - position + (next ? next->count : 0);
+            }
+
+        private:
+            struct pending
+            {
+                std::mutex mutex;
+                bool ready = false;
+                std::coroutine_handle<> waiting;
+                size_t count = 0;
+                batch value;
+            };
+
+            struct ready_awaiter
+            {
+                bool await_ready()
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    return state->ready;
+                }
+
+                bool await_suspend(std::coroutine_handle<> handle)
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+
+                    if (state->ready)
+                        return false;
+
+                    state->waiting = handle;
+                    return true;
+                }
+
+                void await_resume() noexcept {}
+
+                pending* state;
+            };
+
+            void prefetch()
+            {
+                if (position >= indices.size())
+                    return;
+
+                auto state = std::make_shared<pending>();
+                const size_t first = position;
+                state->count = std::min(batch_size, indices.size() - first);
+                position += state->count;
+                next = state;
+
+                ex.threads().submit([this, state, first]
+                {
+                    make_batch(set, indices, first, state->count, state->value.inputs, state->value.targets);
+
+                    std::coroutine_handle<> waiting;
+                    {
+                        std::lock_guard<std::mutex> lock(state->mutex);
+                        state->ready = true;
+                        waiting = std::exchange(state->waiting, {});
+                    }
+
+                    if (waiting)
+                        waiting.resume();
+                });
+            }
+
+            // waits for the batch being assembled, helping the pool meanwhile
+            void settle()
+            {
+                if (!next)
+                    return;
+
+                for (;;)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(next->mutex);
+                        if (next->ready)
+                            return;
+                    }
+
+                    if (!ex.threads().run_pending())
+                        std::this_thread::yield();
+                }
+            }
+
+            const training_set& set;
+            std::vector<size_t> indices;
+            const size_t batch_size;
+            utils::executor& ex;
+
+            size_t position = 0;
+            std::shared_ptr<pending> next;
+        };
+    }
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#define ML_PERF_EVENTS 1
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "logger.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        enum class hw_counter
+        {
+            cycles,
+            instructions,
+            llc_misses,
+            l1d_misses,
+            branch_misses
+        };
+
+        constexpr size_t hw_counter_kinds = 5;
+
+        inline const char* hw_counter_name(hw_counter counter)
+        {
+            switch (counter)
+            {
+            case hw_counter::cycles: return "cycles";
+            case hw_counter::instructions: return "instructions";
+            case hw_counter::llc_misses: return "LLC misses";
+            case hw_counter::l1d_misses: return "L1D misses";
+            case hw_counter::branch_misses: return "branch misses";
+            }
+
+            return "";
+        }
+
+        // Counter values summed over the threads of the process, scaled up when the kernel had to
+        // multiplex the counters
+        struct counter_sample
+        {
+            std::array<double, hw_counter_kinds> values{};
+
+            double operator[](hw_counter counter) const
+            {
+                return values[static_cast<size_t>(counter)];
+            }
+
+            counter_sample& operator+=(const counter_sample& other)
+            {
+                for (size_t i = 0; i < hw_counter_kinds; ++i)
+                    values[i] += other.values[i];
+
+                return *this;
+            }
+
+            friend counter_sample operator-(counter_sample a, const counter_sample& b)
+            {
+                for (size_t i = 0; i < hw_counter_kinds; ++i)
+                    a.values[i] -= b.values[i];
+
+                return a;
+            }
+        };
+
+        // Hardware counters of every thread of the process through perf_event_open, one counter group
+        // per thread so that the counters of a thread are scheduled together. Threads are enumerated
+        // when open() is called; threads started later are not counted. Only user-space events are
+        // counted, which perf_event_paranoid 2 still allows. Events the CPU, the hypervisor or the
+        // permissions refuse are left out; with none left, or outside Linux, open() returns false.
+        class perf_counters
+        {
+        public:
+            perf_counters() = default;
+
+            perf_counters(const perf_counters&) = delete;
+            perf_counters& operator=(const perf_counters&) = delete;
+
+            ~perf_counters()
+            {
+                close();
+            }
+
+            bool open()
+            {
+                close();
+
+#ifdef ML_PERF_EVENTS
+                std::vector<pid_t> threads;
+
+                if (DIR* tasks = ::opendir("/proc/self/task"))
+                {
+                    while (const dirent* entry = ::readdir(tasks))
+                    {
+                        if (entry->d_name[0] != '.')
+                            threads.push_back(static_cast<pid_t>(std::atoi(entry->d_name)));
+                    }
+
+                    ::closedir(tasks);
+                }
+
+                if (threads.empty())
+                    threads.push_back(static_cast<pid_t>(::syscall(SYS_gettid)));
+
+                // the kinds the first thread accepts are opened on every thread
+                opened.fill(true);
+
+                for (pid_t tid : threads)
+                {
+                    group g;
+
+                    for (size_t kind = 0; kind < hw_counter_kinds; ++kind)
+                    {
+                        if (!opened[kind])
+                            continue;
+
+                        const int fd = open_event(static_cast<hw_counter>(kind), tid, g.leader);
+
+                        if (fd < 0)
+                        {
+                            if (groups.empty())
+                            {
+                                opened[kind] = false;
+                                first_error = errno;
+                            }
+
+                            continue;
+                        }
+
+                        if (g.leader < 0)
+                            g.leader = fd;
+
+                        g.fds.push_back(fd);
+                        g.slots[kind] = static_cast<int>(g.fds.size()) - 1;
+                    }
+
+                    if (g.leader >= 0)
+                        groups.push_back(std::move(g));
+                }
+
+                if (groups.empty())
+                {
+                    opened.fill(false);
+                    Logger::Info("profiler", "hardware counters unavailable (" + std::string(std::strerror(first_error)) + "), timing only");
+                    return false;
+                }
+
+                return true;
+#else
+                return false;
+#endif
+            }
+
+            void close()
+            {
+#ifdef ML_PERF_EVENTS
+                for (const auto& g : groups)
+                {
+                    for (int fd : g.fds)
+                        ::close(fd);
+                }
+#endif
+                groups.clear();
+                opened.fill(false);
+            }
+
+            bool available(hw_counter counter) const
+            {
+                return opened[static_cast<size_t>(counter)];
+            }
+
+            bool any() const
+            {
+                return !groups.empty();
+            }
+
+            counter_sample read() const
+            {
+                counter_sample sample;
+
+#ifdef ML_PERF_EVENTS
+                // nr, time enabled, time running, then one value per member
+                std::array<uint64_t, 3 + hw_counter_kinds> buffer{};
+
+                for (const auto& g : groups)
+                {
+                    if (::read(g.leader, buffer.data(), sizeof(buffer)) <= 0)
+                        continue;
+
+                    const uint64_t enabled = buffer[1];
+                    const uint64_t running = buffer[2];
+
+                    if (running == 0)
+                        continue;
+
+                    const double scale = static_cast<double>(enabled) / static_cast<double>(running);
+
+                    for (size_t kind = 0; kind < hw_counter_kinds; ++kind)
+                    {
+                        if (g.slots[kind] >= 0 && static_cast<uint64_t>(g.slots[kind]) < buffer[0])
+                            sample.values[kind] += static_cast<double>(buffer[3 + g.slots[kind]]) * scale;
+                    }
+                }
+#endif
+
+                return sample;
+            }
+
+        private:
+            struct group
+            {
+                int leader = -1;
+                std::vector<int> fds;
+                // position of each kind in the group read, -1 if not opened
+                std::array<int, hw_counter_kinds> slots{ -1, -1, -1, -1, -1 };
+            };
+
+#ifdef ML_PERF_EVENTS
+            static int open_event(hw_counter counter, pid_t tid, int group_fd)
+            {
+                perf_event_attr attr{};
+                attr.size = sizeof(attr);
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                switch (counter)
+                {
+                case hw_counter::cycles:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                    break;
+                case hw_counter::instructions:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                    break;
+                case hw_counter::llc_misses:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                    break;
+                case hw_counter::l1d_misses:
+                    attr.type = PERF_TYPE_HW_CACHE;
+                    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                    break;
+                case hw_counter::branch_misses:
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                    break;
+                }
+
+                return static_cast<int>(::syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, 0));
+            }
+#endif
+
+            std::vector<group> groups;
+            std::array<bool, hw_counter_kinds> opened{};
+            int first_error = 0;
+        };
+    }
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <ostream>
+#include <algorithm>
+
+#include "perf_counters.h"
+#include "roofline.h"
+#include "thread_pool.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        // Totals of one instrumented kernel or layer
+        struct profile_entry
+        {
+            std::string name;
+            uint64_t calls = 0;
+            double seconds = 0.0;
+            // nominal work the scopes declared: arithmetic and compulsory memory traffic
+            double flops = 0.0;
+            double bytes = 0.0;
+            counter_sample counters;
+        };
+
+        // Optional profiling mode for the kernels and layers that open a profile_scope.
+        //
+        // While enabled, every scope adds its wall time and the change of the process-wide hardware
+        // counters to its entry; without counters (not Linux, no permission, a VM without a PMU) the
+        // entries are timed only. The counters cover all threads, so a scope includes the pool work
+        // it forks. Scopes therefore only count on one thread at a time: the first thread to open a
+        // scope owns the profile until its outermost scope closes, and scopes opened meanwhile on
+        // other threads are skipped, their work already being inside the owner's. Nested scopes are
+        // inclusive, e.g. a layer's entry contains its GEMM's. When disabled, a scope costs one
+        // relaxed atomic load.
+        class profiler
+        {
+        public:
+            static profiler& instance()
+            {
+                static profiler shared;
+                return shared;
+            }
+
+            // Starts collecting; false if scopes will be timed only. The thread pool is started first
+            // so that its workers are counted.
+            bool enable()
+            {
+                thread_pool::instance();
+
+                std::lock_guard<std::mutex> lock(mutex);
+                const bool counting = counters.open();
+                on.store(true, std::memory_order_relaxed);
+                return counting;
+            }
+
+            void disable()
+            {
+                on.store(false, std::memory_order_relaxed);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                counters.close();
+            }
+
+            static bool active()
+            {
+                return on.load(std::memory_order_relaxed);
+            }
+
+            bool has_counters() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return counters.any();
+            }
+
+            bool counts(hw_counter counter) const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return counters.available(counter);
+            }
+
+            void reset()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                totals.clear();
+            }
+
+            // slowest first
+            std::vector<profile_entry> entries() const
+            {
+                std::vector<profile_entry> result;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (const auto& item : totals)
+                        result.push_back(item.second);
+                }
+
+                std::sort(result.begin(), result.end(), [](const profile_entry& a, const profile_entry& b)
+                {
+                    return a.seconds > b.seconds;
+                });
+
+                return result;
+            }
+
+            // Per entry: time, achieved GFLOP/s, declared bytes per FLOP, the roofline bound for that
+            // intensity and the share of it reached, and with counters IPC, cache and branch misses
+            void report(std::ostream& out, const roofline& roof) const
+            {
+                const auto list = entries();
+                const bool counting = has_counters();
+
+                out << "profile, " << (counting ? "hardware counters" : "time only")
+                    << "; roofline " << std::fixed << std::setprecision(1) << roof.bandwidth / 1e9 << " GB/s, "
+                    << roof.peak_flops / 1e9 << " GFLOP/s, ridge " << std::setprecision(2) << roof.ridge() << " FLOP/byte\n";
+
+                out << std::left << std::setw(28) << "scope" << std::right
+                    << std::setw(8) << "calls" << std::setw(11) << "ms" << std::setw(10) << "GFLOP/s"
+                    << std::setw(9) << "B/FLOP" << std::setw(9) << "roof %" << std::setw(8) << "bound";
+
+                if (counting)
+                {
+                    out << std::setw(7) << "IPC" << std::setw(10) << "LLC/kF" << std::setw(10) << "L1D/kF"
+                        << std::setw(10) << "DRAM GB/s" << std::setw(10) << "br miss";
+                }
+
+                out << '\n';
+
+                for (const auto& e : list)
+                {
+                    const double gflops = e.seconds > 0.0 ? e.flops / e.seconds / 1e9 : 0.0;
+
+                    out << std::left << std::setw(28) << e.name << std::right
+                        << std::setw(8) << e.calls << std::setw(11) << std::setprecision(3) << e.seconds * 1e3;
+
+                    if (e.flops > 0.0)
+                    {
+                        const double intensity = e.bytes > 0.0 ? e.flops / e.bytes : 0.0;
+                        const double roof_flops = e.bytes > 0.0 ? roof.attainable(intensity) : roof.peak_flops;
+                        const bool memory_bound = e.bytes > 0.0 && intensity < roof.ridge();
+
+                        out << std::setw(10) << std::setprecision(2) << gflops
+                            << std::setw(9) << std::setprecision(3) << e.bytes / e.flops
+                            << std::setw(9) << std::setprecision(1) << (roof_flops > 0.0 ? 100.0 * e.flops / e.seconds / roof_flops : 0.0)
+                            << std::setw(8) << (memory_bound ? "memory" : "compute");
+                    }
+                    else
+                    {
+                        out << std::setw(10) << "-" << std::setw(9) << "-" << std::setw(9) << "-" << std::setw(8) << "memory";
+                    }
+
+                    if (counting)
+                    {
+                        const double kflops = e.flops / 1e3;
+                        auto column = [&](hw_counter counter, double value, int width, int precision)
+                        {
+                            if (counts(counter))
+                                out << std::setw(width) << std::setprecision(precision) << value;
+                            else
+                                out << std::setw(width) << "-";
+                        };
+
+                        column(hw_counter::instructions, e.counters[hw_counter::cycles] > 0.0 ? e.counters[hw_counter::instructions] / e.counters[hw_counter::cycles] : 0.0, 7, 2);
+                        column(hw_counter::llc_misses, kflops > 0.0 ? e.counters[hw_counter::llc_misses] / kflops : 0.0, 10, 3);
+                        column(hw_counter::l1d_misses, kflops > 0.0 ? e.counters[hw_counter::l1d_misses] / kflops : 0.0, 10, 3);
+                        // every last level miss is one line from memory
+                        column(hw_counter::llc_misses, e.seconds > 0.0 ? e.counters[hw_counter::llc_misses] * 64.0 / e.seconds / 1e9 : 0.0, 10, 2);
+                        column(hw_counter::branch_misses, e.counters[hw_counter::branch_misses], 10, 0);
+                    }
+
+                    out << '\n';
+                }
+            }
+
+            void report(std::ostream& out) const
+            {
+                report(out, measure_roofline());
+            }
+
+        private:
+            friend class profile_scope;
+
+            profiler() = default;
+
+            // claims the profile for the calling thread; false if another thread holds it
+            static bool enter()
+            {
+                if (depth == 0)
+                {
+                    std::thread::id none;
+                    if (!owner.compare_exchange_strong(none, std::this_thread::get_id()))
+                        return false;
+                }
+
+                ++depth;
+                return true;
+            }
+
+            static void leave()
+            {
+                if (--depth == 0)
+                    owner.store(std::thread::id());
+            }
+
+            counter_sample read() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return counters.read();
+            }
+
+            void add(const char* name, int index, double seconds, double flops, double bytes, const counter_sample& delta)
+            {
+                std::string key = name;
+                if (index >= 0)
+                    key += "[" + std::to_string(index) + "]";
+
+                std::lock_guard<std::mutex> lock(mutex);
+
+                profile_entry& e = totals[key];
+                e.name = std::move(key);
+                ++e.calls;
+                e.seconds += seconds;
+                e.flops += flops;
+                e.bytes += bytes;
+                e.counters += delta;
+            }
+
+            static inline std::atomic<bool> on{ false };
+            static inline std::atomic<std::thread::id> owner{};
+            static inline thread_local size_t depth = 0;
+
+            mutable std::mutex mutex;
+            perf_counters counters;
+            std::map<std::string, profile_entry> totals;
+        };
+
+        // Adds the enclosed work to the profiler entry name (name[index] for per-layer entries).
+        // flops and bytes are the nominal arithmetic and compulsory memory traffic of the work, used
+        // for the GFLOP/s and roofline columns; name must outlive the scope.
+        class profile_scope
+        {
+        public:
+            profile_scope(const char* name, double flops, double bytes) : profile_scope(name, -1, flops, bytes) {}
+
+            profile_scope(const char* name, int index, double flops, double bytes)
+            {
+                if (!profiler::active() || !profiler::enter())
+                    return;
+
+                this->name = name;
+                this->index = index;
+                this->flops = flops;
+                this->bytes = bytes;
+
+                start_counters = profiler::instance().read();
+                start = std::chrono::steady_clock::now();
+            }
+
+            profile_scope(const profile_scope&) = delete;
+            profile_scope& operator=(const profile_scope&) = delete;
+
+            // replaces the declared work, for kernels that only know it once done (e.g. sparse inputs)
+            void set_work(double flops, double bytes)
+            {
+                this->flops = flops;
+                this->bytes = bytes;
+            }
+
+            ~profile_scope()
+            {
+                if (!name)
+                    return;
+
+                const auto stop = std::chrono::steady_clock::now();
+                profiler& p = profiler::instance();
+                const counter_sample delta = p.read() - start_counters;
+
+                p.add(name, index, std::chrono::duration<double>(stop - start).count(), flops, bytes, delta);
+                profiler::leave();
+            }
+
+        private:
+            const char* name = nullptr;
+            int index = -1;
+            double flops = 0.0;
+            double bytes = 0.0;
+            counter_sample start_counters;
+            std::chrono::steady_clock::time_point start;
+        };
+    }
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ML_RANDOM_SSE
+#endif
+
+#include "thread_pool.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        // Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"): a keyed
+        // bijection of a 128-bit counter. Value i of a stream is a pure function of (seed, stream, i),
+        // so any range of values can be produced on any thread, in any order, with the same bits.
+        namespace philox
+        {
+            constexpr uint32_t multiplier0 = 0xD2511F53u;
+            constexpr uint32_t multiplier1 = 0xCD9E8D57u;
+            constexpr uint32_t weyl0 = 0x9E3779B9u;
+            constexpr uint32_t weyl1 = 0xBB67AE85u;
+            constexpr size_t rounds = 10;
+
+            using block = std::array<uint32_t, 4>;
+
+            inline block generate(block counter, uint32_t key0, uint32_t key1)
+            {
+                for (size_t round = 0; round < rounds; ++round)
+                {
+                    const uint64_t p0 = static_cast<uint64_t>(multiplier0) * counter[0];
+                    const uint64_t p1 = static_cast<uint64_t>(multiplier1) * counter[2];
+
+                    counter = {
+                        static_cast<uint32_t>(p1 >> 32) ^ counter[1] ^ key0,
+                        static_cast<uint32_t>(p1),
+                        static_cast<uint32_t>(p0 >> 32) ^ counter[3] ^ key1,
+                        static_cast<uint32_t>(p0)
+                    };
+
+                    key0 += weyl0;
+                    key1 += weyl1;
+                }
+
+                return counter;
+            }
+
+#ifdef ML_RANDOM_SSE
+            // hi and lo halves of the 32 x 32 bit products of four lanes
+            inline void mulhilo(__m128i a, __m128i m, __m128i& hi, __m128i& lo)
+            {
+                const __m128i even = _mm_shuffle_epi32(_mm_mul_epu32(a, m), _MM_SHUFFLE(3, 1, 2, 0));
+                const __m128i odd = _mm_shuffle_epi32(_mm_mul_epu32(_mm_srli_epi64(a, 32), m), _MM_SHUFFLE(3, 1, 2, 0));
+
+                lo = _mm_unpacklo_epi32(even, odd);
+                hi = _mm_unpackhi_epi32(even, odd);
+            }
+
+            // Four blocks at once, counter word k of block j in lane j of c[k]
+            inline void generate4(__m128i c[4], uint32_t key0, uint32_t key1)
+            {
+                const __m128i m0 = _mm_set1_epi32(static_cast<int>(multiplier0));
+                const __m128i m1 = _mm_set1_epi32(static_cast<int>(multiplier1));
+
+                for (size_t round = 0; round < rounds; ++round)
+                {
+                    __m128i hi0, lo0, hi1, lo1;
+                    mulhilo(c[0], m0, hi0, lo0);
+                    mulhilo(c[2], m1, hi1, lo1);
+
+                    c[0] = _mm_xor_si128(_mm_xor_si128(hi1, c[1]), _mm_set1_epi32(static_cast<int>(key0)));
+                    c[1] = lo1;
+                    c[2] = _mm_xor_si128(_mm_xor_si128(hi0, c[3]), _mm_set1_epi32(static_cast<int>(key1)));
+                    c[3] = lo0;
+
+                    key0 += weyl0;
+                    key1 += weyl1;
+                }
+            }
+#endif
+        }
+
+        // Independent streams of one seed: the purpose in the high half, e.g. a layer or an epoch in the low half
+        namespace rng_stream
+        {
+            constexpr uint64_t weights = 1ull << 32;
+            constexpr uint64_t shuffle = 2ull << 32;
+            constexpr uint64_t dropout = 3ull << 32;
+            constexpr uint64_t augmentation = 4ull << 32;
+            constexpr uint64_t verification = 5ull << 32;
+        }
+
+        // Counter-based generator: four 32-bit values per block, value i in lane i % 4 of block i / 4
+        class counter_rng
+        {
+        public:
+            counter_rng(uint64_t seed, uint64_t stream) : seed(seed), stream(stream) {}
+
+            philox::block block(uint64_t index) const
+            {
+                return philox::generate({ static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32),
+                    static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32) },
+                    static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32));
+            }
+
+            uint32_t bits(uint64_t index) const
+            {
+                return block(index / 4)[index % 4];
+            }
+
+            // Values [first, first + count) into out; vectorized four blocks at a time
+            void fill_bits(uint32_t* out, size_t count, uint64_t first = 0) const
+            {
+                size_t i = 0;
+
+                // head up to a block boundary
+                for (; i < count && (first + i) % 4 != 0; ++i)
+                    out[i] = bits(first + i);
+
+#ifdef ML_RANDOM_SSE
+                const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+                const __m128i stream_lo = _mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(stream)));
+                const __m128i stream_hi = _mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(stream >> 32)));
+
+                for (; i + 16 <= count; i += 16)
+                {
+                    const uint64_t block_index = (first + i) / 4;
+
+                    // lanes add 0..3 to the low counter word without carrying; near a wrap the scalar path takes over
+                    if (static_cast<uint32_t>(block_index) > 0xFFFFFFFCu)
+                        break;
+
+                    __m128i c[4] = {
+                        _mm_add_epi32(_mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(block_index))), lane),
+                        _mm_set1_epi32(static_cast<int>(static_cast<uint32_t>(block_index >> 32))),
+                        stream_lo,
+                        stream_hi
+                    };
+
+                    philox::generate4(c, static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32));
+
+                    // lanes hold blocks, words hold values: transpose into value order
+                    const __m128i t0 = _mm_unpacklo_epi32(c[0], c[1]);
+                    const __m128i t1 = _mm_unpacklo_epi32(c[2], c[3]);
+                    const __m128i t2 = _mm_unpackhi_epi32(c[0], c[1]);
+                    const __m128i t3 = _mm_unpackhi_epi32(c[2], c[3]);
+
+                    __m128i* dst = reinterpret_cast<__m128i*>(out + i);
+                    _mm_storeu_si128(dst + 0, _mm_unpacklo_epi64(t0, t1));
+                    _mm_storeu_si128(dst + 1, _mm_unpackhi_epi64(t0, t1));
+                    _mm_storeu_si128(dst + 2, _mm_unpacklo_epi64(t2, t3));
+                    _mm_storeu_si128(dst + 3, _mm_unpackhi_epi64(t2, t3));
+                }
+#endif
+                for (; i + 4 <= count; i += 4)
+                {
+                    const auto values = block((first + i) / 4);
+                    std::copy(values.begin(), values.end(), out + i);
+                }
+
+                for (; i < count; ++i)
+                    out[i] = bits(first + i);
+            }
+
+            // uniform in [0, 1) from the top 24 bits
+            static float to_uniform(uint32_t bits)
+            {
+                return static_cast<float>(bits >> 8) * (1.f / 16777216.f);
+            }
+
+            float uniform(uint64_t index) const
+            {
+                return to_uniform(bits(index));
+            }
+
+            // uniform in [-1, 1)
+            float symmetric(uint64_t index) const
+            {
+                return 2.f * uniform(index) - 1.f;
+            }
+
+            // Normal samples; value i is one of the Box-Muller pair made from values i & ~1 and i | 1
+            void fill_normal(float* out, size_t count, float mean, float std_dev, uint64_t first = 0) const
+            {
+                constexpr size_t chunk = 256;
+                uint32_t raw[chunk + 2];
+
+                for (size_t done = 0; done < count; )
+                {
+                    const uint64_t pair_first = (first + done) & ~uint64_t{ 1 };
+                    const size_t skip = static_cast<size_t>(first + done - pair_first);
+                    const size_t n = std::min(chunk - skip, count - done);
+                    const size_t drawn = (skip + n + 1) & ~size_t{ 1 };
+
+                    fill_bits(raw, drawn, pair_first);
+
+                    for (size_t k = skip; k < skip + n; ++k)
+                    {
+                        const size_t pair = k & ~size_t{ 1 };
+
+                        // (0, 1] keeps the logarithm finite
+                        const float u1 = (static_cast<float>(raw[pair] >> 8) + 1.f) * (1.f / 16777216.f);
+                        const float u2 = to_uniform(raw[pair + 1]);
+                        const float radius = std::sqrt(-2.f * std::log(u1));
+                        const float angle = 6.28318530718f * u2;
+
+                        out[done + k - skip] = mean + std_dev * radius * ((k & 1) ? std::sin(angle) : std::cos(angle));
+                    }
+
+                    done += n;
+                }
+            }
+
+            // Inverted dropout mask: 1 / keep with probability keep, else 0
+            void fill_dropout_mask(float* out, size_t count, float keep, uint64_t first = 0) const
+            {
+                constexpr size_t chunk = 256;
+                uint32_t raw[chunk];
+                const float scale = keep > 0.f ? 1.f / keep : 0.f;
+                const uint32_t bound = static_cast<uint32_t>(std::min(keep, 1.f) * 16777216.f);
+
+                for (size_t done = 0; done < count; done += chunk)
+                {
+                    const size_t n = std::min(chunk, count - done);
+                    fill_bits(raw, n, first + done);
+
+                    for (size_t k = 0; k < n; ++k)
+                        out[done + k] = (raw[k] >> 8) < bound ? scale : 0.f;
+                }
+            }
+
+        private:
+            uint64_t seed;
+            uint64_t stream;
+        };
+
+        // Fills count normal samples over the shared thread pool; the values depend only on the
+        // generator, never on how the range is split
+        inline void parallel_fill_normal(const counter_rng& rng, float* out, size_t count, float mean, float std_dev)
+        {
+            parallel_for(0, count, 1 << 14, [&](size_t first, size_t last)
+            {
+                rng.fill_normal(out + first, last - first, mean, std_dev, first);
+            });
+        }
+
+        // Fisher-Yates driven by the generator: the draws are generated in parallel, the swaps are serial
+        template<typename T>
+        void shuffle(std::vector<T>& values, const counter_rng& rng)
+        {
+            if (values.size() < 2)
+                return;
+
+            std::vector<uint32_t> draws(values.size());
+
+            parallel_for(0, draws.size(), 1 << 15, [&](size_t first, size_t last)
+            {
+                rng.fill_bits(draws.data() + first, last - first, first);
+            });
+
+            for (size_t i = values.size() - 1; i > 0; --i)
+            {
+                // multiply-shift maps a 32-bit draw onto [0, i]
+                const size_t j = static_cast<size_t>((static_cast<uint64_t>(draws[i]) * (i + 1)) >> 32);
+                std::swap(values[i], values[j]);
+            }
+        }
+
+        // Fresh seed for runs that do not ask for one; it is recorded, so the run can be repeated
+        inline uint64_t random_seed()
+        {
+            std::random_device rd{};
+            return (static_cast<uint64_t>(rd()) << 32) | rd();
+        }
+    }
+}
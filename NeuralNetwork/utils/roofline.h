@@ -0,0 +1,137 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include "thread_pool.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        // Roofline of this machine: a kernel doing flops / bytes FLOP per byte of memory traffic can
+        // reach at most min(peak_flops, bandwidth * flops / bytes) FLOP/s
+        struct roofline
+        {
+            // bytes per second
+            double bandwidth = 0.0;
+            // FLOP per second
+            double peak_flops = 0.0;
+
+            // FLOP per byte where the memory roof meets the compute roof; kernels below it are memory bound
+            double ridge() const
+            {
+                return bandwidth > 0.0 ? peak_flops / bandwidth : 0.0;
+            }
+
+            double attainable(double flops_per_byte) const
+            {
+                return std::min(peak_flops, bandwidth * flops_per_byte);
+            }
+        };
+
+        namespace detail
+        {
+            // independent multiply-add chains the compiler vectorizes; 2 FLOP per chain and iteration
+            constexpr size_t roofline_chains = 32;
+
+            inline float multiply_add_chains(size_t iterations, float seed)
+            {
+                float acc[roofline_chains];
+                for (size_t j = 0; j < roofline_chains; ++j)
+                    acc[j] = seed + static_cast<float>(j) * 1e-3f;
+
+                const float a = 0.999999f;
+                const float b = 1e-7f;
+
+                for (size_t it = 0; it < iterations; ++it)
+                {
+                    for (size_t j = 0; j < roofline_chains; ++j)
+                        acc[j] = acc[j] * a + b;
+                }
+
+                float sum = 0.f;
+                for (size_t j = 0; j < roofline_chains; ++j)
+                    sum += acc[j];
+
+                return sum;
+            }
+        }
+
+        // Measures both roofs over the whole thread pool, best of repeats runs each. The bandwidth is a
+        // STREAM triad (a = b + s * c) over three arrays of array_bytes, counted as three array
+        // transfers like STREAM does; keep the arrays well beyond the last level cache. The compute
+        // roof is what this compiler makes of plain float multiply-adds, the same code generation
+        // the kernels get, rather than the datasheet peak.
+        inline roofline measure_roofline(size_t array_bytes = size_t{ 1 } << 25, size_t repeats = 5, thread_pool& pool = thread_pool::instance())
+        {
+            const size_t count = std::max<size_t>(array_bytes / sizeof(float), 1);
+            const size_t threads = std::max<size_t>(pool.size(), 1);
+            const size_t grain = std::max<size_t>(count / threads, 1 << 12);
+
+            auto a = std::make_unique<float[]>(count);
+            auto b = std::make_unique<float[]>(count);
+            auto c = std::make_unique<float[]>(count);
+
+            // first touch on the threads that stream them later
+            parallel_for(0, count, grain, [&](size_t first, size_t last)
+            {
+                std::fill(a.get() + first, a.get() + last, 0.f);
+                std::fill(b.get() + first, b.get() + last, 1.f);
+                std::fill(c.get() + first, c.get() + last, 2.f);
+            }, pool);
+
+            roofline roof;
+            double best = 0.0;
+
+            for (size_t r = 0; r < repeats; ++r)
+            {
+                const float s = 0.5f + static_cast<float>(r);
+                const auto start = std::chrono::steady_clock::now();
+
+                parallel_for(0, count, grain, [&](size_t first, size_t last)
+                {
+                    float* dst = a.get();
+                    const float* x = b.get();
+                    const float* y = c.get();
+
+                    for (size_t i = first; i < last; ++i)
+                        dst[i] = x[i] + s * y[i];
+                }, pool);
+
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                best = std::max(best, 3.0 * count * sizeof(float) / std::max(seconds, 1e-9));
+            }
+
+            roof.bandwidth = best;
+            best = 0.0;
+
+            constexpr size_t iterations = size_t{ 1 } << 22;
+            std::vector<float> results(threads);
+
+            for (size_t r = 0; r < repeats; ++r)
+            {
+                const auto start = std::chrono::steady_clock::now();
+
+                parallel_for(0, threads, 1, [&](size_t first, size_t last)
+                {
+                    for (size_t t = first; t < last; ++t)
+                        results[t] = detail::multiply_add_chains(iterations, static_cast<float>(t));
+                }, pool);
+
+                const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                best = std::max(best, 2.0 * detail::roofline_chains * iterations * threads / std::max(seconds, 1e-9));
+            }
+
+            // keeps the chains from being optimized away
+            volatile float sink = std::accumulate(results.begin(), results.end(), 0.f);
+            (void)sink;
+
+            roof.peak_flops = best;
+            return roof;
+        }
+    }
+}
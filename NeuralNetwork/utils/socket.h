@@ -0,0 +1,335 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "logger.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        // TCP host:port, or a Unix-domain socket when path is set (POSIX only)
+        struct endpoint
+        {
+            std::string host = "127.0.0.1";
+            uint16_t port = 0;
+            std::string path;
+
+            std::string to_string() const
+            {
+                return path.empty() ? host + ":" + std::to_string(port) : "unix:" + path;
+            }
+        };
+
+        namespace detail
+        {
+#ifdef _WIN32
+            using native_socket = SOCKET;
+            constexpr native_socket invalid_socket = INVALID_SOCKET;
+
+            inline void close_socket(native_socket s) { closesocket(s); }
+
+            struct winsock_session
+            {
+                winsock_session() { WSADATA data; WSAStartup(MAKEWORD(2, 2), &data); }
+                ~winsock_session() { WSACleanup(); }
+            };
+
+            inline void ensure_started()
+            {
+                static winsock_session session;
+            }
+#else
+            using native_socket = int;
+            constexpr native_socket invalid_socket = -1;
+
+            inline void close_socket(native_socket s) { ::close(s); }
+            inline void ensure_started() {}
+#endif
+        }
+
+        // Connected stream socket; send_all / recv_all loop until the whole buffer has been moved
+        class socket_connection
+        {
+        public:
+            socket_connection() = default;
+            explicit socket_connection(detail::native_socket handle) : handle(handle) {}
+
+            ~socket_connection()
+            {
+                close();
+            }
+
+            socket_connection(socket_connection&& other) noexcept : handle(other.handle)
+            {
+                other.handle = detail::invalid_socket;
+            }
+
+            socket_connection& operator=(socket_connection&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    close();
+                    handle = other.handle;
+                    other.handle = detail::invalid_socket;
+                }
+
+                return *this;
+            }
+
+            socket_connection(const socket_connection&) = delete;
+            socket_connection& operator=(const socket_connection&) = delete;
+
+            bool valid() const
+            {
+                return handle != detail::invalid_socket;
+            }
+
+            bool send_all(const void* buffer, size_t size)
+            {
+                const char* bytes = static_cast<const char*>(buffer);
+
+                while (size > 0)
+                {
+                    const int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+#ifdef _WIN32
+                    const int sent = ::send(handle, bytes, chunk, 0);
+#else
+                    const ssize_t sent = ::send(handle, bytes, chunk, MSG_NOSIGNAL);
+#endif
+                    if (sent <= 0)
+                        return false;
+
+                    bytes += sent;
+                    size -= static_cast<size_t>(sent);
+                }
+
+                return true;
+            }
+
+            bool recv_all(void* buffer, size_t size)
+            {
+                char* bytes = static_cast<char*>(buffer);
+
+                while (size > 0)
+                {
+                    const int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+                    const auto received = ::recv(handle, bytes, chunk, 0);
+
+                    if (received <= 0)
+                        return false;
+
+                    bytes += received;
+                    size -= static_cast<size_t>(received);
+                }
+
+                return true;
+            }
+
+            void close()
+            {
+                if (valid())
+                {
+                    detail::close_socket(handle);
+                    handle = detail::invalid_socket;
+                }
+            }
+
+        private:
+            detail::native_socket handle = detail::invalid_socket;
+        };
+
+        class socket_listener
+        {
+        public:
+            socket_listener() = default;
+
+            ~socket_listener()
+            {
+                close();
+            }
+
+            socket_listener(const socket_listener&) = delete;
+            socket_listener& operator=(const socket_listener&) = delete;
+
+            bool listen(const endpoint& address, int backlog = 16)
+            {
+                detail::ensure_started();
+                close();
+                bound = address;
+
+                if (!address.path.empty())
+                {
+#ifdef _WIN32
+                    Logger::Error("socket", "unix-domain sockets are not supported on this platform");
+                    return false;
+#else
+                    sockaddr_un addr{};
+                    if (address.path.size() >= sizeof(addr.sun_path))
+                    {
+                        Logger::Error("socket", "socket path too long: " + address.path);
+                        return false;
+                    }
+
+                    addr.sun_family = AF_UNIX;
+                    std::strcpy(addr.sun_path, address.path.c_str());
+                    ::unlink(address.path.c_str());
+
+                    handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                    if (handle == detail::invalid_socket || ::bind(handle, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+                        return fail();
+#endif
+                }
+                else
+                {
+                    sockaddr_in addr{};
+                    addr.sin_family = AF_INET;
+                    addr.sin_port = htons(address.port);
+                    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+                    handle = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+                    if (handle == detail::invalid_socket)
+                        return fail();
+
+                    int reuse = 1;
+                    ::setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+                    if (::bind(handle, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+                        return fail();
+                }
+
+                if (::listen(handle, backlog) != 0)
+                    return fail();
+
+                return true;
+            }
+
+            socket_connection accept()
+            {
+                detail::native_socket client = ::accept(handle, nullptr, nullptr);
+
+                if (client != detail::invalid_socket && bound.path.empty())
+                    set_no_delay(client);
+
+                return socket_connection(client);
+            }
+
+            void close()
+            {
+                if (handle != detail::invalid_socket)
+                {
+                    detail::close_socket(handle);
+                    handle = detail::invalid_socket;
+#ifndef _WIN32
+                    if (!bound.path.empty())
+                        ::unlink(bound.path.c_str());
+#endif
+                }
+            }
+
+            // small gradient chunks must not wait for Nagle's algorithm
+            static void set_no_delay(detail::native_socket s)
+            {
+                int flag = 1;
+                ::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&flag), sizeof(flag));
+            }
+
+        private:
+            bool fail()
+            {
+                Logger::Error("socket", "could not listen on " + bound.to_string());
+                close();
+                return false;
+            }
+
+        private:
+            detail::native_socket handle = detail::invalid_socket;
+            endpoint bound;
+        };
+
+        // Connects to address, retrying while the peer is not listening yet
+        inline socket_connection connect_to(const endpoint& address, size_t retries = 100,
+            std::chrono::milliseconds retry_delay = std::chrono::milliseconds(100))
+        {
+            detail::ensure_started();
+
+            for (size_t attempt = 0; attempt <= retries; ++attempt)
+            {
+                if (attempt > 0)
+                    std::this_thread::sleep_for(retry_delay);
+
+                if (!address.path.empty())
+                {
+#ifndef _WIN32
+                    sockaddr_un addr{};
+                    addr.sun_family = AF_UNIX;
+                    std::strncpy(addr.sun_path, address.path.c_str(), sizeof(addr.sun_path) - 1);
+
+                    detail::native_socket s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+                    if (s == detail::invalid_socket)
+                        continue;
+
+                    if (::connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0)
+                        return socket_connection(s);
+
+                    detail::close_socket(s);
+#endif
+                    continue;
+                }
+
+                addrinfo hints{};
+                hints.ai_family = AF_INET;
+                hints.ai_socktype = SOCK_STREAM;
+
+                addrinfo* found = nullptr;
+                if (::getaddrinfo(address.host.c_str(), std::to_string(address.port).c_str(), &hints, &found) != 0)
+                    continue;
+
+                for (addrinfo* it = found; it; it = it->ai_next)
+                {
+                    detail::native_socket s = ::socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+                    if (s == detail::invalid_socket)
+                        continue;
+
+                    if (::connect(s, it->ai_addr, static_cast<int>(it->ai_addrlen)) == 0)
+                    {
+                        ::freeaddrinfo(found);
+                        socket_listener::set_no_delay(s);
+                        return socket_connection(s);
+                    }
+
+                    detail::close_socket(s);
+                }
+
+                ::freeaddrinfo(found);
+            }
+
+            Logger::Error("socket", "could not connect to " + address.to_string());
+            return socket_connection();
+        }
+    }
+}
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "logger.h"
+
+namespace ml
+{
+    namespace utils
+    {
+        struct pool_config
+        {
+            // 0 means one worker per hardware thread
+            size_t threads = 0;
+
+            // worker i is pinned to cpus[i % cpus.size()]; empty leaves placement to the OS
+            std::vector<size_t> cpus;
+        };
+
+        // Work-stealing scheduler: every worker owns a deque, pops its own newest task and steals the
+        // oldest task of another worker when it runs dry. Threads waiting on a task_group execute pending
+        // tasks meanwhile, so kernels may fork work from inside other tasks without deadlocking.
+        class thread_pool
+        {
+        public:
+            using task = std::function<void()>;
+
+            explicit thread_pool(const pool_config& config = {})
+            {
+                size_t count = config.threads != 0 ? config.threads : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+                for (size_t i = 0; i < count; ++i)
+                    queues.emplace_back(std::make_unique<worker_queue>());
+
+                for (size_t i = 0; i < count; ++i)
+                {
+                    threads.emplace_back([this, i] { worker_loop(i); });
+
+                    if (!config.cpus.empty())
+                        pin(threads.back(), config.cpus[i % config.cpus.size()]);
+                }
+            }
+
+            ~thread_pool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    stopping = true;
+                }
+
+                wake.notify_all();
+
+                for (auto& thread : threads)
+                    thread.join();
+            }
+
+            thread_pool(const thread_pool&) = delete;
+            thread_pool& operator=(const thread_pool&) = delete;
+
+            size_t size() const
+            {
+                return threads.size();
+            }
+
+            void submit(task work)
+            {
+                const size_t target = current_pool == this ? current_index : next_queue++ % queues.size();
+
+                // counted before it can be popped, so that the pop's decrement never comes first
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    ++pending;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(queues[target]->mutex);
+                    queues[target]->tasks.push_back(std::move(work));
+                }
+
+                wake.notify_one();
+            }
+
+            // Runs one pending task on the calling thread; false if there was none
+            bool run_pending()
+            {
+                task work;
+                const size_t self = current_pool == this ? current_index : 0;
+
+                if (!try_pop(self, work))
+                    return false;
+
+                work();
+                return true;
+            }
+
+            // Process-wide pool shared by the math kernels, the trainer and the data loaders
+            static thread_pool& instance()
+            {
+                // every parallel_for asks for it, so after the first call this is only the static's guard check
+                static thread_pool pool(start_config());
+                return pool;
+            }
+
+            // Sets thread count and affinity of instance(); only valid before its first use
+            static void configure(const pool_config& config)
+            {
+                std::lock_guard<std::mutex> lock(instance_mutex());
+
+                if (instance_started())
+                {
+                    Logger::Warning("thread_pool", "pool already running, configuration ignored");
+                    return;
+                }
+
+                instance_config() = config;
+            }
+
+        private:
+            struct worker_queue
+            {
+                std::mutex mutex;
+                std::deque<task> tasks;
+            };
+
+            bool try_pop(size_t self, task& work)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(queues[self]->mutex);
+
+                    if (!queues[self]->tasks.empty())
+                    {
+                        work = std::move(queues[self]->tasks.back());
+                        queues[self]->tasks.pop_back();
+                        --pending;
+                        return true;
+                    }
+                }
+
+                for (size_t offset = 1; offset < queues.size(); ++offset)
+                {
+                    auto& victim = *queues[(self + offset) % queues.size()];
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+
+                    if (!victim.tasks.empty())
+                    {
+                        work = std::move(victim.tasks.front());
+                        victim.tasks.pop_front();
+                        --pending;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            void worker_loop(size_t index)
+            {
+                current_pool = this;
+                current_index = index;
+
+                task work;
+
+                while (true)
+                {
+                    if (try_pop(index, work))
+                    {
+                        work();
+                        work = nullptr;
+                        continue;
+                    }
+
+                    std::unique_lock<std::mutex> lock(sleep_mutex);
+                    wake.wait(lock, [this] { return pending > 0 || stopping; });
+
+                    if (stopping && pending == 0)
+                        return;
+                }
+            }
+
+            static void pin(std::thread& thread, size_t cpu)
+            {
+#ifdef _WIN32
+                // one bit per cpu of the thread's processor group
+                constexpr size_t cpu_limit = sizeof(DWORD_PTR) * 8;
+#else
+                constexpr size_t cpu_limit = CPU_SETSIZE;
+#endif
+                if (cpu >= cpu_limit)
+                {
+                    Logger::Warning("thread_pool", "cpu " + std::to_string(cpu) + " is out of range, worker left unpinned");
+                    return;
+                }
+
+#ifdef _WIN32
+                if (SetThreadAffinityMask(thread.native_handle(), DWORD_PTR{ 1 } << cpu) == 0)
+                    Logger::Warning("thread_pool", "could not pin worker to cpu " + std::to_string(cpu));
+#else
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+
+                if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0)
+                    Logger::Warning("thread_pool", "could not pin worker to cpu " + std::to_string(cpu));
+#endif
+            }
+
+            static std::mutex& instance_mutex()
+            {
+                static std::mutex mutex;
+                return mutex;
+            }
+
+            static bool& instance_started()
+            {
+                static bool started = false;
+                return started;
+            }
+
+            static pool_config& instance_config()
+            {
+                static pool_config config;
+                return config;
+            }
+
+            // configuration of instance(), after which configure() is refused
+            static pool_config start_config()
+            {
+                std::lock_guard<std::mutex> lock(instance_mutex());
+
+                instance_started() = true;
+                return instance_config();
+            }
+
+        private:
+            std::vector<std::unique_ptr<worker_queue>> queues;
+            std::vector<std::thread> threads;
+
+            std::mutex sleep_mutex;
+            std::condition_variable wake;
+            std::atomic<size_t> pending{ 0 };
+            std::atomic<size_t> next_queue{ 0 };
+            bool stopping = false;
+
+            static thread_local thread_pool* current_pool;
+            static thread_local size_t current_index;
+        };
+
+        inline thread_local thread_pool* thread_pool::current_pool = nullptr;
+        inline thread_local size_t thread_pool::current_index = 0;
+
+        // Set of tasks that can be joined; wait() runs pending pool tasks instead of blocking.
+        // The first exception thrown by a task is rethrown from wait().
+        class task_group
+        {
+        public:
+            explicit task_group(thread_pool& pool = thread_pool::instance()) : pool(pool) {}
+
+            ~task_group()
+            {
+                wait_quietly();
+            }
+
+            task_group(const task_group&) = delete;
+            task_group& operator=(const task_group&) = delete;
+
+            template<typename Fn>
+            void run(Fn&& fn)
+            {
+                ++remaining;
+
+                pool.submit([this, fn = std::forward<Fn>(fn)]() mutable
+                {
+                    try
+                    {
+                        fn();
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(error_mutex);
+                        if (!error)
+                            error = std::current_exception();
+                    }
+
+                    --remaining;
+                });
+            }
+
+            void wait()
+            {
+                wait_quietly();
+
+                std::exception_ptr pending_error;
+                {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    std::swap(pending_error, error);
+                }
+
+                if (pending_error)
+                    std::rethrow_exception(pending_error);
+            }
+
+            thread_pool& executor()
+            {
+                return pool;
+            }
+
+        private:
+            void wait_quietly()
+            {
+                while (remaining > 0)
+                {
+                    if (!pool.run_pending())
+                        std::this_thread::yield();
+                }
+            }
+
+        private:
+            thread_pool& pool;
+            std::atomic<size_t> remaining{ 0 };
+            std::mutex error_mutex;
+            std::exception_ptr error;
+        };
+
+        // Calls fn(first, last) on disjoint chunks of [begin, end) of at least grain elements.
+        // The calling thread takes the first chunk itself.
+        template<typename Fn>
+        void parallel_for(size_t begin, size_t end, size_t grain, Fn&& fn, thread_pool& pool = thread_pool::instance())
+        {
+            if (end <= begin)
+                return;
+
+            const size_t count = end - begin;
+            grain = std::max<size_t>(grain, 1);
+
+            if (count <= grain || pool.size() <= 1)
+            {
+                fn(begin, end);
+                return;
+            }
+
+            const size_t chunks = std::min((count + grain - 1) / grain, pool.size() * 4);
+            const size_t chunk = (count + chunks - 1) / chunks;
+
+            task_group group(pool);
+
+            for (size_t first = begin + chunk; first < end; first += chunk)
+            {
+                const size_t last = std::min(first + chunk, end);
+                group.run([&fn, first, last] { fn(first, last); });
+            }
+
+            fn(begin, std::min(begin + chunk, end));
+            group.wait();
+        }
+    }
+}
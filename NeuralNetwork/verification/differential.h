@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include "../math/matrix.h"
+#include "../utils/random.h"
+
+namespace ml
+{
+    namespace verify
+    {
+        struct verify_config
+        {
+            // every case of every check is a function of this seed
+            uint64_t seed = 1;
+            // random cases per check
+            size_t cases = 40;
+            // largest random dimension; fixed larger shapes also exercise the threaded paths
+            size_t max_dim = 48;
+        };
+
+        // Acceptance bound of one kernel: an element passes when it is within max_ulps of the
+        // reference or its error is at most max_relative of the reference magnitude. The magnitude
+        // is the larger of |reference|, the element's error scale (e.g. sum |a_ik * b_kj| for a dot
+        // product, where cancellation makes |reference| meaningless) and abs_floor.
+        struct tolerance
+        {
+            uint32_t max_ulps = 0;
+            double max_relative = 0.0;
+            double abs_floor = 0.0;
+        };
+
+        // Distance in representable floats; equal values and both zeros give 0, NaN the maximum
+        inline uint32_t ulp_distance(float a, float b)
+        {
+            if (std::isnan(a) || std::isnan(b))
+                return std::numeric_limits<uint32_t>::max();
+
+            auto ordered = [](float f)
+            {
+                int32_t bits;
+                std::memcpy(&bits, &f, sizeof(bits));
+                // map the sign-magnitude encoding onto a monotonic integer line
+                return bits < 0 ? static_cast<int64_t>(std::numeric_limits<int32_t>::min()) - bits : static_cast<int64_t>(bits);
+            };
+
+            const int64_t distance = ordered(a) - ordered(b);
+            return static_cast<uint32_t>(std::min<int64_t>(distance < 0 ? -distance : distance, std::numeric_limits<uint32_t>::max()));
+        }
+
+        struct check_result
+        {
+            std::string kernel;
+            size_t cases = 0;
+            size_t elements = 0;
+            size_t failures = 0;
+            uint32_t worst_ulps = 0;
+            double worst_relative = 0.0;
+            // case description, index and values of the first element out of bounds
+            std::string first_failure;
+
+            bool passed() const
+            {
+                return failures == 0 && cases != 0;
+            }
+        };
+
+        struct report
+        {
+            std::vector<check_result> results;
+
+            bool passed() const
+            {
+                return std::all_of(results.begin(), results.end(), [](const check_result& r) { return r.passed(); });
+            }
+
+            void print(std::ostream& out = std::cout) const
+            {
+                out << "differential checks (cases, elements, worst ulps, worst relative error):\n";
+
+                for (const auto& r : results)
+                {
+                    out << std::left << std::setw(40) << r.kernel << std::right
+                        << std::setw(8) << r.cases << std::setw(12) << r.elements
+                        << std::setw(12) << r.worst_ulps
+                        << std::setw(14) << std::scientific << std::setprecision(2) << r.worst_relative << std::defaultfloat
+                        << (r.passed() ? "  ok" : "  FAILED") << '\n';
+
+                    if (!r.first_failure.empty())
+                        out << "    first failure: " << r.first_failure << '\n';
+                }
+            }
+        };
+
+        // Compares n results of one case against the reference; scale may be null
+        inline void compare(const double* reference, const float* actual, const double* scale, size_t n,
+            const tolerance& bound, const std::string& description, check_result& result)
+        {
+            ++result.cases;
+            result.elements += n;
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                const double expected = reference[i];
+                const uint32_t ulps = ulp_distance(static_cast<float>(expected), actual[i]);
+                const double magnitude = std::max({ std::abs(expected), scale ? scale[i] : 0.0, bound.abs_floor });
+                const double error = std::abs(static_cast<double>(actual[i]) - expected);
+                const double relative = magnitude > 0.0 ? error / magnitude : error;
+
+                result.worst_ulps = std::max(result.worst_ulps, ulps);
+                result.worst_relative = std::max(result.worst_relative, std::isnan(relative) ? std::numeric_limits<double>::infinity() : relative);
+
+                if (ulps <= bound.max_ulps || relative <= bound.max_relative)
+                    continue;
+
+                if (result.failures++ == 0)
+                {
+                    result.first_failure = description + " [" + std::to_string(i) + "] expected " + std::to_string(expected) +
+                        " got " + std::to_string(actual[i]) + " (" + std::to_string(ulps) + " ulps)";
+                }
+            }
+        }
+
+        inline void compare(const std::vector<double>& reference, const math::matrix<float>& actual, const std::vector<double>& scale,
+            const tolerance& bound, const std::string& description, check_result& result)
+        {
+            if (actual.size() != reference.size())
+            {
+                ++result.cases;
+
+                if (result.failures++ == 0)
+                    result.first_failure = description + ": " + std::to_string(actual.size()) + " results, expected " + std::to_string(reference.size());
+
+                return;
+            }
+
+            compare(reference.data(), actual.data_ptr(), scale.empty() ? nullptr : scale.data(), reference.size(), bound, description, result);
+        }
+
+        // Shapes and values for the randomized cases, a function of the seed and the check alone
+        class case_generator
+        {
+        public:
+            case_generator(uint64_t seed, uint32_t check) : rng(seed, utils::rng_stream::verification + check) {}
+
+            // 1..max_dim, with a quarter of the draws pinned to 1 so 1xN, Nx1 and 1x1 shapes come up often
+            size_t dimension(size_t max_dim)
+            {
+                const uint64_t bits = next();
+
+                if ((bits & 3) == 0)
+                    return 1;
+
+                return 1 + static_cast<size_t>((bits >> 2) % std::max<size_t>(max_dim, 1));
+            }
+
+            // Values spread over several binades, with exact zeros and signs mixed in
+            void fill(float* values, size_t count, float magnitude = 1.f)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    const uint64_t bits = next();
+
+                    if ((bits & 15) == 0)
+                    {
+                        values[i] = 0.f;
+                        continue;
+                    }
+
+                    const float mantissa = utils::counter_rng::to_uniform(static_cast<uint32_t>(bits >> 32));
+                    const int exponent = -static_cast<int>((bits >> 4) % 6);
+                    values[i] = std::ldexp(mantissa, exponent) * magnitude * ((bits >> 10) & 1 ? -1.f : 1.f);
+                }
+            }
+
+            void fill(math::matrix<float>& m, float magnitude = 1.f)
+            {
+                fill(m.data_ptr(), m.size(), magnitude);
+            }
+
+            // true with probability numerator / 256
+            bool chance(uint32_t numerator)
+            {
+                return (next() & 255) < numerator;
+            }
+
+            uint64_t next()
+            {
+                const uint64_t high = rng.bits(counter++);
+                return (high << 32) | rng.bits(counter++);
+            }
+
+        private:
+            utils::counter_rng rng;
+            uint64_t counter = 0;
+        };
+
+        inline std::string shape_name(size_t m, size_t n)
+        {
+            return std::to_string(m) + "x" + std::to_string(n);
+        }
+    }
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "differential.h"
+#include "reference.h"
+#include "kernel_checks.h"
+#include "../ml/perceptron.h"
+#include "../ml/convnet.h"
+
+namespace ml
+{
+    namespace verify
+    {
+        // Backpropagation against central finite differences of the loss. The perceptron's loss is
+        // evaluated by the double reference, so the differences are accurate to ~1e-8 and the bound
+        // is tight. convnet has no double reference; its loss comes from forward_batch in float, which
+        // limits the differences to ~1e-3 relative, and the network uses smooth layers only (sigmoid,
+        // average pooling) so no kink lies within the step.
+        inline check_result check_perceptron_gradients(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "perceptron backprop vs finite differences";
+            case_generator gen(config.seed, 9);
+
+            constexpr double step = 1e-4;
+
+            for (size_t i = 0; i < config.cases; ++i)
+            {
+                const size_t inputs = gen.dimension(std::max<size_t>(config.max_dim / 2, 1));
+                verify_config small = config;
+                small.max_dim = std::max<size_t>(config.max_dim / 2, 1);
+
+                auto model = detail::random_perceptron(gen, small, inputs);
+                const size_t batch = gen.dimension(8);
+
+                const auto x = detail::random_matrix(gen, inputs, batch);
+                math::matrix<float> targets(model.layer(model.layer_count() - 1).size_m(), batch);
+                for (auto& t : targets)
+                    t = gen.chance(128) ? 0.99f : 0.01f;
+
+                std::vector<math::matrix<float>> grads;
+                model.compute_gradients(x, targets, grads);
+
+                auto weights = detail::tensors(model);
+                const reference::tensor xs(x);
+                const reference::tensor ts(targets);
+
+                for (size_t l = 0; l < weights.size(); ++l)
+                {
+                    std::vector<double> numeric(weights[l].values.size());
+
+                    for (size_t e = 0; e < numeric.size(); ++e)
+                    {
+                        const double original = weights[l].values[e];
+
+                        weights[l].values[e] = original + step;
+                        const double plus = reference::loss(reference::forward(weights, xs).back(), ts);
+                        weights[l].values[e] = original - step;
+                        const double minus = reference::loss(reference::forward(weights, xs).back(), ts);
+                        weights[l].values[e] = original;
+
+                        numeric[e] = (plus - minus) / (2.0 * step);
+                    }
+
+                    compare(numeric, grads[l], detail::block_scale(numeric), { 4, 1e-4, 0.0 },
+                        std::to_string(model.layer_count()) + " layers, " + std::to_string(inputs) + " inputs, batch " +
+                        std::to_string(batch) + " layer " + std::to_string(l), result);
+                }
+            }
+
+            return result;
+        }
+
+        inline check_result check_convnet_gradients(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "convnet backprop vs finite differences";
+            case_generator gen(config.seed, 10);
+
+            constexpr float step = 1e-2f;
+            // parameters probed per tensor, spread over it
+            constexpr size_t probes = 12;
+
+            for (size_t i = 0; i < std::max<size_t>(config.cases / 4, 1); ++i)
+            {
+                const uint32_t channels = 1 + gen.next() % 2;
+                const uint32_t kernel = 2 + gen.next() % 2;
+                const uint32_t side = 6 + gen.next() % 4;
+                const uint32_t padding = gen.next() % 2;
+                const size_t batch = gen.dimension(4);
+
+                convnet net(channels, side, side,
+                    { layers::conv2d(3, kernel, 1, padding, activation_kind::sigmoid), layers::avg_pool(2),
+                      layers::conv2d(2, 2, 1 + gen.next() % 2, 0, activation_kind::sigmoid), layers::flatten(),
+                      layers::dense(1 + gen.next() % 5, activation_kind::sigmoid) },
+                    optim::optimizer_config(), gen.next());
+
+                const auto x = detail::random_matrix(gen, net.input_size(), batch);
+                math::matrix<float> targets(net.output_size(), batch);
+                for (auto& t : targets)
+                    t = gen.chance(128) ? 0.99f : 0.01f;
+
+                std::vector<math::matrix<float>> grads;
+                net.compute_gradients(x, targets, grads);
+
+                model_snapshot base;
+                net.snapshot(base);
+
+                auto loss_with = [&](size_t p, size_t e, float delta)
+                {
+                    model_snapshot shifted = base;
+                    shifted.layers[p].data_ptr()[e] += delta;
+
+                    convnet probe;
+                    probe.restore(shifted);
+
+                    return reference::loss(reference::tensor(probe.forward_batch(x)), reference::tensor(targets));
+                };
+
+                for (size_t p = 0; p < grads.size(); ++p)
+                {
+                    const size_t count = base.layers[p].size();
+                    const size_t stride = std::max<size_t>(count / probes, 1);
+
+                    std::vector<double> numeric;
+                    std::vector<float> analytic;
+                    double largest = 0.0;
+
+                    for (float g : grads[p])
+                        largest = std::max(largest, static_cast<double>(std::abs(g)));
+
+                    for (size_t e = 0; e < count; e += stride)
+                    {
+                        numeric.push_back((loss_with(p, e, step) - loss_with(p, e, -step)) / (2.0 * step));
+                        analytic.push_back(grads[p].data_ptr()[e]);
+                    }
+
+                    // normwise against the largest analytic gradient of the tensor
+                    const std::vector<double> scale(numeric.size(), largest);
+                    compare(numeric.data(), analytic.data(), scale.data(), numeric.size(), { 4, 2e-2, 1e-6 },
+                        std::to_string(channels) + "x" + shape_name(side, side) + ", batch " + std::to_string(batch) +
+                        " parameter " + std::to_string(p), result);
+                }
+            }
+
+            return result;
+        }
+    }
+}
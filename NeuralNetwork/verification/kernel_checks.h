@@ -0,0 +1,500 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "differential.h"
+#include "reference.h"
+#include "../math/matrix.h"
+#include "../math/sparse_matrix.h"
+#include "../math/low_rank_matrix.h"
+#include "../math/functions.h"
+#include "../ml/perceptron.h"
+#include "../ml/convnet.h"
+#include "../utils/mnist/mnist.h"
+
+namespace ml
+{
+    namespace verify
+    {
+        namespace detail
+        {
+            // float rounding bound of a length k dot product relative to sum |a_i * b_i|, with headroom
+            inline double dot_bound(size_t k)
+            {
+                return 2.0 * static_cast<double>(k + 2) * std::ldexp(1.0, -24);
+            }
+
+            inline math::matrix<float> random_matrix(case_generator& gen, size_t m, size_t n, float magnitude = 1.f)
+            {
+                math::matrix<float> result(m, n);
+                gen.fill(result, magnitude);
+                return result;
+            }
+
+            // normwise scale: every element of a block is measured against the block's largest reference value
+            inline std::vector<double> block_scale(const std::vector<double>& reference)
+            {
+                double largest = 0.0;
+                for (double v : reference)
+                    largest = std::max(largest, std::abs(v));
+
+                return std::vector<double>(reference.size(), largest);
+            }
+
+            inline std::vector<reference::tensor> tensors(const perceptron& model)
+            {
+                std::vector<reference::tensor> weights;
+                for (size_t i = 0; i < model.layer_count(); ++i)
+                    weights.emplace_back(model.layer(i));
+
+                return weights;
+            }
+
+            // small sigmoid perceptron with weights of the usual 1/sqrt(fan_in) size
+            inline perceptron random_perceptron(case_generator& gen, const verify_config& config, size_t inputs)
+            {
+                std::vector<size_t> sizes{ inputs };
+                const size_t layers = 1 + gen.next() % 3;
+
+                for (size_t i = 0; i < layers; ++i)
+                    sizes.push_back(gen.dimension(config.max_dim));
+
+                perceptron model(sizes, optim::optimizer_config(), gen.next());
+
+                for (size_t i = 0; i < model.layer_count(); ++i)
+                    gen.fill(model.layer(i), 2.f / std::sqrt(static_cast<float>(model.layer(i).size_n())));
+
+                return model;
+            }
+
+            // samples as columns: (C * H * W) x N -> CNHW tensor with one row per channel
+            inline reference::tensor to_cnhw(const math::matrix<float>& columns, size_t channels, size_t plane)
+            {
+                const size_t batch = columns.size_n();
+                reference::tensor result(channels, batch * plane);
+
+                for (size_t c = 0; c < channels; ++c)
+                {
+                    for (size_t p = 0; p < plane; ++p)
+                    {
+                        for (size_t n = 0; n < batch; ++n)
+                            result(c, n * plane + p) = columns.data_ptr()[(c * plane + p) * batch + n];
+                    }
+                }
+
+                return result;
+            }
+
+            inline std::vector<double> from_cnhw(const std::vector<double>& values, size_t channels, size_t plane, size_t batch)
+            {
+                std::vector<double> columns(values.size());
+
+                for (size_t c = 0; c < channels; ++c)
+                {
+                    for (size_t n = 0; n < batch; ++n)
+                    {
+                        for (size_t p = 0; p < plane; ++p)
+                            columns[(c * plane + p) * batch + n] = values[(c * batch + n) * plane + p];
+                    }
+                }
+
+                return columns;
+            }
+        }
+
+        // matrix::operator* against the double reference, random shapes plus fixed ones above the threading threshold
+        inline check_result check_gemm(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "matrix * (gemm)";
+            case_generator gen(config.seed, 1);
+
+            std::vector<std::array<size_t, 3>> shapes;
+            for (size_t i = 0; i < config.cases; ++i)
+                shapes.push_back({ gen.dimension(config.max_dim), gen.dimension(config.max_dim), gen.dimension(config.max_dim) });
+
+            shapes.push_back({ 150, 784, 32 });
+            shapes.push_back({ 10, 150, 500 });
+
+            for (const auto& [m, k, n] : shapes)
+            {
+                const auto a = detail::random_matrix(gen, m, k);
+                const auto b = detail::random_matrix(gen, k, n);
+
+                std::vector<double> scale;
+                const auto expected = reference::gemm(reference::tensor(a), reference::tensor(b), &scale);
+
+                compare(expected.values, a * b, scale, { 2, detail::dot_bound(k), 0.0 },
+                    shape_name(m, k) + " * " + shape_name(k, n), result);
+            }
+
+            return result;
+        }
+
+        // transposed(), transpose_to() and in-place transpose() must move values without changing them
+        inline check_result check_transpose(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "matrix transpose";
+            case_generator gen(config.seed, 2);
+
+            for (size_t i = 0; i < config.cases; ++i)
+            {
+                const size_t m = gen.dimension(config.max_dim * 4);
+                const size_t n = gen.chance(64) ? m : gen.dimension(config.max_dim * 4);
+                const auto a = detail::random_matrix(gen, m, n);
+                const auto expected = reference::transpose(reference::tensor(a)).values;
+                const std::string shape = shape_name(m, n);
+
+                compare(expected, a.transposed(), {}, {}, shape + " transposed", result);
+
+                math::matrix<float> target;
+                a.transpose_to(target);
+                compare(expected, target, {}, {}, shape + " transpose_to", result);
+
+                auto in_place = a;
+                in_place.transpose();
+                compare(expected, in_place, {}, {}, shape + " transpose", result);
+            }
+
+            return result;
+        }
+
+        inline check_result check_sigmoid(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "sigmoid_function";
+            case_generator gen(config.seed, 3);
+
+            std::vector<float> inputs = { 0.f, -0.f, 1e-30f, -1e-30f, 88.f, -88.f, 100.f, -100.f };
+            for (size_t i = 0; i < config.cases * 64; ++i)
+                inputs.push_back((utils::counter_rng::to_uniform(static_cast<uint32_t>(gen.next())) - 0.5f) * 40.f);
+
+            std::vector<double> expected(inputs.size());
+            std::vector<float> actual(inputs.size());
+
+            for (size_t i = 0; i < inputs.size(); ++i)
+            {
+                expected[i] = reference::sigmoid(inputs[i]);
+                actual[i] = function::sigmoid_function(inputs[i]);
+            }
+
+            compare(expected.data(), actual.data(), nullptr, inputs.size(), { 2, 0.0, 0.0 }, "sigmoid", result);
+            return result;
+        }
+
+        // bsr_matrix single-sample and batched products over block-pruned matrices of several block shapes
+        inline check_result check_sparse(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "bsr_matrix multiply";
+            case_generator gen(config.seed, 4);
+
+            const std::pair<size_t, size_t> blocks[] = { { 1, 1 }, { 2, 2 }, { 4, 1 }, { 1, 4 }, { 3, 5 }, { 8, 8 } };
+
+            for (size_t i = 0; i < config.cases; ++i)
+            {
+                const auto [bm, bn] = blocks[i % std::size(blocks)];
+                const size_t m = gen.dimension(config.max_dim);
+                const size_t k = gen.dimension(config.max_dim);
+                const size_t n = gen.chance(96) ? 1 : gen.dimension(config.max_dim);
+
+                auto a = detail::random_matrix(gen, m, k);
+
+                // zero roughly three quarters of the blocks, partial edge blocks included
+                for (size_t br = 0; br < (m + bm - 1) / bm; ++br)
+                {
+                    for (size_t bc = 0; bc < (k + bn - 1) / bn; ++bc)
+                    {
+                        if (!gen.chance(192))
+                            continue;
+
+                        for (size_t r = br * bm; r < std::min(m, (br + 1) * bm); ++r)
+                        {
+                            for (size_t c = bc * bn; c < std::min(k, (bc + 1) * bn); ++c)
+                                a.data_ptr()[r * k + c] = 0.f;
+                        }
+                    }
+                }
+
+                const auto x = detail::random_matrix(gen, k, n);
+                const math::bsr_matrix<float> sparse(a, bm, bn);
+
+                std::vector<double> scale;
+                const auto expected = reference::gemm(reference::tensor(a), reference::tensor(x), &scale);
+                const std::string shape = shape_name(m, k) + " * " + shape_name(k, n) + " blocks " + shape_name(bm, bn);
+
+                compare(expected.values, sparse.multiply(x), scale, { 2, detail::dot_bound(k), 0.0 }, shape, result);
+                compare(reference::tensor(a).values, sparse.to_dense(), {}, {}, shape + " to_dense", result);
+            }
+
+            return result;
+        }
+
+        // u * (v * x) against the exact product of the factors
+        inline check_result check_low_rank(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "low_rank_matrix multiply";
+            case_generator gen(config.seed, 5);
+
+            for (size_t i = 0; i < config.cases; ++i)
+            {
+                const size_t m = gen.dimension(config.max_dim);
+                const size_t r = gen.dimension(std::max<size_t>(config.max_dim / 4, 1));
+                const size_t k = gen.dimension(config.max_dim);
+                const size_t n = gen.dimension(config.max_dim);
+
+                math::low_rank_matrix<float> factors(detail::random_matrix(gen, m, r), detail::random_matrix(gen, r, k));
+                const auto x = detail::random_matrix(gen, k, n);
+
+                const reference::tensor u(factors.left());
+                const reference::tensor v(factors.right());
+                const reference::tensor xs(x);
+
+                // the error scale of u * (v * x) is |u| * (|v| * |x|)
+                auto absolute = [](reference::tensor t) { for (double& e : t.values) e = std::abs(e); return t; };
+                const auto scale = reference::gemm(absolute(u), reference::gemm(absolute(v), absolute(xs))).values;
+                const auto expected = reference::gemm(u, reference::gemm(v, xs));
+
+                compare(expected.values, factors.multiply(x), scale, { 2, detail::dot_bound(r) + detail::dot_bound(k), 0.0 },
+                    shape_name(m, r) + " * " + shape_name(r, k) + " * " + shape_name(k, n), result);
+            }
+
+            return result;
+        }
+
+        // forward, forward_batch and forward_rows over dense, sparse, low rank and sparse-input first layers against the
+        // reference forward pass
+        inline check_result check_forward(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "perceptron forward paths";
+            case_generator gen(config.seed, 6);
+
+            // outputs are sigmoids in (0, 1), so the bound is absolute
+            const tolerance bound{ 4, 1e-5, 1.0 };
+
+            for (size_t i = 0; i < config.cases; ++i)
+            {
+                const size_t inputs = gen.dimension(config.max_dim);
+                auto model = detail::random_perceptron(gen, config, inputs);
+                const size_t batch = gen.dimension(config.max_dim);
+                std::string variant = "dense";
+
+                std::vector<reference::tensor> weights;
+
+                if (i % 3 == 1)
+                {
+                    // sparse first layer, 2x2 blocks
+                    auto& w = model.layer(0);
+                    for (size_t r = 0; r < w.size_m(); r += 2)
+                    {
+                        for (size_t c = 0; c < w.size_n(); c += 2)
+                        {
+                            if (!gen.chance(224))
+                                continue;
+
+                            for (size_t rr = r; rr < std::min(r + 2, w.size_m()); ++rr)
+                            {
+                                for (size_t cc = c; cc < std::min(c + 2, w.size_n()); ++cc)
+                                    w.data_ptr()[rr * w.size_n() + cc] = 0.f;
+                            }
+                        }
+                    }
+
+                    model.set_layer_format(0, { layer_encoding::dense, 2, 2 });
+                    model.refresh_sparsity();
+                    variant = model.is_sparse(0) ? "sparse" : "dense (pruning too light)";
+                }
+                else if (i % 3 == 2)
+                {
+                    const size_t rows = model.layer(0).size_m();
+                    const size_t rank = std::max<size_t>(std::min(rows, inputs) / 2, 1);
+                    model.set_factors(0, math::low_rank_matrix<float>(detail::random_matrix(gen, rows, rank, 0.5f),
+                        detail::random_matrix(gen, rank, inputs, 1.f / std::sqrt(static_cast<float>(inputs)))));
+                    variant = "low rank";
+                }
+                else if (i % 6 == 3)
+                {
+                    model.set_sparse_input(true);
+                    variant = "sparse input";
+                }
+
+                weights = detail::tensors(model);
+
+                if (model.is_low_rank(0))
+                    weights[0] = reference::gemm(reference::tensor(model.factors(0).left()), reference::tensor(model.factors(0).right()));
+
+                // uint8 samples one per row with padding, converted like the training data
+                const size_t stride = inputs + 3;
+                std::vector<uint8_t> samples(batch * stride);
+                // mostly blank digits for the sparse-input first layer
+                for (auto& pixel : samples)
+                    pixel = model.uses_sparse_input() && !gen.chance(64) ? 0 : static_cast<uint8_t>(gen.next());
+
+                math::matrix<float> columns(inputs, batch);
+                for (size_t s = 0; s < batch; ++s)
+                {
+                    for (size_t k = 0; k < inputs; ++k)
+                        columns.data_ptr()[k * batch + s] = mnist::normalize_pixel(static_cast<mnist::byte>(samples[s * stride + k]));
+                }
+
+                const auto expected = reference::forward(weights, reference::tensor(columns)).back();
+                const std::string label = variant + " " + std::to_string(model.layer_count()) + " layers, " +
+                    std::to_string(inputs) + " inputs, batch " + std::to_string(batch);
+
+                compare(expected.values, model.forward_batch(columns), {}, bound, label + " forward_batch", result);
+
+                compare(expected.values, model.forward_rows(samples.data(), batch, stride,
+                    [](uint8_t pixel) { return mnist::normalize_pixel(static_cast<mnist::byte>(pixel)); }), {}, bound, label + " forward_rows", result);
+
+                // the single-sample path, one column at a time
+                std::vector<float> sample(inputs);
+                for (size_t k = 0; k < inputs; ++k)
+                    sample[k] = columns.data_ptr()[k * batch];
+
+                std::vector<double> first(expected.m);
+                for (size_t r = 0; r < expected.m; ++r)
+                    first[r] = expected(r, 0);
+
+                compare(first, model.forward(sample), {}, bound, label + " forward", result);
+            }
+
+            return result;
+        }
+
+        // compute_gradients and one SGD train_batch step against the reference chain rule
+        inline check_result check_training(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "perceptron gradients / train_batch";
+            case_generator gen(config.seed, 7);
+
+            const tolerance bound{ 4, 1e-4, 0.0 };
+
+            for (size_t i = 0; i < config.cases; ++i)
+            {
+                const size_t inputs = gen.dimension(config.max_dim);
+                auto model = detail::random_perceptron(gen, config, inputs);
+                const size_t batch = gen.dimension(config.max_dim);
+
+                const auto x = detail::random_matrix(gen, inputs, batch);
+                math::matrix<float> targets(model.layer(model.layer_count() - 1).size_m(), batch);
+                for (auto& t : targets)
+                    t = gen.chance(128) ? 0.99f : 0.01f;
+
+                const auto weights = detail::tensors(model);
+                const auto expected = reference::gradients(weights, reference::tensor(x), reference::tensor(targets));
+                const std::string label = std::to_string(model.layer_count()) + " layers, " + std::to_string(inputs) +
+                    " inputs, batch " + std::to_string(batch);
+
+                std::vector<math::matrix<float>> grads;
+                model.compute_gradients(x, targets, grads);
+
+                for (size_t l = 0; l < grads.size(); ++l)
+                    compare(expected[l].values, grads[l], detail::block_scale(expected[l].values), bound, label + " layer " + std::to_string(l), result);
+
+                optim::optimizer_config sgd;
+                sgd.learning_rate = 0.5f;
+                model.set_optimizer(sgd);
+                model.train_batch(x, targets);
+
+                for (size_t l = 0; l < weights.size(); ++l)
+                {
+                    std::vector<double> updated(weights[l].values.size());
+                    std::vector<double> scale(updated.size());
+                    const double step = sgd.learning_rate * detail::block_scale(expected[l].values).front();
+
+                    for (size_t e = 0; e < updated.size(); ++e)
+                    {
+                        updated[e] = weights[l].values[e] - sgd.learning_rate * expected[l].values[e];
+                        scale[e] = std::abs(weights[l].values[e]) + step;
+                    }
+
+                    compare(updated, model.layer(l), scale, bound, label + " sgd step layer " + std::to_string(l), result);
+                }
+            }
+
+            return result;
+        }
+
+        // convnet convolution (im2col + gemm + bias) against direct convolution, and pooling, random geometries
+        inline check_result check_convolution(const verify_config& config)
+        {
+            check_result result;
+            result.kernel = "convnet conv2d / pooling";
+            case_generator gen(config.seed, 8);
+
+            for (size_t i = 0; i < config.cases; ++i)
+            {
+                math::conv_geometry g;
+                g.channels = 1 + gen.next() % 3;
+                g.kernel = 1 + gen.next() % 4;
+                g.stride = 1 + gen.next() % 2;
+                g.padding = gen.next() % g.kernel;
+                g.height = g.kernel + gen.next() % 9;
+                g.width = g.kernel + gen.next() % 9;
+
+                const size_t out_channels = 1 + gen.next() % 4;
+                const size_t batch = gen.dimension(4);
+                const size_t plane = g.height * g.width;
+                const std::string label = std::to_string(g.channels) + "x" + shape_name(g.height, g.width) + " kernel " +
+                    std::to_string(g.kernel) + " stride " + std::to_string(g.stride) + " padding " + std::to_string(g.padding) +
+                    ", batch " + std::to_string(batch);
+
+                const auto x = detail::random_matrix(gen, g.channels * plane, batch);
+                const auto cnhw = detail::to_cnhw(x, g.channels, plane);
+
+                convnet conv(static_cast<uint32_t>(g.channels), static_cast<uint32_t>(g.height), static_cast<uint32_t>(g.width),
+                    { layers::conv2d(static_cast<uint32_t>(out_channels), static_cast<uint32_t>(g.kernel), static_cast<uint32_t>(g.stride),
+                        static_cast<uint32_t>(g.padding), activation_kind::identity), layers::flatten() }, optim::optimizer_config(), gen.next());
+
+                model_snapshot params;
+                conv.snapshot(params);
+                gen.fill(params.layers[1]);
+                conv.restore(params);
+                conv.snapshot(params);
+
+                std::vector<double> scale;
+                const auto expected = reference::conv2d(cnhw, batch, g, reference::tensor(params.layers[0]), reference::tensor(params.layers[1]), scale);
+                const size_t out_plane = g.out_height() * g.out_width();
+
+                compare(detail::from_cnhw(expected.values, out_channels, out_plane, batch), conv.forward_batch(x),
+                    detail::from_cnhw(scale, out_channels, out_plane, batch), { 2, detail::dot_bound(g.patch() + 1), 0.0 }, label + " conv2d", result);
+
+                // pooling without padding, windows as the layer helpers build them
+                math::conv_geometry pg = g;
+                pg.padding = 0;
+
+                for (const bool max : { true, false })
+                {
+                    const auto spec = max ? layers::max_pool(static_cast<uint32_t>(g.kernel), static_cast<uint32_t>(g.stride))
+                        : layers::avg_pool(static_cast<uint32_t>(g.kernel), static_cast<uint32_t>(g.stride));
+
+                    convnet pool(static_cast<uint32_t>(g.channels), static_cast<uint32_t>(g.height), static_cast<uint32_t>(g.width),
+                        { spec, layers::flatten() }, optim::optimizer_config(), 0);
+
+                    const size_t pooled_plane = pg.out_height() * pg.out_width();
+                    const auto pooled = reference::pool(cnhw, batch, pg, max);
+
+                    // averages cancel like dot products, their error scale is the mean of |x|
+                    auto magnitudes = cnhw;
+                    for (double& v : magnitudes.values)
+                        v = std::abs(v);
+
+                    compare(detail::from_cnhw(pooled.values, g.channels, pooled_plane, batch), pool.forward_batch(x),
+                        detail::from_cnhw(reference::pool(magnitudes, batch, pg, false).values, g.channels, pooled_plane, batch),
+                        { max ? 0u : 2u, max ? 0.0 : detail::dot_bound(pg.kernel * pg.kernel), 0.0 }, label + (max ? " max_pool" : " avg_pool"), result);
+                }
+            }
+
+            return result;
+        }
+    }
+}
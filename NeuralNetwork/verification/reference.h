@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "../math/matrix.h"
+#include "../math/im2col.h"
+
+namespace ml
+{
+    namespace verify
+    {
+        // Scalar reference implementations in double precision: plain loops with the textbook
+        // semantics of the kernels they check and no blocking, vectorization or threading. They are
+        // kept out of the engine on purpose and must stay this simple.
+        namespace reference
+        {
+            // row-major m x n values in double
+            struct tensor
+            {
+                size_t m = 0;
+                size_t n = 0;
+                std::vector<double> values;
+
+                tensor() = default;
+                tensor(size_t m, size_t n) : m(m), n(n), values(m * n, 0.0) {}
+
+                explicit tensor(const math::matrix<float>& source) : m(source.size_m()), n(source.size_n()),
+                    values(source.data_ptr(), source.data_ptr() + source.size()) {}
+
+                double& operator()(size_t i, size_t j) { return values[i * n + j]; }
+                double operator()(size_t i, size_t j) const { return values[i * n + j]; }
+            };
+
+            inline double sigmoid(double x)
+            {
+                return 1.0 / (1.0 + std::exp(-x));
+            }
+
+            // a * b; scale, when given, receives sum_k |a_ik * b_kj|, the error scale of each element
+            inline tensor gemm(const tensor& a, const tensor& b, std::vector<double>* scale = nullptr)
+            {
+                tensor c(a.m, b.n);
+
+                if (scale)
+                    scale->assign(a.m * b.n, 0.0);
+
+                for (size_t i = 0; i < a.m; ++i)
+                {
+                    for (size_t j = 0; j < b.n; ++j)
+                    {
+                        double sum = 0.0;
+                        double magnitude = 0.0;
+
+                        for (size_t k = 0; k < a.n; ++k)
+                        {
+                            sum += a(i, k) * b(k, j);
+                            magnitude += std::abs(a(i, k) * b(k, j));
+                        }
+
+                        c(i, j) = sum;
+
+                        if (scale)
+                            (*scale)[i * b.n + j] = magnitude;
+                    }
+                }
+
+                return c;
+            }
+
+            inline tensor transpose(const tensor& a)
+            {
+                tensor t(a.n, a.m);
+
+                for (size_t i = 0; i < a.m; ++i)
+                {
+                    for (size_t j = 0; j < a.n; ++j)
+                        t(j, i) = a(i, j);
+                }
+
+                return t;
+            }
+
+            // Sigmoid perceptron without biases; returns the activations of every layer, inputs first
+            inline std::vector<tensor> forward(const std::vector<tensor>& weights, const tensor& inputs)
+            {
+                std::vector<tensor> activations{ inputs };
+
+                for (const auto& w : weights)
+                {
+                    tensor out = gemm(w, activations.back());
+
+                    for (double& v : out.values)
+                        v = sigmoid(v);
+
+                    activations.push_back(std::move(out));
+                }
+
+                return activations;
+            }
+
+            // 1/(2N) * sum of squared errors over the batch, the loss perceptron and convnet descend
+            inline double loss(const tensor& outputs, const tensor& targets)
+            {
+                double sum = 0.0;
+
+                for (size_t i = 0; i < outputs.values.size(); ++i)
+                {
+                    const double d = outputs.values[i] - targets.values[i];
+                    sum += d * d;
+                }
+
+                return sum / (2.0 * static_cast<double>(outputs.n));
+            }
+
+            // Gradients of loss with respect to every weight, by the chain rule written out per element
+            inline std::vector<tensor> gradients(const std::vector<tensor>& weights, const tensor& inputs, const tensor& targets)
+            {
+                const auto activations = forward(weights, inputs);
+                const double batch = static_cast<double>(inputs.n);
+                std::vector<tensor> grads(weights.size());
+
+                tensor delta(activations.back().m, activations.back().n);
+                for (size_t i = 0; i < delta.values.size(); ++i)
+                {
+                    const double y = activations.back().values[i];
+                    delta.values[i] = (y - targets.values[i]) * y * (1.0 - y);
+                }
+
+                for (size_t layer = weights.size(); layer-- > 0; )
+                {
+                    const tensor& x = activations[layer];
+                    tensor& g = grads[layer];
+                    g = tensor(weights[layer].m, weights[layer].n);
+
+                    for (size_t i = 0; i < g.m; ++i)
+                    {
+                        for (size_t j = 0; j < g.n; ++j)
+                        {
+                            double sum = 0.0;
+                            for (size_t s = 0; s < batch; ++s)
+                                sum += delta(i, s) * x(j, s);
+
+                            g(i, j) = sum / batch;
+                        }
+                    }
+
+                    if (layer == 0)
+                        break;
+
+                    tensor previous(x.m, x.n);
+                    for (size_t j = 0; j < x.m; ++j)
+                    {
+                        for (size_t s = 0; s < x.n; ++s)
+                        {
+                            double sum = 0.0;
+                            for (size_t i = 0; i < g.m; ++i)
+                                sum += weights[layer](i, j) * delta(i, s);
+
+                            previous(j, s) = sum * x(j, s) * (1.0 - x(j, s));
+                        }
+                    }
+
+                    delta = std::move(previous);
+                }
+
+                return grads;
+            }
+
+            // Direct convolution of a CNHW batch (one row per channel) with (out_channels x patch)
+            // weights plus bias; scale receives sum |w * x| + |b| per output
+            inline tensor conv2d(const tensor& input, size_t batch, const math::conv_geometry& g, const tensor& weights,
+                const tensor& bias, std::vector<double>& scale)
+            {
+                const size_t oh = g.out_height();
+                const size_t ow = g.out_width();
+                tensor out(weights.m, batch * oh * ow);
+                scale.assign(out.values.size(), 0.0);
+
+                for (size_t oc = 0; oc < weights.m; ++oc)
+                {
+                    for (size_t n = 0; n < batch; ++n)
+                    {
+                        for (size_t oy = 0; oy < oh; ++oy)
+                        {
+                            for (size_t ox = 0; ox < ow; ++ox)
+                            {
+                                double sum = bias.values[oc];
+                                double magnitude = std::abs(bias.values[oc]);
+
+                                for (size_t c = 0; c < g.channels; ++c)
+                                {
+                                    for (size_t ky = 0; ky < g.kernel; ++ky)
+                                    {
+                                        for (size_t kx = 0; kx < g.kernel; ++kx)
+                                        {
+                                            const ptrdiff_t y = static_cast<ptrdiff_t>(oy * g.stride + ky) - static_cast<ptrdiff_t>(g.padding);
+                                            const ptrdiff_t x = static_cast<ptrdiff_t>(ox * g.stride + kx) - static_cast<ptrdiff_t>(g.padding);
+
+                                            if (y < 0 || x < 0 || y >= static_cast<ptrdiff_t>(g.height) || x >= static_cast<ptrdiff_t>(g.width))
+                                                continue;
+
+                                            const double w = weights(oc, (c * g.kernel + ky) * g.kernel + kx);
+                                            const double v = input(c, (n * g.height + y) * g.width + x);
+                                            sum += w * v;
+                                            magnitude += std::abs(w * v);
+                                        }
+                                    }
+                                }
+
+                                const size_t column = (n * oh + oy) * ow + ox;
+                                out(oc, column) = sum;
+                                scale[oc * out.n + column] = magnitude;
+                            }
+                        }
+                    }
+                }
+
+                return out;
+            }
+
+            // Max or average (over the full window, padding included) pooling of a CNHW batch
+            inline tensor pool(const tensor& input, size_t batch, const math::conv_geometry& g, bool max)
+            {
+                const size_t oh = g.out_height();
+                const size_t ow = g.out_width();
+                tensor out(g.channels, batch * oh * ow);
+
+                for (size_t c = 0; c < g.channels; ++c)
+                {
+                    for (size_t n = 0; n < batch; ++n)
+                    {
+                        for (size_t oy = 0; oy < oh; ++oy)
+                        {
+                            for (size_t ox = 0; ox < ow; ++ox)
+                            {
+                                double best = -INFINITY;
+                                double sum = 0.0;
+
+                                for (size_t ky = 0; ky < g.kernel; ++ky)
+                                {
+                                    for (size_t kx = 0; kx < g.kernel; ++kx)
+                                    {
+                                        const ptrdiff_t y = static_cast<ptrdiff_t>(oy * g.stride + ky) - static_cast<ptrdiff_t>(g.padding);
+                                        const ptrdiff_t x = static_cast<ptrdiff_t>(ox * g.stride + kx) - static_cast<ptrdiff_t>(g.padding);
+
+                                        if (y < 0 || x < 0 || y >= static_cast<ptrdiff_t>(g.height) || x >= static_cast<ptrdiff_t>(g.width))
+                                            continue;
+
+                                        const double v = input(c, (n * g.height + y) * g.width + x);
+                                        best = std::max(best, v);
+                                        sum += v;
+                                    }
+                                }
+
+                                out(c, (n * oh + oy) * ow + ox) = max ? best : sum / static_cast<double>(g.kernel * g.kernel);
+                            }
+                        }
+                    }
+                }
+
+                return out;
+            }
+        }
+    }
+}
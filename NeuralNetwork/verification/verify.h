@@ -0,0 +1,28 @@
+#pragma once
+
+#include "differential.h"
+#include "kernel_checks.h"
+#include "gradient_check.h"
+
+namespace ml
+{
+    namespace verify
+    {
+        // Every check at config; report.passed() gates enabling a new fast path
+        inline report run_all(const verify_config& config = verify_config())
+        {
+            report all;
+            all.results.push_back(check_gemm(config));
+            all.results.push_back(check_transpose(config));
+            all.results.push_back(check_sigmoid(config));
+            all.results.push_back(check_sparse(config));
+            all.results.push_back(check_low_rank(config));
+            all.results.push_back(check_forward(config));
+            all.results.push_back(check_training(config));
+            all.results.push_back(check_convolution(config));
+            all.results.push_back(check_perceptron_gradients(config));
+            all.results.push_back(check_convnet_gradients(config));
+            return all;
+        }
+    }
+}
@@ -4,6 +4,7 @@ using System.Drawing;
 using System.Drawing.Drawing2D;
 using System.Drawing.Imaging;
 using System.IO;
+using System.Runtime.InteropServices;
 using System.Windows.Forms;
 using MlWrapper;
 
@@ -46,65 +47,34 @@ namespace NumberRecognizer
 
         private void RecognizeBtn_Click(object sender, EventArgs e)
         {
-            using (var bmp = new Bitmap(canvas.Width, canvas.Height))
+            using (var bmp = new Bitmap(canvas.Width, canvas.Height, PixelFormat.Format32bppArgb))
             {
                 using (var graphics = Graphics.FromImage(bmp))
                 {
-                    PointF centerOfMass = new PointF(0F, 0F);
-                    var pointsCount = 0;
-
-                    foreach (var line in lines)
-                    {
-                        foreach (var point in line)
-                        {
-                            centerOfMass.X += point.X;
-                            centerOfMass.Y += point.Y;
-                        }
-
-                        pointsCount += line.Count;
-                    }
-
-                    centerOfMass.X /= pointsCount;
-                    centerOfMass.Y /= pointsCount;
-
-                    var center = new PointF(canvas.Width / 2F, canvas.Height / 2F);
-                    var offset = new PointF(center.X - centerOfMass.X, center.Y - centerOfMass.Y);
-
-                    foreach (var line in lines)
-                    {
-                        for (int i = 0; i < line.Count; ++i)
-                        {
-                            var newX = (int)(line[i].X + offset.X);
-                            var newY = (int)(line[i].Y + offset.Y);
-                            line[i] = new Point(newX, newY);
-                        }
-                    }
-
                     graphics.Clear(Color.White);
 
                     foreach (var line in lines)
                     {
                         graphics.DrawLines(currentPen, line.ToArray());
                     }
+                }
 
-                    var tmp = ResizeImage(bmp, 28, 28);
-                    var pixels = new List<float>();
-
-                    for (var y = 0; y < tmp.Height; ++y)
-                    {
-                        for (var x = 0; x < tmp.Width; ++x)
-                        {
-                            var pixelColor = tmp.GetPixel(x, y);
-                            var pixelGrey = (pixelColor.R + pixelColor.G + pixelColor.B) / 3F;
-                            pixelGrey = (((255F - pixelGrey) / 255F) * 0.99F) + 0.01F;
-                            pixels.Add(pixelGrey);
-                        }
-                    }
+                // cropping, centering, downscaling to 28x28 and normalization happen natively
+                var data = bmp.LockBits(new Rectangle(0, 0, bmp.Width, bmp.Height), ImageLockMode.ReadOnly, PixelFormat.Format32bppArgb);
+                var pixels = new byte[data.Stride * data.Height];
 
-                    var answer = perceptron.Forward(pixels);
-                    OutputLabel.Text = $"With a probability of {(answer.First * 100):0.#}% this is the number {answer.Second}";
+                try
+                {
+                    Marshal.Copy(data.Scan0, pixels, 0, pixels.Length);
+                }
+                finally
+                {
+                    bmp.UnlockBits(data);
                 }
-            }   
+
+                var answer = perceptron.Recognize(pixels, bmp.Width, bmp.Height, data.Stride, 4);
+                OutputLabel.Text = $"With a probability of {(answer.First * 100):0.#}% this is the number {answer.Second}";
+            }
         }
 
         private void ClearBtn_Click(object sender, EventArgs e)
@@ -151,31 +121,6 @@ namespace NumberRecognizer
             currentPen.Width = (float)((NumericUpDown)sender).Value;
         }
 
-        private static Bitmap ResizeImage(Image image, int width, int height)
-        {
-            var destRect = new Rectangle(0, 0, width, height);
-            var destImage = new Bitmap(width, height);
-
-            destImage.SetResolution(image.HorizontalResolution, image.VerticalResolution);
-
-            using (var graphics = Graphics.FromImage(destImage))
-            {
-                graphics.CompositingMode    = CompositingMode.SourceCopy;
-                graphics.CompositingQuality = CompositingQuality.HighQuality;
-                graphics.InterpolationMode  = InterpolationMode.HighQualityBicubic;
-                graphics.SmoothingMode      = SmoothingMode.HighQuality;
-                graphics.PixelOffsetMode    = PixelOffsetMode.HighQuality;
-
-                using (var wrapMode = new ImageAttributes())
-                {
-                    wrapMode.SetWrapMode(WrapMode.TileFlipXY);
-                    graphics.DrawImage(image, destRect, 0, 0, image.Width, image.Height, GraphicsUnit.Pixel, wrapMode);
-                }
-            }
-
-            return destImage;
-        }
-
         private void MainForm_Load(object sender, EventArgs e)
         {
             var tempFolder = Path.GetTempPath();
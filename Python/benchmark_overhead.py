@@ -0,0 +1,48 @@
+"""Per-call cost of the bindings for batches of 1 and 1024 samples.
+
+The 1 -> 1 model does almost no arithmetic, so its time per call is the binding overhead
+(argument parsing, buffer acquisition, GIL release, result wrapping). The 784 -> 150 -> 10
+model shows how that overhead compares with real work.
+"""
+
+import time
+
+import numpy as np
+
+import perceptron
+
+
+def per_call(fn, repeats):
+    fn()
+    start = time.perf_counter()
+    for _ in range(repeats):
+        fn()
+    return (time.perf_counter() - start) / repeats
+
+
+def main():
+    rng = np.random.default_rng(42)
+    models = {
+        "1 -> 1": perceptron.Perceptron([1, 1]),
+        "784 -> 150 -> 10": perceptron.Perceptron([784, 150, 10]),
+    }
+
+    print(f"{'model':<20}{'batch':>8}{'dtype':>10}{'us/call':>12}{'us/sample':>12}")
+
+    for name, model in models.items():
+        width = model.shape[0]
+
+        for batch in (1, 1024):
+            inputs = {
+                "float32": rng.random((batch, width), dtype=np.float32),
+                "uint8": rng.integers(0, 256, (batch, width), dtype=np.uint8),
+            }
+
+            for dtype, samples in inputs.items():
+                repeats = 20000 if batch == 1 or width == 1 else 50
+                seconds = per_call(lambda: model.forward_batch(samples), repeats)
+                print(f"{name:<20}{batch:>8}{dtype:>10}{seconds * 1e6:>12.2f}{seconds * 1e6 / batch:>12.3f}")
+
+
+if __name__ == "__main__":
+    main()
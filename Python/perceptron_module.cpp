@@ -0,0 +1,652 @@
+// CPython bindings for ml::perceptron.
+//
+// Inputs are taken through the buffer protocol, so NumPy arrays (and anything else exporting a
+// buffer) of float32 or uint8 with shape (n, inputs) are read in place; rows may be strided but
+// each row has to be contiguous. Results come back as NumPy arrays viewing engine-owned memory.
+// The GIL is released while the engine computes; forward passes on one model may run concurrently,
+// training, loading and saving take the model exclusively.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <shared_mutex>
+
+#include "../NeuralNetwork/ml/perceptron.h"
+#include "../NeuralNetwork/utils/mnist/mnist.h"
+
+namespace
+{
+    // --- result buffers -------------------------------------------------------------------------
+
+    // Owns an engine matrix and exports it as a 2-D float32 buffer. Engine results hold one sample
+    // per column, so the (samples, outputs) view uses strides instead of a transposing copy.
+    struct ResultObject
+    {
+        PyObject_HEAD
+        ml::math::matrix<float>* values;
+        Py_ssize_t shape[2];
+        Py_ssize_t strides[2];
+    };
+
+    void result_dealloc(ResultObject* self)
+    {
+        delete self->values;
+        Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+    }
+
+    int result_getbuffer(ResultObject* self, Py_buffer* view, int flags)
+    {
+        if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE)
+        {
+            PyErr_SetString(PyExc_BufferError, "engine results are read-only");
+            return -1;
+        }
+
+        if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES)
+        {
+            PyErr_SetString(PyExc_BufferError, "engine results are strided");
+            return -1;
+        }
+
+        view->obj = reinterpret_cast<PyObject*>(self);
+        Py_INCREF(self);
+
+        view->buf = self->values->data_ptr();
+        view->len = static_cast<Py_ssize_t>(self->values->size() * sizeof(float));
+        view->readonly = 1;
+        view->itemsize = sizeof(float);
+        view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>("f") : nullptr;
+        view->ndim = 2;
+        view->shape = self->shape;
+        view->strides = self->strides;
+        view->suboffsets = nullptr;
+        view->internal = nullptr;
+        return 0;
+    }
+
+    PyBufferProcs result_buffer_procs = { reinterpret_cast<getbufferproc>(result_getbuffer), nullptr };
+
+    PyTypeObject ResultType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+    // Wraps values (outputs x samples) as a (samples, outputs) array; a plain buffer object without NumPy
+    PyObject* wrap_result(ml::math::matrix<float>&& values)
+    {
+        ResultObject* result = PyObject_New(ResultObject, &ResultType);
+        if (!result)
+            return nullptr;
+
+        const Py_ssize_t outputs = static_cast<Py_ssize_t>(values.size_m());
+        const Py_ssize_t samples = static_cast<Py_ssize_t>(values.size_n());
+
+        result->values = new ml::math::matrix<float>(std::move(values));
+        result->shape[0] = samples;
+        result->shape[1] = outputs;
+        result->strides[0] = sizeof(float);
+        result->strides[1] = samples * static_cast<Py_ssize_t>(sizeof(float));
+
+        PyObject* numpy = PyImport_ImportModule("numpy");
+        if (!numpy)
+        {
+            PyErr_Clear();
+            return reinterpret_cast<PyObject*>(result);
+        }
+
+        PyObject* array = PyObject_CallMethod(numpy, "asarray", "O", result);
+        Py_DECREF(numpy);
+        Py_DECREF(result);
+        return array;
+    }
+
+    // --- input buffers --------------------------------------------------------------------------
+
+    enum class element { f32, u8 };
+
+    // A 2-D (or 1-D, single sample) float32/uint8 buffer with contiguous rows
+    struct sample_view
+    {
+        Py_buffer buffer{};
+        bool acquired = false;
+
+        element type = element::f32;
+        size_t count = 0;
+        size_t width = 0;
+        size_t stride = 0;
+
+        ~sample_view()
+        {
+            if (acquired)
+                PyBuffer_Release(&buffer);
+        }
+
+        bool acquire(PyObject* object, size_t expected_width)
+        {
+            if (PyObject_GetBuffer(object, &buffer, PyBUF_STRIDES | PyBUF_FORMAT) != 0)
+                return false;
+
+            acquired = true;
+
+            const std::string format = buffer.format ? buffer.format : "B";
+            const char code = format.empty() ? 'B' : format.back();
+            const bool native = format.size() == 1 || format.front() == '=' || format.front() == '<' || format.front() == '@';
+
+            if (native && code == 'f' && buffer.itemsize == 4)
+                type = element::f32;
+            else if (native && code == 'B' && buffer.itemsize == 1)
+                type = element::u8;
+            else
+                return fail("inputs must be float32 or uint8");
+
+            if (buffer.ndim == 1)
+            {
+                count = 1;
+                width = static_cast<size_t>(buffer.shape[0]);
+                stride = width;
+
+                if (buffer.strides && buffer.strides[0] != buffer.itemsize)
+                    return fail("a single sample must be contiguous");
+            }
+            else if (buffer.ndim == 2)
+            {
+                count = static_cast<size_t>(buffer.shape[0]);
+                width = static_cast<size_t>(buffer.shape[1]);
+
+                if (buffer.strides[1] != buffer.itemsize || buffer.strides[0] < 0 || buffer.strides[0] % buffer.itemsize != 0)
+                    return fail("each sample row must be contiguous");
+
+                stride = static_cast<size_t>(buffer.strides[0] / buffer.itemsize);
+            }
+            else
+            {
+                return fail("inputs must have shape (samples, inputs)");
+            }
+
+            if (width != expected_width)
+                return fail("expected " + std::to_string(expected_width) + " inputs per sample, got " + std::to_string(width));
+
+            return true;
+        }
+
+        float value(size_t sample, size_t index) const
+        {
+            if (type == element::u8)
+                return ml::mnist::normalize_pixel(static_cast<const ml::mnist::byte*>(buffer.buf)[sample * stride + index]);
+
+            return static_cast<const float*>(buffer.buf)[sample * stride + index];
+        }
+
+        bool fail(const std::string& message)
+        {
+            PyErr_SetString(PyExc_ValueError, message.c_str());
+            return false;
+        }
+    };
+
+    // Class labels from any integer buffer (uint8, int32, int64, ...), each below outputs
+    bool read_labels(PyObject* object, size_t count, size_t outputs, std::vector<size_t>& labels)
+    {
+        Py_buffer buffer;
+        if (PyObject_GetBuffer(object, &buffer, PyBUF_STRIDES | PyBUF_FORMAT) != 0)
+            return false;
+
+        bool ok = buffer.ndim == 1 && static_cast<size_t>(buffer.shape[0]) == count;
+        const char code = buffer.format ? buffer.format[std::strlen(buffer.format) - 1] : 'B';
+
+        if (!ok)
+            PyErr_SetString(PyExc_ValueError, "labels must have shape (samples,)");
+
+        labels.resize(count);
+
+        for (size_t i = 0; ok && i < count; ++i)
+        {
+            const char* item = static_cast<const char*>(buffer.buf) + i * buffer.strides[0];
+            long long value = 0;
+
+            switch (code)
+            {
+            case 'B': value = *reinterpret_cast<const unsigned char*>(item); break;
+            case 'b': value = *reinterpret_cast<const signed char*>(item); break;
+            case 'i': value = *reinterpret_cast<const int*>(item); break;
+            case 'I': value = *reinterpret_cast<const unsigned int*>(item); break;
+            case 'l': value = *reinterpret_cast<const long*>(item); break;
+            case 'q': value = *reinterpret_cast<const long long*>(item); break;
+            case 'L': value = static_cast<long long>(*reinterpret_cast<const unsigned long*>(item)); break;
+            case 'Q': value = static_cast<long long>(*reinterpret_cast<const unsigned long long*>(item)); break;
+            default:
+                PyErr_SetString(PyExc_ValueError, "labels must be integers");
+                ok = false;
+                continue;
+            }
+
+            if (value < 0 || static_cast<unsigned long long>(value) >= outputs)
+            {
+                PyErr_SetString(PyExc_ValueError, ("labels must be below the model's " + std::to_string(outputs) + " outputs").c_str());
+                ok = false;
+            }
+
+            labels[i] = static_cast<size_t>(value);
+        }
+
+        PyBuffer_Release(&buffer);
+        return ok;
+    }
+
+    // Training needs the batch as columns; this is the one copy on the training path
+    void pack_batch(const sample_view& view, const std::vector<size_t>& labels, size_t outputs, ml::math::matrix<float>& inputs, ml::math::matrix<float>& targets)
+    {
+        inputs = ml::math::matrix<float>(view.width, view.count);
+        targets = ml::math::matrix<float>(outputs, view.count);
+
+        float* in = inputs.data_ptr();
+        float* out = targets.data_ptr();
+        std::fill(out, out + targets.size(), 0.01f);
+
+        for (size_t s = 0; s < view.count; ++s)
+        {
+            for (size_t k = 0; k < view.width; ++k)
+                in[k * view.count + s] = view.value(s, k);
+
+            out[labels[s] * view.count + s] = 0.99f;
+        }
+    }
+
+    // --- Perceptron -----------------------------------------------------------------------------
+
+    struct PerceptronObject
+    {
+        PyObject_HEAD
+        ml::perceptron* model;
+        std::shared_mutex* lock;
+    };
+
+    PyObject* perceptron_new(PyTypeObject* type, PyObject*, PyObject*)
+    {
+        PerceptronObject* self = reinterpret_cast<PerceptronObject*>(type->tp_alloc(type, 0));
+        if (!self)
+            return nullptr;
+
+        self->model = new ml::perceptron();
+        self->lock = new std::shared_mutex();
+        return reinterpret_cast<PyObject*>(self);
+    }
+
+    int perceptron_init(PerceptronObject* self, PyObject* args, PyObject* kwargs)
+    {
+        static const char* keywords[] = { "layers", "learning_rate", "seed", nullptr };
+        PyObject* layers = nullptr;
+        float learning_rate = 0.3f;
+        PyObject* seed_value = nullptr;
+
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OfO", const_cast<char**>(keywords), &layers, &learning_rate, &seed_value))
+            return -1;
+
+        uint64_t seed = 0;
+
+        if (seed_value && seed_value != Py_None)
+        {
+            seed = PyLong_AsUnsignedLongLong(seed_value);
+            if (PyErr_Occurred())
+                return -1;
+        }
+        else
+        {
+            seed = ml::utils::random_seed();
+        }
+
+        if (!layers || layers == Py_None)
+            return 0;
+
+        PyObject* sequence = PySequence_Fast(layers, "layers must be a sequence of sizes");
+        if (!sequence)
+            return -1;
+
+        std::vector<size_t> sizes;
+        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(sequence); ++i)
+        {
+            const size_t size = PyLong_AsSize_t(PySequence_Fast_GET_ITEM(sequence, i));
+            if (PyErr_Occurred())
+            {
+                Py_DECREF(sequence);
+                return -1;
+            }
+
+            sizes.push_back(size);
+        }
+
+        Py_DECREF(sequence);
+
+        if (sizes.size() < 2)
+        {
+            PyErr_SetString(PyExc_ValueError, "layers needs at least an input and an output size");
+            return -1;
+        }
+
+        ml::optim::optimizer_config config;
+        config.learning_rate = learning_rate;
+
+        ml::perceptron built(sizes, config, seed);
+
+        std::unique_lock<std::shared_mutex> guard(*self->lock);
+        *self->model = std::move(built);
+        return 0;
+    }
+
+    void perceptron_dealloc(PerceptronObject* self)
+    {
+        delete self->model;
+        delete self->lock;
+        Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+    }
+
+    struct model_shape
+    {
+        size_t inputs = 0;
+        size_t outputs = 0;
+    };
+
+    // Called with self->lock held; zeros when the model has no layers
+    model_shape shape_of(const PerceptronObject* self)
+    {
+        const ml::perceptron& model = *self->model;
+
+        if (model.layer_count() == 0)
+            return {};
+
+        return { model.layer(0).size_n(), model.layer(model.layer_count() - 1).size_m() };
+    }
+
+    // Inputs per sample and outputs of the current model, zeros with a RuntimeError set when it has no
+    // layers. A concurrent load() can replace the model once the lock is released, so the kernels
+    // check the shape again with fits_shape under the lock they run under.
+    model_shape current_shape(const PerceptronObject* self)
+    {
+        std::shared_lock<std::shared_mutex> guard(*self->lock);
+        const model_shape shape = shape_of(self);
+
+        if (shape.inputs == 0)
+            PyErr_SetString(PyExc_RuntimeError, "model has no layers; load one or pass layers to the constructor");
+
+        return shape;
+    }
+
+    // Called with self->lock held
+    bool fits_shape(const PerceptronObject* self, const model_shape& shape)
+    {
+        const model_shape current = shape_of(self);
+        return current.inputs == shape.inputs && current.outputs == shape.outputs;
+    }
+
+    PyObject* replaced_model_error()
+    {
+        PyErr_SetString(PyExc_ValueError, "the model was replaced by one with a different shape");
+        return nullptr;
+    }
+
+    PyObject* perceptron_load(PerceptronObject* self, PyObject* args)
+    {
+        const char* path = nullptr;
+        if (!PyArg_ParseTuple(args, "s", &path))
+            return nullptr;
+
+        bool ok = false;
+        Py_BEGIN_ALLOW_THREADS
+        {
+            std::unique_lock<std::shared_mutex> guard(*self->lock);
+            ok = self->model->load(path);
+        }
+        Py_END_ALLOW_THREADS
+
+        if (!ok)
+            return PyErr_Format(PyExc_IOError, "could not load model: %s", path);
+
+        Py_RETURN_NONE;
+    }
+
+    PyObject* perceptron_save(PerceptronObject* self, PyObject* args)
+    {
+        const char* path = nullptr;
+        if (!PyArg_ParseTuple(args, "s", &path))
+            return nullptr;
+
+        bool ok = false;
+        Py_BEGIN_ALLOW_THREADS
+        {
+            std::shared_lock<std::shared_mutex> guard(*self->lock);
+            ok = self->model->save(path);
+        }
+        Py_END_ALLOW_THREADS
+
+        if (!ok)
+            return PyErr_Format(PyExc_IOError, "could not save model: %s", path);
+
+        Py_RETURN_NONE;
+    }
+
+    PyObject* perceptron_forward_batch(PerceptronObject* self, PyObject* args)
+    {
+        PyObject* samples = nullptr;
+        if (!PyArg_ParseTuple(args, "O", &samples))
+            return nullptr;
+
+        const model_shape shape = current_shape(self);
+        sample_view view;
+        if (shape.inputs == 0 || !view.acquire(samples, shape.inputs))
+            return nullptr;
+
+        ml::math::matrix<float> outputs;
+        bool fits = false;
+
+        Py_BEGIN_ALLOW_THREADS
+        {
+            std::shared_lock<std::shared_mutex> guard(*self->lock);
+            fits = fits_shape(self, shape);
+
+            if (fits && view.type == element::f32)
+            {
+                outputs = self->model->forward_rows(static_cast<const float*>(view.buffer.buf), view.count, view.stride,
+                    [](float value) { return value; });
+            }
+            else if (fits)
+            {
+                outputs = self->model->forward_rows(static_cast<const ml::mnist::byte*>(view.buffer.buf), view.count, view.stride,
+                    [](ml::mnist::byte pixel) { return ml::mnist::normalize_pixel(pixel); });
+            }
+        }
+        Py_END_ALLOW_THREADS
+
+        if (!fits)
+            return replaced_model_error();
+
+        return wrap_result(std::move(outputs));
+    }
+
+    PyObject* perceptron_train_batch(PerceptronObject* self, PyObject* args)
+    {
+        PyObject* samples = nullptr;
+        PyObject* labels = nullptr;
+        if (!PyArg_ParseTuple(args, "OO", &samples, &labels))
+            return nullptr;
+
+        const model_shape shape = current_shape(self);
+        sample_view view;
+        std::vector<size_t> classes;
+        if (shape.inputs == 0 || !view.acquire(samples, shape.inputs) || !read_labels(labels, view.count, shape.outputs, classes))
+            return nullptr;
+
+        bool fits = false;
+
+        Py_BEGIN_ALLOW_THREADS
+        {
+            ml::math::matrix<float> inputs;
+            ml::math::matrix<float> targets;
+            pack_batch(view, classes, shape.outputs, inputs, targets);
+
+            std::unique_lock<std::shared_mutex> guard(*self->lock);
+            fits = fits_shape(self, shape);
+
+            if (fits)
+                self->model->train_batch(inputs, targets);
+        }
+        Py_END_ALLOW_THREADS
+
+        if (!fits)
+            return replaced_model_error();
+
+        Py_RETURN_NONE;
+    }
+
+    // (mean squared error, accuracy) over the samples, with the trainer's 0.99/0.01 targets
+    PyObject* perceptron_evaluate(PerceptronObject* self, PyObject* args)
+    {
+        PyObject* samples = nullptr;
+        PyObject* labels = nullptr;
+        if (!PyArg_ParseTuple(args, "OO", &samples, &labels))
+            return nullptr;
+
+        const model_shape shape = current_shape(self);
+        sample_view view;
+        std::vector<size_t> classes;
+        if (shape.inputs == 0 || !view.acquire(samples, shape.inputs) || !read_labels(labels, view.count, shape.outputs, classes))
+            return nullptr;
+
+        double squared_error = 0.0;
+        size_t right_answers = 0;
+        bool fits = false;
+
+        Py_BEGIN_ALLOW_THREADS
+        {
+            ml::math::matrix<float> outputs;
+            {
+                std::shared_lock<std::shared_mutex> guard(*self->lock);
+                fits = fits_shape(self, shape);
+
+                if (fits && view.type == element::f32)
+                    outputs = self->model->forward_rows(static_cast<const float*>(view.buffer.buf), view.count, view.stride, [](float value) { return value; });
+                else if (fits)
+                    outputs = self->model->forward_rows(static_cast<const ml::mnist::byte*>(view.buffer.buf), view.count, view.stride,
+                        [](ml::mnist::byte pixel) { return ml::mnist::normalize_pixel(pixel); });
+            }
+
+            const float* out = outputs.data_ptr();
+            const size_t count = view.count;
+
+            for (size_t col = 0; fits && col < count; ++col)
+            {
+                size_t predicted = 0;
+
+                for (size_t row = 0; row < outputs.size_m(); ++row)
+                {
+                    const float diff = out[row * count + col] - (row == classes[col] ? 0.99f : 0.01f);
+                    squared_error += diff * diff;
+
+                    if (out[row * count + col] > out[predicted * count + col])
+                        predicted = row;
+                }
+
+                if (predicted == classes[col])
+                    ++right_answers;
+            }
+        }
+        Py_END_ALLOW_THREADS
+
+        if (!fits)
+            return replaced_model_error();
+
+        const double samples_count = view.count == 0 ? 1.0 : static_cast<double>(view.count);
+        return Py_BuildValue("(dd)", squared_error / samples_count, right_answers / samples_count);
+    }
+
+    PyObject* perceptron_get_shape(PerceptronObject* self, void*)
+    {
+        std::shared_lock<std::shared_mutex> guard(*self->lock);
+
+        const size_t layers = self->model->layer_count();
+
+        PyObject* sizes = PyList_New(layers == 0 ? 0 : static_cast<Py_ssize_t>(layers + 1));
+        if (!sizes || layers == 0)
+            return sizes;
+
+        for (size_t i = 0; i <= layers; ++i)
+        {
+            PyObject* size = PyLong_FromSize_t(i == 0 ? self->model->layer(0).size_n() : self->model->layer(i - 1).size_m());
+
+            if (!size)
+            {
+                Py_DECREF(sizes);
+                return nullptr;
+            }
+
+            // steals the reference
+            PyList_SET_ITEM(sizes, static_cast<Py_ssize_t>(i), size);
+        }
+
+        return sizes;
+    }
+
+    PyObject* perceptron_get_seed(PerceptronObject* self, void*)
+    {
+        std::shared_lock<std::shared_mutex> guard(*self->lock);
+        return PyLong_FromUnsignedLongLong(self->model->seed());
+    }
+
+    PyMethodDef perceptron_methods[] = {
+        { "load", reinterpret_cast<PyCFunction>(perceptron_load), METH_VARARGS, "load(path): replaces the model with the one saved at path" },
+        { "save", reinterpret_cast<PyCFunction>(perceptron_save), METH_VARARGS, "save(path): writes the model atomically" },
+        { "forward_batch", reinterpret_cast<PyCFunction>(perceptron_forward_batch), METH_VARARGS,
+            "forward_batch(samples) -> (n, outputs) float32 array; samples is (n, inputs) float32 or uint8 pixels" },
+        { "train_batch", reinterpret_cast<PyCFunction>(perceptron_train_batch), METH_VARARGS,
+            "train_batch(samples, labels): one optimizer step on the batch" },
+        { "evaluate", reinterpret_cast<PyCFunction>(perceptron_evaluate), METH_VARARGS,
+            "evaluate(samples, labels) -> (loss, accuracy)" },
+        { nullptr, nullptr, 0, nullptr }
+    };
+
+    PyGetSetDef perceptron_getset[] = {
+        { "shape", reinterpret_cast<getter>(perceptron_get_shape), nullptr, "layer sizes, inputs first", nullptr },
+        { "seed", reinterpret_cast<getter>(perceptron_get_seed), nullptr, "seed of the initial weights, 0 if unknown", nullptr },
+        { nullptr, nullptr, nullptr, nullptr, nullptr }
+    };
+
+    PyTypeObject PerceptronType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+    PyModuleDef perceptron_module = { PyModuleDef_HEAD_INIT, "perceptron", "Bindings for the ml::perceptron engine", -1 };
+}
+
+PyMODINIT_FUNC PyInit_perceptron(void)
+{
+    ResultType.tp_name = "perceptron.Result";
+    ResultType.tp_basicsize = sizeof(ResultObject);
+    ResultType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ResultType.tp_dealloc = reinterpret_cast<destructor>(result_dealloc);
+    ResultType.tp_as_buffer = &result_buffer_procs;
+    ResultType.tp_doc = "Engine-owned float32 result exported through the buffer protocol";
+
+    PerceptronType.tp_name = "perceptron.Perceptron";
+    PerceptronType.tp_basicsize = sizeof(PerceptronObject);
+    PerceptronType.tp_flags = Py_TPFLAGS_DEFAULT;
+    PerceptronType.tp_new = perceptron_new;
+    PerceptronType.tp_init = reinterpret_cast<initproc>(perceptron_init);
+    PerceptronType.tp_dealloc = reinterpret_cast<destructor>(perceptron_dealloc);
+    PerceptronType.tp_methods = perceptron_methods;
+    PerceptronType.tp_getset = perceptron_getset;
+    PerceptronType.tp_doc = "Perceptron(layers=None, learning_rate=0.3, seed=None)";
+
+    if (PyType_Ready(&ResultType) < 0 || PyType_Ready(&PerceptronType) < 0)
+        return nullptr;
+
+    PyObject* module = PyModule_Create(&perceptron_module);
+    if (!module)
+        return nullptr;
+
+    Py_INCREF(&PerceptronType);
+    if (PyModule_AddObject(module, "Perceptron", reinterpret_cast<PyObject*>(&PerceptronType)) < 0)
+    {
+        Py_DECREF(&PerceptronType);
+        Py_DECREF(module);
+        return nullptr;
+    }
+
+    return module;
+}
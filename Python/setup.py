@@ -0,0 +1,24 @@
+# Builds the `perceptron` extension module:  python setup.py build_ext --inplace
+import sys
+
+from setuptools import Extension, setup
+
+if sys.platform == "win32":
+    compile_args = ["/std:c++latest", "/O2", "/EHsc"]
+else:
+    compile_args = ["-std=c++17", "-O2", "-pthread"]
+
+setup(
+    name="perceptron",
+    version="1.0",
+    description="Python bindings for the ml::perceptron engine",
+    ext_modules=[
+        Extension(
+            "perceptron",
+            sources=["perceptron_module.cpp"],
+            extra_compile_args=compile_args,
+            extra_link_args=[] if sys.platform == "win32" else ["-pthread"],
+            language="c++",
+        )
+    ],
+)
@@ -0,0 +1,51 @@
+// Runs the differential checks of NeuralNetwork/verification against the float64 references and
+// exits with 1 when any kernel is out of bounds, so a build can gate on it.
+//   verification [--seed N] [--cases N] [--max-dim N]
+
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "../NeuralNetwork/verification/verify.h"
+
+namespace
+{
+    bool parse_size(const char* text, uint64_t& value)
+    {
+        char* end = nullptr;
+        value = std::strtoull(text, &end, 10);
+        return end != text && *end == '\0';
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    ml::verify::verify_config config;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        uint64_t value = 0;
+        const bool has_value = i + 1 < argc && parse_size(argv[i + 1], value);
+
+        if (std::strcmp(argv[i], "--seed") == 0 && has_value)
+            config.seed = value;
+        else if (std::strcmp(argv[i], "--cases") == 0 && has_value && value != 0)
+            config.cases = static_cast<size_t>(value);
+        else if (std::strcmp(argv[i], "--max-dim") == 0 && has_value && value != 0)
+            config.max_dim = static_cast<size_t>(value);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--seed N] [--cases N] [--max-dim N]\n";
+            return 2;
+        }
+
+        ++i;
+    }
+
+    const ml::verify::report report = ml::verify::run_all(config);
+    report.print();
+
+    std::cout << (report.passed() ? "all checks passed" : "verification FAILED") << " (seed " << config.seed << ")\n";
+    return report.passed() ? 0 : 1;
+}
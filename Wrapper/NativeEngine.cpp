@@ -0,0 +1,113 @@
+#include "NativeEngine.h"
+
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "../NeuralNetwork/ml/model_registry.h"
+#include "../NeuralNetwork/ml/online_learner.h"
+#include "../NeuralNetwork/image/preprocess.h"
+
+namespace MlWrapper
+{
+    namespace
+    {
+        const std::string model_name = "digits";
+
+        // Empty if the dimensions do not describe an image; pixels must hold (height - 1) * stride +
+        // width * channels bytes, which only the caller can check
+        std::vector<float> preprocess(const unsigned char* pixels, size_t width, size_t height, size_t stride, size_t channels)
+        {
+            if (!pixels || width == 0 || height == 0 || (channels != 1 && channels != 3 && channels != 4) || stride / channels < width)
+                return {};
+
+            ml::image::image_view view;
+            view.pixels = pixels;
+            view.width = width;
+            view.height = height;
+            view.stride = stride;
+            view.channels = channels;
+
+            ml::image::preprocess_config config;
+            config.invert = true;
+
+            std::vector<float> input(config.output_size * config.output_size);
+            ml::image::preprocess(view, config, input.data());
+
+            return input;
+        }
+    }
+
+    // Load publishes a new version while recognitions on other threads finish on the previous one;
+    // corrections fine-tune a shadow copy that is published the same way
+    struct NativeEngine::Impl
+    {
+        ml::model_registry models;
+
+        // started by the first correction; declared after models so it stops before they go
+        std::mutex learner_mutex;
+        std::unique_ptr<ml::online_learner> learner;
+    };
+
+    NativeEngine::NativeEngine() : impl(std::make_unique<Impl>())
+    {
+        // kernel parameters measured on this host by the autotuner, if any
+        ml::tuning_cache tuning;
+        if (tuning.load(ml::tuning_cache::default_path()))
+            impl->models.set_tuning(tuning);
+    }
+
+    NativeEngine::~NativeEngine() = default;
+
+    bool NativeEngine::Load(const std::string& path)
+    {
+        return impl->models.load(model_name, path).has_value();
+    }
+
+    std::pair<float, int> NativeEngine::Forward(const float* input, size_t size) const
+    {
+        const auto current = impl->models.acquire(model_name);
+
+        // forward_rows reads a whole sample, so a shorter input must not reach it
+        if (!current || current.model().layer_count() == 0 || size != current.model().layer(0).size_n())
+            return { 0.f, -1 };
+
+        auto out = current.model().forward_rows(input, 1, size, [](float value) { return value; });
+        if (out.size() == 0)
+            return { 0.f, -1 };
+
+        auto result = std::max_element(out.begin(), out.end());
+
+        return { *result, static_cast<int>(std::distance(out.begin(), result)) };
+    }
+
+    std::pair<float, int> NativeEngine::Recognize(const unsigned char* pixels, size_t width, size_t height, size_t stride, size_t channels) const
+    {
+        const auto input = preprocess(pixels, width, height, stride, channels);
+        return Forward(input.data(), input.size());
+    }
+
+    bool NativeEngine::Correct(const unsigned char* pixels, size_t width, size_t height, size_t stride, size_t channels, int label)
+    {
+        const auto input = preprocess(pixels, width, height, stride, channels);
+
+        if (label < 0 || input.empty())
+            return false;
+
+        {
+            std::lock_guard<std::mutex> lock(impl->learner_mutex);
+
+            if (!impl->learner)
+            {
+                auto learner = std::make_unique<ml::online_learner>(impl->models, model_name);
+                if (!learner->start())
+                    return false;
+
+                impl->learner = std::move(learner);
+            }
+        }
+
+        return impl->learner->submit(input.data(), input.size(), static_cast<size_t>(label));
+    }
+}
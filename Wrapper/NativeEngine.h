@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace MlWrapper
+{
+    // Engine calls compiled as native code (NativeEngine.cpp is built without /clr): the engine
+    // uses <thread> and <mutex>, which cannot be included in managed translation units
+    class NativeEngine
+    {
+    public:
+        NativeEngine();
+        ~NativeEngine();
+
+        bool Load(const std::string& path);
+
+        // best probability and its label; label -1 while no model is loaded or if size is not its input size
+        std::pair<float, int> Forward(const float* input, size_t size) const;
+
+        // label -1 also if width, height, stride or channels do not describe an image
+        std::pair<float, int> Recognize(const unsigned char* pixels, size_t width, size_t height, size_t stride, size_t channels) const;
+
+        // Queues the drawing with its correct label for background fine-tuning of the loaded model;
+        // the improved weights replace it between recognitions. False while no model is loaded or for
+        // an image Recognize would reject.
+        bool Correct(const unsigned char* pixels, size_t width, size_t height, size_t stride, size_t channels, int label);
+
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> impl;
+    };
+}
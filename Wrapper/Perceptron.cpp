@@ -3,23 +3,54 @@
 
 namespace MlWrapper
 {
-    Perceptron::Perceptron() : ManagedObject(new ml::perceptron())
+    Perceptron::Perceptron() : ManagedObject(new NativeEngine())
     {}
 
     void Perceptron::Load(String^ pathToModel)
     {
         auto filePath = ManagedStrToUnmanagedStr(pathToModel);
-        m_Instance->load(filePath);
+        m_Instance->Load(filePath);
     }
 
     Pair<float, int>^ Perceptron::Forward(List<float>^ input)
     {
         auto vector = ListToVector(input);
-        auto out = m_Instance->forward(vector);
-        auto result = std::max_element(out.begin(), out.end());
-        auto predict_label = static_cast<int>(std::distance(out.begin(), result));
-        
-        return gcnew Pair<float, int>(*result, predict_label);
+        auto answer = m_Instance->Forward(vector.data(), vector.size());
+
+        return gcnew Pair<float, int>(answer.first, answer.second);
+    }
+
+    Pair<float, int>^ Perceptron::Recognize(array<Byte>^ pixels, int width, int height, int stride, int channels)
+    {
+        if (!IsImage(pixels, width, height, stride, channels))
+            return gcnew Pair<float, int>(0.f, -1);
+
+        pin_ptr<Byte> data = &pixels[0];
+        auto answer = m_Instance->Recognize(data, static_cast<size_t>(width), static_cast<size_t>(height),
+            static_cast<size_t>(stride), static_cast<size_t>(channels));
+
+        return gcnew Pair<float, int>(answer.first, answer.second);
+    }
+
+    bool Perceptron::Correct(array<Byte>^ pixels, int width, int height, int stride, int channels, int label)
+    {
+        if (!IsImage(pixels, width, height, stride, channels))
+            return false;
+
+        pin_ptr<Byte> data = &pixels[0];
+        return m_Instance->Correct(data, static_cast<size_t>(width), static_cast<size_t>(height),
+            static_cast<size_t>(stride), static_cast<size_t>(channels), label);
+    }
+
+    bool Perceptron::IsImage(array<Byte>^ pixels, int width, int height, int stride, int channels)
+    {
+        if (pixels == nullptr || width <= 0 || height <= 0 || (channels != 1 && channels != 3 && channels != 4))
+            return false;
+
+        const long long row = static_cast<long long>(width) * channels;
+
+        // the last row only needs its pixels, not the padding up to stride
+        return stride >= row && static_cast<long long>(pixels->Length) >= static_cast<long long>(height - 1) * stride + row;
     }
 
     std::string Perceptron::ManagedStrToUnmanagedStr(String^ managedStr)
@@ -30,6 +61,7 @@ namespace MlWrapper
     std::vector<float> Perceptron::ListToVector(List<float>^ list)
     {
         std::vector<float> temp;
+        temp.reserve(list->Count);
 
         for each(float value in list)
         {
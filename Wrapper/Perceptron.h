@@ -1,27 +1,39 @@
 #pragma once
 
-#include <msclr\marshal_cppstd.h>
+#include <msclr/marshal_cppstd.h>
 #include <string>
 #include <vector>
 #include "ManagedObject.h"
 #include "Pair.h"
-#include "..\NeuralNetwork\ml\perceptron.h"
+#include "NativeEngine.h"
 
 using namespace System;
 using namespace System::Collections::Generic;
 
 namespace MlWrapper
 {
-    public ref class Perceptron : public ManagedObject<ml::perceptron>
+    public ref class Perceptron : public ManagedObject<NativeEngine>
     {
     public:
         Perceptron();
 
         Pair<float, int>^ Forward(List<float>^ input);
 
+        // Raw canvas pixels (dark ink on white, 1, 3 or 4 bytes per pixel); cropping, centering,
+        // downscaling and normalization run natively. Label -1 if the dimensions do not describe an
+        // image that fits in pixels.
+        Pair<float, int>^ Recognize(array<Byte>^ pixels, int width, int height, int stride, int channels);
+
+        // Same pixels with the digit they actually show; the model is fine-tuned in the background.
+        // False for pixels Recognize would reject.
+        bool Correct(array<Byte>^ pixels, int width, int height, int stride, int channels, int label);
+
         void Load(String^ pathToModel);
 
     private:
+        // stride >= width * channels and pixels holds every row up to the last pixel
+        static bool IsImage(array<Byte>^ pixels, int width, int height, int stride, int channels);
+
         static std::string ManagedStrToUnmanagedStr(String^ managedStr);
 
         static std::vector<float> ListToVector(List<float>^ list);